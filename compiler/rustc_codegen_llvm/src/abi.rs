@@ -42,12 +42,11 @@ fn for_each_kind<F>(&self, mut f: F)
 }
 
 pub trait ArgAttributesExt {
-    fn apply_attrs_to_llfn(&self, idx: AttributePlace, cx: &CodegenCx<'_, '_>, llfn: &Value);
-    fn apply_attrs_to_callsite(
+    fn add_attrs_to(
         &self,
         idx: AttributePlace,
         cx: &CodegenCx<'_, '_>,
-        callsite: &Value,
+        attrs: &mut llvm::AttributeListBuilder<'_>,
     );
 }
 
@@ -64,77 +63,36 @@ fn should_use_mutable_noalias(cx: &CodegenCx<'_, '_>) -> bool {
 }
 
 impl ArgAttributesExt for ArgAttributes {
-    fn apply_attrs_to_llfn(&self, idx: AttributePlace, cx: &CodegenCx<'_, '_>, llfn: &Value) {
-        let mut regular = self.regular;
-        unsafe {
-            let deref = self.pointee_size.bytes();
-            if deref != 0 {
-                if regular.contains(ArgAttribute::NonNull) {
-                    llvm::LLVMRustAddDereferenceableAttr(llfn, idx.as_uint(), deref);
-                } else {
-                    llvm::LLVMRustAddDereferenceableOrNullAttr(llfn, idx.as_uint(), deref);
-                }
-                regular -= ArgAttribute::NonNull;
-            }
-            if let Some(align) = self.pointee_align {
-                llvm::LLVMRustAddAlignmentAttr(llfn, idx.as_uint(), align.bytes() as u32);
-            }
-            regular.for_each_kind(|attr| attr.apply_llfn(idx, llfn));
-            if regular.contains(ArgAttribute::NoAliasMutRef) && should_use_mutable_noalias(cx) {
-                llvm::Attribute::NoAlias.apply_llfn(idx, llfn);
-            }
-            match self.arg_ext {
-                ArgExtension::None => {}
-                ArgExtension::Zext => {
-                    llvm::Attribute::ZExt.apply_llfn(idx, llfn);
-                }
-                ArgExtension::Sext => {
-                    llvm::Attribute::SExt.apply_llfn(idx, llfn);
-                }
-            }
-        }
-    }
-
-    fn apply_attrs_to_callsite(
+    fn add_attrs_to(
         &self,
         idx: AttributePlace,
         cx: &CodegenCx<'_, '_>,
-        callsite: &Value,
+        attrs: &mut llvm::AttributeListBuilder<'_>,
     ) {
         let mut regular = self.regular;
-        unsafe {
-            let deref = self.pointee_size.bytes();
-            if deref != 0 {
-                if regular.contains(ArgAttribute::NonNull) {
-                    llvm::LLVMRustAddDereferenceableCallSiteAttr(callsite, idx.as_uint(), deref);
-                } else {
-                    llvm::LLVMRustAddDereferenceableOrNullCallSiteAttr(
-                        callsite,
-                        idx.as_uint(),
-                        deref,
-                    );
-                }
-                regular -= ArgAttribute::NonNull;
-            }
-            if let Some(align) = self.pointee_align {
-                llvm::LLVMRustAddAlignmentCallSiteAttr(
-                    callsite,
-                    idx.as_uint(),
-                    align.bytes() as u32,
-                );
+        let deref = self.pointee_size.bytes();
+        if deref != 0 {
+            if regular.contains(ArgAttribute::NonNull) {
+                attrs.add_dereferenceable(idx, deref);
+            } else {
+                attrs.add_dereferenceable_or_null(idx, deref);
             }
-            regular.for_each_kind(|attr| attr.apply_callsite(idx, callsite));
-            if regular.contains(ArgAttribute::NoAliasMutRef) && should_use_mutable_noalias(cx) {
-                llvm::Attribute::NoAlias.apply_callsite(idx, callsite);
+            regular -= ArgAttribute::NonNull;
+        }
+        if let Some(align) = self.pointee_align {
+            attrs.add_alignment(idx, align.bytes() as u32);
+        }
+        regular.for_each_kind(|attr| attrs.add(idx, attr));
+        if regular.contains(ArgAttribute::NoAliasMutRef) && should_use_mutable_noalias(cx) {
+            attrs.add(idx, llvm::Attribute::NoAlias);
+        }
+        match self.arg_ext {
+            ArgExtension::None => {}
+            ArgExtension::Zext => {
+                attrs.add(idx, llvm::Attribute::ZExt);
             }
-            match self.arg_ext {
-                ArgExtension::None => {}
-                ArgExtension::Zext => {
-                    llvm::Attribute::ZExt.apply_callsite(idx, callsite);
-                }
-                ArgExtension::Sext => {
-                    llvm::Attribute::SExt.apply_callsite(idx, callsite);
-                }
+            ArgExtension::Sext => {
+                attrs.add(idx, llvm::Attribute::SExt);
             }
         }
     }
@@ -436,98 +394,92 @@ fn llvm_cconv(&self) -> llvm::CallConv {
     }
 
     fn apply_attrs_llfn(&self, cx: &CodegenCx<'ll, 'tcx>, llfn: &'ll Value) {
+        let mut llattrs = llvm::AttributeListBuilder::default();
+
         // FIXME(eddyb) can this also be applied to callsites?
         if self.ret.layout.abi.is_uninhabited() {
-            llvm::Attribute::NoReturn.apply_llfn(llvm::AttributePlace::Function, llfn);
+            llattrs.add(llvm::AttributePlace::Function, llvm::Attribute::NoReturn);
         }
 
         // FIXME(eddyb, wesleywiser): apply this to callsites as well?
         if !self.can_unwind {
-            llvm::Attribute::NoUnwind.apply_llfn(llvm::AttributePlace::Function, llfn);
+            llattrs.add(llvm::AttributePlace::Function, llvm::Attribute::NoUnwind);
         }
 
         let mut i = 0;
-        let mut apply = |attrs: &ArgAttributes| {
-            attrs.apply_attrs_to_llfn(llvm::AttributePlace::Argument(i), cx, llfn);
+        let mut apply = |llattrs: &mut llvm::AttributeListBuilder<'ll>, attrs: &ArgAttributes| {
+            attrs.add_attrs_to(llvm::AttributePlace::Argument(i), cx, llattrs);
             i += 1;
             i - 1
         };
         match self.ret.mode {
             PassMode::Direct(ref attrs) => {
-                attrs.apply_attrs_to_llfn(llvm::AttributePlace::ReturnValue, cx, llfn);
+                attrs.add_attrs_to(llvm::AttributePlace::ReturnValue, cx, &mut llattrs);
             }
             PassMode::Indirect { ref attrs, extra_attrs: _, on_stack } => {
                 assert!(!on_stack);
-                let i = apply(attrs);
-                unsafe {
-                    llvm::LLVMRustAddStructRetAttr(
-                        llfn,
-                        llvm::AttributePlace::Argument(i).as_uint(),
-                        self.ret.layout.llvm_type(cx),
-                    );
-                }
+                let i = apply(&mut llattrs, attrs);
+                llattrs.add_struct_ret(
+                    llvm::AttributePlace::Argument(i),
+                    self.ret.layout.llvm_type(cx),
+                );
             }
             _ => {}
         }
         for arg in &self.args {
             if arg.pad.is_some() {
-                apply(&ArgAttributes::new());
+                apply(&mut llattrs, &ArgAttributes::new());
             }
             match arg.mode {
                 PassMode::Ignore => {}
                 PassMode::Indirect { ref attrs, extra_attrs: None, on_stack: true } => {
-                    let i = apply(attrs);
-                    unsafe {
-                        llvm::LLVMRustAddByValAttr(
-                            llfn,
-                            llvm::AttributePlace::Argument(i).as_uint(),
-                            arg.layout.llvm_type(cx),
-                        );
-                    }
+                    let i = apply(&mut llattrs, attrs);
+                    llattrs.add_byval(llvm::AttributePlace::Argument(i), arg.layout.llvm_type(cx));
                 }
                 PassMode::Direct(ref attrs)
                 | PassMode::Indirect { ref attrs, extra_attrs: None, on_stack: false } => {
-                    apply(attrs);
+                    apply(&mut llattrs, attrs);
                 }
                 PassMode::Indirect { ref attrs, extra_attrs: Some(ref extra_attrs), on_stack } => {
                     assert!(!on_stack);
-                    apply(attrs);
-                    apply(extra_attrs);
+                    apply(&mut llattrs, attrs);
+                    apply(&mut llattrs, extra_attrs);
                 }
                 PassMode::Pair(ref a, ref b) => {
-                    apply(a);
-                    apply(b);
+                    apply(&mut llattrs, a);
+                    apply(&mut llattrs, b);
                 }
                 PassMode::Cast(_) => {
-                    apply(&ArgAttributes::new());
+                    apply(&mut llattrs, &ArgAttributes::new());
                 }
             }
         }
+
+        cx.attribute_lists.apply_llfn(cx.llcx, llattrs, llfn);
     }
 
     fn apply_attrs_callsite(&self, bx: &mut Builder<'a, 'll, 'tcx>, callsite: &'ll Value) {
         // FIXME(wesleywiser, eddyb): We should apply `nounwind` and `noreturn` as appropriate to this callsite.
 
+        let cx = bx.cx;
+        let mut llattrs = llvm::AttributeListBuilder::default();
         let mut i = 0;
-        let mut apply = |cx: &CodegenCx<'_, '_>, attrs: &ArgAttributes| {
-            attrs.apply_attrs_to_callsite(llvm::AttributePlace::Argument(i), cx, callsite);
+        let mut apply = |llattrs: &mut llvm::AttributeListBuilder<'ll>, attrs: &ArgAttributes| {
+            attrs.add_attrs_to(llvm::AttributePlace::Argument(i), cx, llattrs);
             i += 1;
             i - 1
         };
         match self.ret.mode {
             PassMode::Direct(ref attrs) => {
-                attrs.apply_attrs_to_callsite(llvm::AttributePlace::ReturnValue, &bx.cx, callsite);
+                attrs.add_attrs_to(llvm::AttributePlace::ReturnValue, cx, &mut llattrs);
             }
             PassMode::Indirect { ref attrs, extra_attrs: _, on_stack } => {
                 assert!(!on_stack);
-                let i = apply(bx.cx, attrs);
-                unsafe {
-                    llvm::LLVMRustAddStructRetCallSiteAttr(
-                        callsite,
-                        llvm::AttributePlace::Argument(i).as_uint(),
-                        self.ret.layout.llvm_type(bx),
-                    );
-                }
+                let i = apply(&mut llattrs, attrs);
+                llattrs.add_struct_ret(
+                    llvm::AttributePlace::Argument(i),
+                    self.ret.layout.llvm_type(cx),
+                );
             }
             _ => {}
         }
@@ -546,41 +498,36 @@ fn apply_attrs_callsite(&self, bx: &mut Builder<'a, 'll, 'tcx>, callsite: &'ll V
         }
         for arg in &self.args {
             if arg.pad.is_some() {
-                apply(bx.cx, &ArgAttributes::new());
+                apply(&mut llattrs, &ArgAttributes::new());
             }
             match arg.mode {
                 PassMode::Ignore => {}
                 PassMode::Indirect { ref attrs, extra_attrs: None, on_stack: true } => {
-                    let i = apply(bx.cx, attrs);
-                    unsafe {
-                        llvm::LLVMRustAddByValCallSiteAttr(
-                            callsite,
-                            llvm::AttributePlace::Argument(i).as_uint(),
-                            arg.layout.llvm_type(bx),
-                        );
-                    }
+                    let i = apply(&mut llattrs, attrs);
+                    llattrs.add_byval(llvm::AttributePlace::Argument(i), arg.layout.llvm_type(cx));
                 }
                 PassMode::Direct(ref attrs)
                 | PassMode::Indirect { ref attrs, extra_attrs: None, on_stack: false } => {
-                    apply(bx.cx, attrs);
+                    apply(&mut llattrs, attrs);
                 }
                 PassMode::Indirect {
                     ref attrs,
                     extra_attrs: Some(ref extra_attrs),
                     on_stack: _,
                 } => {
-                    apply(bx.cx, attrs);
-                    apply(bx.cx, extra_attrs);
+                    apply(&mut llattrs, attrs);
+                    apply(&mut llattrs, extra_attrs);
                 }
                 PassMode::Pair(ref a, ref b) => {
-                    apply(bx.cx, a);
-                    apply(bx.cx, b);
+                    apply(&mut llattrs, a);
+                    apply(&mut llattrs, b);
                 }
                 PassMode::Cast(_) => {
-                    apply(bx.cx, &ArgAttributes::new());
+                    apply(&mut llattrs, &ArgAttributes::new());
                 }
             }
         }
+        cx.attribute_lists.apply_callsite(cx.llcx, llattrs, callsite);
 
         let cconv = self.llvm_cconv();
         if cconv != llvm::CCallConv {
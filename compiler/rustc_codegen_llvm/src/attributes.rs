@@ -63,12 +63,6 @@ pub fn emit_uwtable(val: &'ll Value, emit: bool) {
     Attribute::UWTable.toggle_llfn(Function, val, emit);
 }
 
-/// Tell LLVM if this function should be 'naked', i.e., skip the epilogue and prologue.
-#[inline]
-fn naked(val: &'ll Value, is_naked: bool) {
-    Attribute::Naked.toggle_llfn(Function, val, is_naked);
-}
-
 pub fn set_frame_pointer_type(cx: &CodegenCx<'ll, '_>, llfn: &'ll Value) {
     let mut fp = cx.sess().target.frame_pointer;
     // "mcount" function relies on stack pointer.
@@ -125,7 +119,7 @@ fn set_probestack(cx: &CodegenCx<'ll, '_>, llfn: &'ll Value) {
     }
 
     // probestack doesn't play nice either with `-C profile-generate`.
-    if cx.sess().opts.cg.profile_generate.enabled() {
+    if cx.sess().instrument_pgo() {
         return;
     }
 
@@ -268,24 +262,26 @@ pub fn from_fn_attrs(cx: &CodegenCx<'ll, 'tcx>, llfn: &'ll Value, instance: ty::
     set_instrument_function(cx, llfn);
     set_probestack(cx, llfn);
 
+    let mut llattrs = llvm::AttributeListBuilder::default();
     if codegen_fn_attrs.flags.contains(CodegenFnAttrFlags::COLD) {
-        Attribute::Cold.apply_llfn(Function, llfn);
+        llattrs.add(Function, Attribute::Cold);
     }
     if codegen_fn_attrs.flags.contains(CodegenFnAttrFlags::FFI_RETURNS_TWICE) {
-        Attribute::ReturnsTwice.apply_llfn(Function, llfn);
+        llattrs.add(Function, Attribute::ReturnsTwice);
     }
     if codegen_fn_attrs.flags.contains(CodegenFnAttrFlags::FFI_PURE) {
-        Attribute::ReadOnly.apply_llfn(Function, llfn);
+        llattrs.add(Function, Attribute::ReadOnly);
     }
     if codegen_fn_attrs.flags.contains(CodegenFnAttrFlags::FFI_CONST) {
-        Attribute::ReadNone.apply_llfn(Function, llfn);
+        llattrs.add(Function, Attribute::ReadNone);
     }
     if codegen_fn_attrs.flags.contains(CodegenFnAttrFlags::NAKED) {
-        naked(llfn, true);
+        llattrs.add(Function, Attribute::Naked);
     }
     if codegen_fn_attrs.flags.contains(CodegenFnAttrFlags::ALLOCATOR) {
-        Attribute::NoAlias.apply_llfn(llvm::AttributePlace::ReturnValue, llfn);
+        llattrs.add(llvm::AttributePlace::ReturnValue, Attribute::NoAlias);
     }
+    cx.attribute_lists.apply_llfn(cx.llcx, llattrs, llfn);
     if codegen_fn_attrs.flags.contains(CodegenFnAttrFlags::CMSE_NONSECURE_ENTRY) {
         llvm::AddFunctionAttrString(llfn, Function, cstr!("cmse_nonsecure_entry"));
     }
@@ -7,7 +7,7 @@
 use std::ptr;
 use std::str;
 
-use crate::llvm::archive_ro::{ArchiveRO, Child};
+use crate::llvm::archive_ro::{ArchiveRO, Member};
 use crate::llvm::{self, ArchiveKind, LLVMMachineType, LLVMRustCOFFShortExport};
 use rustc_codegen_ssa::back::archive::{find_library, ArchiveBuilder};
 use rustc_codegen_ssa::{looks_like_rust_object_file, METADATA_FILENAME};
@@ -46,8 +46,8 @@ fn path(&self) -> &Path {
     }
 }
 
-fn is_relevant_child(c: &Child<'_>) -> bool {
-    match c.name() {
+fn is_relevant_child(c: &Member<'_>) -> bool {
+    match c.name {
         Some(name) => !name.contains("SYMDEF"),
         None => false,
     }
@@ -102,10 +102,11 @@ fn src_files(&mut self) -> Vec<String> {
         let archive = self.src_archive.as_ref().unwrap().as_ref().unwrap();
 
         archive
+            .members()
+            .unwrap_or_default()
             .iter()
-            .filter_map(|child| child.ok())
-            .filter(is_relevant_child)
-            .filter_map(|child| child.name())
+            .filter(|member| is_relevant_child(member))
+            .filter_map(|member| member.name)
             .filter(|name| !self.removals.iter().any(|x| x == name))
             .map(|name| name.to_owned())
             .collect()
@@ -184,6 +185,10 @@ fn build(mut self) {
             self.config.sess.fatal(&format!("Don't know how to build archive of type: {}", kind))
         });
 
+        let _timer = self.config.sess.prof.extra_verbose_generic_activity(
+            "LLVM_write_archive",
+            self.config.dst.display().to_string(),
+        );
         if let Err(e) = self.build_with_llvm(kind) {
             self.config.sess.fatal(&format!("failed to build archive: {}", e));
         }
@@ -229,7 +234,10 @@ fn inject_dll_import_lib(
 
         let ffi_exports: Vec<LLVMRustCOFFShortExport> = import_name_vector
             .iter()
-            .map(|name_z| LLVMRustCOFFShortExport::from_name(name_z.as_ptr()))
+            .zip(dll_imports)
+            .map(|(name_z, import)| {
+                LLVMRustCOFFShortExport::new(name_z.as_ptr(), import.ordinal, !import.is_fn)
+            })
             .collect();
         let result = unsafe {
             crate::llvm::LLVMRustWriteImportLibrary(
@@ -258,6 +266,27 @@ fn inject_dll_import_lib(
             ));
         });
     }
+
+    fn write_dwarf_package(
+        _sess: &'a Session,
+        executable: &Path,
+        dwp: &Path,
+    ) -> Option<Result<(), String>> {
+        if !unsafe { llvm::LLVMRustHasDwarfPackageWriter() } {
+            return None;
+        }
+
+        let executable_z = rustc_fs_util::path_to_c_string(executable);
+        let dwp_z = rustc_fs_util::path_to_c_string(dwp);
+        let result =
+            unsafe { llvm::LLVMRustWriteDwarfPackage(executable_z.as_ptr(), dwp_z.as_ptr()) };
+        Some(match result {
+            llvm::LLVMRustResult::Success => Ok(()),
+            llvm::LLVMRustResult::Failure => {
+                Err(llvm::last_error().unwrap_or("unknown LLVM error".to_string()))
+            }
+        })
+    }
 }
 
 impl<'a> LlvmArchiveBuilder<'a> {
@@ -302,24 +331,25 @@ fn build_with_llvm(&mut self, kind: ArchiveKind) -> io::Result<()> {
 
         let dst = CString::new(self.config.dst.to_str().unwrap())?;
         let should_update_symbols = self.should_update_symbols;
+        let thin = self.config.sess.opts.debugging_opts.thin_archives;
+        let in_place = self.config.sess.opts.debugging_opts.archive_update_in_place;
 
         unsafe {
             if let Some(archive) = self.src_archive() {
-                for child in archive.iter() {
-                    let child = child.map_err(string_to_io_error)?;
-                    let child_name = match child.name() {
+                for member in archive.members().map_err(string_to_io_error)? {
+                    let member_name = match member.name {
                         Some(s) => s,
                         None => continue,
                     };
-                    if removals.iter().any(|r| r == child_name) {
+                    if removals.iter().any(|r| r == member_name) {
                         continue;
                     }
 
-                    let name = CString::new(child_name)?;
+                    let name = CString::new(member_name)?;
                     members.push(llvm::LLVMRustArchiveMemberNew(
                         ptr::null(),
                         name.as_ptr(),
-                        Some(child.raw),
+                        Some(member.raw),
                     ));
                     strings.push(name);
                 }
@@ -338,12 +368,11 @@ fn build_with_llvm(&mut self, kind: ArchiveKind) -> io::Result<()> {
                         strings.push(name);
                     }
                     Addition::Archive { archive, skip, .. } => {
-                        for child in archive.iter() {
-                            let child = child.map_err(string_to_io_error)?;
-                            if !is_relevant_child(&child) {
+                        for member in archive.members().map_err(string_to_io_error)? {
+                            if !is_relevant_child(&member) {
                                 continue;
                             }
-                            let child_name = child.name().unwrap();
+                            let child_name = member.name.unwrap();
                             if skip(child_name) {
                                 continue;
                             }
@@ -360,7 +389,7 @@ fn build_with_llvm(&mut self, kind: ArchiveKind) -> io::Result<()> {
                             let m = llvm::LLVMRustArchiveMemberNew(
                                 ptr::null(),
                                 name.as_ptr(),
-                                Some(child.raw),
+                                Some(member.raw),
                             );
                             members.push(m);
                             strings.push(name);
@@ -375,6 +404,8 @@ fn build_with_llvm(&mut self, kind: ArchiveKind) -> io::Result<()> {
                 members.as_ptr() as *const &_,
                 should_update_symbols,
                 kind,
+                thin,
+                in_place,
             );
             let ret = if r.into_result().is_err() {
                 let err = llvm::LLVMRustGetLastError();
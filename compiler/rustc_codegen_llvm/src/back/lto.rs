@@ -1,18 +1,27 @@
+use crate::back::profiling::{record_thin_lto_import_loads, record_thin_lto_memory_usage};
 use crate::back::write::{
-    self, save_temp_bitcode, to_llvm_opt_settings, with_llvm_pmb, DiagnosticHandlers,
+    self, save_temp_bitcode, to_llvm_opt_settings, with_llvm_pmb, CodegenDiagnosticsStage,
+    DiagnosticHandlers,
 };
 use crate::llvm::archive_ro::ArchiveRO;
 use crate::llvm::{self, build_string, False, True};
-use crate::{LlvmCodegenBackend, ModuleLlvm};
-use rustc_codegen_ssa::back::lto::{LtoModuleCodegen, SerializedModule, ThinModule, ThinShared};
+use crate::{base, LlvmCodegenBackend, ModuleLlvm};
+use rustc_codegen_ssa::back::lto::{
+    LtoModuleCodegen, SerializedModule, ThinModule, ThinModuleSource, ThinShared,
+};
 use rustc_codegen_ssa::back::symbol_export;
 use rustc_codegen_ssa::back::write::{
-    CodegenContext, FatLTOInput, ModuleConfig, TargetMachineFactoryConfig,
+    CodegenContext, ExtraTokens, FatLTOInput, ModuleConfig, TargetMachineFactoryConfig,
 };
 use rustc_codegen_ssa::traits::*;
-use rustc_codegen_ssa::{looks_like_rust_object_file, ModuleCodegen, ModuleKind};
+use rustc_codegen_ssa::{
+    looks_like_rust_object_file, ModuleCodegen, ModuleKind, METADATA_FILENAME,
+};
+use rustc_data_structures::fingerprint::Fingerprint;
 use rustc_data_structures::fx::FxHashMap;
+use rustc_data_structures::stable_hasher::StableHasher;
 use rustc_errors::{FatalError, Handler};
+use rustc_fs_util::path_to_c_string;
 use rustc_hir::def_id::LOCAL_CRATE;
 use rustc_middle::bug;
 use rustc_middle::dep_graph::WorkProduct;
@@ -22,18 +31,26 @@
 use tracing::{debug, info};
 
 use std::ffi::{CStr, CString};
-use std::fs::File;
+use std::fs::{self, File};
+use std::hash::Hash;
 use std::io;
 use std::iter;
-use std::path::Path;
+use std::panic;
+use std::path::{Path, PathBuf};
 use std::ptr;
 use std::slice;
-use std::sync::Arc;
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::vec;
 
 /// We keep track of the computed LTO cache keys from the previous
 /// session to determine which CGUs we can reuse.
 pub const THIN_LTO_KEYS_INCR_COMP_FILE_NAME: &str = "thin-lto-past-keys.bin";
 
+/// We cache the thin link of the previous session so it can be reused
+/// when none of the modules participating in it changed.
+pub const THIN_LTO_INDEX_INCR_COMP_FILE_NAME: &str = "thin-lto-index.bin";
+
 pub fn crate_type_allows_lto(crate_type: CrateType) -> bool {
     match crate_type {
         CrateType::Executable | CrateType::Staticlib | CrateType::Cdylib => true,
@@ -41,10 +58,94 @@ pub fn crate_type_allows_lto(crate_type: CrateType) -> bool {
     }
 }
 
+/// The bitcode of a module from an upstream crate, found by its location in
+/// that crate's rlib rather than copied out of it. Both fat and thin LTO borrow
+/// it from the mapped rlib, so it's only paged in when looked at.
+struct UpstreamModule {
+    rlib: PathBuf,
+    offset: u64,
+    len: usize,
+}
+
+impl UpstreamModule {
+    fn read(&self) -> io::Result<Vec<u8>> {
+        use std::io::{Read, Seek, SeekFrom};
+        let mut file = File::open(&self.rlib)?;
+        file.seek(SeekFrom::Start(self.offset))?;
+        let mut data = vec![0; self.len];
+        file.read_exact(&mut data)?;
+        Ok(data)
+    }
+
+    /// Loads the bitcode of archive member `member`, borrowing it from the mapped rlib when
+    /// possible and only reading a copy otherwise (e.g. for the members of thin rlibs).
+    fn load(&self, member: &str) -> io::Result<SerializedModule<ModuleBuffer>> {
+        if let Ok(archive) = ArchiveRO::open(&self.rlib) {
+            if let Some(bitcode) = MappedBitcode::new(archive, member) {
+                return Ok(SerializedModule::FromMappedRlib(Box::new(bitcode)));
+            }
+        }
+        self.read().map(SerializedModule::FromRlib)
+    }
+
+    /// The key of this module for the thin link cache. Hashing the bitcode of every upstream
+    /// crate in every session would cost about as much as the cache saves, so this relies on
+    /// the rlib's metadata instead: rlibs are only ever rewritten as a whole. Returns `None`
+    /// if that metadata can't be read, in which case the cache can't be trusted.
+    fn key(&self) -> Option<[u64; 2]> {
+        let metadata = fs::metadata(&self.rlib).ok()?;
+        let modified = metadata.modified().ok()?;
+        let mut hasher = StableHasher::new();
+        self.rlib.hash(&mut hasher);
+        self.offset.hash(&mut hasher);
+        self.len.hash(&mut hasher);
+        metadata.len().hash(&mut hasher);
+        modified.hash(&mut hasher);
+        let key: Fingerprint = hasher.finish();
+        let (hi, lo) = key.as_value();
+        Some([hi, lo])
+    }
+}
+
+/// The key of in-memory bitcode for the thin link cache.
+fn bitcode_key(data: &[u8]) -> [u64; 2] {
+    let mut hasher = StableHasher::new();
+    data.hash(&mut hasher);
+    let key: Fingerprint = hasher.finish();
+    let (hi, lo) = key.as_value();
+    [hi, lo]
+}
+
+/// The bitcode of an rlib member, inside the rlib as mapped by its `ArchiveRO`.
+struct MappedBitcode {
+    data: *const u8,
+    len: usize,
+    _archive: ArchiveRO,
+}
+
+unsafe impl Send for MappedBitcode {}
+unsafe impl Sync for MappedBitcode {}
+
+impl MappedBitcode {
+    fn new(archive: ArchiveRO, member: &str) -> Option<MappedBitcode> {
+        let (data, len) = match archive.member_bitcode(member) {
+            Ok(bitcode) => (bitcode.as_ptr(), bitcode.len()),
+            Err(_) => return None,
+        };
+        Some(MappedBitcode { data, len, _archive: archive })
+    }
+}
+
+impl ModuleBufferMethods for MappedBitcode {
+    fn data(&self) -> &[u8] {
+        unsafe { slice::from_raw_parts(self.data, self.len) }
+    }
+}
+
 fn prepare_lto(
     cgcx: &CodegenContext<LlvmCodegenBackend>,
     diag_handler: &Handler,
-) -> Result<(Vec<CString>, Vec<(SerializedModule<ModuleBuffer>, CString)>), FatalError> {
+) -> Result<(Vec<CString>, Vec<(UpstreamModule, CString)>), FatalError> {
     let export_threshold = match cgcx.lto {
         // We're just doing LTO for our one crate
         Lto::ThinLocal => SymbolExportLevel::Rust,
@@ -73,8 +174,8 @@ fn prepare_lto(
     // upstream dependencies, find the corresponding rlib and load the bitcode
     // from the archive.
     //
-    // We save off all the bytecode and LLVM module ids for later processing
-    // with either fat or thin LTO
+    // We save off the location of all the bytecode and LLVM module ids for
+    // later processing with either fat or thin LTO
     let mut upstream_modules = Vec::new();
     if cgcx.lto != Lto::ThinLocal {
         if cgcx.opts.cg.prefer_dynamic {
@@ -110,15 +211,33 @@ fn prepare_lto(
             }
 
             let archive = ArchiveRO::open(&path).expect("wanted an rlib");
-            let obj_files = archive
+            let is_thin = archive.is_thin();
+            let members = archive.members().unwrap_or_default();
+            let obj_files = members
                 .iter()
-                .filter_map(|child| child.ok().and_then(|c| c.name().map(|name| (name, c))))
+                .filter_map(|member| member.name.map(|name| (name, member)))
                 .filter(|&(name, _)| looks_like_rust_object_file(name));
-            for (name, child) in obj_files {
+            for (name, member) in obj_files {
                 info!("adding bitcode from {}", name);
-                match get_bitcode_slice_from_object_data(child.data()) {
+                let obj = member.data;
+                match get_bitcode_slice_from_object_data(obj) {
                     Ok(data) => {
-                        let module = SerializedModule::FromRlib(data.to_vec());
+                        let offset = data.as_ptr() as usize - obj.as_ptr() as usize;
+                        // The members of thin rlibs are files of their own, named
+                        // relative to the rlib.
+                        let module = if is_thin {
+                            UpstreamModule {
+                                rlib: path.parent().unwrap_or(Path::new("")).join(name),
+                                offset: offset as u64,
+                                len: data.len(),
+                            }
+                        } else {
+                            UpstreamModule {
+                                rlib: path.clone(),
+                                offset: member.data_offset + offset as u64,
+                                len: data.len(),
+                            }
+                        };
                         upstream_modules.push((module, CString::new(name).unwrap()));
                     }
                     Err(msg) => return Err(diag_handler.fatal(&msg)),
@@ -130,6 +249,57 @@ fn prepare_lto(
     Ok((symbols_below_threshold, upstream_modules))
 }
 
+/// Finds the native objects bundled into the rlibs we link that are ThinLTO
+/// bitcode, e.g. from C built with `clang -flto=thin`, for ThinLTO to import
+/// from (see `-Z thinlto-import-native-bitcode`). They're linked in as they are
+/// either way, so nothing else happens to them.
+fn native_bitcode_modules(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+) -> Vec<(UpstreamModule, CString)> {
+    let _timer = cgcx.prof.generic_activity("LLVM_thin_lto_find_native_bitcode");
+    let mut native_modules = Vec::new();
+    for (_, path) in cgcx.each_linked_rlib_for_lto.iter() {
+        let archive = match ArchiveRO::open(&path) {
+            Ok(archive) => archive,
+            Err(_) => continue,
+        };
+        let is_thin = archive.is_thin();
+        let members = archive.members().unwrap_or_default();
+        let native_objects = members
+            .iter()
+            .filter_map(|member| member.name.map(|name| (name, member)))
+            .filter(|&(name, _)| name != METADATA_FILENAME && !looks_like_rust_object_file(name));
+        for (name, member) in native_objects {
+            let obj = member.data;
+            // Anything that isn't bitcode is a regular native object.
+            let data = match get_bitcode_slice_from_object_data(obj) {
+                Ok(data) => data,
+                Err(_) => continue,
+            };
+            info!("adding native bitcode from {}({})", path.display(), name);
+            let offset = data.as_ptr() as usize - obj.as_ptr() as usize;
+            let module = if is_thin {
+                UpstreamModule {
+                    rlib: path.parent().unwrap_or(Path::new("")).join(name),
+                    offset: offset as u64,
+                    len: data.len(),
+                }
+            } else {
+                UpstreamModule {
+                    rlib: path.clone(),
+                    offset: member.data_offset + offset as u64,
+                    len: data.len(),
+                }
+            };
+            // Member names needn't be unique across rlibs, so the rlib is part
+            // of the module's name.
+            let name = CString::new(format!("{}({})", path.display(), name)).unwrap();
+            native_modules.push((module, name));
+        }
+    }
+    native_modules
+}
+
 fn get_bitcode_slice_from_object_data(obj: &[u8]) -> Result<&[u8], String> {
     let mut len = 0;
     let data =
@@ -159,8 +329,16 @@ pub(crate) fn run_fat(
 ) -> Result<LtoModuleCodegen<LlvmCodegenBackend>, FatalError> {
     let diag_handler = cgcx.create_diag_handler();
     let (symbols_below_threshold, upstream_modules) = prepare_lto(cgcx, &diag_handler)?;
-    let symbols_below_threshold =
-        symbols_below_threshold.iter().map(|c| c.as_ptr()).collect::<Vec<_>>();
+    let upstream_modules = upstream_modules
+        .into_iter()
+        .map(|(module, name)| match module.load(name.to_str().unwrap()) {
+            Ok(module) => Ok((module, name)),
+            Err(err) => {
+                let msg = format!("failed to read bitcode of {:?} for LTO: {}", name, err);
+                Err(diag_handler.fatal(&msg))
+            }
+        })
+        .collect::<Result<Vec<_>, _>>()?;
     fat_lto(
         cgcx,
         &diag_handler,
@@ -189,29 +367,64 @@ pub(crate) fn run_thin(
                       is deferred to the linker"
         );
     }
+    let native_modules = if cgcx.opts.debugging_opts.thinlto_import_native_bitcode {
+        native_bitcode_modules(cgcx)
+    } else {
+        Vec::new()
+    };
     thin_lto(
         cgcx,
         &diag_handler,
         modules,
         upstream_modules,
         cached_modules,
+        native_modules,
         &symbols_below_threshold,
     )
 }
 
-pub(crate) fn prepare_thin(module: ModuleCodegen<ModuleLlvm>) -> (String, ThinBuffer) {
+pub(crate) fn prepare_thin(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    module: ModuleCodegen<ModuleLlvm>,
+) -> (String, ThinBuffer) {
     let name = module.name.clone();
+    let _timer = cgcx.prof.generic_activity_with_arg("LLVM_thin_lto_buffer_create", &name[..]);
     let buffer = ThinBuffer::new(module.module_llvm.llmod());
     (name, buffer)
 }
 
+pub(crate) fn compress_thin_buffer(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    name: &str,
+    buffer: &mut ThinBuffer,
+) {
+    if cgcx.opts.debugging_opts.thinlto_compress_buffers && !buffer.compress() {
+        info!("not compressing ThinLTO buffer for {}: LLVM has no zlib support", name);
+    }
+}
+
+/// Serializes the in-memory modules taken from `queue` until it is empty.
+fn serialize_in_memory_modules(
+    queue: &Mutex<vec::IntoIter<ModuleCodegen<ModuleLlvm>>>,
+) -> Vec<(SerializedModule<ModuleBuffer>, CString)> {
+    let mut serialized = Vec::new();
+    loop {
+        let module = match queue.lock().unwrap().next() {
+            Some(module) => module,
+            None => return serialized,
+        };
+        let buffer = ModuleBuffer::new(module.module_llvm.llmod());
+        serialized.push((SerializedModule::Local(buffer), CString::new(module.name).unwrap()));
+    }
+}
+
 fn fat_lto(
     cgcx: &CodegenContext<LlvmCodegenBackend>,
     diag_handler: &Handler,
     modules: Vec<FatLTOInput<LlvmCodegenBackend>>,
     cached_modules: Vec<(SerializedModule<ModuleBuffer>, WorkProduct)>,
     mut serialized_modules: Vec<(SerializedModule<ModuleBuffer>, CString)>,
-    symbols_below_threshold: &[*const libc::c_char],
+    symbols_below_threshold: &[CString],
 ) -> Result<LtoModuleCodegen<LlvmCodegenBackend>, FatalError> {
     let _timer = cgcx.prof.generic_activity("LLVM_fat_lto_build_monolithic_module");
     info!("going for a fat lto");
@@ -255,10 +468,7 @@ fn fat_lto(
         .iter()
         .enumerate()
         .filter(|&(_, module)| module.kind == ModuleKind::Regular)
-        .map(|(i, module)| {
-            let cost = unsafe { llvm::LLVMRustModuleCost(module.module_llvm.llmod()) };
-            (cost, i)
-        })
+        .map(|(i, module)| (base::llvm_module_cost(module.module_llvm.llmod()), i))
         .max();
 
     // If we found a costliest module, we're good to go. Otherwise all our
@@ -290,18 +500,40 @@ fn fat_lto(
         // The linking steps below may produce errors and diagnostics within LLVM
         // which we'd like to handle and print, so set up our diagnostic handlers
         // (which get unregistered when they go out of scope below).
-        let _handler = DiagnosticHandlers::new(cgcx, diag_handler, llcx);
+        let _handler = DiagnosticHandlers::new(
+            cgcx,
+            diag_handler,
+            llcx,
+            &module.name,
+            CodegenDiagnosticsStage::LtoLink,
+        );
 
         // For all other modules we codegened we'll need to link them into our own
         // bitcode. All modules were codegened in their own LLVM context, however,
         // and we want to move everything to the same LLVM context. Currently the
         // way we know of to do that is to serialize them to a string and them parse
         // them later. Not great but hey, that's why it's "fat" LTO, right?
-        for module in in_memory {
-            let buffer = ModuleBuffer::new(module.module_llvm.llmod());
-            let llmod_id = CString::new(&module.name[..]).unwrap();
-            serialized_modules.push((SerializedModule::Local(buffer), llmod_id));
+        //
+        // Each of these modules lives in its own context, so they are serialized (and their
+        // contexts torn down) on as many threads as the jobserver gives us tokens for; only
+        // linking into the base module is serial.
+        let mut tokens = ExtraTokens::request(cgcx, in_memory.len().saturating_sub(1));
+        let helpers = (tokens.acquire() - 1).min(in_memory.len().saturating_sub(1));
+        let queue = Arc::new(Mutex::new(in_memory.into_iter()));
+        let serializers = (0..helpers)
+            .map(|_| {
+                let queue = queue.clone();
+                thread::spawn(move || serialize_in_memory_modules(&queue))
+            })
+            .collect::<Vec<_>>();
+        serialized_modules.extend(serialize_in_memory_modules(&queue));
+        for serializer in serializers {
+            match serializer.join() {
+                Ok(serialized) => serialized_modules.extend(serialized),
+                Err(panic) => panic::resume_unwind(panic),
+            }
         }
+        drop(tokens);
         // Sort the modules to ensure we produce deterministic results.
         serialized_modules.sort_by(|module1, module2| module1.1.cmp(&module2.1));
 
@@ -310,6 +542,14 @@ fn fat_lto(
         // know much about the memory management here so we err on the side of being
         // save and persist everything with the original module.
         let mut linker = Linker::new(llmod);
+        if cgcx.opts.debugging_opts.fat_lto_dead_strip {
+            let _timer = cgcx.prof.generic_activity("LLVM_fat_lto_compute_liveness");
+            let bytecodes = serialized_modules.iter().map(|(m, _)| m.data()).collect::<Vec<_>>();
+            let preserved = symbols_below_threshold.iter().map(|c| c.as_ptr()).collect::<Vec<_>>();
+            linker.compute_liveness(&bytecodes, &preserved).map_err(|()| {
+                write::llvm_err(&diag_handler, "failed to compute liveness for fat LTO")
+            })?;
+        }
         for (bc_decoded, name) in serialized_modules {
             let _timer = cgcx
                 .prof
@@ -327,18 +567,17 @@ fn fat_lto(
 
         // Internalize everything below threshold to help strip out more modules and such.
         unsafe {
-            let ptr = symbols_below_threshold.as_ptr();
-            llvm::LLVMRustRunRestrictionPass(
-                llmod,
-                ptr as *const *const libc::c_char,
-                symbols_below_threshold.len() as libc::size_t,
-            );
+            let symbols = symbols_below_threshold.iter().map(|c| c.as_bytes()).collect::<Vec<_>>();
+            let ptrs =
+                symbols.iter().map(|s| s.as_ptr() as *const libc::c_char).collect::<Vec<_>>();
+            let lens = symbols.iter().map(|s| s.len()).collect::<Vec<_>>();
+            llvm::LLVMRustRunRestrictionPass(llmod, ptrs.as_ptr(), lens.as_ptr(), symbols.len());
             save_temp_bitcode(&cgcx, &module, "lto.after-restriction");
         }
 
         if cgcx.no_landing_pads {
             unsafe {
-                llvm::LLVMRustMarkAllFunctionsNounwind(llmod);
+                mark_all_functions_nounwind(cgcx, llmod);
             }
             save_temp_bitcode(&cgcx, &module, "lto.after-nounwind");
         }
@@ -347,6 +586,45 @@ fn fat_lto(
     Ok(LtoModuleCodegen::Fat { module: Some(module), _serialized_bitcode: serialized_bitcode })
 }
 
+/// Splits the optimized fat LTO module into `partitions` modules, each of which is parsed
+/// into a context of its own so that their code can be generated on separate threads. A module
+/// with module-level inline assembly is returned as it is.
+pub(crate) fn split_fat_module(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    diag_handler: &Handler,
+    module: ModuleCodegen<ModuleLlvm>,
+    partitions: usize,
+) -> Result<Vec<ModuleCodegen<ModuleLlvm>>, FatalError> {
+    let _timer = cgcx.prof.generic_activity("LLVM_fat_lto_split_module");
+    save_temp_bitcode(cgcx, &module, "lto.before-split");
+
+    let mut parts = iter::repeat_with(|| None).take(partitions).collect::<Vec<_>>();
+    let len = unsafe {
+        llvm::LLVMRustSplitModule(module.module_llvm.llmod(), partitions, parts.as_mut_ptr())
+    };
+    if len == 0 {
+        info!("not splitting fat LTO module {:?}: it has module asm", module.name);
+        return Ok(vec![module]);
+    }
+    let parts = parts.into_iter().take(len).map(|part| ModuleBuffer(part.unwrap()));
+    let name = module.name;
+    drop(module.module_llvm);
+
+    parts
+        .enumerate()
+        .map(|(i, buffer)| {
+            let name = format!("{}-part{}", name, i);
+            let llmod_id = CString::new(&name[..]).unwrap();
+            info!("parsing fat LTO partition {:?}", name);
+            Ok(ModuleCodegen {
+                module_llvm: ModuleLlvm::parse(cgcx, &llmod_id, buffer.data(), diag_handler)?,
+                name,
+                kind: ModuleKind::Regular,
+            })
+        })
+        .collect()
+}
+
 crate struct Linker<'a>(&'a mut llvm::Linker<'a>);
 
 impl Linker<'a> {
@@ -354,6 +632,29 @@ impl Linker<'a> {
         unsafe { Linker(llvm::LLVMRustLinkerNew(llmod)) }
     }
 
+    /// Works out which globals of `bytecodes` are reachable from `preserved`, so that
+    /// `add` only links those in. Every later `add` must pass one of `bytecodes`.
+    crate fn compute_liveness(
+        &mut self,
+        bytecodes: &[&[u8]],
+        preserved: &[*const libc::c_char],
+    ) -> Result<(), ()> {
+        let ptrs =
+            bytecodes.iter().map(|bc| bc.as_ptr() as *const libc::c_char).collect::<Vec<_>>();
+        let lens = bytecodes.iter().map(|bc| bc.len()).collect::<Vec<_>>();
+        unsafe {
+            llvm::LLVMRustLinkerComputeLiveness(
+                self.0,
+                ptrs.as_ptr(),
+                lens.as_ptr(),
+                bytecodes.len(),
+                preserved.as_ptr(),
+                preserved.len(),
+            )
+            .into_result()
+        }
+    }
+
     crate fn add(&mut self, bytecode: &[u8]) -> Result<(), ()> {
         unsafe {
             if llvm::LLVMRustLinkerAdd(
@@ -411,8 +712,9 @@ fn thin_lto(
     cgcx: &CodegenContext<LlvmCodegenBackend>,
     diag_handler: &Handler,
     modules: Vec<(String, ThinBuffer)>,
-    serialized_modules: Vec<(SerializedModule<ModuleBuffer>, CString)>,
+    upstream_modules: Vec<(UpstreamModule, CString)>,
     cached_modules: Vec<(SerializedModule<ModuleBuffer>, WorkProduct)>,
+    native_modules: Vec<(UpstreamModule, CString)>,
     symbols_below_threshold: &[*const libc::c_char],
 ) -> Result<(Vec<LtoModuleCodegen<LlvmCodegenBackend>>, Vec<WorkProduct>), FatalError> {
     let _timer = cgcx.prof.generic_activity("LLVM_thin_lto_global_analysis");
@@ -422,11 +724,17 @@ fn thin_lto(
         let green_modules: FxHashMap<_, _> =
             cached_modules.iter().map(|&(_, ref wp)| (wp.cgu_name.clone(), wp.clone())).collect();
 
-        let full_scope_len = modules.len() + serialized_modules.len() + cached_modules.len();
-        let mut thin_buffers = Vec::with_capacity(modules.len());
+        let full_scope_len =
+            modules.len() + upstream_modules.len() + cached_modules.len() + native_modules.len();
+        let mut sources = Vec::with_capacity(full_scope_len);
         let mut module_names = Vec::with_capacity(full_scope_len);
         let mut thin_modules = Vec::with_capacity(full_scope_len);
+        // Whether every module has a key, otherwise the cached thin link is
+        // ignored.
+        let mut keys_known = true;
 
+        // Compressed buffers stay that way, the thin link and each backend only
+        // decompress a temporary copy while they read one.
         for (i, (name, buffer)) in modules.into_iter().enumerate() {
             info!("local module: {} - {}", i, name);
             let cname = CString::new(name.clone()).unwrap();
@@ -434,80 +742,209 @@ fn thin_lto(
                 identifier: cname.as_ptr(),
                 data: buffer.data().as_ptr(),
                 len: buffer.data().len(),
+                path: ptr::null(),
+                offset: 0,
+                import_only: false,
+                key: bitcode_key(buffer.data()),
             });
-            thin_buffers.push(buffer);
+            sources.push(ThinModuleSource::Local(buffer));
             module_names.push(cname);
         }
 
-        // FIXME: All upstream crates are deserialized internally in the
-        //        function below to extract their summary and modules. Note that
-        //        unlike the loop above we *must* decode and/or read something
-        //        here as these are all just serialized files on disk. An
-        //        improvement, however, to make here would be to store the
-        //        module summary separately from the actual module itself. Right
-        //        now this is store in one large bitcode file, and the entire
-        //        file is deflate-compressed. We could try to bypass some of the
-        //        decompression by storing the index uncompressed and only
-        //        lazily decompressing the bytecode if necessary.
-        //
-        //        Note that truly taking advantage of this optimization will
-        //        likely be further down the road. We'd have to implement
-        //        incremental ThinLTO first where we could actually avoid
-        //        looking at upstream modules entirely sometimes (the contents,
-        //        we must always unconditionally look at the index).
-        let mut serialized = Vec::with_capacity(serialized_modules.len() + cached_modules.len());
+        // The bitcode of upstream crates is borrowed from their mapped rlibs
+        // rather than read up front, so only the parts of it that are actually
+        // looked at (the summary, and whatever is imported or optimized) are
+        // ever paged in.
+        for (module, name) in upstream_modules {
+            info!("upstream module {:?}", name);
+            let key = module.key();
+            keys_known &= key.is_some();
+            let module = module.load(name.to_str().unwrap()).map_err(|err| {
+                let msg = format!("failed to read bitcode of {:?} for LTO: {}", name, err);
+                diag_handler.fatal(&msg)
+            })?;
+            thin_modules.push(llvm::ThinLTOModule {
+                identifier: name.as_ptr(),
+                data: module.data().as_ptr(),
+                len: module.data().len(),
+                path: ptr::null(),
+                offset: 0,
+                import_only: false,
+                key: key.unwrap_or_default(),
+            });
+            sources.push(ThinModuleSource::Serialized(module));
+            module_names.push(name);
+        }
 
         let cached_modules =
             cached_modules.into_iter().map(|(sm, wp)| (sm, CString::new(wp.cgu_name).unwrap()));
 
-        for (module, name) in serialized_modules.into_iter().chain(cached_modules) {
-            info!("upstream or cached module {:?}", name);
+        for (module, name) in cached_modules {
+            info!("cached module {:?}", name);
             thin_modules.push(llvm::ThinLTOModule {
                 identifier: name.as_ptr(),
                 data: module.data().as_ptr(),
                 len: module.data().len(),
+                path: ptr::null(),
+                offset: 0,
+                import_only: false,
+                key: bitcode_key(module.data()),
             });
-            serialized.push(module);
+            sources.push(ThinModuleSource::Serialized(module));
+            module_names.push(name);
+        }
+
+        // Native bitcode comes last, so that the modules we're compiling come
+        // first when LLVM picks among copies of the same definition. Nothing
+        // but modules to import from, they get neither keys nor compiled. The
+        // C++ side maps their bitcode itself, and the paths only need to live
+        // until the ThinLTO data has been created.
+        let codegen_modules = thin_modules.len();
+        let mut native_rlibs = Vec::with_capacity(native_modules.len());
+        for (module, name) in native_modules {
+            info!("native module {:?}", name);
+            let key = module.key();
+            keys_known &= key.is_some();
+            let rlib = path_to_c_string(&module.rlib);
+            thin_modules.push(llvm::ThinLTOModule {
+                identifier: name.as_ptr(),
+                data: ptr::null(),
+                len: module.len,
+                path: rlib.as_ptr(),
+                offset: module.offset,
+                import_only: true,
+                key: key.unwrap_or_default(),
+            });
+            native_rlibs.push(rlib);
             module_names.push(name);
         }
 
         // Sanity check
         assert_eq!(thin_modules.len(), module_names.len());
+        assert_eq!(sources.len(), codegen_modules);
 
         // Delegate to the C++ bindings to create some data here. Once this is a
         // tried-and-true interface we may wish to try to upstream some of this
         // to LLVM itself, right now we reimplement a lot of what they do
         // upstream...
-        let data = llvm::LLVMRustCreateThinLTOData(
-            thin_modules.as_ptr(),
-            thin_modules.len() as u32,
-            symbols_below_threshold.as_ptr(),
-            symbols_below_threshold.len() as u32,
-        )
+        //
+        // When compiling incrementally the thin link of the previous session
+        // is cached, and reused as-is if none of the modules participating
+        // in it changed.
+        let index_path = cgcx
+            .incr_comp_session_dir
+            .as_ref()
+            .map(|dir| dir.join(THIN_LTO_INDEX_INCR_COMP_FILE_NAME));
+        let prev_index =
+            index_path.as_ref().filter(|_| keys_known).and_then(|path| fs::read(path).ok());
+        let dopts = &cgcx.opts.debugging_opts;
+        let import_options = llvm::ThinLTOImportOptions {
+            instr_limit: dopts.thinlto_import_instr_limit.map_or(-1, |limit| limit as libc::c_int),
+            hot_multiplier: dopts.thinlto_import_hot_multiplier.unwrap_or(-1.0),
+            cold_multiplier: dopts.thinlto_import_cold_multiplier.unwrap_or(-1.0),
+            max_module_functions: dopts.thinlto_import_max_module_functions.unwrap_or(0),
+            max_module_instrs: dopts.thinlto_import_max_module_instrs.unwrap_or(0),
+            whole_program_visibility: whole_program_visibility(cgcx),
+            propagate_global_attrs: dopts.thinlto_propagate_global_attrs,
+        };
+        let mut changed_modules = thin_modules.len();
+        let buffer_bytes = thin_modules.iter().map(|m| m.len).sum::<usize>();
+        // Locating the summaries and hashing the preserved symbols is done on a
+        // thread pool, with a thread for each jobserver token we can get.
+        let mut tokens = ExtraTokens::request(cgcx, thin_modules.len().saturating_sub(1));
+        let threads = tokens.acquire() as u32;
+        // The arguments give the size of the input, for throughput.
+        let data_timer = cgcx.prof.extra_verbose_generic_activity(
+            "LLVM_thin_lto_create_data",
+            format!("{} modules, {} bytes", thin_modules.len(), buffer_bytes),
+        );
+        let data = match prev_index {
+            Some(ref prev_index) => llvm::LLVMRustLoadCachedThinLTOData(
+                prev_index.as_ptr().cast(),
+                prev_index.len(),
+                thin_modules.as_ptr(),
+                thin_modules.len() as u32,
+                symbols_below_threshold.as_ptr(),
+                symbols_below_threshold.len() as u32,
+                threads,
+                &import_options,
+                &mut changed_modules,
+            ),
+            None => llvm::LLVMRustCreateThinLTOData(
+                thin_modules.as_ptr(),
+                thin_modules.len() as u32,
+                symbols_below_threshold.as_ptr(),
+                symbols_below_threshold.len() as u32,
+                threads,
+                &import_options,
+            ),
+        }
         .ok_or_else(|| write::llvm_err(&diag_handler, "failed to prepare thin LTO context"))?;
+        drop(data_timer);
+        drop(tokens);
 
         let data = ThinData(data);
 
-        info!("thin LTO data created");
+        info!("thin LTO data created, {} modules changed", changed_modules);
+        log_thin_lto_imports(&data);
+        if cgcx.prof.llvm_recording_enabled() {
+            if let Some(profiler) = cgcx.prof.get_self_profiler() {
+                record_thin_lto_memory_usage(&profiler, data.0, buffer_bytes);
+            }
+        }
 
-        let (key_map_path, prev_key_map, curr_key_map) = if let Some(ref incr_comp_session_dir) =
-            cgcx.incr_comp_session_dir
-        {
-            let path = incr_comp_session_dir.join(THIN_LTO_KEYS_INCR_COMP_FILE_NAME);
-            // If the previous file was deleted, or we get an IO error
-            // reading the file, then we'll just use `None` as the
-            // prev_key_map, which will force the code to be recompiled.
-            let prev =
-                if path.exists() { ThinLTOKeysMap::load_from_file(&path).ok() } else { None };
-            let curr = ThinLTOKeysMap::from_thin_lto_modules(&data, &thin_modules, &module_names);
-            (Some(path), prev, curr)
-        } else {
-            // If we don't compile incrementally, we don't need to load the
-            // import data from LLVM.
-            assert!(green_modules.is_empty());
-            let curr = ThinLTOKeysMap::default();
-            (None, None, curr)
-        };
+        if cgcx.opts.debugging_opts.thinlto_write_index_shards {
+            for name in &module_names[..codegen_modules] {
+                let cgu_name = module_name_to_str(name);
+                let index = cgcx.output_filenames.temp_path_ext("thinlto.bc", Some(cgu_name));
+                let imports = cgcx.output_filenames.temp_path_ext("imports", Some(cgu_name));
+                let (index, imports) = (path_to_c_string(&index), path_to_c_string(&imports));
+                let result = llvm::LLVMRustThinLTOWriteIndexShard(
+                    data.0,
+                    name.as_ptr(),
+                    index.as_ptr(),
+                    imports.as_ptr(),
+                );
+                result.into_result().map_err(|()| {
+                    let msg = format!("failed to write ThinLTO index shard for {}", cgu_name);
+                    write::llvm_err(&diag_handler, &msg)
+                })?;
+            }
+        }
+
+        if let (Some(path), true) = (index_path, changed_modules != 0) {
+            let index = llvm::build_byte_buffer(|s| llvm::LLVMRustThinLTODataWrite(data.0, s));
+            if let Err(err) = fs::write(&path, index) {
+                let msg = format!("Error while writing ThinLTO index data: {}", err);
+                return Err(write::llvm_err(&diag_handler, &msg));
+            }
+        }
+
+        let (key_map_path, prev_key_map, curr_key_map) =
+            if let Some(ref incr_comp_session_dir) = cgcx.incr_comp_session_dir {
+                let path = incr_comp_session_dir.join(THIN_LTO_KEYS_INCR_COMP_FILE_NAME);
+                // If the previous file was deleted, or we get an IO error
+                // reading the file, then we'll just use `None` as the
+                // prev_key_map, which will force the code to be recompiled.
+                let prev =
+                    if path.exists() { ThinLTOKeysMap::load_from_file(&path).ok() } else { None };
+                // The keys are computed on a thread pool as well.
+                let mut tokens = ExtraTokens::request(cgcx, codegen_modules.saturating_sub(1));
+                let curr = ThinLTOKeysMap::from_thin_lto_modules(
+                    &data,
+                    &thin_modules[..codegen_modules],
+                    &module_names[..codegen_modules],
+                    tokens.acquire() as u32,
+                );
+                drop(tokens);
+                (Some(path), prev, curr)
+            } else {
+                // If we don't compile incrementally, we don't need to load the
+                // import data from LLVM.
+                assert!(green_modules.is_empty());
+                let curr = ThinLTOKeysMap::default();
+                (None, None, curr)
+            };
         info!("thin LTO cache key map loaded");
         info!("prev_key_map: {:#?}", prev_key_map);
         info!("curr_key_map: {:#?}", curr_key_map);
@@ -516,18 +953,15 @@ fn thin_lto(
         // also put all memory referenced by the C++ data (buffers, ids, etc)
         // into the arc as well. After this we'll create a thin module
         // codegen per module in this data.
-        let shared = Arc::new(ThinShared {
-            data,
-            thin_buffers,
-            serialized_modules: serialized,
-            module_names,
-        });
+        let shared = Arc::new(ThinShared { data, modules: sources, module_names });
 
         let mut copy_jobs = vec![];
         let mut opt_jobs = vec![];
 
         info!("checking which modules can be-reused and which have to be re-optimized.");
-        for (module_index, module_name) in shared.module_names.iter().enumerate() {
+        for (module_index, module_name) in
+            shared.module_names.iter().enumerate().take(codegen_modules)
+        {
             let module_name = module_name_to_str(module_name);
             if let (Some(prev_key_map), true) =
                 (prev_key_map.as_ref(), green_modules.contains_key(module_name))
@@ -566,12 +1000,40 @@ fn thin_lto(
     }
 }
 
+/// Whether LTO may assume that nothing outside of the modules it's looking at
+/// can derive from their vtables, see `-Z whole-program-visibility`. That only
+/// holds for executables.
+fn whole_program_visibility(cgcx: &CodegenContext<LlvmCodegenBackend>) -> bool {
+    cgcx.opts.debugging_opts.whole_program_visibility
+        && cgcx.crate_types.iter().all(|&crate_type| crate_type == CrateType::Executable)
+}
+
+/// Marks everything in `llmod`, which only holds `panic=abort` code, as not
+/// unwinding. With `-Z lto-remove-unwind` its invokes and landing pads are
+/// removed as well, along with the `uwtable` attributes if the target doesn't
+/// need unwind tables, so no `.eh_frame` entries are emitted for it either.
+unsafe fn mark_all_functions_nounwind(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    llmod: &llvm::Module,
+) {
+    let remove_unwind = cgcx.opts.debugging_opts.lto_remove_unwind;
+    llvm::LLVMRustMarkAllFunctionsNounwind(
+        llmod,
+        remove_unwind,
+        remove_unwind && !cgcx.must_emit_unwind_tables,
+    );
+}
+
+/// Runs the LTO optimization pipeline over `module`. For ThinLTO `thin_data`
+/// is the result of the thin link, whose index the pipeline consults for the
+/// decisions made there.
 pub(crate) fn run_pass_manager(
     cgcx: &CodegenContext<LlvmCodegenBackend>,
     diag_handler: &Handler,
     module: &ModuleCodegen<ModuleLlvm>,
     config: &ModuleConfig,
     thin: bool,
+    thin_data: Option<&ThinData>,
 ) -> Result<(), FatalError> {
     let _timer = cgcx.prof.extra_verbose_generic_activity("LLVM_lto_optimize", &module.name[..]);
 
@@ -582,8 +1044,13 @@ pub(crate) fn run_pass_manager(
     //      tools/lto/LTOCodeGenerator.cpp
     debug!("running the pass manager");
     unsafe {
+        let thin_lto_data = thin_data.map(|data| &*data.0);
+        if !thin && whole_program_visibility(cgcx) {
+            llvm::LLVMRustUpdateVCallVisibility(module.module_llvm.llmod(), true);
+        }
+
+        let opt_stage = if thin { llvm::OptStage::ThinLTO } else { llvm::OptStage::FatLTO };
         if write::should_use_new_llvm_pass_manager(config) {
-            let opt_stage = if thin { llvm::OptStage::ThinLTO } else { llvm::OptStage::FatLTO };
             let opt_level = config.opt_level.unwrap_or(config::OptLevel::No);
             write::optimize_with_new_llvm_pass_manager(
                 cgcx,
@@ -592,6 +1059,7 @@ pub(crate) fn run_pass_manager(
                 config,
                 opt_level,
                 opt_stage,
+                thin_lto_data,
             )?;
             debug!("lto done");
             return Ok(());
@@ -609,9 +1077,9 @@ pub(crate) fn run_pass_manager(
             .opt_level
             .map(|x| to_llvm_opt_settings(x).0)
             .unwrap_or(llvm::CodeGenOptLevel::None);
-        with_llvm_pmb(module.module_llvm.llmod(), config, opt_level, false, &mut |b| {
+        with_llvm_pmb(cgcx, module.module_llvm.llmod(), config, opt_level, false, &mut |b| {
             if thin {
-                llvm::LLVMRustPassManagerBuilderPopulateThinLTOPassManager(b, pm);
+                llvm::LLVMRustPassManagerBuilderPopulateThinLTOPassManager(b, pm, thin_lto_data);
             } else {
                 llvm::LLVMPassManagerBuilderPopulateLTOPassManager(
                     b, pm, /* Internalize = */ False, /* RunInliner = */ True,
@@ -631,7 +1099,10 @@ pub(crate) fn run_pass_manager(
             llvm::LLVMRustAddPass(pm, pass.unwrap());
         }
 
-        llvm::LLVMRunPassManager(pm, module.module_llvm.llmod());
+        write::profile_optimization_stage(cgcx, module, opt_stage, || {
+            llvm::LLVMRunPassManager(pm, module.module_llvm.llmod());
+            Ok(())
+        })?;
 
         llvm::LLVMDisposePassManager(pm);
     }
@@ -668,6 +1139,27 @@ fn drop(&mut self) {
     }
 }
 
+/// Logs how much each module imports from every other module.
+fn log_thin_lto_imports(data: &ThinData) {
+    unsafe extern "C" fn imported_module_callback(
+        _payload: *mut libc::c_void,
+        importing_module_name: *const libc::c_char,
+        imported_module_name: *const libc::c_char,
+        functions: libc::size_t,
+        instructions: libc::size_t,
+    ) {
+        let importing = CStr::from_ptr(importing_module_name).to_string_lossy();
+        let imported = CStr::from_ptr(imported_module_name).to_string_lossy();
+        info!(
+            " - {} imports {} functions ({} instructions) from {}",
+            importing, functions, instructions, imported
+        );
+    }
+    unsafe {
+        llvm::LLVMRustGetThinLTOModules(data.0, imported_module_callback, ptr::null_mut());
+    }
+}
+
 pub struct ThinData(&'static mut llvm::ThinLTOData);
 
 unsafe impl Send for ThinData {}
@@ -693,6 +1185,13 @@ pub fn new(m: &llvm::Module) -> ThinBuffer {
             ThinBuffer(buffer)
         }
     }
+
+    /// Replaces the buffer with a compressed copy, which LLVM decompresses
+    /// wherever it reads ThinLTO buffers. Returns `false` if compression isn't
+    /// available.
+    pub fn compress(&mut self) -> bool {
+        unsafe { llvm::LLVMRustThinLTOBufferCompress(self.0) }
+    }
 }
 
 impl ThinBufferMethods for ThinBuffer {
@@ -729,9 +1228,16 @@ pub unsafe fn optimize_thin_module(
     // into that context. One day, however, we may do this for upstream
     // crates but for locally codegened modules we may be able to reuse
     // that LLVM Context and Module.
-    let llcx = llvm::LLVMRustContextCreate(cgcx.fewer_names);
-    let llmod_raw =
-        parse_module(llcx, &module_name, thin_module.data(), &diag_handler)? as *const _;
+    let llcx = crate::create_context(&cgcx.opts, cgcx.fewer_names);
+    // Saving the module as bitcode needs all of it, so parse it lazily only if
+    // nothing saves it until it's been materialized. The data it's parsed from
+    // outlives that.
+    let lazy = cgcx.opts.debugging_opts.llvm_lazy_thin_lto_parsing && !cgcx.save_temps;
+    let llmod_raw = if lazy {
+        parse_module_lazily(llcx, &module_name, thin_module.data(), &diag_handler)?
+    } else {
+        parse_module(llcx, &module_name, thin_module.data(), &diag_handler)?
+    } as *const _;
     let module = ModuleCodegen {
         module_llvm: ModuleLlvm { llmod_raw, llcx, tm },
         name: thin_module.name().to_string(),
@@ -742,6 +1248,16 @@ pub unsafe fn optimize_thin_module(
         let llmod = module.module_llvm.llmod();
         save_temp_bitcode(&cgcx, &module, "thin-lto-input");
 
+        // Like for fat LTO, report what LLVM has to say about the module, and
+        // stream its remarks with `-Z remark-dir`, while it's being optimized.
+        let _handlers = DiagnosticHandlers::new(
+            cgcx,
+            &diag_handler,
+            &*module.module_llvm.llcx,
+            &module.name,
+            CodegenDiagnosticsStage::Lto,
+        );
+
         // Before we do much else find the "main" `DICompileUnit` that we'll be
         // using below. If we find more than one though then rustc has changed
         // in a way we're not ready for, so generate an ICE by returning
@@ -755,13 +1271,18 @@ pub unsafe fn optimize_thin_module(
         }
 
         // Like with "fat" LTO, get some better optimizations if landing pads
-        // are disabled by removing all landing pads.
-        if cgcx.no_landing_pads {
+        // are disabled by removing all landing pads. That needs the function
+        // bodies, so with a lazily parsed module it's done once they've all
+        // been read below.
+        let remove_landing_pads = || {
             let _timer = cgcx
                 .prof
                 .generic_activity_with_arg("LLVM_thin_lto_remove_landing_pads", thin_module.name());
-            llvm::LLVMRustMarkAllFunctionsNounwind(llmod);
+            mark_all_functions_nounwind(cgcx, llmod);
             save_temp_bitcode(&cgcx, &module, "thin-lto-after-nounwind");
+        };
+        if cgcx.no_landing_pads && !lazy {
+            remove_landing_pads();
         }
 
         // Up next comes the per-module local analyses that we do for Thin LTO.
@@ -782,6 +1303,14 @@ pub unsafe fn optimize_thin_module(
             save_temp_bitcode(cgcx, &module, "thin-lto-after-rename");
         }
 
+        // What isn't live will be thrown away anyway, so with a lazily parsed
+        // module it doesn't get read in the first place.
+        if lazy {
+            let _timer =
+                cgcx.prof.generic_activity_with_arg("LLVM_thin_lto_drop_dead", thin_module.name());
+            llvm::LLVMRustPrepareThinLTODropDeadSymbols(thin_module.shared.data.0, llmod);
+        }
+
         {
             let _timer = cgcx
                 .prof
@@ -807,13 +1336,49 @@ pub unsafe fn optimize_thin_module(
         {
             let _timer =
                 cgcx.prof.generic_activity_with_arg("LLVM_thin_lto_import", thin_module.name());
-            if !llvm::LLVMRustPrepareThinLTOImport(thin_module.shared.data.0, llmod, target) {
+            let (mut cached_loads, mut uncached_loads) = (0, 0);
+            if !llvm::LLVMRustPrepareThinLTOImport(
+                thin_module.shared.data.0,
+                llmod,
+                target,
+                &mut cached_loads,
+                &mut uncached_loads,
+            ) {
                 let msg = "failed to prepare thin LTO module";
                 return Err(write::llvm_err(&diag_handler, msg));
             }
+            info!(
+                "{}: {} cached import loads, {} uncached",
+                thin_module.name(),
+                cached_loads,
+                uncached_loads
+            );
+            if cgcx.prof.llvm_recording_enabled() {
+                if let Some(profiler) = cgcx.prof.get_self_profiler() {
+                    record_thin_lto_import_loads(
+                        &profiler,
+                        thin_module.name(),
+                        cached_loads,
+                        uncached_loads,
+                    );
+                }
+            }
             save_temp_bitcode(cgcx, &module, "thin-lto-after-import");
         }
 
+        if lazy {
+            let _timer = cgcx
+                .prof
+                .generic_activity_with_arg("LLVM_thin_lto_materialize", thin_module.name());
+            if !llvm::LLVMRustMaterializeModule(llmod) {
+                let msg = "failed to read bitcode for LTO module";
+                return Err(write::llvm_err(&diag_handler, msg));
+            }
+            if cgcx.no_landing_pads {
+                remove_landing_pads();
+            }
+        }
+
         // Ok now this is a bit unfortunate. This is also something you won't
         // find upstream in LLVM's ThinLTO passes! This is a hack for now to
         // work around bugs in LLVM.
@@ -859,7 +1424,8 @@ pub unsafe fn optimize_thin_module(
         {
             info!("running thin lto passes over {}", module.name);
             let config = cgcx.config(module.kind);
-            run_pass_manager(cgcx, &diag_handler, &module, config, true)?;
+            let thin_data = &thin_module.shared.data;
+            run_pass_manager(cgcx, &diag_handler, &module, config, true, Some(thin_data))?;
             save_temp_bitcode(cgcx, &module, "thin-lto-after-pm");
         }
     }
@@ -903,15 +1469,24 @@ fn from_thin_lto_modules(
         data: &ThinData,
         modules: &[llvm::ThinLTOModule],
         names: &[CString],
+        threads: u32,
     ) -> Self {
-        let keys = iter::zip(modules, names)
-            .map(|(module, name)| {
-                let key = build_string(|rust_str| unsafe {
-                    llvm::LLVMRustComputeLTOCacheKey(rust_str, module.identifier, data.0);
-                })
-                .expect("Invalid ThinLTO module key");
-                (name.clone().into_string().unwrap(), key)
-            })
+        let identifiers = modules.iter().map(|module| module.identifier).collect::<Vec<_>>();
+        let keys = build_string(|rust_str| unsafe {
+            llvm::LLVMRustComputeLTOCacheKeys(
+                rust_str,
+                identifiers.as_ptr(),
+                identifiers.len(),
+                data.0,
+                threads,
+            );
+        })
+        .expect("Invalid ThinLTO module key");
+        // One key per line, in the order of `modules`.
+        let keys = keys.lines().collect::<Vec<_>>();
+        assert_eq!(keys.len(), names.len(), "expected one ThinLTO cache key per module");
+        let keys = iter::zip(names, keys)
+            .map(|(name, key)| (name.clone().into_string().unwrap(), key.to_string()))
             .collect();
         Self { keys }
     }
@@ -938,3 +1513,20 @@ pub fn parse_module<'a>(
         )
     }
 }
+
+/// Like `parse_module`, but leaves reading the function bodies for later, see
+/// `LLVMRustParseBitcodeForLTOLazily`. `data` has to outlive that.
+pub fn parse_module_lazily<'a>(
+    cx: &'a llvm::Context,
+    name: &CStr,
+    data: &[u8],
+    diag_handler: &Handler,
+) -> Result<&'a llvm::Module, FatalError> {
+    unsafe {
+        llvm::LLVMRustParseBitcodeForLTOLazily(cx, data.as_ptr(), data.len(), name.as_ptr())
+            .ok_or_else(|| {
+                let msg = "failed to parse bitcode for LTO module";
+                write::llvm_err(&diag_handler, msg)
+            })
+    }
+}
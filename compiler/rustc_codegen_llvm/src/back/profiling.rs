@@ -1,58 +1,365 @@
+use crate::llvm::{self, IRUnitKind};
 use measureme::{event_id::SEPARATOR_BYTE, EventId, StringComponent, StringId};
+use rustc_data_structures::fx::FxHashMap;
 use rustc_data_structures::profiling::{SelfProfiler, TimingGuard};
-use std::ffi::{c_void, CStr};
+use smallvec::SmallVec;
+use std::ffi::c_void;
 use std::os::raw::c_char;
 use std::sync::Arc;
 
-fn llvm_args_to_string_id(profiler: &SelfProfiler, pass_name: &str, ir_name: &str) -> EventId {
-    let pass_name = profiler.get_or_alloc_cached_string(pass_name);
-    let mut components = vec![StringComponent::Ref(pass_name)];
-    // handle that LazyCallGraph::SCC is a comma separated list within parentheses
-    let parentheses: &[_] = &['(', ')'];
-    let trimmed = ir_name.trim_matches(parentheses);
-    for part in trimmed.split(", ") {
-        let demangled_ir_name = rustc_demangle::demangle(part).to_string();
-        let ir_name = profiler.get_or_alloc_cached_string(demangled_ir_name);
-        components.push(StringComponent::Value(SEPARATOR_BYTE));
-        components.push(StringComponent::Ref(ir_name));
-    }
-    EventId::from_label(profiler.alloc_string(components.as_slice()))
+unsafe fn str_from_raw_parts<'a>(ptr: *const c_char, len: usize) -> &'a str {
+    std::str::from_utf8(std::slice::from_raw_parts(ptr.cast(), len)).expect("valid UTF-8")
+}
+
+struct PassEvent<'a> {
+    guard: TimingGuard<'a>,
+    /// The event's label and arguments, if arguments are recorded: the pass
+    /// name, the name(s) of the IR unit it ran on and the kind of that unit,
+    /// and empty otherwise. The change in instruction
+    /// count is appended when the pass finishes, and only then is the event's
+    /// id allocated, since sampled events may not be recorded at all.
+    args: SmallVec<[StringComponent<'static>; 8]>,
+    instruction_count: i64,
 }
 
 pub struct LlvmSelfProfiler<'a> {
     profiler: Arc<SelfProfiler>,
-    stack: Vec<TimingGuard<'a>>,
+    stack: Vec<PassEvent<'a>>,
     llvm_pass_event_kind: StringId,
+    llvm_pass_summary_event_kind: StringId,
+    llvm_slow_pass_event_kind: StringId,
+    /// Whether events carry their IR unit and instruction count delta, which
+    /// means allocating a string per event (`-Z self-profile-events=args`).
+    /// Otherwise an event is just its pass name.
+    record_args: bool,
+    /// There are only so many passes, each of which runs many times.
+    pass_names: FxHashMap<String, StringId>,
+    /// LLVM passes us the same (mangled) names over and over again, so we only
+    /// demangle each of them once.
+    ir_names: FxHashMap<String, StringId>,
+    ir_unit_kinds: [StringId; 5],
+    instruction_deltas: FxHashMap<i64, StringId>,
 }
 
 impl<'a> LlvmSelfProfiler<'a> {
     pub fn new(profiler: Arc<SelfProfiler>) -> Self {
         let llvm_pass_event_kind = profiler.alloc_string("LLVM Pass");
-        Self { profiler, stack: Vec::default(), llvm_pass_event_kind }
+        let llvm_pass_summary_event_kind = profiler.alloc_string("LLVM Pass Summary");
+        let llvm_slow_pass_event_kind = profiler.alloc_string("LLVM Slow Pass");
+        let ir_unit_kinds = [
+            profiler.alloc_string("module"),
+            profiler.alloc_string("function"),
+            profiler.alloc_string("loop"),
+            profiler.alloc_string("scc"),
+            profiler.alloc_string("other"),
+        ];
+        Self {
+            record_args: profiler.function_args_recording_enabled(),
+            profiler,
+            stack: Vec::default(),
+            llvm_pass_event_kind,
+            llvm_pass_summary_event_kind,
+            llvm_slow_pass_event_kind,
+            pass_names: FxHashMap::default(),
+            ir_names: FxHashMap::default(),
+            ir_unit_kinds,
+            instruction_deltas: FxHashMap::default(),
+        }
+    }
+
+    fn pass_name_string_id(&mut self, pass_name: &str) -> StringId {
+        if let Some(&id) = self.pass_names.get(pass_name) {
+            return id;
+        }
+        let id = self.profiler.get_or_alloc_cached_string(pass_name);
+        self.pass_names.insert(pass_name.to_owned(), id);
+        id
     }
 
-    fn before_pass_callback(&'a mut self, pass_name: &str, ir_name: &str) {
-        let event_id = llvm_args_to_string_id(&self.profiler, pass_name, ir_name);
+    fn ir_name_string_id(&mut self, ir_name: &str) -> StringId {
+        if let Some(&id) = self.ir_names.get(ir_name) {
+            return id;
+        }
+        let demangled_ir_name = rustc_demangle::demangle(ir_name).to_string();
+        let id = self.profiler.get_or_alloc_cached_string(demangled_ir_name);
+        self.ir_names.insert(ir_name.to_owned(), id);
+        id
+    }
+
+    /// Appends the name(s) of the IR unit a pass ran on and the kind of that
+    /// unit to `components`.
+    fn push_ir_unit(
+        &mut self,
+        components: &mut SmallVec<[StringComponent<'static>; 8]>,
+        ir_name: &str,
+        kind: IRUnitKind,
+    ) {
+        // handle that LazyCallGraph::SCC is a comma separated list within parentheses
+        let parentheses: &[_] = &['(', ')'];
+        let trimmed = ir_name.trim_matches(parentheses);
+        for part in trimmed.split(", ") {
+            let ir_name = self.ir_name_string_id(part);
+            components.push(StringComponent::Value(SEPARATOR_BYTE));
+            components.push(StringComponent::Ref(ir_name));
+        }
+        components.push(StringComponent::Value(SEPARATOR_BYTE));
+        components.push(StringComponent::Ref(self.ir_unit_kinds[kind as usize]));
+    }
+
+    fn before_pass_callback(
+        &'a mut self,
+        pass_name: &str,
+        ir_name: &str,
+        kind: IRUnitKind,
+        instruction_count: i64,
+    ) {
+        let pass_name = self.pass_name_string_id(pass_name);
+        let mut args = SmallVec::new();
+        if self.record_args {
+            args.push(StringComponent::Ref(pass_name));
+            self.push_ir_unit(&mut args, ir_name, kind);
+        }
+
+        let event_id = EventId::from_label(pass_name);
+        let guard = TimingGuard::start(&self.profiler, self.llvm_pass_event_kind, event_id);
+        self.stack.push(PassEvent { guard, args, instruction_count });
+    }
 
-        self.stack.push(TimingGuard::start(&self.profiler, self.llvm_pass_event_kind, event_id));
+    fn after_pass_callback(&mut self, instruction_count: i64) {
+        let event = match self.stack.pop() {
+            Some(event) => event,
+            None => return,
+        };
+        let PassEvent { guard, args: mut components, instruction_count: before } = event;
+        if !self.record_args {
+            drop(guard);
+            return;
+        }
+        if before >= 0 && instruction_count >= 0 {
+            let delta = instruction_count - before;
+            let profiler = &self.profiler;
+            let delta = *self
+                .instruction_deltas
+                .entry(delta)
+                .or_insert_with(|| profiler.alloc_string(&format!("{:+}", delta)[..]));
+            components.push(StringComponent::Value(SEPARATOR_BYTE));
+            components.push(StringComponent::Ref(delta));
+        }
+        let event_id = EventId::from_label(self.profiler.alloc_string(components.as_slice()));
+        guard.finish_with_override_event_id(event_id);
     }
-    fn after_pass_callback(&mut self) {
-        self.stack.pop();
+
+    fn slow_pass_callback(&mut self, pass_name: &str, ir_name: &str, kind: IRUnitKind, nanos: u64) {
+        let pass_name = self.pass_name_string_id(pass_name);
+        let mut components = SmallVec::new();
+        components.push(StringComponent::Ref(pass_name));
+        if self.record_args {
+            self.push_ir_unit(&mut components, ir_name, kind);
+        }
+        let nanos = nanos.to_string();
+        components.push(StringComponent::Value(SEPARATOR_BYTE));
+        components.push(StringComponent::Value(&nanos));
+        let event_id = EventId::from_label(self.profiler.alloc_string(components.as_slice()));
+        self.profiler.record_instant_event(self.llvm_slow_pass_event_kind, event_id);
     }
 }
 
 pub unsafe extern "C" fn selfprofile_before_pass_callback(
     llvm_self_profiler: *mut c_void,
     pass_name: *const c_char,
+    pass_name_len: usize,
     ir_name: *const c_char,
+    ir_name_len: usize,
+    kind: IRUnitKind,
+    instruction_count: i64,
+) {
+    let llvm_self_profiler = &mut *(llvm_self_profiler as *mut LlvmSelfProfiler<'_>);
+    let pass_name = str_from_raw_parts(pass_name, pass_name_len);
+    let ir_name = str_from_raw_parts(ir_name, ir_name_len);
+    llvm_self_profiler.before_pass_callback(pass_name, ir_name, kind, instruction_count);
+}
+
+pub unsafe extern "C" fn selfprofile_after_pass_callback(
+    llvm_self_profiler: *mut c_void,
+    instruction_count: i64,
 ) {
     let llvm_self_profiler = &mut *(llvm_self_profiler as *mut LlvmSelfProfiler<'_>);
-    let pass_name = CStr::from_ptr(pass_name).to_str().expect("valid UTF-8");
-    let ir_name = CStr::from_ptr(ir_name).to_str().expect("valid UTF-8");
-    llvm_self_profiler.before_pass_callback(pass_name, ir_name);
+    llvm_self_profiler.after_pass_callback(instruction_count);
 }
 
-pub unsafe extern "C" fn selfprofile_after_pass_callback(llvm_self_profiler: *mut c_void) {
+/// Records a pass that wasn't sampled but took at least
+/// `-Z self-profile-llvm-min-duration`, along with how long it took.
+pub unsafe extern "C" fn selfprofile_slow_pass_callback(
+    llvm_self_profiler: *mut c_void,
+    pass_name: *const c_char,
+    pass_name_len: usize,
+    ir_name: *const c_char,
+    ir_name_len: usize,
+    kind: IRUnitKind,
+    nanos: u64,
+) {
     let llvm_self_profiler = &mut *(llvm_self_profiler as *mut LlvmSelfProfiler<'_>);
-    llvm_self_profiler.after_pass_callback();
+    let pass_name = str_from_raw_parts(pass_name, pass_name_len);
+    let ir_name = str_from_raw_parts(ir_name, ir_name_len);
+    llvm_self_profiler.slow_pass_callback(pass_name, ir_name, kind, nanos);
+}
+
+/// Records how often a pass ran without being recorded individually, and for
+/// how long in total, when sampling LLVM passes.
+pub unsafe extern "C" fn selfprofile_pass_summary_callback(
+    llvm_self_profiler: *mut c_void,
+    pass_name: *const c_char,
+    pass_name_len: usize,
+    executions: u64,
+    nanos: u64,
+) {
+    let llvm_self_profiler = &mut *(llvm_self_profiler as *mut LlvmSelfProfiler<'_>);
+    let pass_name =
+        llvm_self_profiler.pass_name_string_id(str_from_raw_parts(pass_name, pass_name_len));
+    let profiler = &llvm_self_profiler.profiler;
+    let executions = profiler.alloc_string(&executions.to_string()[..]);
+    let nanos = profiler.alloc_string(&nanos.to_string()[..]);
+    let components = [
+        StringComponent::Ref(pass_name),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Ref(executions),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Ref(nanos),
+    ];
+    let event_id = EventId::from_label(profiler.alloc_string(&components[..]));
+    profiler.record_instant_event(llvm_self_profiler.llvm_pass_summary_event_kind, event_id);
+}
+
+struct FunctionSizeRecorder<'a> {
+    profiler: &'a SelfProfiler,
+    event_kind: StringId,
+    module_name: StringId,
+    stage: StringId,
+}
+
+unsafe extern "C" fn function_size_callback(payload: *mut c_void, size: &llvm::FunctionSize) {
+    let recorder = &*(payload as *const FunctionSizeRecorder<'_>);
+    let profiler = recorder.profiler;
+    let name = rustc_demangle::demangle(str_from_raw_parts(size.name, size.name_len)).to_string();
+    let name = profiler.get_or_alloc_cached_string(name);
+    let instructions = size.instructions.to_string();
+    let basic_blocks = size.basic_blocks.to_string();
+    let allocas = size.allocas.to_string();
+    let components = [
+        StringComponent::Ref(recorder.module_name),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Ref(recorder.stage),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Ref(name),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Value(&instructions),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Value(&basic_blocks),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Value(&allocas),
+    ];
+    let event_id = EventId::from_label(profiler.alloc_string(&components[..]));
+    profiler.record_instant_event(recorder.event_kind, event_id);
+}
+
+/// Records one "LLVM Function Size" event for each function defined in
+/// `llmod`, carrying the module name, `stage`, the demangled function name and
+/// its instruction, basic block and alloca counts. Comparing the events
+/// recorded before and after optimization shows which instantiations grow the
+/// most through inlining.
+pub fn record_function_sizes(
+    profiler: &SelfProfiler,
+    llmod: &llvm::Module,
+    module_name: &str,
+    stage: &str,
+) {
+    let recorder = FunctionSizeRecorder {
+        profiler,
+        event_kind: profiler.get_or_alloc_cached_string("LLVM Function Size"),
+        module_name: profiler.get_or_alloc_cached_string(module_name),
+        stage: profiler.get_or_alloc_cached_string(stage),
+    };
+    unsafe {
+        llvm::LLVMRustGetFunctionSizes(
+            llmod,
+            function_size_callback,
+            &recorder as *const _ as *mut c_void,
+        );
+    }
+}
+
+/// Records an "LLVM Memory Usage" event carrying the module name, `stage` and
+/// the estimated number of bytes taken up by the module's IR and by the
+/// metadata it refers to, so that the codegen units that take up the most
+/// memory can be found and split up.
+pub fn record_module_memory_usage(
+    profiler: &SelfProfiler,
+    llmod: &llvm::Module,
+    module_name: &str,
+    stage: &str,
+) {
+    let mut usage = llvm::ModuleMemoryUsage::default();
+    unsafe { llvm::LLVMRustGetModuleMemoryUsage(llmod, &mut usage) };
+    let ir = usage.ir.to_string();
+    let metadata = usage.metadata.to_string();
+    let components = [
+        StringComponent::Ref(profiler.get_or_alloc_cached_string(module_name)),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Ref(profiler.get_or_alloc_cached_string(stage)),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Value(&ir),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Value(&metadata),
+    ];
+    let event_kind = profiler.get_or_alloc_cached_string("LLVM Memory Usage");
+    let event_id = EventId::from_label(profiler.alloc_string(&components[..]));
+    profiler.record_instant_event(event_kind, event_id);
+}
+
+/// Records an "LLVM ThinLTO Memory Usage" event carrying the estimated number
+/// of bytes taken up by the combined index and by the import and export lists
+/// of `data`, and the size of the ThinLTO buffers it was built from.
+pub fn record_thin_lto_memory_usage(
+    profiler: &SelfProfiler,
+    data: &llvm::ThinLTOData,
+    buffer_bytes: usize,
+) {
+    let (mut index, mut lists) = (0, 0);
+    unsafe { llvm::LLVMRustThinLTOGetMemoryUsage(data, &mut index, &mut lists) };
+    let index = index.to_string();
+    let lists = lists.to_string();
+    let buffer_bytes = buffer_bytes.to_string();
+    let components = [
+        StringComponent::Value(&index),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Value(&lists),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Value(&buffer_bytes),
+    ];
+    let event_kind = profiler.get_or_alloc_cached_string("LLVM ThinLTO Memory Usage");
+    let event_id = EventId::from_label(profiler.alloc_string(&components[..]));
+    profiler.record_instant_event(event_kind, event_id);
+}
+
+/// Records an "LLVM ThinLTO Import Loads" event carrying the name of the module
+/// imported into, and how many of the modules it imported from were loaded with
+/// the bitcode layout found by the thin link and how many were scanned again.
+pub fn record_thin_lto_import_loads(
+    profiler: &SelfProfiler,
+    module_name: &str,
+    cached_loads: u64,
+    uncached_loads: u64,
+) {
+    let cached_loads = cached_loads.to_string();
+    let uncached_loads = uncached_loads.to_string();
+    let components = [
+        StringComponent::Ref(profiler.get_or_alloc_cached_string(module_name)),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Value(&cached_loads),
+        StringComponent::Value(SEPARATOR_BYTE),
+        StringComponent::Value(&uncached_loads),
+    ];
+    let event_kind = profiler.get_or_alloc_cached_string("LLVM ThinLTO Import Loads");
+    let event_id = EventId::from_label(profiler.alloc_string(&components[..]));
+    profiler.record_instant_event(event_kind, event_id);
 }
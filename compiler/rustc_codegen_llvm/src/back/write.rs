@@ -1,6 +1,8 @@
 use crate::back::lto::ThinBuffer;
 use crate::back::profiling::{
-    selfprofile_after_pass_callback, selfprofile_before_pass_callback, LlvmSelfProfiler,
+    record_function_sizes, record_module_memory_usage, selfprofile_after_pass_callback,
+    selfprofile_before_pass_callback, selfprofile_pass_summary_callback,
+    selfprofile_slow_pass_callback, LlvmSelfProfiler,
 };
 use crate::base;
 use crate::common;
@@ -12,17 +14,19 @@
 use crate::ModuleLlvm;
 use rustc_codegen_ssa::back::link::ensure_removed;
 use rustc_codegen_ssa::back::write::{
-    BitcodeSection, CodegenContext, EmitObj, ModuleConfig, TargetMachineFactoryConfig,
+    BitcodeSection, CodegenContext, EmitObj, ExtraTokens, ModuleConfig, TargetMachineFactoryConfig,
     TargetMachineFactoryFn,
 };
 use rustc_codegen_ssa::traits::*;
 use rustc_codegen_ssa::{CompiledModule, ModuleCodegen};
 use rustc_data_structures::small_c_str::SmallCStr;
-use rustc_errors::{FatalError, Handler, Level};
+use rustc_errors::{ErrorReported, FatalError, Handler, Level};
 use rustc_fs_util::{link_or_copy, path_to_c_string};
 use rustc_middle::bug;
 use rustc_middle::ty::TyCtxt;
-use rustc_session::config::{self, Lto, OutputType, Passes, SwitchWithOptPath};
+use rustc_serialize::json;
+use rustc_session::config::{self, BasicBlockSections, DebugInfoCompression, Lto, OutputType};
+use rustc_session::config::{InstructionSelector, MachineOutliner, Passes, SwitchWithOptPath};
 use rustc_session::Session;
 use rustc_span::symbol::sym;
 use rustc_span::InnerSpan;
@@ -36,7 +40,7 @@
 use std::path::{Path, PathBuf};
 use std::slice;
 use std::str;
-use std::sync::Arc;
+use std::sync::{Arc, Mutex};
 
 pub fn llvm_err(handler: &rustc_errors::Handler, msg: &str) -> FatalError {
     match llvm::last_error() {
@@ -53,6 +57,7 @@ pub fn write_output_file(
     output: &Path,
     dwo_output: Option<&Path>,
     file_type: llvm::FileType,
+    release_function_bodies: bool,
 ) -> Result<(), FatalError> {
     unsafe {
         let output_c = path_to_c_string(output);
@@ -65,6 +70,7 @@ pub fn write_output_file(
                 output_c.as_ptr(),
                 dwo_output_c.as_ptr(),
                 file_type,
+                release_function_bodies,
             )
         } else {
             llvm::LLVMRustWriteOutputFile(
@@ -74,6 +80,7 @@ pub fn write_output_file(
                 output_c.as_ptr(),
                 std::ptr::null(),
                 file_type,
+                release_function_bodies,
             )
         };
         result.into_result().map_err(|()| {
@@ -83,6 +90,42 @@ pub fn write_output_file(
     }
 }
 
+/// Like `write_output_file` for an object file, but also writes the assembly
+/// listing to `asm_output` without running codegen a second time.
+pub fn write_object_and_assembly_files(
+    handler: &rustc_errors::Handler,
+    target: &'ll llvm::TargetMachine,
+    pm: &llvm::PassManager<'ll>,
+    m: &'ll llvm::Module,
+    output: &Path,
+    dwo_output: Option<&Path>,
+    asm_output: &Path,
+    release_function_bodies: bool,
+) -> Result<(), FatalError> {
+    unsafe {
+        let output_c = path_to_c_string(output);
+        let dwo_output_c = dwo_output.map(path_to_c_string);
+        let asm_output_c = path_to_c_string(asm_output);
+        let result = llvm::LLVMRustWriteObjectAndAssemblyFiles(
+            target,
+            pm,
+            m,
+            output_c.as_ptr(),
+            dwo_output_c.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
+            asm_output_c.as_ptr(),
+            release_function_bodies,
+        );
+        result.into_result().map_err(|()| {
+            let msg = format!(
+                "could not write output to {} and {}",
+                output.display(),
+                asm_output.display()
+            );
+            llvm_err(handler, &msg)
+        })
+    }
+}
+
 pub fn create_informational_target_machine(sess: &Session) -> &'static mut llvm::TargetMachine {
     let config = TargetMachineFactoryConfig { split_dwarf_file: None };
     target_machine_factory(sess, config::OptLevel::No)(config)
@@ -188,6 +231,46 @@ pub fn target_machine_factory(
     let use_init_array =
         !sess.opts.debugging_opts.use_ctors_section.unwrap_or(sess.target.use_ctors_section);
 
+    // Machine function splitting is driven by the profile, so it's only
+    // worth turning on with one.
+    let split_machine_functions = sess.opts.debugging_opts.split_machine_functions
+        && (sess.opts.cg.profile_use.is_some()
+            || sess.opts.debugging_opts.profile_sample_use.is_some());
+
+    let (bb_sections, bb_sections_list) = match sess.opts.debugging_opts.basic_block_sections {
+        BasicBlockSections::None => (llvm::BasicBlockSections::None, None),
+        BasicBlockSections::All => (llvm::BasicBlockSections::All, None),
+        BasicBlockSections::Labels => (llvm::BasicBlockSections::Labels, None),
+        BasicBlockSections::List(ref path) => {
+            let path = CString::new(path.to_string_lossy().as_bytes()).unwrap();
+            (llvm::BasicBlockSections::List, Some(path))
+        }
+    };
+
+    let debug_compression = match sess.opts.debugging_opts.debuginfo_compression {
+        DebugInfoCompression::None => llvm::DebugCompression::None,
+        DebugInfoCompression::Zlib => llvm::DebugCompression::Zlib,
+    };
+
+    // GlobalISel only tells about falling back if asked to. Falling back rather than aborting is
+    // also what it does by default where the target picks it, so an explicit choice of it
+    // doesn't abort on the first function some part of it doesn't support yet.
+    let isel_abort = if sess.opts.debugging_opts.isel_abort_on_fallback {
+        llvm::ISelAbort::Abort
+    } else if sess.opts.debugging_opts.isel_stats {
+        llvm::ISelAbort::FallbackWithDiag
+    } else if sess.opts.debugging_opts.instruction_selector == InstructionSelector::GlobalISel {
+        llvm::ISelAbort::Fallback
+    } else {
+        llvm::ISelAbort::Default
+    };
+
+    let machine_outliner = match sess.opts.debugging_opts.machine_outliner {
+        MachineOutliner::Never => llvm::MachineOutliner::Never,
+        MachineOutliner::TargetDefault => llvm::MachineOutliner::TargetDefault,
+        MachineOutliner::Always => llvm::MachineOutliner::Always,
+    };
+
     Arc::new(move |config: TargetMachineFactoryConfig| {
         let split_dwarf_file = config.split_dwarf_file.unwrap_or_default();
         let split_dwarf_file = CString::new(split_dwarf_file.to_str().unwrap()).unwrap();
@@ -210,12 +293,24 @@ pub fn target_machine_factory(
                 emit_stack_size_section,
                 relax_elf_relocations,
                 use_init_array,
+                split_machine_functions,
+                bb_sections,
+                bb_sections_list.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
+                debug_compression,
+                machine_outliner,
+                isel_abort,
                 split_dwarf_file.as_ptr(),
             )
         };
 
         tm.ok_or_else(|| {
-            format!("Could not create LLVM TargetMachine for triple: {}", triple.to_str().unwrap())
+            let triple = triple.to_str().unwrap();
+            match llvm::last_error() {
+                Some(err) => {
+                    format!("Could not create LLVM TargetMachine for triple: {}: {}", triple, err)
+                }
+                None => format!("Could not create LLVM TargetMachine for triple: {}", triple),
+            }
         })
     })
 }
@@ -238,9 +333,35 @@ pub(crate) fn save_temp_bitcode(
     }
 }
 
+/// The step of the LLVM pipeline a set of diagnostic handlers is installed
+/// for, used to keep the remark files of the different steps apart.
+#[derive(Copy, Clone)]
+pub enum CodegenDiagnosticsStage {
+    /// Per-module optimization.
+    Optimize,
+    /// Linking all modules into one for fat LTO.
+    LtoLink,
+    /// LTO optimization, fat or thin.
+    Lto,
+    /// Machine code generation.
+    Codegen,
+}
+
+impl CodegenDiagnosticsStage {
+    fn as_str(self) -> &'static str {
+        match self {
+            CodegenDiagnosticsStage::Optimize => "optimize",
+            CodegenDiagnosticsStage::LtoLink => "lto-link",
+            CodegenDiagnosticsStage::Lto => "lto",
+            CodegenDiagnosticsStage::Codegen => "codegen",
+        }
+    }
+}
+
 pub struct DiagnosticHandlers<'a> {
     data: *mut (&'a CodegenContext<LlvmCodegenBackend>, &'a Handler),
     llcx: &'a llvm::Context,
+    remark_file: Option<&'a mut llvm::RemarkFile>,
 }
 
 impl<'a> DiagnosticHandlers<'a> {
@@ -248,13 +369,34 @@ pub fn new(
         cgcx: &'a CodegenContext<LlvmCodegenBackend>,
         handler: &'a Handler,
         llcx: &'a llvm::Context,
+        module_name: &str,
+        stage: CodegenDiagnosticsStage,
     ) -> Self {
+        // Remarks written to `-Z remark-dir` go through LLVM's remark
+        // streamer, so none of them need to be delivered to us.
+        let (remark_all_passes, remark_passes) = match cgcx.remark {
+            _ if cgcx.opts.debugging_opts.remark_dir.is_some() => (false, Vec::new()),
+            Passes::All => (true, Vec::new()),
+            Passes::Some(ref passes) => {
+                (false, passes.iter().map(|pass| SmallCStr::new(pass)).collect())
+            }
+        };
+        let remark_passes: Vec<*const c_char> =
+            remark_passes.iter().map(|pass| pass.as_ptr()).collect();
         let data = Box::into_raw(Box::new((cgcx, handler)));
         unsafe {
             llvm::LLVMRustSetInlineAsmDiagnosticHandler(llcx, inline_asm_handler, data.cast());
-            llvm::LLVMContextSetDiagnosticHandler(llcx, diagnostic_handler, data.cast());
+            llvm::LLVMRustContextConfigureDiagnosticHandler(
+                llcx,
+                diagnostic_handler,
+                data.cast(),
+                remark_all_passes,
+                remark_passes.as_ptr(),
+                remark_passes.len(),
+            );
         }
-        DiagnosticHandlers { data, llcx }
+        let remark_file = setup_remark_file(cgcx, handler, llcx, module_name, stage);
+        DiagnosticHandlers { data, llcx, remark_file }
     }
 }
 
@@ -262,13 +404,68 @@ impl<'a> Drop for DiagnosticHandlers<'a> {
     fn drop(&mut self) {
         use std::ptr::null_mut;
         unsafe {
+            if let Some(remark_file) = self.remark_file.take() {
+                llvm::LLVMRustFinishOptimizationRemarks(self.llcx, remark_file);
+            }
             llvm::LLVMRustSetInlineAsmDiagnosticHandler(self.llcx, inline_asm_handler, null_mut());
-            llvm::LLVMContextSetDiagnosticHandler(self.llcx, diagnostic_handler, null_mut());
+            llvm::LLVMRustContextConfigureDiagnosticHandler(
+                self.llcx,
+                diagnostic_handler,
+                null_mut(),
+                false,
+                std::ptr::null(),
+                0,
+            );
             drop(Box::from_raw(self.data));
         }
     }
 }
 
+/// With `-Z remark-dir`, has LLVM serialize the remarks selected by
+/// `-C remark` into `<dir>/<module>.<stage>.opt.<format>` rather than handing
+/// each of them to `diagnostic_handler`.
+fn setup_remark_file<'a>(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    handler: &Handler,
+    llcx: &'a llvm::Context,
+    module_name: &str,
+    stage: CodegenDiagnosticsStage,
+) -> Option<&'a mut llvm::RemarkFile> {
+    let opts = &cgcx.opts.debugging_opts;
+    let dir = opts.remark_dir.as_ref()?;
+    // LLVM treats an empty pass filter as "all passes".
+    let passes = match cgcx.remark {
+        Passes::All => String::new(),
+        Passes::Some(ref v) if v.is_empty() => return None,
+        Passes::Some(ref v) => format!("^({})$", v.join("|")),
+    };
+    if let Err(err) = fs::create_dir_all(dir) {
+        handler.err(&format!("failed to create remark directory {}: {}", dir.display(), err));
+        return None;
+    }
+
+    let path = dir.join(format!("{}.{}.opt.{}", module_name, stage.as_str(), opts.remark_format));
+    let path = path_to_c_string(&path);
+    let passes = CString::new(passes).unwrap();
+    let format = CString::new(&opts.remark_format[..]).unwrap();
+    let threshold = opts.remark_hotness_threshold;
+    let remark_file = unsafe {
+        llvm::LLVMRustSetupOptimizationRemarks(
+            llcx,
+            path.as_ptr(),
+            passes.as_ptr(),
+            format.as_ptr(),
+            threshold.is_some(),
+            threshold.unwrap_or(0),
+        )
+    };
+    if remark_file.is_none() {
+        let err = llvm::last_error().unwrap_or_else(|| "unknown error".to_string());
+        handler.err(&format!("failed to open remark file: {}", err));
+    }
+    remark_file
+}
+
 fn report_inline_asm(
     cgcx: &CodegenContext<LlvmCodegenBackend>,
     msg: String,
@@ -337,6 +534,15 @@ fn report_inline_asm(
     }
     let (cgcx, diag_handler) = *(user as *const (&CodegenContext<LlvmCodegenBackend>, &Handler));
 
+    // The C++ handler already drops the remarks of passes not named by
+    // `-C remark`, but optimization failures always get through; don't unpack
+    // those when nothing is going to print them.
+    if llvm::LLVMRustGetDiagInfoKind(info).is_optimization()
+        && (cgcx.remark.is_empty() || cgcx.opts.debugging_opts.remark_dir.is_some())
+    {
+        return;
+    }
+
     match llvm::diagnostic::Diagnostic::unpack(info) {
         llvm::diagnostic::InlineAsm(inline) => {
             report_inline_asm(
@@ -385,7 +591,15 @@ fn report_inline_asm(
 }
 
 fn get_pgo_gen_path(config: &ModuleConfig) -> Option<CString> {
-    match config.pgo_gen {
+    profraw_path(&config.pgo_gen)
+}
+
+fn get_pgo_cs_gen_path(config: &ModuleConfig) -> Option<CString> {
+    profraw_path(&config.pgo_cs_gen)
+}
+
+fn profraw_path(switch: &SwitchWithOptPath) -> Option<CString> {
+    match *switch {
         SwitchWithOptPath::Enabled(ref opt_dir_path) => {
             let path = if let Some(dir_path) = opt_dir_path {
                 dir_path.join("default_%m.profraw")
@@ -406,11 +620,303 @@ fn get_pgo_use_path(config: &ModuleConfig) -> Option<CString> {
         .map(|path_buf| CString::new(path_buf.to_string_lossy().as_bytes()).unwrap())
 }
 
+/// Whether the `-C profile-use` profile at `pgo_use_path` has context-sensitive
+/// counts, in which case those are used as well. The profile is only read for
+/// this once per session rather than for every module.
+fn pgo_use_cs_profile(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    pgo_use_path: Option<&CString>,
+) -> bool {
+    let path = match pgo_use_path {
+        Some(path) => path,
+        None => return false,
+    };
+    *cgcx
+        .backend
+        .pgo_use_cs_profile
+        .lock()
+        .unwrap()
+        .get_or_insert_with(|| unsafe { llvm::LLVMRustProfileHasCSIRLevel(path.as_ptr()) })
+}
+
+fn get_pgo_sample_use_path(config: &ModuleConfig) -> Option<CString> {
+    config
+        .pgo_sample_use
+        .as_ref()
+        .map(|path_buf| CString::new(path_buf.to_string_lossy().as_bytes()).unwrap())
+}
+
+fn get_pgo_remapping_path(config: &ModuleConfig) -> Option<CString> {
+    config
+        .pgo_remapping_file
+        .as_ref()
+        .map(|path_buf| CString::new(path_buf.to_string_lossy().as_bytes()).unwrap())
+}
+
+/// How the counters of `-Z instrument-coverage` should be updated, if this module is
+/// instrumented at all.
+fn instr_prof_options(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    config: &ModuleConfig,
+) -> Option<llvm::InstrProfOptions> {
+    if !config.instrument_coverage {
+        return None;
+    }
+    Some(llvm::InstrProfOptions {
+        atomic: cgcx.opts.debugging_opts.coverage_atomic_counters,
+        do_counter_promotion: cgcx.opts.debugging_opts.coverage_promote_counters,
+    })
+}
+
+/// Writes the functions of the `-C profile-use` profile to `path`, hottest
+/// first, for `-Z pgo-symbol-ordering-file`. The profile covers the whole
+/// program, so this doesn't depend on what was codegened in this session.
+pub(crate) fn write_pgo_symbol_ordering(sess: &Session, path: &Path) -> Result<(), ErrorReported> {
+    let profile = sess.opts.cg.profile_use.as_ref().expect("checked when parsing options");
+    let symbol_prefix = if sess.target.is_like_osx { "_" } else { "" };
+    let profile = path_to_c_string(profile);
+    let out = path_to_c_string(path);
+    let symbol_prefix = CString::new(symbol_prefix).unwrap();
+    let result = unsafe {
+        llvm::LLVMRustWritePGOSymbolOrdering(profile.as_ptr(), out.as_ptr(), symbol_prefix.as_ptr())
+    };
+    result.into_result().map_err(|()| {
+        let err = llvm::last_error().unwrap_or_else(|| "unknown error".to_string());
+        sess.err(&format!("failed to write symbol ordering file {}: {}", path.display(), err));
+        ErrorReported
+    })
+}
+
 pub(crate) fn should_use_new_llvm_pass_manager(config: &ModuleConfig) -> bool {
     // The new pass manager is disabled by default.
     config.new_llvm_pass_manager.unwrap_or(false)
 }
 
+/// Everything a new pass manager pipeline built by `LLVMRustCreateNewPMPipeline`
+/// depends on, other than the target, which is the same for a whole session.
+#[derive(PartialEq)]
+struct PassPipelineKey {
+    opt_level: config::OptLevel,
+    opt_stage: llvm::OptStage,
+    no_prepopulate_passes: bool,
+    verify_llvm_ir: bool,
+    using_thin_buffers: bool,
+    merge_functions: bool,
+    unroll_loops: bool,
+    vectorize_slp: bool,
+    vectorize_loop: bool,
+    no_builtins: bool,
+    emit_lifetime_markers: bool,
+    pgo_use_path: Option<CString>,
+    pgo_sample_use_path: Option<CString>,
+    pgo_remapping_path: Option<CString>,
+    self_profile: bool,
+    thin_lto_data: Option<*const llvm::ThinLTOData>,
+}
+
+/// A pipeline along with the target machine it was built against.
+struct PassPipeline {
+    key: PassPipelineKey,
+    raw: &'static mut llvm::NewPMPipeline,
+    tm: &'static mut llvm::TargetMachine,
+}
+
+// Only ever used by one thread at a time, see `PassPipelineCache`.
+unsafe impl Send for PassPipeline {}
+
+impl Drop for PassPipeline {
+    fn drop(&mut self) {
+        unsafe {
+            llvm::LLVMRustFreeNewPMPipeline(&mut *(self.raw as *mut _));
+            llvm::LLVMRustDisposeTargetMachine(&mut *(self.tm as *mut _));
+        }
+    }
+}
+
+/// The new pass manager pipelines built so far in this session that aren't
+/// currently running, for `-Z llvm-reuse-pass-pipelines`. A worker thread
+/// takes a pipeline out while optimizing a module with it and puts it back
+/// afterwards, so there are at most as many of each kind as there are modules
+/// being optimized at once.
+#[derive(Default)]
+pub struct PassPipelineCache {
+    idle: Mutex<Vec<PassPipeline>>,
+}
+
+impl PassPipelineCache {
+    fn take(&self, key: &PassPipelineKey) -> Option<PassPipeline> {
+        let mut idle = self.idle.lock().unwrap();
+        let i = idle.iter().position(|pipeline| pipeline.key == *key)?;
+        Some(idle.swap_remove(i))
+    }
+
+    fn put(&self, pipeline: PassPipeline) {
+        self.idle.lock().unwrap().push(pipeline);
+    }
+}
+
+/// Everything a codegen pipeline built by `LLVMRustCreateCodegenPipeline`
+/// depends on, other than the target.
+#[derive(PartialEq)]
+struct CodegenPipelineKey {
+    no_builtins: bool,
+    file_type: llvm::FileType,
+}
+
+/// A codegen pipeline along with the target machine it was built against.
+struct CodegenPipeline {
+    key: CodegenPipelineKey,
+    raw: &'static mut llvm::CodegenPipeline,
+    tm: &'static mut llvm::TargetMachine,
+}
+
+// Only ever used by one thread at a time, see `CodegenPipelineCache`.
+unsafe impl Send for CodegenPipeline {}
+
+impl Drop for CodegenPipeline {
+    fn drop(&mut self) {
+        unsafe {
+            llvm::LLVMRustFreeCodegenPipeline(&mut *(self.raw as *mut _));
+            llvm::LLVMRustDisposeTargetMachine(&mut *(self.tm as *mut _));
+        }
+    }
+}
+
+/// The idle codegen pipelines of this session, for
+/// `-Z llvm-reuse-codegen-pipelines`. Works like `PassPipelineCache`.
+#[derive(Default)]
+pub struct CodegenPipelineCache {
+    idle: Mutex<Vec<CodegenPipeline>>,
+}
+
+impl CodegenPipelineCache {
+    fn take(&self, key: &CodegenPipelineKey) -> Option<CodegenPipeline> {
+        let mut idle = self.idle.lock().unwrap();
+        let i = idle.iter().position(|pipeline| pipeline.key == *key)?;
+        Some(idle.swap_remove(i))
+    }
+
+    fn put(&self, pipeline: CodegenPipeline) {
+        self.idle.lock().unwrap().push(pipeline);
+    }
+}
+
+/// Emits `llmod` to `output` with a reused codegen pipeline. Returns `None` if
+/// the pipeline can't be used for this module, in which case the caller should
+/// fall back to `write_output_file`.
+unsafe fn write_output_file_with_cached_pipeline(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    handler: &rustc_errors::Handler,
+    llmod: &llvm::Module,
+    no_builtins: bool,
+    output: &Path,
+    file_type: llvm::FileType,
+) -> Option<Result<(), FatalError>> {
+    // The DWARF of a module refers to its split DWARF file through the target
+    // machine, so those target machines can't be shared.
+    if !cgcx.opts.debugging_opts.llvm_reuse_codegen_pipelines
+        || (cgcx.target_can_use_split_dwarf && cgcx.split_debuginfo != SplitDebuginfo::Off)
+    {
+        return None;
+    }
+
+    let key = CodegenPipelineKey { no_builtins, file_type };
+    let cache = &cgcx.backend.codegen_pipelines;
+    let mut pipeline = match cache.take(&key) {
+        Some(pipeline) => pipeline,
+        None => {
+            let tm =
+                (cgcx.tm_factory)(TargetMachineFactoryConfig { split_dwarf_file: None }).ok()?;
+            let release_function_bodies = cgcx.opts.debugging_opts.llvm_release_function_bodies;
+            match llvm::LLVMRustCreateCodegenPipeline(
+                tm,
+                no_builtins,
+                file_type,
+                release_function_bodies,
+            ) {
+                Some(raw) => CodegenPipeline { key, raw, tm },
+                None => {
+                    llvm::LLVMRustDisposeTargetMachine(tm);
+                    return None;
+                }
+            }
+        }
+    };
+
+    let output_c = path_to_c_string(output);
+    let result = llvm::LLVMRustRunCodegenPipeline(pipeline.raw, llmod, output_c.as_ptr());
+    cache.put(pipeline);
+    Some(result.into_result().map_err(|()| {
+        let msg = format!("could not write output to {}", output.display());
+        llvm_err(handler, &msg)
+    }))
+}
+
+fn pass_sampling_options(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+) -> Option<llvm::PassSamplingOptions> {
+    let opts = &cgcx.opts.debugging_opts;
+    if opts.self_profile_llvm_sample_every.is_none()
+        && opts.self_profile_llvm_min_duration.is_none()
+    {
+        return None;
+    }
+    Some(llvm::PassSamplingOptions {
+        sample_every: opts.self_profile_llvm_sample_every.unwrap_or(0),
+        min_duration_nanos: opts.self_profile_llvm_min_duration.map_or(0, |us| us * 1000),
+        slow_pass_callback: selfprofile_slow_pass_callback,
+        summary_callback: selfprofile_pass_summary_callback,
+    })
+}
+
+/// Returns an idle pipeline for `key`, building one if there isn't any. Returns
+/// `None` if that fails, in which case the caller should fall back to
+/// `LLVMRustOptimizeWithNewPassManager`, which reports the error properly.
+unsafe fn take_pass_pipeline(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    key: PassPipelineKey,
+    opt_level: config::OptLevel,
+) -> Option<PassPipeline> {
+    let cache = &cgcx.backend.pass_pipelines;
+    if let Some(pipeline) = cache.take(&key) {
+        return Some(pipeline);
+    }
+
+    // The pipeline only needs the target machine for the target's cost
+    // model, so one without any per-module configuration will do.
+    let tm = (cgcx.tm_factory)(TargetMachineFactoryConfig { split_dwarf_file: None }).ok()?;
+    let raw = llvm::LLVMRustCreateNewPMPipeline(
+        tm,
+        to_pass_builder_opt_level(opt_level),
+        key.opt_stage,
+        key.no_prepopulate_passes,
+        key.verify_llvm_ir,
+        key.using_thin_buffers,
+        key.merge_functions,
+        key.unroll_loops,
+        key.vectorize_slp,
+        key.vectorize_loop,
+        key.no_builtins,
+        key.emit_lifetime_markers,
+        key.pgo_use_path.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
+        pgo_use_cs_profile(cgcx, key.pgo_use_path.as_ref()),
+        key.pgo_sample_use_path.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
+        key.pgo_remapping_path.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
+        key.self_profile,
+        selfprofile_before_pass_callback,
+        selfprofile_after_pass_callback,
+        pass_sampling_options(cgcx).as_ref(),
+        key.thin_lto_data.map(|data| &*data),
+    );
+    match raw {
+        Some(raw) => Some(PassPipeline { key, raw, tm }),
+        None => {
+            llvm::LLVMRustDisposeTargetMachine(tm);
+            None
+        }
+    }
+}
+
 pub(crate) unsafe fn optimize_with_new_llvm_pass_manager(
     cgcx: &CodegenContext<LlvmCodegenBackend>,
     diag_handler: &Handler,
@@ -418,12 +924,63 @@ pub(crate) unsafe fn optimize_with_new_llvm_pass_manager(
     config: &ModuleConfig,
     opt_level: config::OptLevel,
     opt_stage: llvm::OptStage,
+    thin_lto_data: Option<&llvm::ThinLTOData>,
+) -> Result<(), FatalError> {
+    profile_optimization_stage(cgcx, module, opt_stage, || {
+        run_new_llvm_pass_manager(
+            cgcx,
+            diag_handler,
+            module,
+            config,
+            opt_level,
+            opt_stage,
+            thin_lto_data,
+        )
+    })
+}
+
+/// Runs one optimization stage of `module` through `run_passes`, with either pass manager.
+/// Per-function sizes are recorded before and after the stage, so that the functions that grow
+/// the most can be matched with the passes they slow down. The memory taken up by the module is
+/// only recorded after the stage, as estimating it walks all of the module's metadata.
+pub(crate) unsafe fn profile_optimization_stage(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    module: &ModuleCodegen<ModuleLlvm>,
+    opt_stage: llvm::OptStage,
+    run_passes: impl FnOnce() -> Result<(), FatalError>,
+) -> Result<(), FatalError> {
+    let profiler =
+        if cgcx.prof.llvm_recording_enabled() { cgcx.prof.get_self_profiler() } else { None };
+    let llmod = module.module_llvm.llmod();
+    if let Some(profiler) = &profiler {
+        record_function_sizes(profiler, llmod, &module.name, &format!("{:?} before", opt_stage));
+    }
+    run_passes()?;
+    if let Some(profiler) = &profiler {
+        let stage = format!("{:?} after", opt_stage);
+        record_function_sizes(profiler, llmod, &module.name, &stage);
+        record_module_memory_usage(profiler, llmod, &module.name, &stage);
+    }
+    Ok(())
+}
+
+unsafe fn run_new_llvm_pass_manager(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    diag_handler: &Handler,
+    module: &ModuleCodegen<ModuleLlvm>,
+    config: &ModuleConfig,
+    opt_level: config::OptLevel,
+    opt_stage: llvm::OptStage,
+    thin_lto_data: Option<&llvm::ThinLTOData>,
 ) -> Result<(), FatalError> {
     let unroll_loops =
         opt_level != config::OptLevel::Size && opt_level != config::OptLevel::SizeMin;
     let using_thin_buffers = opt_stage == llvm::OptStage::PreLinkThinLTO || config.bitcode_needed();
     let pgo_gen_path = get_pgo_gen_path(config);
     let pgo_use_path = get_pgo_use_path(config);
+    let pgo_cs_gen_path = get_pgo_cs_gen_path(config);
+    let pgo_sample_use_path = get_pgo_sample_use_path(config);
+    let pgo_remapping_path = get_pgo_remapping_path(config);
     let is_lto = opt_stage == llvm::OptStage::ThinLTO || opt_stage == llvm::OptStage::FatLTO;
     // Sanitizer instrumentation is only inserted during the pre-link optimization stage.
     let sanitizer_options = if !is_lto {
@@ -440,45 +997,188 @@ pub(crate) unsafe fn optimize_with_new_llvm_pass_manager(
     } else {
         None
     };
+    let instr_prof_options = instr_prof_options(cgcx, config);
 
-    let llvm_selfprofiler = if cgcx.prof.llvm_recording_enabled() {
-        let mut llvm_profiler = LlvmSelfProfiler::new(cgcx.prof.get_self_profiler().unwrap());
-        &mut llvm_profiler as *mut _ as *mut c_void
+    let mut llvm_profiler = if cgcx.prof.llvm_recording_enabled() {
+        Some(LlvmSelfProfiler::new(cgcx.prof.get_self_profiler().unwrap()))
     } else {
-        std::ptr::null_mut()
+        None
+    };
+    let llvm_selfprofiler =
+        llvm_profiler.as_mut().map_or(std::ptr::null_mut(), |s| s as *mut _ as *mut c_void);
+    let sampling_options = pass_sampling_options(cgcx);
+
+    let debugging_opts = &cgcx.opts.debugging_opts;
+    let millis_to_nanos = |ms: Option<u64>| ms.map_or(0, |ms| ms * 1_000_000);
+    let mut budget = if debugging_opts.llvm_function_time_budget.is_some()
+        || debugging_opts.llvm_module_time_budget.is_some()
+    {
+        Some(llvm::OptimizationBudget {
+            function_budget_nanos: millis_to_nanos(debugging_opts.llvm_function_time_budget),
+            module_budget_nanos: millis_to_nanos(debugging_opts.llvm_module_time_budget),
+            skipped_passes: 0,
+        })
+    } else {
+        None
     };
 
     let extra_passes = config.passes.join(",");
 
+    // Give the serial pipeline below a head start on big modules by
+    // simplifying their functions on several threads first. Profiling and
+    // coverage instrumentation need to see the whole module at once.
+    if let Some(min_instructions) = cgcx.opts.debugging_opts.llvm_parallel_function_simplification {
+        if !cgcx.opts.debugging_opts.no_parallel_llvm
+            && opt_level != config::OptLevel::No
+            && !config.no_prepopulate_passes
+            && pgo_gen_path.is_none()
+            && pgo_use_path.is_none()
+            && pgo_sample_use_path.is_none()
+            && !config.instrument_coverage
+            && !config.instrument_gcov
+        {
+            let _timer = cgcx
+                .prof
+                .generic_activity_with_arg("LLVM_module_parallel_simplify", &module.name[..]);
+            // Other codegen units are being optimized at the same time, so
+            // every thread beyond this one needs a jobserver token.
+            let mut tokens = ExtraTokens::request(cgcx, num_cpus::get().saturating_sub(1));
+            llvm::LLVMRustSimplifyFunctionsInParallel(
+                module.module_llvm.llmod(),
+                &*module.module_llvm.tm,
+                to_pass_builder_opt_level(opt_level),
+                config.no_builtins,
+                tokens.acquire() as u32,
+                min_instructions,
+            )
+            .into_result()
+            .map_err(|()| llvm_err(diag_handler, "failed to simplify functions in parallel"))?;
+            drop(tokens);
+        }
+    }
+
+    // Instrumentation passes keep state from one module to the next, and so
+    // may arbitrary extra passes, so only plain optimization pipelines are
+    // reused. Time budgets and pass timings are kept per run, too.
+    let time_passes = debugging_opts.time_llvm_passes_json;
+    let reuse_pipeline = cgcx.opts.debugging_opts.llvm_reuse_pass_pipelines
+        && budget.is_none()
+        && !time_passes
+        && (is_lto || config.sanitizer.is_empty())
+        && pgo_gen_path.is_none()
+        && pgo_cs_gen_path.is_none()
+        && !config.instrument_coverage
+        && !config.instrument_gcov
+        && extra_passes.is_empty();
+    if reuse_pipeline {
+        let key = PassPipelineKey {
+            opt_level,
+            opt_stage,
+            no_prepopulate_passes: config.no_prepopulate_passes,
+            verify_llvm_ir: config.verify_llvm_ir,
+            using_thin_buffers,
+            merge_functions: config.merge_functions,
+            unroll_loops,
+            vectorize_slp: config.vectorize_slp,
+            vectorize_loop: config.vectorize_loop,
+            no_builtins: config.no_builtins,
+            emit_lifetime_markers: config.emit_lifetime_markers,
+            pgo_use_path: pgo_use_path.clone(),
+            pgo_sample_use_path: pgo_sample_use_path.clone(),
+            pgo_remapping_path: pgo_remapping_path.clone(),
+            self_profile: !llvm_selfprofiler.is_null(),
+            thin_lto_data: thin_lto_data.map(|data| data as *const _),
+        };
+        if let Some(mut pipeline) = take_pass_pipeline(cgcx, key, opt_level) {
+            llvm::LLVMRustRunNewPMPipeline(
+                pipeline.raw,
+                module.module_llvm.llmod(),
+                llvm_selfprofiler,
+            );
+            cgcx.backend.pass_pipelines.put(pipeline);
+            return Ok(());
+        }
+    }
+
     // FIXME: NewPM doesn't provide a facility to pass custom InlineParams.
     // We would have to add upstream support for this first, before we can support
     // config.inline_threshold and our more aggressive default thresholds.
-    let result = llvm::LLVMRustOptimizeWithNewPassManager(
-        module.module_llvm.llmod(),
-        &*module.module_llvm.tm,
-        to_pass_builder_opt_level(opt_level),
-        opt_stage,
-        config.no_prepopulate_passes,
-        config.verify_llvm_ir,
-        using_thin_buffers,
-        config.merge_functions,
-        unroll_loops,
-        config.vectorize_slp,
-        config.vectorize_loop,
-        config.no_builtins,
-        config.emit_lifetime_markers,
-        sanitizer_options.as_ref(),
-        pgo_gen_path.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
-        pgo_use_path.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
-        config.instrument_coverage,
-        config.instrument_gcov,
-        llvm_selfprofiler,
-        selfprofile_before_pass_callback,
-        selfprofile_after_pass_callback,
-        extra_passes.as_ptr().cast(),
-        extra_passes.len(),
+    let mut result = llvm::LLVMRustResult::Failure;
+    let pass_timings = llvm::build_string(|pass_timings_out| {
+        result = llvm::LLVMRustOptimizeWithNewPassManager(
+            module.module_llvm.llmod(),
+            &*module.module_llvm.tm,
+            to_pass_builder_opt_level(opt_level),
+            opt_stage,
+            config.no_prepopulate_passes,
+            config.verify_llvm_ir,
+            using_thin_buffers,
+            config.merge_functions,
+            unroll_loops,
+            config.vectorize_slp,
+            config.vectorize_loop,
+            config.no_builtins,
+            config.emit_lifetime_markers,
+            sanitizer_options.as_ref(),
+            pgo_gen_path.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
+            pgo_use_path.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
+            pgo_use_cs_profile(cgcx, pgo_use_path.as_ref()),
+            pgo_cs_gen_path.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
+            pgo_sample_use_path.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
+            pgo_remapping_path.as_ref().map_or(std::ptr::null(), |s| s.as_ptr()),
+            instr_prof_options.as_ref(),
+            config.instrument_gcov,
+            llvm_selfprofiler,
+            selfprofile_before_pass_callback,
+            selfprofile_after_pass_callback,
+            sampling_options.as_ref(),
+            budget.as_mut(),
+            time_passes.then(|| pass_timings_out),
+            extra_passes.as_ptr().cast(),
+            extra_passes.len(),
+            thin_lto_data,
+        );
+    });
+    result.into_result().map_err(|()| llvm_err(diag_handler, "failed to run LLVM passes"))?;
+    if time_passes {
+        let pass_timings = pass_timings.expect("non-UTF8 pass timings");
+        write_pass_timings(cgcx, diag_handler, module, opt_stage, &pass_timings);
+    }
+    if let Some(budget) = budget {
+        if budget.skipped_passes > 0 {
+            diag_handler.note_without_error(&format!(
+                "skipped {} optional LLVM passes in `{}` to stay within the time budget",
+                budget.skipped_passes, module.name
+            ));
+        }
+    }
+    Ok(())
+}
+
+/// Writes the pass timings of one run of the pipeline over `module`, for
+/// `-Z time-llvm-passes-json`, to `<crate>.<module>.<stage>.llvm-timings.json`
+/// next to the other temporary outputs. `passes` is the JSON array produced by
+/// `LLVMRustOptimizeWithNewPassManager`.
+fn write_pass_timings(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    diag_handler: &Handler,
+    module: &ModuleCodegen<ModuleLlvm>,
+    opt_stage: llvm::OptStage,
+    passes: &str,
+) {
+    let stage = format!("{:?}", opt_stage);
+    let ext = format!("{}.llvm-timings.json", stage.to_lowercase());
+    let path = cgcx.output_filenames.temp_path_ext(&ext, Some(&module.name));
+    let json = format!(
+        "{{\"module\":{},\"stage\":\"{}\",\"worker\":{},\"passes\":{}}}\n",
+        json::as_json(&module.name),
+        stage,
+        cgcx.worker,
+        passes
     );
-    result.into_result().map_err(|()| llvm_err(diag_handler, "failed to run LLVM passes"))
+    if let Err(err) = fs::write(&path, json) {
+        diag_handler.err(&format!("failed to write {}: {}", path.display(), err));
+    }
 }
 
 // Unsafe due to LLVM calls.
@@ -493,7 +1193,13 @@ pub(crate) unsafe fn optimize(
     let llmod = module.module_llvm.llmod();
     let llcx = &*module.module_llvm.llcx;
     let tm = &*module.module_llvm.tm;
-    let _handlers = DiagnosticHandlers::new(cgcx, diag_handler, llcx);
+    let _handlers = DiagnosticHandlers::new(
+        cgcx,
+        diag_handler,
+        llcx,
+        &module.name,
+        CodegenDiagnosticsStage::Optimize,
+    );
 
     let module_name = module.name.clone();
     let module_name = Some(&module_name[..]);
@@ -505,13 +1211,13 @@ pub(crate) unsafe fn optimize(
     }
 
     if let Some(opt_level) = config.opt_level {
+        let opt_stage = match cgcx.lto {
+            Lto::Fat => llvm::OptStage::PreLinkFatLTO,
+            Lto::Thin | Lto::ThinLocal => llvm::OptStage::PreLinkThinLTO,
+            _ if cgcx.opts.cg.linker_plugin_lto.enabled() => llvm::OptStage::PreLinkThinLTO,
+            _ => llvm::OptStage::PreLinkNoLTO,
+        };
         if should_use_new_llvm_pass_manager(config) {
-            let opt_stage = match cgcx.lto {
-                Lto::Fat => llvm::OptStage::PreLinkFatLTO,
-                Lto::Thin | Lto::ThinLocal => llvm::OptStage::PreLinkThinLTO,
-                _ if cgcx.opts.cg.linker_plugin_lto.enabled() => llvm::OptStage::PreLinkThinLTO,
-                _ => llvm::OptStage::PreLinkNoLTO,
-            };
             return optimize_with_new_llvm_pass_manager(
                 cgcx,
                 diag_handler,
@@ -519,6 +1225,7 @@ pub(crate) unsafe fn optimize(
                 config,
                 opt_level,
                 opt_stage,
+                None,
             );
         }
 
@@ -574,8 +1281,8 @@ pub(crate) unsafe fn optimize(
             if config.instrument_gcov {
                 llvm::LLVMRustAddPass(mpm, find_pass("insert-gcov-profiling").unwrap());
             }
-            if config.instrument_coverage {
-                llvm::LLVMRustAddPass(mpm, find_pass("instrprof").unwrap());
+            if let Some(options) = instr_prof_options(cgcx, config) {
+                llvm::LLVMRustAddPass(mpm, llvm::LLVMRustCreateInstrProfilingPass(&options));
             }
 
             add_sanitizer_passes(config, &mut extra_passes);
@@ -591,7 +1298,7 @@ pub(crate) unsafe fn optimize(
                 let prepare_for_thin_lto = cgcx.lto == Lto::Thin
                     || cgcx.lto == Lto::ThinLocal
                     || (cgcx.lto != Lto::Fat && cgcx.opts.cg.linker_plugin_lto.enabled());
-                with_llvm_pmb(llmod, &config, opt_level, prepare_for_thin_lto, &mut |b| {
+                with_llvm_pmb(cgcx, llmod, &config, opt_level, prepare_for_thin_lto, &mut |b| {
                     llvm::LLVMRustAddLastExtensionPasses(
                         b,
                         extra_passes.as_ptr(),
@@ -635,20 +1342,23 @@ pub(crate) unsafe fn optimize(
         diag_handler.abort_if_errors();
 
         // Finally, run the actual optimization passes
-        {
-            let _timer = cgcx.prof.extra_verbose_generic_activity(
-                "LLVM_module_optimize_function_passes",
-                &module.name[..],
-            );
-            llvm::LLVMRustRunFunctionPassManager(fpm, llmod);
-        }
-        {
-            let _timer = cgcx.prof.extra_verbose_generic_activity(
-                "LLVM_module_optimize_module_passes",
-                &module.name[..],
-            );
-            llvm::LLVMRunPassManager(mpm, llmod);
-        }
+        profile_optimization_stage(cgcx, module, opt_stage, || {
+            {
+                let _timer = cgcx.prof.extra_verbose_generic_activity(
+                    "LLVM_module_optimize_function_passes",
+                    &module.name[..],
+                );
+                llvm::LLVMRustRunFunctionPassManager(fpm, llmod);
+            }
+            {
+                let _timer = cgcx.prof.extra_verbose_generic_activity(
+                    "LLVM_module_optimize_module_passes",
+                    &module.name[..],
+                );
+                llvm::LLVMRunPassManager(mpm, llmod);
+            }
+            Ok(())
+        })?;
 
         // Deallocate managers that we're now done with
         llvm::LLVMDisposePassManager(fpm);
@@ -702,6 +1412,130 @@ pub(crate) fn link(
     Ok(modules.remove(0))
 }
 
+/// Writes the frame sizes collected while emitting `llmod`, for
+/// `-Z stack-size-report`, to `<crate>.<module>.stack-sizes.json` next to the
+/// other temporary outputs.
+unsafe fn write_stack_sizes<'a>(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    diag_handler: &Handler,
+    module: &ModuleCodegen<ModuleLlvm>,
+    llmod: &'a llvm::Module,
+    collector: &'a mut llvm::StackSizeCollector,
+) {
+    unsafe extern "C" fn callback(
+        data: *mut c_void,
+        name: *const c_char,
+        name_len: size_t,
+        frame_size: u64,
+        dynamic_alloca: bool,
+    ) {
+        let functions = &mut *(data as *mut Vec<String>);
+        let name = slice::from_raw_parts(name as *const u8, name_len);
+        functions.push(format!(
+            "{{\"function\":{},\"frame_size\":{},\"dynamic_alloca\":{}}}",
+            json::as_json(&String::from_utf8_lossy(name).into_owned()),
+            frame_size,
+            dynamic_alloca
+        ));
+    }
+
+    let mut functions = Vec::<String>::new();
+    let collected = llvm::LLVMRustFinishCollectingStackSizes(
+        llmod,
+        collector,
+        callback,
+        &mut functions as *mut _ as *mut c_void,
+    );
+    if !collected {
+        diag_handler.err(&format!(
+            "failed to collect the stack sizes of `{}`: the diagnostic handler was replaced",
+            module.name
+        ));
+        return;
+    }
+
+    let path = cgcx.output_filenames.temp_path_ext("stack-sizes.json", Some(&module.name));
+    let json = format!(
+        "{{\"module\":{},\"functions\":[{}]}}\n",
+        json::as_json(&module.name),
+        functions.join(",")
+    );
+    if let Err(err) = fs::write(&path, json) {
+        diag_handler.err(&format!("failed to write {}: {}", path.display(), err));
+    }
+}
+
+/// Writes the instruction selection fallbacks counted while emitting `llmod`,
+/// for `-Z isel-stats`, to `<crate>.<module>.isel-stats.json` next to the
+/// other temporary outputs. Only the functions that had any are listed.
+unsafe fn write_isel_stats<'a>(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
+    diag_handler: &Handler,
+    module: &ModuleCodegen<ModuleLlvm>,
+    llmod: &'a llvm::Module,
+    collector: &'a mut llvm::ISelStatsCollector,
+) {
+    #[derive(Default)]
+    struct Stats {
+        functions: u64,
+        fast_isel_fallbacks: u64,
+        global_isel_fallbacks: u64,
+        fallbacks: Vec<String>,
+    }
+
+    unsafe extern "C" fn callback(
+        data: *mut c_void,
+        name: *const c_char,
+        name_len: size_t,
+        fast_isel_fallbacks: u64,
+        global_isel_fallback: bool,
+    ) {
+        let stats = &mut *(data as *mut Stats);
+        stats.functions += 1;
+        stats.fast_isel_fallbacks += fast_isel_fallbacks;
+        stats.global_isel_fallbacks += global_isel_fallback as u64;
+        if fast_isel_fallbacks != 0 || global_isel_fallback {
+            let name = slice::from_raw_parts(name as *const u8, name_len);
+            stats.fallbacks.push(format!(
+                "{{\"function\":{},\"fast_isel\":{},\"global_isel\":{}}}",
+                json::as_json(&String::from_utf8_lossy(name).into_owned()),
+                fast_isel_fallbacks,
+                global_isel_fallback
+            ));
+        }
+    }
+
+    let mut stats = Stats::default();
+    let collected = llvm::LLVMRustFinishCollectingISelStats(
+        llmod,
+        collector,
+        callback,
+        &mut stats as *mut _ as *mut c_void,
+    );
+    if !collected {
+        diag_handler.err(&format!(
+            "failed to collect the instruction selection stats of `{}`: \
+             the diagnostic handler was replaced",
+            module.name
+        ));
+        return;
+    }
+
+    let path = cgcx.output_filenames.temp_path_ext("isel-stats.json", Some(&module.name));
+    let json = format!(
+        "{{\"module\":{},\"functions\":{},\"fast_isel_fallbacks\":{},\
+         \"global_isel_fallbacks\":{},\"fallbacks\":[{}]}}\n",
+        json::as_json(&module.name),
+        stats.functions,
+        stats.fast_isel_fallbacks,
+        stats.global_isel_fallbacks,
+        stats.fallbacks.join(",")
+    );
+    if let Err(err) = fs::write(&path, json) {
+        diag_handler.err(&format!("failed to write {}: {}", path.display(), err));
+    }
+}
+
 pub(crate) unsafe fn codegen(
     cgcx: &CodegenContext<LlvmCodegenBackend>,
     diag_handler: &Handler,
@@ -715,12 +1549,22 @@ pub(crate) unsafe fn codegen(
         let tm = &*module.module_llvm.tm;
         let module_name = module.name.clone();
         let module_name = Some(&module_name[..]);
-        let handlers = DiagnosticHandlers::new(cgcx, diag_handler, llcx);
+        let handlers = DiagnosticHandlers::new(
+            cgcx,
+            diag_handler,
+            llcx,
+            &module.name,
+            CodegenDiagnosticsStage::Codegen,
+        );
 
         if cgcx.msvc_imps_needed {
             create_msvc_imps(cgcx, llcx, llmod);
         }
 
+        // Nothing looks at the IR of a function once it's been emitted, so it
+        // can go right away rather than when the module is dropped.
+        let release_function_bodies = cgcx.opts.debugging_opts.llvm_release_function_bodies;
+
         // A codegen-specific pass manager is used to generate object
         // files for an LLVM module.
         //
@@ -754,30 +1598,71 @@ unsafe fn with_codegen<'ll, F, R>(
         let bc_out = cgcx.output_filenames.temp_path(OutputType::Bitcode, module_name);
         let obj_out = cgcx.output_filenames.temp_path(OutputType::Object, module_name);
 
+        // A temporary file that's only needed until the object has been emitted.
+        let mut remove_after_emission = None;
+
         if config.bitcode_needed() {
             let _timer = cgcx
                 .prof
                 .generic_activity_with_arg("LLVM_module_codegen_make_bitcode", &module.name[..]);
-            let thin = ThinBuffer::new(llmod);
-            let data = thin.data();
+            let write_bc = config.emit_bc || config.emit_obj == EmitObj::Bitcode;
 
-            if config.emit_bc || config.emit_obj == EmitObj::Bitcode {
-                let _timer = cgcx.prof.generic_activity_with_arg(
-                    "LLVM_module_codegen_emit_bitcode",
-                    &module.name[..],
-                );
-                if let Err(e) = fs::write(&bc_out, data) {
-                    let msg = format!("failed to write bytecode to {}: {}", bc_out.display(), e);
-                    diag_handler.err(&msg);
+            if config.emit_obj == EmitObj::ObjectCode(BitcodeSection::Full) {
+                let thin = ThinBuffer::new(llmod);
+                let data = thin.data();
+
+                // The assembler can pull the bitcode into the object straight from
+                // the file when it's needed anyway, or from a temporary one. The
+                // emitted IR or assembly would refer to that file too, though, so
+                // they get the bitcode as a constant.
+                let incbin = !config.emit_ir && !config.emit_asm && embed_bitcode_with_incbin(cgcx);
+                let mut embed_from = None;
+                if write_bc || incbin {
+                    let _timer = cgcx.prof.generic_activity_with_arg(
+                        "LLVM_module_codegen_emit_bitcode",
+                        &module.name[..],
+                    );
+                    match fs::write(&bc_out, data) {
+                        Ok(()) => {
+                            if incbin {
+                                embed_from = Some(bc_out.as_path());
+                            }
+                        }
+                        Err(e) => {
+                            let msg =
+                                format!("failed to write bytecode to {}: {}", bc_out.display(), e);
+                            diag_handler.err(&msg);
+                        }
+                    }
+                }
+                if embed_from.is_some() && !write_bc && !cgcx.save_temps {
+                    remove_after_emission = Some(bc_out.clone());
                 }
-            }
 
-            if config.emit_obj == EmitObj::ObjectCode(BitcodeSection::Full) {
                 let _timer = cgcx.prof.generic_activity_with_arg(
                     "LLVM_module_codegen_embed_bitcode",
                     &module.name[..],
                 );
-                embed_bitcode(cgcx, llcx, llmod, &config.bc_cmdline, data);
+                embed_bitcode(cgcx, llcx, llmod, &config.bc_cmdline, data, embed_from);
+            } else if write_bc {
+                // Nothing else needs the serialized module, so stream it straight to
+                // disk instead of holding a second copy of it in memory.
+                let _timer = cgcx.prof.generic_activity_with_arg(
+                    "LLVM_module_codegen_emit_bitcode",
+                    &module.name[..],
+                );
+                let bc_out_c = path_to_c_string(&bc_out);
+                if llvm::LLVMRustThinLTOBufferWriteToFile(llmod, bc_out_c.as_ptr())
+                    .into_result()
+                    .is_err()
+                {
+                    let msg = format!(
+                        "failed to write bytecode to {}: {}",
+                        bc_out.display(),
+                        llvm::last_error().unwrap_or_default()
+                    );
+                    diag_handler.err(&msg);
+                }
             }
         }
 
@@ -827,7 +1712,17 @@ extern "C" fn demangle_callback(
             })?;
         }
 
-        if config.emit_asm {
+        // Lowering the module only once and disassembling the object is much
+        // cheaper than codegening a clone of it, at the price of a listing that
+        // lacks the non-code sections and most directives.
+        let asm_from_obj = config.emit_asm
+            && config.emit_asm_from_obj
+            && matches!(config.emit_obj, EmitObj::ObjectCode(_))
+            && llvm::LLVMRustTargetMachineHasDisassembler(tm);
+
+        let stack_size_report = cgcx.opts.debugging_opts.stack_size_report;
+
+        if config.emit_asm && !asm_from_obj {
             let _timer = cgcx
                 .prof
                 .generic_activity_with_arg("LLVM_module_codegen_emit_asm", &module.name[..]);
@@ -837,22 +1732,46 @@ extern "C" fn demangle_callback(
             // because that triggers various errors like invalid IR or broken
             // binaries. So we must clone the module to produce the asm output
             // if we are also producing object code.
-            let llmod = if let EmitObj::ObjectCode(_) = config.emit_obj {
-                llvm::LLVMCloneModule(llmod)
+            let (llmod, stack_sizes) = if let EmitObj::ObjectCode(_) = config.emit_obj {
+                (llvm::LLVMCloneModule(llmod), None)
             } else {
-                llmod
+                // Without object code, the listing is all the module is
+                // lowered to, so that's where the frame sizes come from.
+                let stack_sizes =
+                    stack_size_report.then(|| llvm::LLVMRustStartCollectingStackSizes(llmod));
+                (llmod, stack_sizes)
             };
-            with_codegen(tm, llmod, config.no_builtins, |cpm| {
-                write_output_file(
-                    diag_handler,
-                    tm,
-                    cpm,
-                    llmod,
-                    &path,
-                    None,
-                    llvm::FileType::AssemblyFile,
-                )
-            })?;
+            let result = if let Some(result) = write_output_file_with_cached_pipeline(
+                cgcx,
+                diag_handler,
+                llmod,
+                config.no_builtins,
+                &path,
+                llvm::FileType::AssemblyFile,
+            ) {
+                result
+            } else {
+                with_codegen(tm, llmod, config.no_builtins, |cpm| {
+                    write_output_file(
+                        diag_handler,
+                        tm,
+                        cpm,
+                        llmod,
+                        &path,
+                        None,
+                        llvm::FileType::AssemblyFile,
+                        release_function_bodies,
+                    )
+                })
+            };
+
+            // Even if emitting failed, the collector has to give the context
+            // its handler back (and, before LLVM 13, release the stack size
+            // warning option shared by all threads).
+            if let Some(collector) = stack_sizes {
+                write_stack_sizes(cgcx, diag_handler, &module, llmod, collector);
+            }
+            result?;
         }
 
         match config.emit_obj {
@@ -861,6 +1780,16 @@ extern "C" fn demangle_callback(
                     .prof
                     .generic_activity_with_arg("LLVM_module_codegen_emit_obj", &module.name[..]);
 
+                // Only the object code counts; an assembly listing emitted
+                // separately above was lowered from a clone of the module.
+                let stack_sizes =
+                    stack_size_report.then(|| llvm::LLVMRustStartCollectingStackSizes(llmod));
+                let isel_stats = cgcx
+                    .opts
+                    .debugging_opts
+                    .isel_stats
+                    .then(|| llvm::LLVMRustStartCollectingISelStats(llmod));
+
                 let dwo_out = cgcx.output_filenames.temp_path_dwo(module_name);
                 let dwo_out = match cgcx.split_debuginfo {
                     // Don't change how DWARF is emitted in single mode (or when disabled).
@@ -875,17 +1804,54 @@ extern "C" fn demangle_callback(
                     }
                 };
 
-                with_codegen(tm, llmod, config.no_builtins, |cpm| {
-                    write_output_file(
-                        diag_handler,
-                        tm,
-                        cpm,
-                        llmod,
-                        &obj_out,
-                        dwo_out,
-                        llvm::FileType::ObjectFile,
-                    )
-                })?;
+                let result = if asm_from_obj {
+                    let asm_out =
+                        cgcx.output_filenames.temp_path(OutputType::Assembly, module_name);
+                    with_codegen(tm, llmod, config.no_builtins, |cpm| {
+                        write_object_and_assembly_files(
+                            diag_handler,
+                            tm,
+                            cpm,
+                            llmod,
+                            &obj_out,
+                            dwo_out,
+                            &asm_out,
+                            release_function_bodies,
+                        )
+                    })
+                } else if let Some(result) = write_output_file_with_cached_pipeline(
+                    cgcx,
+                    diag_handler,
+                    llmod,
+                    config.no_builtins,
+                    &obj_out,
+                    llvm::FileType::ObjectFile,
+                ) {
+                    result
+                } else {
+                    with_codegen(tm, llmod, config.no_builtins, |cpm| {
+                        write_output_file(
+                            diag_handler,
+                            tm,
+                            cpm,
+                            llmod,
+                            &obj_out,
+                            dwo_out,
+                            llvm::FileType::ObjectFile,
+                            release_function_bodies,
+                        )
+                    })
+                };
+
+                // Finished whether or not emitting succeeded, in the reverse
+                // order of the collectors being set up.
+                if let Some(collector) = isel_stats {
+                    write_isel_stats(cgcx, diag_handler, &module, llmod, collector);
+                }
+                if let Some(collector) = stack_sizes {
+                    write_stack_sizes(cgcx, diag_handler, &module, llmod, collector);
+                }
+                result?;
             }
 
             EmitObj::Bitcode => {
@@ -903,6 +1869,19 @@ extern "C" fn demangle_callback(
             EmitObj::None => {}
         }
 
+        // Frame sizes only exist once a module is lowered to machine code.
+        let lowered = config.emit_asm || matches!(config.emit_obj, EmitObj::ObjectCode(_));
+        if stack_size_report && !lowered {
+            diag_handler.warn(
+                "`-Z stack-size-report` has no effect when no object code or assembly is \
+                 generated, e.g. with `-C linker-plugin-lto`",
+            );
+        }
+
+        if let Some(path) = remove_after_emission {
+            ensure_removed(diag_handler, &path);
+        }
+
         drop(handlers);
     }
 
@@ -914,6 +1893,16 @@ extern "C" fn demangle_callback(
     ))
 }
 
+/// Whether `embed_bitcode` should leave it to the assembler to read the
+/// bitcode from a file (`-Z embed-bitcode-incbin`). Wasm objects don't take
+/// sections from module-level assembly.
+fn embed_bitcode_with_incbin(cgcx: &CodegenContext<LlvmCodegenBackend>) -> bool {
+    let triple = cgcx.opts.target_triple.triple();
+    cgcx.opts.debugging_opts.embed_bitcode_incbin
+        && !triple.starts_with("wasm")
+        && !triple.starts_with("asmjs")
+}
+
 /// Embed the bitcode of an LLVM module in the LLVM module itself.
 ///
 /// This is done primarily for iOS where it appears to be standard to compile C
@@ -938,23 +1927,41 @@ unsafe fn embed_bitcode(
     llmod: &llvm::Module,
     cmdline: &str,
     bitcode: &[u8],
+    bitcode_file: Option<&Path>,
 ) {
-    let llconst = common::bytes_in_context(llcx, bitcode);
-    let llglobal = llvm::LLVMAddGlobal(
-        llmod,
-        common::val_ty(llconst),
-        "rustc.embedded.module\0".as_ptr().cast(),
-    );
-    llvm::LLVMSetInitializer(llglobal, llconst);
-
     let is_apple = cgcx.opts.target_triple.triple().contains("-ios")
         || cgcx.opts.target_triple.triple().contains("-darwin")
         || cgcx.opts.target_triple.triple().contains("-tvos");
 
-    let section = if is_apple { "__LLVM,__bitcode\0" } else { ".llvmbc\0" };
-    llvm::LLVMSetSection(llglobal, section.as_ptr().cast());
-    llvm::LLVMRustSetLinkage(llglobal, llvm::Linkage::PrivateLinkage);
-    llvm::LLVMSetGlobalConstant(llglobal, llvm::True);
+    if let Some(bitcode_file) = bitcode_file.and_then(|path| path.to_str()) {
+        // Have the assembler copy the bitcode into the section when the object
+        // is emitted, rather than turning it into a constant that stays alive
+        // in the context and that codegen has to walk again.
+        let path = bitcode_file.replace('\\', "\\\\").replace('"', "\\\"");
+        // The flags have to match the ones given to the section below.
+        let section = if is_apple {
+            "__LLVM,__bitcode"
+        } else if cgcx.is_pe_coff {
+            ".llvmbc,\"n\""
+        } else {
+            ".llvmbc,\"e\""
+        };
+        let asm = format!("\n.section {}\n.incbin \"{}\"\n", section, path);
+        llvm::LLVMRustAppendModuleInlineAsm(llmod, asm.as_ptr().cast(), asm.len());
+    } else {
+        let llconst = common::bytes_in_context(llcx, bitcode);
+        let llglobal = llvm::LLVMAddGlobal(
+            llmod,
+            common::val_ty(llconst),
+            "rustc.embedded.module\0".as_ptr().cast(),
+        );
+        llvm::LLVMSetInitializer(llglobal, llconst);
+
+        let section = if is_apple { "__LLVM,__bitcode\0" } else { ".llvmbc\0" };
+        llvm::LLVMSetSection(llglobal, section.as_ptr().cast());
+        llvm::LLVMRustSetLinkage(llglobal, llvm::Linkage::PrivateLinkage);
+        llvm::LLVMSetGlobalConstant(llglobal, llvm::True);
+    }
 
     let llconst = common::bytes_in_context(llcx, cmdline.as_bytes());
     let llglobal = llvm::LLVMAddGlobal(
@@ -1018,6 +2025,7 @@ unsafe fn embed_bitcode(
 }
 
 pub unsafe fn with_llvm_pmb(
+    cgcx: &CodegenContext<LlvmCodegenBackend>,
     llmod: &llvm::Module,
     config: &ModuleConfig,
     opt_level: llvm::CodeGenOptLevel,
@@ -1034,6 +2042,8 @@ pub unsafe fn with_llvm_pmb(
     let inline_threshold = config.inline_threshold;
     let pgo_gen_path = get_pgo_gen_path(config);
     let pgo_use_path = get_pgo_use_path(config);
+    let pgo_cs_gen_path = get_pgo_cs_gen_path(config);
+    let pgo_sample_use_path = get_pgo_sample_use_path(config);
 
     llvm::LLVMRustConfigurePassManagerBuilder(
         builder,
@@ -1044,6 +2054,9 @@ pub unsafe fn with_llvm_pmb(
         prepare_for_thin_lto,
         pgo_gen_path.as_ref().map_or(ptr::null(), |s| s.as_ptr()),
         pgo_use_path.as_ref().map_or(ptr::null(), |s| s.as_ptr()),
+        pgo_use_cs_profile(cgcx, pgo_use_path.as_ref()),
+        pgo_cs_gen_path.as_ref().map_or(ptr::null(), |s| s.as_ptr()),
+        pgo_sample_use_path.as_ref().map_or(ptr::null(), |s| s.as_ptr()),
     );
 
     llvm::LLVMPassManagerBuilderSetSizeLevel(builder, opt_size as u32);
@@ -36,7 +36,6 @@
 use rustc_target::spec::SanitizerSet;
 
 use std::ffi::CString;
-use std::time::Instant;
 
 pub fn write_compressed_metadata<'tcx>(
     tcx: TyCtxt<'tcx>,
@@ -106,20 +105,25 @@ pub fn iter_globals(llmod: &'ll llvm::Module) -> ValueIter<'ll> {
     unsafe { ValueIter { cur: llvm::LLVMGetFirstGlobal(llmod), step: llvm::LLVMGetNextGlobal } }
 }
 
+/// An estimate of how long LLVM will take to optimize and codegen `llmod`, used
+/// to start on the most expensive modules first. Only code that is actually
+/// defined in the module counts. Calls and loops weigh more than other
+/// instructions, as inlining and the loop passes multiply the code behind them.
+pub fn llvm_module_cost(llmod: &llvm::Module) -> u64 {
+    let mut info = llvm::ModuleCostInfo::default();
+    unsafe { llvm::LLVMRustGetModuleCostInfo(llmod, &mut info) };
+    info.instructions + 2 * info.basic_blocks + 4 * info.calls + 16 * info.loops
+}
+
 pub fn compile_codegen_unit(
     tcx: TyCtxt<'tcx>,
     cgu_name: Symbol,
 ) -> (ModuleCodegen<ModuleLlvm>, u64) {
-    let start_time = Instant::now();
-
     let dep_node = tcx.codegen_unit(cgu_name).codegen_dep_node(tcx);
     let (module, _) =
         tcx.dep_graph.with_task(dep_node, tcx, cgu_name, module_codegen, dep_graph::hash_result);
-    let time_to_codegen = start_time.elapsed();
 
-    // We assume that the cost to run LLVM on a CGU is proportional to
-    // the time we needed for codegenning it.
-    let cost = time_to_codegen.as_nanos() as u64;
+    let cost = llvm_module_cost(module.module_llvm.llmod());
 
     fn module_codegen(tcx: TyCtxt<'_>, cgu_name: Symbol) -> ModuleCodegen<ModuleLlvm> {
         let cgu = tcx.codegen_unit(cgu_name);
@@ -606,13 +606,7 @@ fn store_with_flags(
                 llvm::LLVMSetVolatile(store, llvm::True);
             }
             if flags.contains(MemFlags::NONTEMPORAL) {
-                // According to LLVM [1] building a nontemporal store must
-                // *always* point to a metadata value of the integer 1.
-                //
-                // [1]: https://llvm.org/docs/LangRef.html#store-instruction
-                let one = self.cx.const_i32(1);
-                let node = llvm::LLVMMDNodeInContext(self.cx.llcx, &one, 1);
-                llvm::LLVMSetMetadata(store, llvm::MD_nontemporal as c_uint, node);
+                llvm::LLVMRustSetNontemporal(store);
             }
             store
         }
@@ -1042,6 +1036,9 @@ fn atomic_rmw(
         src: &'ll Value,
         order: rustc_codegen_ssa::common::AtomicOrdering,
     ) -> &'ll Value {
+        if let Some(op) = llvm::AtomicRmwFloatOp::from_generic(op) {
+            return self.atomic_rmw_float(op, dst, src, order, SynchronizationScope::CrossThread);
+        }
         unsafe {
             llvm::LLVMBuildAtomicRMW(
                 self.llbuilder,
@@ -1201,17 +1198,19 @@ pub fn vector_reduce_fadd(&mut self, acc: &'ll Value, src: &'ll Value) -> &'ll V
     pub fn vector_reduce_fmul(&mut self, acc: &'ll Value, src: &'ll Value) -> &'ll Value {
         unsafe { llvm::LLVMRustBuildVectorReduceFMul(self.llbuilder, acc, src) }
     }
-    pub fn vector_reduce_fadd_fast(&mut self, acc: &'ll Value, src: &'ll Value) -> &'ll Value {
+    // Unordered reductions only need to be reassociable; the full `fast` set
+    // would also let LLVM assume there are no NaNs or infinities.
+    pub fn vector_reduce_fadd_reassoc(&mut self, acc: &'ll Value, src: &'ll Value) -> &'ll Value {
         unsafe {
             let instr = llvm::LLVMRustBuildVectorReduceFAdd(self.llbuilder, acc, src);
-            llvm::LLVMRustSetFastMath(instr);
+            llvm::LLVMRustSetFastMathFlags(instr, llvm::FastMathFlags::ALLOW_REASSOC);
             instr
         }
     }
-    pub fn vector_reduce_fmul_fast(&mut self, acc: &'ll Value, src: &'ll Value) -> &'ll Value {
+    pub fn vector_reduce_fmul_reassoc(&mut self, acc: &'ll Value, src: &'ll Value) -> &'ll Value {
         unsafe {
             let instr = llvm::LLVMRustBuildVectorReduceFMul(self.llbuilder, acc, src);
-            llvm::LLVMRustSetFastMath(instr);
+            llvm::LLVMRustSetFastMathFlags(instr, llvm::FastMathFlags::ALLOW_REASSOC);
             instr
         }
     }
@@ -1263,6 +1262,83 @@ pub fn vector_reduce_max(&mut self, src: &'ll Value, is_signed: bool) -> &'ll Va
         unsafe { llvm::LLVMRustBuildVectorReduceMax(self.llbuilder, src, is_signed) }
     }
 
+    pub fn prefetch(&mut self, ptr: &'ll Value, is_write: bool, locality: u32, is_data: bool) {
+        unsafe {
+            llvm::LLVMRustBuildPrefetch(self.llbuilder, ptr, is_write, locality, is_data);
+        }
+    }
+
+    pub fn atomic_rmw_float(
+        &mut self,
+        op: llvm::AtomicRmwFloatOp,
+        dst: &'ll Value,
+        src: &'ll Value,
+        order: rustc_codegen_ssa::common::AtomicOrdering,
+        scope: SynchronizationScope,
+    ) -> &'ll Value {
+        unsafe {
+            llvm::LLVMRustBuildAtomicRMWFloat(
+                self.llbuilder,
+                op,
+                dst,
+                src,
+                AtomicOrdering::from_generic(order),
+                scope,
+            )
+        }
+    }
+
+    pub fn masked_load(
+        &mut self,
+        ty: &'ll Type,
+        ptr: &'ll Value,
+        align: Align,
+        mask: &'ll Value,
+        passthru: Option<&'ll Value>,
+    ) -> &'ll Value {
+        unsafe {
+            let align = align.bytes() as c_uint;
+            llvm::LLVMRustBuildMaskedLoad(self.llbuilder, ty, ptr, align, mask, passthru)
+        }
+    }
+    pub fn masked_store(
+        &mut self,
+        val: &'ll Value,
+        ptr: &'ll Value,
+        align: Align,
+        mask: &'ll Value,
+    ) {
+        unsafe {
+            let align = align.bytes() as c_uint;
+            llvm::LLVMRustBuildMaskedStore(self.llbuilder, val, ptr, align, mask);
+        }
+    }
+    pub fn masked_gather(
+        &mut self,
+        ty: &'ll Type,
+        ptrs: &'ll Value,
+        align: Align,
+        mask: &'ll Value,
+        passthru: Option<&'ll Value>,
+    ) -> &'ll Value {
+        unsafe {
+            let align = align.bytes() as c_uint;
+            llvm::LLVMRustBuildMaskedGather(self.llbuilder, ty, ptrs, align, mask, passthru)
+        }
+    }
+    pub fn masked_scatter(
+        &mut self,
+        val: &'ll Value,
+        ptrs: &'ll Value,
+        align: Align,
+        mask: &'ll Value,
+    ) {
+        unsafe {
+            let align = align.bytes() as c_uint;
+            llvm::LLVMRustBuildMaskedScatter(self.llbuilder, val, ptrs, align, mask);
+        }
+    }
+
     pub fn add_clause(&mut self, landing_pad: &'ll Value, clause: &'ll Value) {
         unsafe {
             llvm::LLVMAddClause(landing_pad, clause);
@@ -2,7 +2,7 @@
 
 use crate::consts::{self, const_alloc_to_llvm};
 pub use crate::context::CodegenCx;
-use crate::llvm::{self, BasicBlock, Bool, ConstantInt, False, OperandBundleDef, True};
+use crate::llvm::{self, BasicBlock, Bool, ConstantInt, False, OperandBundles, True};
 use crate::type_::Type;
 use crate::type_of::LayoutLlvmExt;
 use crate::value::Value;
@@ -58,22 +58,22 @@
 /// exceptions (`cleanuppad` + `cleanupret` instructions) this contains data.
 /// When inside of a landing pad, each function call in LLVM IR needs to be
 /// annotated with which landing pad it's a part of. This is accomplished via
-/// the `OperandBundleDef` value created for MSVC landing pads.
+/// the `OperandBundles` value created for MSVC landing pads.
 pub struct Funclet<'ll> {
     cleanuppad: &'ll Value,
-    operand: OperandBundleDef<'ll>,
+    operand: OperandBundles<'ll>,
 }
 
 impl Funclet<'ll> {
     pub fn new(cleanuppad: &'ll Value) -> Self {
-        Funclet { cleanuppad, operand: OperandBundleDef::new("funclet", &[cleanuppad]) }
+        Funclet { cleanuppad, operand: OperandBundles::new(&[("funclet", &[cleanuppad])]) }
     }
 
     pub fn cleanuppad(&self) -> &'ll Value {
         self.cleanuppad
     }
 
-    pub fn bundle(&self) -> &OperandBundleDef<'ll> {
+    pub fn bundle(&self) -> &OperandBundles<'ll> {
         &self.operand
     }
 }
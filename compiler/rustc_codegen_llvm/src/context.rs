@@ -88,6 +88,9 @@ pub struct CodegenCx<'ll, 'tcx> {
 
     intrinsics: RefCell<FxHashMap<&'static str, &'ll Value>>,
 
+    /// Cache of the attribute lists given to functions and call sites
+    pub attribute_lists: llvm::AttributeListCache<'ll>,
+
     /// A counter that is used for generating local symbol names
     local_gen_sym_counter: Cell<usize>,
 }
@@ -187,6 +190,10 @@ pub unsafe fn create_module(
         llvm::LLVMRustAddModuleFlag(llmod, avoid_plt, 1);
     }
 
+    if let Some(direct) = sess.opts.debugging_opts.direct_access_external_data {
+        llvm::LLVMRustSetModuleDirectAccessExternalData(llmod, direct);
+    }
+
     // Control Flow Guard is currently only supported by the MSVC linker on Windows.
     if sess.target.is_like_msvc {
         match sess.opts.cg.control_flow_guard {
@@ -313,6 +320,7 @@ impl<'ll, 'tcx> CodegenCx<'ll, 'tcx> {
             eh_catch_typeinfo: Cell::new(None),
             rust_try_fn: Cell::new(None),
             intrinsics: Default::default(),
+            attribute_lists: Default::default(),
             local_gen_sym_counter: Cell::new(0),
         }
     }
@@ -711,7 +719,6 @@ macro_rules! mk_struct {
         ifn!("llvm.x86.seh.recoverfp", fn(i8p, i8p) -> i8p);
 
         ifn!("llvm.assume", fn(i1) -> void);
-        ifn!("llvm.prefetch", fn(i8p, t_i32, t_i32, t_i32) -> void);
 
         // This isn't an "LLVM intrinsic", but LLVM's optimization passes
         // recognize it like one and we assume it exists in `core::slice::cmp`
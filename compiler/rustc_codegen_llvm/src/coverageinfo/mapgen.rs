@@ -2,17 +2,14 @@
 use crate::coverageinfo;
 use crate::llvm;
 
-use llvm::coverageinfo::CounterMappingRegion;
+use llvm::coverageinfo::{CounterMappingRegion, FunctionMapping};
 use rustc_codegen_ssa::coverageinfo::map::{Counter, CounterExpression};
 use rustc_codegen_ssa::traits::{ConstMethods, CoverageInfoMethods};
 use rustc_data_structures::fx::{FxHashMap, FxHashSet, FxIndexSet};
 use rustc_hir::def_id::{DefId, DefIdSet};
-use rustc_llvm::RustString;
 use rustc_middle::mir::coverage::CodeRegion;
 use rustc_span::Symbol;
 
-use std::ffi::CString;
-
 use tracing::debug;
 
 /// Generates and exports the Coverage Map.
@@ -69,20 +66,28 @@ pub fn finalize<'ll, 'tcx>(cx: &CodegenCx<'ll, 'tcx>) {
         let (expressions, counter_regions) =
             function_coverage.get_expressions_and_counter_regions();
 
-        let coverage_mapping_buffer = llvm::build_byte_buffer(|coverage_mapping_buffer| {
-            mapgen.write_coverage_mapping(expressions, counter_regions, coverage_mapping_buffer);
-        });
-        debug_assert!(
-            coverage_mapping_buffer.len() > 0,
-            "Every `FunctionCoverage` should have at least one counter"
-        );
-
-        function_data.push((mangled_function_name, source_hash, is_used, coverage_mapping_buffer));
+        mapgen.add_coverage_mapping(expressions, counter_regions);
+        function_data.push((mangled_function_name, source_hash, is_used));
     }
 
+    // Encode the coverage mappings of all functions in one go
+    let mut offsets = Vec::new();
+    let coverage_mappings_buffer = {
+        let _timer = tcx.sess.prof.generic_activity_with_arg(
+            "LLVM_coverage_write_mappings",
+            &cx.codegen_unit.name().as_str()[..],
+        );
+        llvm::build_byte_buffer(|coverage_mappings_buffer| {
+            offsets = mapgen.write_coverage_mappings(coverage_mappings_buffer);
+        })
+    };
+
     // Encode all filenames referenced by counters/expressions in this module
     let filenames_buffer = llvm::build_byte_buffer(|filenames_buffer| {
-        coverageinfo::write_filenames_section_to_buffer(&mapgen.filenames, filenames_buffer);
+        coverageinfo::write_filenames_section_to_buffer(
+            mapgen.filenames.iter().copied(),
+            filenames_buffer,
+        );
     });
 
     let filenames_size = filenames_buffer.len();
@@ -92,14 +97,26 @@ pub fn finalize<'ll, 'tcx>(cx: &CodegenCx<'ll, 'tcx>) {
     // Generate the LLVM IR representation of the coverage map and store it in a well-known global
     let cov_data_val = mapgen.generate_coverage_map(cx, version, filenames_size, filenames_val);
 
-    for (mangled_function_name, source_hash, is_used, coverage_mapping_buffer) in function_data {
+    // Hash the names of all functions in one go
+    let mangled_function_names =
+        function_data.iter().map(|(name, ..)| name.as_str()).collect::<Vec<_>>();
+    let func_name_hashes = coverageinfo::hash_strs(&mangled_function_names);
+
+    for (((_, source_hash, is_used), func_name_hash), range) in
+        function_data.iter().zip(func_name_hashes).zip(offsets.windows(2))
+    {
+        let coverage_mapping_buffer = &coverage_mappings_buffer[range[0]..range[1]];
+        debug_assert!(
+            coverage_mapping_buffer.len() > 0,
+            "Every `FunctionCoverage` should have at least one counter"
+        );
         save_function_record(
             cx,
-            mangled_function_name,
-            source_hash,
+            func_name_hash,
+            *source_hash,
             filenames_ref,
             coverage_mapping_buffer,
-            is_used,
+            *is_used,
         );
     }
 
@@ -107,32 +124,46 @@ pub fn finalize<'ll, 'tcx>(cx: &CodegenCx<'ll, 'tcx>) {
     coverageinfo::save_cov_data_to_mod(cx, cov_data_val);
 }
 
+/// The virtual file mappings, expressions and regions of every function in the module are
+/// collected into flat arrays, so that LLVM can encode all of their coverage mappings at once.
 struct CoverageMapGenerator {
-    filenames: FxIndexSet<CString>,
+    filenames: FxIndexSet<Symbol>,
+    functions: Vec<FunctionMapping>,
+    virtual_file_mapping: Vec<u32>,
+    expressions: Vec<CounterExpression>,
+    mapping_regions: Vec<CounterMappingRegion>,
 }
 
 impl CoverageMapGenerator {
     fn new() -> Self {
-        Self { filenames: FxIndexSet::default() }
+        Self {
+            filenames: FxIndexSet::default(),
+            functions: Vec::new(),
+            virtual_file_mapping: Vec::new(),
+            expressions: Vec::new(),
+            mapping_regions: Vec::new(),
+        }
     }
 
     /// Using the `expressions` and `counter_regions` collected for the current function, generate
-    /// the `mapping_regions` and `virtual_file_mapping`, and capture any new filenames. Then use
-    /// LLVM APIs to encode the `virtual_file_mapping`, `expressions`, and `mapping_regions` into
-    /// the given `coverage_mapping` byte buffer, compliant with the LLVM Coverage Mapping format.
-    fn write_coverage_mapping(
+    /// the `mapping_regions` and `virtual_file_mapping`, and capture any new filenames. These are
+    /// appended to the ones of the functions added before, to be encoded by
+    /// `write_coverage_mappings`.
+    fn add_coverage_mapping(
         &mut self,
         expressions: Vec<CounterExpression>,
         counter_regions: impl Iterator<Item = (Counter, &'a CodeRegion)>,
-        coverage_mapping_buffer: &RustString,
     ) {
         let mut counter_regions = counter_regions.collect::<Vec<_>>();
         if counter_regions.is_empty() {
+            self.functions.push(FunctionMapping::default());
             return;
         }
 
-        let mut virtual_file_mapping = Vec::new();
-        let mut mapping_regions = Vec::new();
+        let virtual_file_mapping = &mut self.virtual_file_mapping;
+        let mapping_regions = &mut self.mapping_regions;
+        let num_virtual_file_mapping_ids = virtual_file_mapping.len();
+        let num_mapping_regions = mapping_regions.len();
         let mut current_file_name = None;
         let mut current_file_id = 0;
 
@@ -150,10 +181,8 @@ fn write_coverage_mapping(
                     current_file_id += 1;
                 }
                 current_file_name = Some(file_name);
-                let c_filename = CString::new(file_name.to_string())
-                    .expect("null error converting filename to C string");
-                debug!("  file_id: {} = '{:?}'", current_file_id, c_filename);
-                let (filenames_index, _) = self.filenames.insert_full(c_filename);
+                debug!("  file_id: {} = '{:?}'", current_file_id, file_name);
+                let (filenames_index, _) = self.filenames.insert_full(file_name);
                 virtual_file_mapping.push(filenames_index as u32);
             }
             debug!("Adding counter {:?} to map for {:?}", counter, region);
@@ -167,13 +196,26 @@ fn write_coverage_mapping(
             ));
         }
 
-        // Encode and append the current function's coverage mapping data
-        coverageinfo::write_mapping_to_buffer(
-            virtual_file_mapping,
-            expressions,
-            mapping_regions,
-            coverage_mapping_buffer,
-        );
+        self.functions.push(FunctionMapping {
+            num_virtual_file_mapping_ids: (virtual_file_mapping.len()
+                - num_virtual_file_mapping_ids) as u32,
+            num_expressions: expressions.len() as u32,
+            num_mapping_regions: (mapping_regions.len() - num_mapping_regions) as u32,
+        });
+        self.expressions.extend(expressions);
+    }
+
+    /// Use LLVM APIs to encode the coverage mappings of all functions added so far into the
+    /// given byte buffer, compliant with the LLVM Coverage Mapping format. Returns where each
+    /// function's mapping starts in the buffer, followed by the end of the last one.
+    fn write_coverage_mappings(&self, coverage_mappings_buffer: &RustString) -> Vec<usize> {
+        coverageinfo::write_mappings_to_buffer(
+            &self.functions,
+            &self.virtual_file_mapping,
+            &self.expressions,
+            &self.mapping_regions,
+            coverage_mappings_buffer,
+        )
     }
 
     /// Construct coverage map header and the array of function records, and combine them into the
@@ -209,17 +251,16 @@ fn generate_coverage_map(
 /// specific, well-known section and name.
 fn save_function_record(
     cx: &CodegenCx<'ll, 'tcx>,
-    mangled_function_name: String,
+    func_name_hash: u64,
     source_hash: u64,
     filenames_ref: u64,
-    coverage_mapping_buffer: Vec<u8>,
+    coverage_mapping_buffer: &[u8],
     is_used: bool,
 ) {
     // Concatenate the encoded coverage mappings
     let coverage_mapping_size = coverage_mapping_buffer.len();
-    let coverage_mapping_val = cx.const_bytes(&coverage_mapping_buffer[..]);
+    let coverage_mapping_val = cx.const_bytes(coverage_mapping_buffer);
 
-    let func_name_hash = coverageinfo::hash_str(&mangled_function_name);
     let func_name_hash_val = cx.const_u64(func_name_hash);
     let coverage_mapping_size_val = cx.const_u32(coverage_mapping_size as u32);
     let source_hash_val = cx.const_u64(source_hash);
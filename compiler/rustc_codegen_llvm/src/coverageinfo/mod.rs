@@ -4,8 +4,7 @@
 use crate::builder::Builder;
 use crate::common::CodegenCx;
 
-use libc::c_uint;
-use llvm::coverageinfo::CounterMappingRegion;
+use llvm::coverageinfo::{CounterMappingRegion, FunctionMapping};
 use rustc_codegen_ssa::coverageinfo::map::{CounterExpression, FunctionCoverage};
 use rustc_codegen_ssa::traits::{
     BaseTypeMethods, BuilderMethods, ConstMethods, CoverageInfoBuilderMethods, CoverageInfoMethods,
@@ -23,6 +22,7 @@
 use rustc_middle::ty::layout::FnAbiExt;
 use rustc_middle::ty::subst::InternalSubsts;
 use rustc_middle::ty::Instance;
+use rustc_span::Symbol;
 
 use std::cell::RefCell;
 use std::ffi::CString;
@@ -279,42 +279,62 @@ fn create_pgo_func_name_var(
     unsafe { llvm::LLVMRustCoverageCreatePGOFuncNameVar(llfn, mangled_fn_name.as_ptr()) }
 }
 
-pub(crate) fn write_filenames_section_to_buffer<'a>(
-    filenames: impl IntoIterator<Item = &'a CString>,
+pub(crate) fn write_filenames_section_to_buffer(
+    filenames: impl IntoIterator<Item = Symbol>,
     buffer: &RustString,
 ) {
-    let c_str_vec = filenames.into_iter().map(|cstring| cstring.as_ptr()).collect::<Vec<_>>();
+    let filenames = filenames.into_iter().map(|filename| filename.as_str()).collect::<Vec<_>>();
+    let ptrs = filenames.iter().map(|filename| filename.as_ptr().cast()).collect::<Vec<_>>();
+    let lens = filenames.iter().map(|filename| filename.len()).collect::<Vec<_>>();
     unsafe {
         llvm::LLVMRustCoverageWriteFilenamesSectionToBuffer(
-            c_str_vec.as_ptr(),
-            c_str_vec.len(),
+            ptrs.as_ptr(),
+            lens.as_ptr(),
+            filenames.len(),
             buffer,
         );
     }
 }
 
-pub(crate) fn write_mapping_to_buffer(
-    virtual_file_mapping: Vec<u32>,
-    expressions: Vec<CounterExpression>,
-    mapping_regions: Vec<CounterMappingRegion>,
+/// Encodes the coverage mappings of all `functions`, whose virtual file mappings, expressions
+/// and regions are concatenated in the other arguments, into `buffer`. Returns the offsets into
+/// `buffer` at which each function's encoded mapping starts, followed by the end of the last one.
+pub(crate) fn write_mappings_to_buffer(
+    functions: &[FunctionMapping],
+    virtual_file_mapping: &[u32],
+    expressions: &[CounterExpression],
+    mapping_regions: &[CounterMappingRegion],
     buffer: &RustString,
-) {
+) -> Vec<usize> {
+    let mut offsets = vec![0; functions.len() + 1];
     unsafe {
-        llvm::LLVMRustCoverageWriteMappingToBuffer(
+        llvm::LLVMRustCoverageWriteMappingsToBuffer(
+            functions.as_ptr(),
+            functions.len(),
             virtual_file_mapping.as_ptr(),
-            virtual_file_mapping.len() as c_uint,
             expressions.as_ptr(),
-            expressions.len() as c_uint,
             mapping_regions.as_ptr(),
-            mapping_regions.len() as c_uint,
+            offsets.as_mut_ptr(),
             buffer,
         );
     }
+    offsets
 }
 
-pub(crate) fn hash_str(strval: &str) -> u64 {
-    let strval = CString::new(strval).expect("null error converting hashable str to C string");
-    unsafe { llvm::LLVMRustCoverageHashCString(strval.as_ptr()) }
+/// Hashes all of `strvals` with a single call into LLVM.
+pub(crate) fn hash_strs(strvals: &[&str]) -> Vec<u64> {
+    let ptrs = strvals.iter().map(|strval| strval.as_ptr().cast()).collect::<Vec<_>>();
+    let lens = strvals.iter().map(|strval| strval.len()).collect::<Vec<_>>();
+    let mut hashes = vec![0; strvals.len()];
+    unsafe {
+        llvm::LLVMRustCoverageHashByteArrays(
+            ptrs.as_ptr(),
+            lens.as_ptr(),
+            strvals.len(),
+            hashes.as_mut_ptr(),
+        );
+    }
+    hashes
 }
 
 pub(crate) fn hash_bytes(bytes: Vec<u8>) -> u64 {
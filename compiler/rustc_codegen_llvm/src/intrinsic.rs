@@ -194,24 +194,30 @@ fn codegen_intrinsic_call(
             | sym::prefetch_write_data
             | sym::prefetch_read_instruction
             | sym::prefetch_write_instruction => {
-                let expect = self.get_intrinsic(&("llvm.prefetch"));
-                let (rw, cache_type) = match name {
-                    sym::prefetch_read_data => (0, 1),
-                    sym::prefetch_write_data => (1, 1),
-                    sym::prefetch_read_instruction => (0, 0),
-                    sym::prefetch_write_instruction => (1, 0),
+                let (is_write, is_data) = match name {
+                    sym::prefetch_read_data => (false, true),
+                    sym::prefetch_write_data => (true, true),
+                    sym::prefetch_read_instruction => (false, false),
+                    sym::prefetch_write_instruction => (true, false),
                     _ => bug!(),
                 };
-                self.call(
-                    expect,
-                    &[
-                        args[0].immediate(),
-                        self.const_i32(rw),
-                        args[1].immediate(),
-                        self.const_i32(cache_type),
-                    ],
-                    None,
-                )
+                // LLVM only accepts an immediate locality, and rejects the
+                // whole module otherwise.
+                let locality = match self.const_to_opt_u128(args[1].immediate(), false) {
+                    Some(locality) if locality <= 3 => locality as u32,
+                    _ => {
+                        tcx.sess.span_err(
+                            span,
+                            &format!(
+                                "the locality of `{}` has to be a constant between 0 and 3",
+                                name
+                            ),
+                        );
+                        return;
+                    }
+                };
+                self.prefetch(args[0].immediate(), is_write, locality, is_data);
+                self.const_undef(llret_ty)
             }
             sym::ctlz
             | sym::ctlz_nonzero
@@ -1141,19 +1147,6 @@ macro_rules! return_error {
         return simd_simple_float_intrinsic(name, in_elem, in_ty, in_len, bx, span, args);
     }
 
-    // FIXME: use:
-    //  https://github.com/llvm-mirror/llvm/blob/master/include/llvm/IR/Function.h#L182
-    //  https://github.com/llvm-mirror/llvm/blob/master/include/llvm/IR/Intrinsics.h#L81
-    fn llvm_vector_str(elem_ty: Ty<'_>, vec_len: u64, no_pointers: usize) -> String {
-        let p0s: String = "p0".repeat(no_pointers);
-        match *elem_ty.kind() {
-            ty::Int(v) => format!("v{}{}i{}", vec_len, p0s, v.bit_width().unwrap()),
-            ty::Uint(v) => format!("v{}{}i{}", vec_len, p0s, v.bit_width().unwrap()),
-            ty::Float(v) => format!("v{}{}f{}", vec_len, p0s, v.bit_width()),
-            _ => unreachable!(),
-        }
-    }
-
     fn llvm_vector_ty(
         cx: &CodegenCx<'ll, '_>,
         elem_ty: Ty<'_>,
@@ -1174,6 +1167,85 @@ fn llvm_vector_ty(
         cx.type_vector(elem_ty, vec_len)
     }
 
+    if name == sym::simd_masked_load || name == sym::simd_masked_store {
+        // simd_masked_load(values: <N x T>, pointer: *_ T, mask: <N x i{M}>) -> <N x T>
+        // simd_masked_store(values: <N x T>, pointer: *mut T, mask: <N x i{M}>) -> ()
+        // * N: number of elements in the input vectors
+        // * T: type of the element to load or store
+        // * M: any integer width is supported, will be truncated to i1
+        // Only the lanes whose mask is set are loaded from or stored to the
+        // N consecutive elements at `pointer`; a load takes the other lanes
+        // from `values`. This lets vector loops handle their tails without
+        // touching memory past the end.
+        let is_store = name == sym::simd_masked_store;
+        require_simd!(arg_tys[2], "third");
+        if !is_store {
+            require!(ret_ty == in_ty, "expected return type `{}`, found `{}`", in_ty, ret_ty);
+        }
+
+        let (mask_len, mask_elem) = arg_tys[2].simd_size_and_type(bx.tcx());
+        require!(
+            in_len == mask_len,
+            "expected {} argument with length {} (same as input type `{}`), \
+             found `{}` with length {}",
+            "third",
+            in_len,
+            in_ty,
+            arg_tys[2],
+            mask_len
+        );
+
+        match arg_tys[1].kind() {
+            ty::RawPtr(p) if p.ty == in_elem && (!is_store || p.mutbl == hir::Mutability::Mut) => {}
+            _ => {
+                require!(
+                    false,
+                    "expected second argument `{}` to be a pointer to the element type `{}` \
+                     of the first argument `{}`, found `{}` != `{} {}`",
+                    arg_tys[1],
+                    in_elem,
+                    in_ty,
+                    arg_tys[1],
+                    if is_store { "*mut" } else { "*_" },
+                    in_elem
+                );
+            }
+        }
+
+        // The element type of the third argument must be a signed integer type of any width:
+        match mask_elem.kind() {
+            ty::Int(_) => (),
+            _ => {
+                require!(
+                    false,
+                    "expected element type `{}` of third argument `{}` \
+                     to be a signed integer type",
+                    mask_elem,
+                    arg_tys[2]
+                );
+            }
+        }
+
+        // Only the elements are known to be aligned, not the whole vector:
+        let alignment = bx.align_of(in_elem);
+
+        // Truncate the mask vector to a vector of i1s:
+        let mask = {
+            let i1 = bx.type_i1();
+            let i1xn = bx.type_vector(i1, in_len);
+            bx.trunc(args[2].immediate(), i1xn)
+        };
+
+        let values = args[0].immediate();
+        let vec_ty = bx.val_ty(values);
+        let ptr = bx.pointercast(args[1].immediate(), bx.type_ptr_to(vec_ty));
+        if is_store {
+            bx.masked_store(values, ptr, alignment, mask);
+            return Ok(bx.const_undef(llret_ty));
+        }
+        return Ok(bx.masked_load(vec_ty, ptr, alignment, mask, Some(values)));
+    }
+
     if name == sym::simd_gather {
         // simd_gather(values: <N x T>, pointers: <N x *_ T>,
         //             mask: <N x i{M}>) -> <N x T>
@@ -1271,36 +1343,26 @@ fn non_ptr(t: Ty<'_>) -> Ty<'_> {
             }
         }
 
-        // Alignment of T, must be a constant integer value:
-        let alignment_ty = bx.type_i32();
-        let alignment = bx.const_i32(bx.align_of(in_elem).bytes() as i32);
+        // Alignment of T:
+        let alignment = bx.align_of(in_elem);
 
         // Truncate the mask vector to a vector of i1s:
-        let (mask, mask_ty) = {
+        let mask = {
             let i1 = bx.type_i1();
             let i1xn = bx.type_vector(i1, in_len);
-            (bx.trunc(args[2].immediate(), i1xn), i1xn)
+            bx.trunc(args[2].immediate(), i1xn)
         };
 
-        // Type of the vector of pointers:
-        let llvm_pointer_vec_ty = llvm_vector_ty(bx, underlying_ty, in_len, pointer_count);
-        let llvm_pointer_vec_str = llvm_vector_str(underlying_ty, in_len, pointer_count);
-
         // Type of the vector of elements:
         let llvm_elem_vec_ty = llvm_vector_ty(bx, underlying_ty, in_len, pointer_count - 1);
-        let llvm_elem_vec_str = llvm_vector_str(underlying_ty, in_len, pointer_count - 1);
 
-        let llvm_intrinsic =
-            format!("llvm.masked.gather.{}.{}", llvm_elem_vec_str, llvm_pointer_vec_str);
-        let f = bx.declare_cfn(
-            &llvm_intrinsic,
-            llvm::UnnamedAddr::No,
-            bx.type_func(
-                &[llvm_pointer_vec_ty, alignment_ty, mask_ty, llvm_elem_vec_ty],
-                llvm_elem_vec_ty,
-            ),
+        let v = bx.masked_gather(
+            llvm_elem_vec_ty,
+            args[1].immediate(),
+            alignment,
+            mask,
+            Some(args[0].immediate()),
         );
-        let v = bx.call(f, &[args[1].immediate(), alignment, mask, args[0].immediate()], None);
         return Ok(v);
     }
 
@@ -1399,35 +1461,18 @@ fn non_ptr(t: Ty<'_>) -> Ty<'_> {
             }
         }
 
-        // Alignment of T, must be a constant integer value:
-        let alignment_ty = bx.type_i32();
-        let alignment = bx.const_i32(bx.align_of(in_elem).bytes() as i32);
+        // Alignment of T:
+        let alignment = bx.align_of(in_elem);
 
         // Truncate the mask vector to a vector of i1s:
-        let (mask, mask_ty) = {
+        let mask = {
             let i1 = bx.type_i1();
             let i1xn = bx.type_vector(i1, in_len);
-            (bx.trunc(args[2].immediate(), i1xn), i1xn)
+            bx.trunc(args[2].immediate(), i1xn)
         };
 
-        let ret_t = bx.type_void();
-
-        // Type of the vector of pointers:
-        let llvm_pointer_vec_ty = llvm_vector_ty(bx, underlying_ty, in_len, pointer_count);
-        let llvm_pointer_vec_str = llvm_vector_str(underlying_ty, in_len, pointer_count);
-
-        // Type of the vector of elements:
-        let llvm_elem_vec_ty = llvm_vector_ty(bx, underlying_ty, in_len, pointer_count - 1);
-        let llvm_elem_vec_str = llvm_vector_str(underlying_ty, in_len, pointer_count - 1);
-
-        let llvm_intrinsic =
-            format!("llvm.masked.scatter.{}.{}", llvm_elem_vec_str, llvm_pointer_vec_str);
-        let f = bx.declare_cfn(
-            &llvm_intrinsic,
-            llvm::UnnamedAddr::No,
-            bx.type_func(&[llvm_elem_vec_ty, llvm_pointer_vec_ty, alignment_ty, mask_ty], ret_t),
-        );
-        let v = bx.call(f, &[args[0].immediate(), args[1].immediate(), alignment, mask], None);
+        bx.masked_scatter(args[0].immediate(), args[1].immediate(), alignment, mask);
+        let v = bx.const_undef(llret_ty);
         return Ok(v);
     }
 
@@ -1491,14 +1536,14 @@ macro_rules! arith_red {
     arith_red!(simd_reduce_mul_ordered: vector_reduce_mul, vector_reduce_fmul, true, mul, 1.0);
     arith_red!(
         simd_reduce_add_unordered: vector_reduce_add,
-        vector_reduce_fadd_fast,
+        vector_reduce_fadd_reassoc,
         false,
         add,
         0.0
     );
     arith_red!(
         simd_reduce_mul_unordered: vector_reduce_mul,
-        vector_reduce_fmul_fast,
+        vector_reduce_fmul_reassoc,
         false,
         mul,
         1.0
@@ -12,6 +12,7 @@
 #![feature(in_band_lifetimes)]
 #![feature(iter_zip)]
 #![feature(nll)]
+#![feature(once_cell)]
 #![recursion_limit = "256"]
 
 use back::write::{create_informational_target_machine, create_target_machine};
@@ -30,12 +31,13 @@
 use rustc_middle::dep_graph::{WorkProduct, WorkProductId};
 use rustc_middle::middle::cstore::EncodedMetadata;
 use rustc_middle::ty::TyCtxt;
-use rustc_session::config::{OptLevel, OutputFilenames, PrintRequest};
+use rustc_session::config::{OptLevel, Options, OutputFilenames, PrintRequest};
 use rustc_session::Session;
 use rustc_span::symbol::Symbol;
 
 use std::any::Any;
 use std::ffi::CStr;
+use std::sync::{Arc, Mutex};
 
 mod back {
     pub mod archive;
@@ -73,8 +75,15 @@ pub mod llvm {
 mod va_arg;
 mod value;
 
-#[derive(Clone)]
-pub struct LlvmCodegenBackend(());
+#[derive(Clone, Default)]
+pub struct LlvmCodegenBackend {
+    /// Shared by all the clones of the backend used while codegenning a crate.
+    pass_pipelines: Arc<back::write::PassPipelineCache>,
+    codegen_pipelines: Arc<back::write::CodegenPipelineCache>,
+    /// Whether the `-C profile-use` profile has context-sensitive counts,
+    /// once that has been looked up.
+    pgo_use_cs_profile: Arc<Mutex<Option<bool>>>,
+}
 
 impl ExtraBackendMethods for LlvmCodegenBackend {
     fn new_metadata(&self, tcx: TyCtxt<'_>, mod_name: &str) -> ModuleLlvm {
@@ -118,6 +127,32 @@ fn target_cpu<'b>(&self, sess: &'b Session) -> &'b str {
     fn tune_cpu<'b>(&self, sess: &'b Session) -> Option<&'b str> {
         llvm_util::tune_cpu(sess)
     }
+
+    fn spawn_named_thread<F, T>(
+        time_trace: bool,
+        name: String,
+        f: F,
+    ) -> std::io::Result<std::thread::JoinHandle<T>>
+    where
+        F: FnOnce() -> T,
+        F: Send + 'static,
+        T: Send + 'static,
+    {
+        std::thread::Builder::new().name(name).spawn(move || {
+            if time_trace {
+                unsafe {
+                    llvm::LLVMTimeTraceProfilerInitializeThread();
+                }
+            }
+            let result = f();
+            if time_trace {
+                unsafe {
+                    llvm::LLVMTimeTraceProfilerFinishThread();
+                }
+            }
+            result
+        })
+    }
 }
 
 impl WriteBackendMethods for LlvmCodegenBackend {
@@ -175,8 +210,18 @@ unsafe fn codegen(
     ) -> Result<CompiledModule, FatalError> {
         back::write::codegen(cgcx, diag_handler, module, config)
     }
-    fn prepare_thin(module: ModuleCodegen<Self::Module>) -> (String, Self::ThinBuffer) {
-        back::lto::prepare_thin(module)
+    fn prepare_thin(
+        cgcx: &CodegenContext<Self>,
+        module: ModuleCodegen<Self::Module>,
+    ) -> (String, Self::ThinBuffer) {
+        back::lto::prepare_thin(cgcx, module)
+    }
+    fn compress_thin_buffer(
+        cgcx: &CodegenContext<Self>,
+        name: &str,
+        buffer: &mut Self::ThinBuffer,
+    ) {
+        back::lto::compress_thin_buffer(cgcx, name, buffer)
     }
     fn serialize_module(module: ModuleCodegen<Self::Module>) -> (String, Self::ModuleBuffer) {
         (module.name, back::lto::ModuleBuffer::new(module.module_llvm.llmod()))
@@ -188,7 +233,22 @@ fn run_lto_pass_manager(
         thin: bool,
     ) -> Result<(), FatalError> {
         let diag_handler = cgcx.create_diag_handler();
-        back::lto::run_pass_manager(cgcx, &diag_handler, module, config, thin)
+        let _handlers = back::write::DiagnosticHandlers::new(
+            cgcx,
+            &diag_handler,
+            &*module.module_llvm.llcx,
+            &module.name,
+            back::write::CodegenDiagnosticsStage::Lto,
+        );
+        back::lto::run_pass_manager(cgcx, &diag_handler, module, config, thin, None)
+    }
+    fn split_fat_lto_module(
+        cgcx: &CodegenContext<Self>,
+        diag_handler: &Handler,
+        module: ModuleCodegen<Self::Module>,
+        partitions: usize,
+    ) -> Result<Vec<ModuleCodegen<Self::Module>>, FatalError> {
+        back::lto::split_fat_module(cgcx, diag_handler, module, partitions)
     }
 }
 
@@ -197,7 +257,7 @@ unsafe impl Sync for LlvmCodegenBackend {}
 
 impl LlvmCodegenBackend {
     pub fn new() -> Box<dyn CodegenBackend> {
-        Box::new(LlvmCodegenBackend(()))
+        Box::new(LlvmCodegenBackend::default())
     }
 }
 
@@ -254,7 +314,7 @@ fn codegen_crate<'tcx>(
         need_metadata_module: bool,
     ) -> Box<dyn Any> {
         Box::new(rustc_codegen_ssa::base::codegen_crate(
-            LlvmCodegenBackend(()),
+            LlvmCodegenBackend::default(),
             tcx,
             crate::llvm_util::target_cpu(tcx.sess).to_string(),
             metadata,
@@ -290,6 +350,11 @@ fn link(
         use crate::back::archive::LlvmArchiveBuilder;
         use rustc_codegen_ssa::back::link::link_binary;
 
+        // Written before linking so that `-Z symbol-ordering-file` can use it right away.
+        if let Some(path) = &sess.opts.debugging_opts.pgo_symbol_ordering_file {
+            back::write::write_pgo_symbol_ordering(sess, path)?;
+        }
+
         // Run the linker on any artifacts that resulted from the LLVM run.
         // This should produce either a finished executable or library.
         link_binary::<LlvmArchiveBuilder<'_>>(sess, &codegen_results, outputs);
@@ -310,7 +375,7 @@ unsafe impl Sync for ModuleLlvm {}
 impl ModuleLlvm {
     fn new(tcx: TyCtxt<'_>, mod_name: &str) -> Self {
         unsafe {
-            let llcx = llvm::LLVMRustContextCreate(tcx.sess.fewer_names());
+            let llcx = create_context(&tcx.sess.opts, tcx.sess.fewer_names());
             let llmod_raw = context::create_module(tcx, llcx, mod_name) as *const _;
             ModuleLlvm { llmod_raw, llcx, tm: create_target_machine(tcx, mod_name) }
         }
@@ -318,7 +383,7 @@ fn new(tcx: TyCtxt<'_>, mod_name: &str) -> Self {
 
     fn new_metadata(tcx: TyCtxt<'_>, mod_name: &str) -> Self {
         unsafe {
-            let llcx = llvm::LLVMRustContextCreate(tcx.sess.fewer_names());
+            let llcx = create_context(&tcx.sess.opts, tcx.sess.fewer_names());
             let llmod_raw = context::create_module(tcx, llcx, mod_name) as *const _;
             ModuleLlvm { llmod_raw, llcx, tm: create_informational_target_machine(tcx.sess) }
         }
@@ -331,7 +396,7 @@ fn parse(
         handler: &Handler,
     ) -> Result<Self, FatalError> {
         unsafe {
-            let llcx = llvm::LLVMRustContextCreate(cgcx.fewer_names);
+            let llcx = create_context(&cgcx.opts, cgcx.fewer_names);
             let llmod_raw = back::lto::parse_module(llcx, name, buffer, handler)?;
             let tm_factory_config = TargetMachineFactoryConfig::new(&cgcx, name.to_str().unwrap());
             let tm = match (cgcx.tm_factory)(tm_factory_config) {
@@ -351,10 +416,23 @@ fn llmod(&self) -> &llvm::Module {
     }
 }
 
+/// Creates the context of a new module, taking it from the backend's pool of contexts with
+/// `-Z llvm-reuse-contexts`. Either way it is released along with its `ModuleLlvm`.
+pub(crate) unsafe fn create_context(
+    opts: &Options,
+    fewer_names: bool,
+) -> &'static mut llvm::Context {
+    if opts.debugging_opts.llvm_reuse_contexts {
+        llvm::LLVMRustContextTake(fewer_names)
+    } else {
+        llvm::LLVMRustContextCreate(fewer_names)
+    }
+}
+
 impl Drop for ModuleLlvm {
     fn drop(&mut self) {
         unsafe {
-            llvm::LLVMContextDispose(&mut *(self.llcx as *mut _));
+            llvm::LLVMRustContextRelease(&mut *(self.llcx as *mut _), self.llmod_raw);
             llvm::LLVMRustDisposeTargetMachine(&mut *(self.tm as *mut _));
         }
     }
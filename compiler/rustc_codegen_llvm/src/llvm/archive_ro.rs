@@ -2,6 +2,7 @@
 
 use rustc_fs_util::path_to_c_string;
 use std::path::Path;
+use std::ptr;
 use std::slice;
 use std::str;
 
@@ -19,11 +20,25 @@ pub struct Child<'a> {
     pub raw: &'a mut super::ArchiveChild<'a>,
 }
 
+/// A member of an archive as returned by `ArchiveRO::members`. Unlike `Child`
+/// this borrows everything from the archive and owns nothing.
+pub struct Member<'a> {
+    /// The member's name, or `None` if it is not valid UTF-8.
+    pub name: Option<&'a str>,
+    pub data: &'a [u8],
+    /// The offset of the member's data from the start of the archive file.
+    pub data_offset: u64,
+    pub raw: &'a super::ArchiveChild<'a>,
+}
+
 impl ArchiveRO {
     /// Opens a static archive for read-only purposes. This is more optimized
     /// than the `open` method because it uses LLVM's internal `Archive` class
     /// rather than shelling out to `ar` for everything.
     ///
+    /// An archive that is still open elsewhere is shared, so opening the same
+    /// unchanged archive again while it's in use is cheap.
+    ///
     /// If this archive is used with a mutable method, then an error will be
     /// raised.
     pub fn open(dst: &Path) -> Result<ArchiveRO, String> {
@@ -39,6 +54,63 @@ pub fn open(dst: &Path) -> Result<ArchiveRO, String> {
     pub fn iter(&self) -> Iter<'_> {
         unsafe { Iter { raw: super::LLVMRustArchiveIteratorNew(self.raw) } }
     }
+
+    /// Whether this is a thin archive, whose members live in files of their own.
+    pub fn is_thin(&self) -> bool {
+        unsafe { super::LLVMRustArchiveIsThin(self.raw) }
+    }
+
+    /// Returns all members of the archive in order. This is a single call into
+    /// LLVM, so prefer it over `iter` when looking at every member anyway.
+    pub fn members(&self) -> Result<Vec<Member<'_>>, String> {
+        unsafe {
+            let mut len = 0;
+            let error = || super::last_error().unwrap_or_else(|| "failed to read archive".into());
+            super::LLVMRustArchiveGetMembers(self.raw, ptr::null_mut(), 0, &mut len)
+                .into_result()
+                .map_err(|()| error())?;
+
+            let mut infos = Vec::with_capacity(len);
+            let mut filled = 0;
+            super::LLVMRustArchiveGetMembers(self.raw, infos.as_mut_ptr(), len, &mut filled)
+                .into_result()
+                .map_err(|()| error())?;
+            infos.set_len(len.min(filled));
+
+            Ok(infos
+                .into_iter()
+                .map(|info: super::ArchiveMemberInfo<'_>| {
+                    let name = slice::from_raw_parts(info.name as *const u8, info.name_len);
+                    let data = slice::from_raw_parts(info.data as *const u8, info.data_len);
+                    Member {
+                        name: str::from_utf8(name).ok(),
+                        data,
+                        data_offset: info.data_offset,
+                        raw: info.child,
+                    }
+                })
+                .collect())
+        }
+    }
+
+    /// Returns the embedded bitcode of the member called `name`, pointing into the mapped
+    /// archive rather than copied out of it.
+    pub fn member_bitcode(&self, name: &str) -> Result<&[u8], String> {
+        unsafe {
+            let mut len = 0;
+            let data = super::LLVMRustArchiveGetMemberBitcode(
+                self.raw,
+                name.as_ptr().cast(),
+                name.len(),
+                &mut len,
+            );
+            if data.is_null() {
+                Err(super::last_error().unwrap_or_else(|| "failed to find bitcode".into()))
+            } else {
+                Ok(slice::from_raw_parts(data as *const u8, len))
+            }
+        }
+    }
 }
 
 impl Drop for ArchiveRO {
@@ -94,6 +166,11 @@ pub fn data(&self) -> &'a [u8] {
             slice::from_raw_parts(data_ptr as *const u8, data_len as usize)
         }
     }
+
+    /// The offset of this member's data from the start of the archive file.
+    pub fn data_offset(&self) -> u64 {
+        unsafe { super::LLVMRustArchiveChildDataOffset(self.raw) }
+    }
 }
 
 impl<'a> Drop for Child<'a> {
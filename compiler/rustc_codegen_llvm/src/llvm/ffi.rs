@@ -34,14 +34,34 @@ pub enum LLVMRustResult {
 #[repr(C)]
 pub struct LLVMRustCOFFShortExport {
     pub name: *const c_char,
+    pub ordinal_present: bool,
+    // `ordinal` is meaningless unless `ordinal_present` is set.
+    pub ordinal: u16,
+    pub data: bool,
 }
 
 impl LLVMRustCOFFShortExport {
-    pub fn from_name(name: *const c_char) -> LLVMRustCOFFShortExport {
-        LLVMRustCOFFShortExport { name }
+    pub fn new(name: *const c_char, ordinal: Option<u16>, data: bool) -> LLVMRustCOFFShortExport {
+        LLVMRustCOFFShortExport {
+            name,
+            ordinal_present: ordinal.is_some(),
+            ordinal: ordinal.unwrap_or(0),
+            data,
+        }
     }
 }
 
+/// LLVMRustArchiveMemberInfo
+#[repr(C)]
+pub struct ArchiveMemberInfo<'a> {
+    pub name: *const c_char,
+    pub name_len: size_t,
+    pub data: *const c_char,
+    pub data_len: size_t,
+    pub data_offset: u64,
+    pub child: &'a ArchiveChild<'a>,
+}
+
 /// Translation of LLVM's MachineTypes enum, defined in llvm\include\llvm\BinaryFormat\COFF.h.
 ///
 /// We include only architectures supported on Windows.
@@ -161,6 +181,28 @@ pub enum Attribute {
     WillReturn = 29,
 }
 
+/// LLVMRustAttributeEntryKind
+#[derive(Copy, Clone, PartialEq, Eq, Hash)]
+#[repr(C)]
+pub enum AttributeEntryKind {
+    Enum,
+    Alignment,
+    Dereferenceable,
+    DereferenceableOrNull,
+    ByVal,
+    StructRet,
+}
+
+/// LLVMRustAttributeEntry
+#[derive(Copy, Clone, PartialEq, Eq, Hash)]
+#[repr(C)]
+pub struct AttributeEntry<'a> {
+    pub index: c_uint,
+    pub kind: AttributeEntryKind,
+    pub value: u64,
+    pub ty: Option<&'a Type>,
+}
+
 /// LLVMIntPredicate
 #[derive(Copy, Clone)]
 #[repr(C)]
@@ -269,6 +311,22 @@ pub fn to_generic(self) -> rustc_codegen_ssa::common::TypeKind {
     }
 }
 
+bitflags::bitflags! {
+    /// LLVMRustFastMathFlags
+    ///
+    /// <https://llvm.org/docs/LangRef.html#fast-math-flags>
+    #[repr(transparent)]
+    pub struct FastMathFlags: u32 {
+        const ALLOW_REASSOC     = 1 << 0;
+        const NO_NANS           = 1 << 1;
+        const NO_INFS           = 1 << 2;
+        const NO_SIGNED_ZEROS   = 1 << 3;
+        const ALLOW_RECIPROCAL  = 1 << 4;
+        const ALLOW_CONTRACT    = 1 << 5;
+        const APPROX_FUNC       = 1 << 6;
+    }
+}
+
 /// LLVMAtomicRmwBinOp
 #[derive(Copy, Clone)]
 #[repr(C)]
@@ -300,6 +358,28 @@ pub fn from_generic(op: rustc_codegen_ssa::common::AtomicRmwBinOp) -> Self {
             rustc_codegen_ssa::common::AtomicRmwBinOp::AtomicMin => AtomicRmwBinOp::AtomicMin,
             rustc_codegen_ssa::common::AtomicRmwBinOp::AtomicUMax => AtomicRmwBinOp::AtomicUMax,
             rustc_codegen_ssa::common::AtomicRmwBinOp::AtomicUMin => AtomicRmwBinOp::AtomicUMin,
+            rustc_codegen_ssa::common::AtomicRmwBinOp::AtomicFAdd
+            | rustc_codegen_ssa::common::AtomicRmwBinOp::AtomicFSub => {
+                unreachable!("floating-point atomicrmw goes through AtomicRmwFloatOp")
+            }
+        }
+    }
+}
+
+/// LLVMRustAtomicRmwFloatOp
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub enum AtomicRmwFloatOp {
+    FAdd,
+    FSub,
+}
+
+impl AtomicRmwFloatOp {
+    pub fn from_generic(op: rustc_codegen_ssa::common::AtomicRmwBinOp) -> Option<Self> {
+        match op {
+            rustc_codegen_ssa::common::AtomicRmwBinOp::AtomicFAdd => Some(AtomicRmwFloatOp::FAdd),
+            rustc_codegen_ssa::common::AtomicRmwBinOp::AtomicFSub => Some(AtomicRmwFloatOp::FSub),
+            _ => None,
         }
     }
 }
@@ -359,7 +439,7 @@ pub fn from_generic(sc: rustc_codegen_ssa::common::SynchronizationScope) -> Self
 }
 
 /// LLVMRustFileType
-#[derive(Copy, Clone)]
+#[derive(Copy, Clone, PartialEq)]
 #[repr(C)]
 pub enum FileType {
     AssemblyFile,
@@ -423,7 +503,7 @@ pub enum PassBuilderOptLevel {
 }
 
 /// LLVMRustOptStage
-#[derive(PartialEq)]
+#[derive(Copy, Clone, PartialEq, Debug)]
 #[repr(C)]
 pub enum OptStage {
     PreLinkNoLTO,
@@ -446,6 +526,13 @@ pub struct SanitizerOptions {
     pub sanitize_hwaddress_recover: bool,
 }
 
+/// LLVMRustInstrProfOptions
+#[repr(C)]
+pub struct InstrProfOptions {
+    pub atomic: bool,
+    pub do_counter_promotion: bool,
+}
+
 /// LLVMRelocMode
 #[derive(Copy, Clone, PartialEq)]
 #[repr(C)]
@@ -470,6 +557,43 @@ pub enum CodeModel {
     None,
 }
 
+/// LLVMRustBasicBlockSections
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub enum BasicBlockSections {
+    None,
+    All,
+    Labels,
+    List,
+}
+
+/// LLVMRustDebugCompression
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub enum DebugCompression {
+    None,
+    Zlib,
+}
+
+/// LLVMRustISelAbort
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub enum ISelAbort {
+    Default,
+    Abort,
+    Fallback,
+    FallbackWithDiag,
+}
+
+/// LLVMRustMachineOutliner
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub enum MachineOutliner {
+    Never,
+    TargetDefault,
+    Always,
+}
+
 /// LLVMRustDiagnosticKind
 #[derive(Copy, Clone)]
 #[repr(C)]
@@ -492,6 +616,23 @@ pub enum DiagnosticKind {
     Unsupported,
 }
 
+impl DiagnosticKind {
+    /// Whether `Diagnostic::unpack` turns a diagnostic of this kind into an
+    /// `Optimization`, which copies its pass name, location and message out.
+    pub fn is_optimization(self) -> bool {
+        matches!(
+            self,
+            DiagnosticKind::OptimizationRemark
+                | DiagnosticKind::OptimizationRemarkMissed
+                | DiagnosticKind::OptimizationRemarkAnalysis
+                | DiagnosticKind::OptimizationRemarkAnalysisFPCommute
+                | DiagnosticKind::OptimizationRemarkAnalysisAliasing
+                | DiagnosticKind::OptimizationRemarkOther
+                | DiagnosticKind::OptimizationFailure
+        )
+    }
+}
+
 /// LLVMRustDiagnosticLevel
 #[derive(Copy, Clone)]
 #[repr(C)]
@@ -533,9 +674,51 @@ pub enum PassKind {
     pub type ThinLTOBuffer;
 }
 
+/// LLVMRustNewPMPipeline
+extern "C" {
+    pub type NewPMPipeline;
+}
+
+/// LLVMRustCodegenPipeline
+extern "C" {
+    pub type CodegenPipeline;
+}
+
+/// LLVMRustRemarkFile
+extern "C" {
+    pub type RemarkFile;
+}
+
+/// LLVMRustStackSizeCollector
+extern "C" {
+    pub type StackSizeCollector;
+}
+
+/// LLVMRustISelStatsCollector
+extern "C" {
+    pub type ISelStatsCollector;
+}
+
+/// LLVMRustTargetFeature
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub struct TargetFeature {
+    pub feature: *const c_char,
+    pub desc: *const c_char,
+}
+
+// LLVMRustHostCPUFeatureCallback
+pub type HostCPUFeatureCallback = unsafe extern "C" fn(*mut c_void, *const c_char, size_t, bool);
+
+// LLVMRustStackSizeCallback
+pub type StackSizeCallback = unsafe extern "C" fn(*mut c_void, *const c_char, size_t, u64, bool);
+
+// LLVMRustISelStatsCallback
+pub type ISelStatsCallback = unsafe extern "C" fn(*mut c_void, *const c_char, size_t, u64, bool);
+
 // LLVMRustModuleNameCallback
 pub type ThinLTOModuleNameCallback =
-    unsafe extern "C" fn(*mut c_void, *const c_char, *const c_char);
+    unsafe extern "C" fn(*mut c_void, *const c_char, *const c_char, size_t, size_t);
 
 /// LLVMRustThinLTOModule
 #[repr(C)]
@@ -543,6 +726,31 @@ pub struct ThinLTOModule {
     pub identifier: *const c_char,
     pub data: *const u8,
     pub len: usize,
+    pub path: *const c_char,
+    pub offset: u64,
+    pub import_only: bool,
+    pub key: [u64; 2],
+}
+
+/// LLVMRustOperandBundle
+#[repr(C)]
+pub struct OperandBundle<'a> {
+    pub tag: *const c_char,
+    pub tag_len: size_t,
+    pub inputs: *const &'a Value,
+    pub num_inputs: size_t,
+}
+
+/// LLVMRustThinLTOImportOptions
+#[repr(C)]
+pub struct ThinLTOImportOptions {
+    pub instr_limit: c_int,
+    pub hot_multiplier: f32,
+    pub cold_multiplier: f32,
+    pub max_module_functions: size_t,
+    pub max_module_instrs: size_t,
+    pub whole_program_visibility: bool,
+    pub propagate_global_attrs: bool,
 }
 
 /// LLVMThreadLocalMode
@@ -594,6 +802,9 @@ struct InvariantOpaque<'a> {
 extern "C" {
     pub type Metadata;
 }
+extern "C" {
+    pub type AttributeList;
+}
 extern "C" {
     pub type BasicBlock;
 }
@@ -632,7 +843,7 @@ struct InvariantOpaque<'a> {
 #[repr(C)]
 pub struct RustArchiveMember<'a>(InvariantOpaque<'a>);
 #[repr(C)]
-pub struct OperandBundleDef<'a>(InvariantOpaque<'a>);
+pub struct OperandBundles<'a>(InvariantOpaque<'a>);
 #[repr(C)]
 pub struct Linker<'a>(InvariantOpaque<'a>);
 
@@ -793,6 +1004,18 @@ impl CounterMappingRegion {
             }
         }
     }
+
+    /// How many virtual file mapping IDs, expressions and regions one function has in the flat
+    /// arrays passed to `LLVMRustCoverageWriteMappingsToBuffer`.
+    ///
+    /// Matches LLVMRustCoverageFunctionMapping.
+    #[derive(Copy, Clone, Debug, Default)]
+    #[repr(C)]
+    pub struct FunctionMapping {
+        crate num_virtual_file_mapping_ids: u32,
+        crate num_expressions: u32,
+        crate num_mapping_regions: u32,
+    }
 }
 
 pub mod debuginfo {
@@ -889,15 +1112,96 @@ pub fn from_generic(kind: rustc_session::config::DebugInfo) -> Self {
     pub type ModuleBuffer;
 }
 
-pub type SelfProfileBeforePassCallback =
-    unsafe extern "C" fn(*mut c_void, *const c_char, *const c_char);
-pub type SelfProfileAfterPassCallback = unsafe extern "C" fn(*mut c_void);
+/// LLVMRustIRUnitKind
+#[derive(Copy, Clone, PartialEq)]
+#[repr(C)]
+#[allow(dead_code)] // Variants constructed by C++.
+pub enum IRUnitKind {
+    Module,
+    Function,
+    Loop,
+    SCC,
+    Other,
+}
+
+pub type SelfProfileBeforePassCallback = unsafe extern "C" fn(
+    *mut c_void,
+    *const c_char,
+    size_t,
+    *const c_char,
+    size_t,
+    IRUnitKind,
+    i64,
+);
+pub type SelfProfileAfterPassCallback = unsafe extern "C" fn(*mut c_void, i64);
+pub type SelfProfileSlowPassCallback = unsafe extern "C" fn(
+    *mut c_void,
+    *const c_char,
+    size_t,
+    *const c_char,
+    size_t,
+    IRUnitKind,
+    u64,
+);
+pub type SelfProfilePassSummaryCallback =
+    unsafe extern "C" fn(*mut c_void, *const c_char, size_t, u64, u64);
+
+/// LLVMRustFunctionSize
+#[repr(C)]
+pub struct FunctionSize {
+    pub name: *const c_char,
+    pub name_len: size_t,
+    pub instructions: c_uint,
+    pub basic_blocks: c_uint,
+    pub allocas: c_uint,
+}
+
+// LLVMRustFunctionSizeCallback
+pub type FunctionSizeCallback = unsafe extern "C" fn(*mut c_void, &FunctionSize);
+
+/// LLVMRustModuleMemoryUsage
+#[derive(Default)]
+#[repr(C)]
+pub struct ModuleMemoryUsage {
+    pub ir: u64,
+    pub metadata: u64,
+}
+
+/// LLVMRustOptimizationBudget
+#[repr(C)]
+pub struct OptimizationBudget {
+    pub function_budget_nanos: u64,
+    pub module_budget_nanos: u64,
+    pub skipped_passes: u64,
+}
+
+/// LLVMRustModuleCostInfo
+#[derive(Default)]
+#[repr(C)]
+pub struct ModuleCostInfo {
+    pub functions: u64,
+    pub instructions: u64,
+    pub basic_blocks: u64,
+    pub loops: u64,
+    pub calls: u64,
+}
+
+/// LLVMRustPassSamplingOptions
+#[repr(C)]
+pub struct PassSamplingOptions {
+    pub sample_every: c_uint,
+    pub min_duration_nanos: u64,
+    pub slow_pass_callback: SelfProfileSlowPassCallback,
+    pub summary_callback: SelfProfilePassSummaryCallback,
+}
 
 extern "C" {
     pub fn LLVMRustInstallFatalErrorHandler();
 
     // Create and destroy contexts.
     pub fn LLVMRustContextCreate(shouldDiscardNames: bool) -> &'static mut Context;
+    pub fn LLVMRustContextTake(shouldDiscardNames: bool) -> &'static mut Context;
+    pub fn LLVMRustContextRelease(C: &'static mut Context, M: *const Module);
     pub fn LLVMContextDispose(C: &'static mut Context);
     pub fn LLVMGetMDKindIDInContext(C: &Context, Name: *const c_char, SLen: c_uint) -> c_uint;
 
@@ -1075,12 +1379,14 @@ pub fn LLVMRustGetOrInsertFunction(
         FunctionTy: &'a Type,
     ) -> &'a Value;
     pub fn LLVMSetFunctionCallConv(Fn: &Value, CC: c_uint);
-    pub fn LLVMRustAddAlignmentAttr(Fn: &Value, index: c_uint, bytes: u32);
-    pub fn LLVMRustAddDereferenceableAttr(Fn: &Value, index: c_uint, bytes: u64);
-    pub fn LLVMRustAddDereferenceableOrNullAttr(Fn: &Value, index: c_uint, bytes: u64);
-    pub fn LLVMRustAddByValAttr(Fn: &Value, index: c_uint, ty: &Type);
-    pub fn LLVMRustAddStructRetAttr(Fn: &Value, index: c_uint, ty: &Type);
     pub fn LLVMRustAddFunctionAttribute(Fn: &Value, index: c_uint, attr: Attribute);
+    pub fn LLVMRustCreateAttributeList(
+        C: &'a Context,
+        Entries: *const AttributeEntry<'a>,
+        NumEntries: size_t,
+    ) -> &'a AttributeList;
+    pub fn LLVMRustDisposeAttributeList(List: &'a AttributeList);
+    pub fn LLVMRustApplyFunctionAttributeList(Fn: &Value, List: &AttributeList);
     pub fn LLVMRustAddFunctionAttrStringValue(
         Fn: &Value,
         index: c_uint,
@@ -1109,12 +1415,8 @@ pub fn LLVMAppendBasicBlockInContext(
     // Operations on call sites
     pub fn LLVMSetInstructionCallConv(Instr: &Value, CC: c_uint);
     pub fn LLVMRustAddCallSiteAttribute(Instr: &Value, index: c_uint, attr: Attribute);
+    pub fn LLVMRustApplyCallSiteAttributeList(Instr: &Value, List: &AttributeList);
     pub fn LLVMRustAddCallSiteAttrString(Instr: &Value, index: c_uint, Name: *const c_char);
-    pub fn LLVMRustAddAlignmentCallSiteAttr(Instr: &Value, index: c_uint, bytes: u32);
-    pub fn LLVMRustAddDereferenceableCallSiteAttr(Instr: &Value, index: c_uint, bytes: u64);
-    pub fn LLVMRustAddDereferenceableOrNullCallSiteAttr(Instr: &Value, index: c_uint, bytes: u64);
-    pub fn LLVMRustAddByValCallSiteAttr(Instr: &Value, index: c_uint, ty: &Type);
-    pub fn LLVMRustAddStructRetCallSiteAttr(Instr: &Value, index: c_uint, ty: &Type);
 
     // Operations on load/store instructions (only)
     pub fn LLVMSetVolatile(MemoryAccessInst: &Value, volatile: Bool);
@@ -1159,7 +1461,7 @@ pub fn LLVMRustBuildInvoke(
         NumArgs: c_uint,
         Then: &'a BasicBlock,
         Catch: &'a BasicBlock,
-        Bundle: Option<&OperandBundleDef<'a>>,
+        Bundles: Option<&OperandBundles<'a>>,
         Name: *const c_char,
     ) -> &'a Value;
     pub fn LLVMBuildLandingPad(
@@ -1376,6 +1678,7 @@ pub fn LLVMBuildXor(
     pub fn LLVMBuildFNeg(B: &Builder<'a>, V: &'a Value, Name: *const c_char) -> &'a Value;
     pub fn LLVMBuildNot(B: &Builder<'a>, V: &'a Value, Name: *const c_char) -> &'a Value;
     pub fn LLVMRustSetFastMath(Instr: &Value);
+    pub fn LLVMRustSetFastMathFlags(Instr: &Value, Flags: FastMathFlags);
 
     // Memory
     pub fn LLVMBuildAlloca(B: &Builder<'a>, Ty: &'a Type, Name: *const c_char) -> &'a Value;
@@ -1525,7 +1828,7 @@ pub fn LLVMRustBuildCall(
         Fn: &'a Value,
         Args: *const &'a Value,
         NumArgs: c_uint,
-        Bundle: Option<&OperandBundleDef<'a>>,
+        Bundles: Option<&OperandBundles<'a>>,
     ) -> &'a Value;
     pub fn LLVMRustBuildMemCpy(
         B: &Builder<'a>,
@@ -1545,6 +1848,14 @@ pub fn LLVMRustBuildMemMove(
         Size: &'a Value,
         IsVolatile: bool,
     ) -> &'a Value;
+    pub fn LLVMRustSetNontemporal(Instr: &'a Value);
+    pub fn LLVMRustBuildPrefetch(
+        B: &Builder<'a>,
+        Ptr: &'a Value,
+        IsWrite: bool,
+        Locality: c_uint,
+        IsData: bool,
+    ) -> &'a Value;
     pub fn LLVMRustBuildMemSet(
         B: &Builder<'a>,
         Dst: &'a Value,
@@ -1630,6 +1941,52 @@ pub fn LLVMRustBuildVectorReduceFMin(B: &Builder<'a>, Src: &'a Value, IsNaN: boo
     pub fn LLVMRustBuildVectorReduceFMax(B: &Builder<'a>, Src: &'a Value, IsNaN: bool)
     -> &'a Value;
 
+    pub fn LLVMRustBuildMaskedLoad(
+        B: &Builder<'a>,
+        Ty: &'a Type,
+        Ptr: &'a Value,
+        Alignment: c_uint,
+        Mask: &'a Value,
+        PassThru: Option<&'a Value>,
+    ) -> &'a Value;
+    pub fn LLVMRustBuildMaskedStore(
+        B: &Builder<'a>,
+        Val: &'a Value,
+        Ptr: &'a Value,
+        Alignment: c_uint,
+        Mask: &'a Value,
+    ) -> &'a Value;
+    pub fn LLVMRustBuildMaskedGather(
+        B: &Builder<'a>,
+        Ty: &'a Type,
+        Ptrs: &'a Value,
+        Alignment: c_uint,
+        Mask: &'a Value,
+        PassThru: Option<&'a Value>,
+    ) -> &'a Value;
+    pub fn LLVMRustBuildMaskedScatter(
+        B: &Builder<'a>,
+        Val: &'a Value,
+        Ptrs: &'a Value,
+        Alignment: c_uint,
+        Mask: &'a Value,
+    ) -> &'a Value;
+    pub fn LLVMRustBuildMaskedExpandLoad(
+        B: &Builder<'a>,
+        Ty: &'a Type,
+        Ptr: &'a Value,
+        Alignment: c_uint,
+        Mask: &'a Value,
+        PassThru: Option<&'a Value>,
+    ) -> &'a Value;
+    pub fn LLVMRustBuildMaskedCompressStore(
+        B: &Builder<'a>,
+        Val: &'a Value,
+        Ptr: &'a Value,
+        Alignment: c_uint,
+        Mask: &'a Value,
+    ) -> &'a Value;
+
     pub fn LLVMRustBuildMinNum(B: &Builder<'a>, LHS: &'a Value, LHS: &'a Value) -> &'a Value;
     pub fn LLVMRustBuildMaxNum(B: &Builder<'a>, LHS: &'a Value, LHS: &'a Value) -> &'a Value;
 
@@ -1667,6 +2024,14 @@ pub fn LLVMBuildAtomicRMW(
         Order: AtomicOrdering,
         SingleThreaded: Bool,
     ) -> &'a Value;
+    pub fn LLVMRustBuildAtomicRMWFloat(
+        B: &Builder<'a>,
+        Op: AtomicRmwFloatOp,
+        Dst: &'a Value,
+        Val: &'a Value,
+        Order: AtomicOrdering,
+        Scope: SynchronizationScope,
+    ) -> &'a Value;
 
     pub fn LLVMRustBuildAtomicFence(
         B: &Builder<'_>,
@@ -1693,6 +2058,10 @@ pub fn LLVMRustBuildAtomicFence(
 
     pub fn LLVMTimeTraceProfilerInitialize();
 
+    pub fn LLVMTimeTraceProfilerInitializeThread();
+
+    pub fn LLVMTimeTraceProfilerFinishThread();
+
     pub fn LLVMTimeTraceProfilerFinish(FileName: *const c_char);
 
     pub fn LLVMAddAnalysisPasses(T: &'a TargetMachine, PM: &PassManager<'a>);
@@ -1723,6 +2092,7 @@ pub fn LLVMPassManagerBuilderPopulateLTOPassManager(
     pub fn LLVMRustPassManagerBuilderPopulateThinLTOPassManager(
         PMB: &PassManagerBuilder,
         PM: &PassManager<'_>,
+        ThinLTOData: Option<&ThinLTOData>,
     );
 
     pub fn LLVMGetHostCPUFeatures() -> *mut c_char;
@@ -1766,25 +2136,31 @@ pub fn LLVMRustInlineAsmVerify(
     #[allow(improper_ctypes)]
     pub fn LLVMRustCoverageWriteFilenamesSectionToBuffer(
         Filenames: *const *const c_char,
+        FilenameLens: *const size_t,
         FilenamesLen: size_t,
         BufferOut: &RustString,
     );
 
     #[allow(improper_ctypes)]
-    pub fn LLVMRustCoverageWriteMappingToBuffer(
+    pub fn LLVMRustCoverageWriteMappingsToBuffer(
+        Functions: *const coverageinfo::FunctionMapping,
+        NumFunctions: size_t,
         VirtualFileMappingIDs: *const c_uint,
-        NumVirtualFileMappingIDs: c_uint,
         Expressions: *const coverage_map::CounterExpression,
-        NumExpressions: c_uint,
         MappingRegions: *const coverageinfo::CounterMappingRegion,
-        NumMappingRegions: c_uint,
+        Offsets: *mut size_t,
         BufferOut: &RustString,
     );
 
     pub fn LLVMRustCoverageCreatePGOFuncNameVar(F: &'a Value, FuncName: *const c_char)
     -> &'a Value;
-    pub fn LLVMRustCoverageHashCString(StrVal: *const c_char) -> u64;
     pub fn LLVMRustCoverageHashByteArray(Bytes: *const c_char, NumBytes: size_t) -> u64;
+    pub fn LLVMRustCoverageHashByteArrays(
+        Bytes: *const *const c_char,
+        Lens: *const size_t,
+        Num: size_t,
+        Hashes: *mut u64,
+    );
 
     #[allow(improper_ctypes)]
     pub fn LLVMRustCoverageWriteMapSectionNameToString(M: &Module, Str: &RustString);
@@ -2116,6 +2492,7 @@ pub fn LLVMRustCreateMemorySanitizerPass(
     ) -> &'static mut Pass;
     pub fn LLVMRustCreateThreadSanitizerPass() -> &'static mut Pass;
     pub fn LLVMRustCreateHWAddressSanitizerPass(Recover: bool) -> &'static mut Pass;
+    pub fn LLVMRustCreateInstrProfilingPass(Options: &InstrProfOptions) -> &'static mut Pass;
     pub fn LLVMRustAddPass(PM: &PassManager<'_>, Pass: &'static mut Pass);
     pub fn LLVMRustAddLastExtensionPasses(
         PMB: &PassManagerBuilder,
@@ -2127,14 +2504,17 @@ pub fn LLVMRustAddLastExtensionPasses(
 
     pub fn LLVMRustPrintTargetCPUs(T: &TargetMachine);
     pub fn LLVMRustGetTargetFeaturesCount(T: &TargetMachine) -> size_t;
-    pub fn LLVMRustGetTargetFeature(
+    pub fn LLVMRustGetTargetFeatures(
         T: &TargetMachine,
-        Index: size_t,
-        Feature: &mut *const c_char,
-        Desc: &mut *const c_char,
-    );
+        Features: *mut TargetFeature,
+        Len: size_t,
+    ) -> size_t;
 
     pub fn LLVMRustGetHostCPUName(len: *mut usize) -> *const c_char;
+    pub fn LLVMRustGetHostCPUFeatures(
+        Callback: HostCPUFeatureCallback,
+        CallbackPayload: *mut c_void,
+    ) -> bool;
     pub fn LLVMRustCreateTargetMachine(
         Triple: *const c_char,
         CPU: *const c_char,
@@ -2152,6 +2532,12 @@ pub fn LLVMRustCreateTargetMachine(
         EmitStackSizeSection: bool,
         RelaxELFRelocations: bool,
         UseInitArray: bool,
+        SplitMachineFunctions: bool,
+        BBSections: BasicBlockSections,
+        BBSectionsListPath: *const c_char,
+        DebugCompression: DebugCompression,
+        MachineOutliner: MachineOutliner,
+        ISelAbort: ISelAbort,
         SplitDwarfFile: *const c_char,
     ) -> Option<&'static mut TargetMachine>;
     pub fn LLVMRustDisposeTargetMachine(T: &'static mut TargetMachine);
@@ -2169,6 +2555,9 @@ pub fn LLVMRustConfigurePassManagerBuilder(
         PrepareForThinLTO: bool,
         PGOGenPath: *const c_char,
         PGOUsePath: *const c_char,
+        PGOUseCSProfile: bool,
+        PGOCSGenPath: *const c_char,
+        PGOSampleUsePath: *const c_char,
     );
     pub fn LLVMRustAddLibraryInfo(
         PM: &PassManager<'a>,
@@ -2176,6 +2565,12 @@ pub fn LLVMRustAddLibraryInfo(
         DisableSimplifyLibCalls: bool,
     );
     pub fn LLVMRustRunFunctionPassManager(PM: &PassManager<'a>, M: &'a Module);
+    pub fn LLVMRustProfileHasCSIRLevel(Path: *const c_char) -> bool;
+    pub fn LLVMRustWritePGOSymbolOrdering(
+        ProfilePath: *const c_char,
+        OutPath: *const c_char,
+        SymbolPrefix: *const c_char,
+    ) -> LLVMRustResult;
     pub fn LLVMRustWriteOutputFile(
         T: &'a TargetMachine,
         PM: &PassManager<'a>,
@@ -2183,6 +2578,29 @@ pub fn LLVMRustWriteOutputFile(
         Output: *const c_char,
         DwoOutput: *const c_char,
         FileType: FileType,
+        ReleaseFunctionBodies: bool,
+    ) -> LLVMRustResult;
+    pub fn LLVMRustCreateCodegenPipeline(
+        T: &TargetMachine,
+        DisableSimplifyLibCalls: bool,
+        FileType: FileType,
+        ReleaseFunctionBodies: bool,
+    ) -> Option<&'static mut CodegenPipeline>;
+    pub fn LLVMRustRunCodegenPipeline(
+        P: &mut CodegenPipeline,
+        M: &Module,
+        Output: *const c_char,
+    ) -> LLVMRustResult;
+    pub fn LLVMRustFreeCodegenPipeline(P: &'static mut CodegenPipeline);
+    pub fn LLVMRustTargetMachineHasDisassembler(T: &TargetMachine) -> bool;
+    pub fn LLVMRustWriteObjectAndAssemblyFiles(
+        T: &'a TargetMachine,
+        PM: &PassManager<'a>,
+        M: &'a Module,
+        ObjOutput: *const c_char,
+        DwoOutput: *const c_char,
+        AsmOutput: *const c_char,
+        ReleaseFunctionBodies: bool,
     ) -> LLVMRustResult;
     pub fn LLVMRustOptimizeWithNewPassManager(
         M: &'a Module,
@@ -2201,14 +2619,60 @@ pub fn LLVMRustOptimizeWithNewPassManager(
         SanitizerOptions: Option<&SanitizerOptions>,
         PGOGenPath: *const c_char,
         PGOUsePath: *const c_char,
-        InstrumentCoverage: bool,
+        PGOUseCSProfile: bool,
+        PGOCSGenPath: *const c_char,
+        PGOSampleUsePath: *const c_char,
+        PGORemappingPath: *const c_char,
+        InstrumentCoverage: Option<&InstrProfOptions>,
         InstrumentGCOV: bool,
         llvm_selfprofiler: *mut c_void,
         begin_callback: SelfProfileBeforePassCallback,
         end_callback: SelfProfileAfterPassCallback,
+        sampling_options: Option<&PassSamplingOptions>,
+        budget: Option<&mut OptimizationBudget>,
+        PassTimingsOut: Option<&RustString>,
         ExtraPasses: *const c_char,
         ExtraPassesLen: size_t,
+        ThinLTOData: Option<&ThinLTOData>,
+    ) -> LLVMRustResult;
+    pub fn LLVMRustCreateNewPMPipeline(
+        TM: &TargetMachine,
+        OptLevel: PassBuilderOptLevel,
+        OptStage: OptStage,
+        NoPrepopulatePasses: bool,
+        VerifyIR: bool,
+        UseThinLTOBuffers: bool,
+        MergeFunctions: bool,
+        UnrollLoops: bool,
+        SLPVectorize: bool,
+        LoopVectorize: bool,
+        DisableSimplifyLibCalls: bool,
+        EmitLifetimeMarkers: bool,
+        PGOUsePath: *const c_char,
+        PGOUseCSProfile: bool,
+        PGOSampleUsePath: *const c_char,
+        PGORemappingPath: *const c_char,
+        SelfProfile: bool,
+        begin_callback: SelfProfileBeforePassCallback,
+        end_callback: SelfProfileAfterPassCallback,
+        sampling_options: Option<&PassSamplingOptions>,
+        ThinLTOData: Option<&ThinLTOData>,
+    ) -> Option<&'static mut NewPMPipeline>;
+    pub fn LLVMRustRunNewPMPipeline(
+        P: &mut NewPMPipeline,
+        M: &Module,
+        llvm_selfprofiler: *mut c_void,
+    );
+    pub fn LLVMRustFreeNewPMPipeline(P: &'static mut NewPMPipeline);
+    pub fn LLVMRustSimplifyFunctionsInParallel(
+        M: &Module,
+        TM: &TargetMachine,
+        OptLevel: PassBuilderOptLevel,
+        DisableSimplifyLibCalls: bool,
+        Threads: c_uint,
+        MinInstructions: size_t,
     ) -> LLVMRustResult;
+    pub fn LLVMRustUpdateVCallVisibility(M: &Module, WholeProgramVisibility: bool);
     pub fn LLVMRustPrintModule(
         M: &'a Module,
         Output: *const c_char,
@@ -2217,18 +2681,43 @@ pub fn LLVMRustPrintModule(
     pub fn LLVMRustSetLLVMOptions(Argc: c_int, Argv: *const *const c_char);
     pub fn LLVMRustPrintPasses();
     pub fn LLVMRustGetInstructionCount(M: &Module) -> u32;
+    pub fn LLVMRustGetFunctionSizes(
+        M: &Module,
+        Callback: FunctionSizeCallback,
+        CallbackPayload: *mut c_void,
+    );
+    pub fn LLVMRustGetModuleMemoryUsage(M: &Module, Usage: &mut ModuleMemoryUsage);
     pub fn LLVMRustSetNormalizedTarget(M: &Module, triple: *const c_char);
     pub fn LLVMRustAddAlwaysInlinePass(P: &PassManagerBuilder, AddLifetimes: bool);
-    pub fn LLVMRustRunRestrictionPass(M: &Module, syms: *const *const c_char, len: size_t);
-    pub fn LLVMRustMarkAllFunctionsNounwind(M: &Module);
+    pub fn LLVMRustRunRestrictionPass(
+        M: &Module,
+        syms: *const *const c_char,
+        sym_lens: *const size_t,
+        len: size_t,
+    );
+    pub fn LLVMRustMarkAllFunctionsNounwind(M: &Module, RemoveInvokes: bool, RemoveUWTable: bool);
 
     pub fn LLVMRustOpenArchive(path: *const c_char) -> Option<&'static mut Archive>;
     pub fn LLVMRustArchiveIteratorNew(AR: &'a Archive) -> &'a mut ArchiveIterator<'a>;
     pub fn LLVMRustArchiveIteratorNext(
         AIR: &ArchiveIterator<'a>,
     ) -> Option<&'a mut ArchiveChild<'a>>;
+    pub fn LLVMRustArchiveIsThin(AR: &Archive) -> bool;
+    pub fn LLVMRustArchiveGetMemberBitcode(
+        AR: &Archive,
+        Name: *const c_char,
+        NameLen: size_t,
+        OutLen: &mut size_t,
+    ) -> *const c_char;
+    pub fn LLVMRustArchiveGetMembers(
+        AR: &'a Archive,
+        Members: *mut ArchiveMemberInfo<'a>,
+        Capacity: size_t,
+        NumMembers: &mut size_t,
+    ) -> LLVMRustResult;
     pub fn LLVMRustArchiveChildName(ACR: &ArchiveChild<'_>, size: &mut size_t) -> *const c_char;
     pub fn LLVMRustArchiveChildData(ACR: &ArchiveChild<'_>, size: &mut size_t) -> *const c_char;
+    pub fn LLVMRustArchiveChildDataOffset(ACR: &ArchiveChild<'_>) -> u64;
     pub fn LLVMRustArchiveChildFree(ACR: &'a mut ArchiveChild<'a>);
     pub fn LLVMRustArchiveIteratorFree(AIR: &'a mut ArchiveIterator<'a>);
     pub fn LLVMRustDestroyArchive(AR: &'static mut Archive);
@@ -2236,10 +2725,13 @@ pub fn LLVMRustArchiveIteratorNext(
     #[allow(improper_ctypes)]
     pub fn LLVMRustWriteTwineToString(T: &Twine, s: &RustString);
 
-    pub fn LLVMContextSetDiagnosticHandler(
+    pub fn LLVMRustContextConfigureDiagnosticHandler(
         C: &Context,
         Handler: DiagnosticHandler,
         DiagnosticContext: *mut c_void,
+        RemarkAllPasses: bool,
+        RemarkPasses: *const *const c_char,
+        RemarkPassesLen: size_t,
     );
 
     #[allow(improper_ctypes)]
@@ -2271,6 +2763,31 @@ pub fn LLVMRustSetInlineAsmDiagnosticHandler(
         CX: *mut c_void,
     );
 
+    pub fn LLVMRustStartCollectingStackSizes(M: &'a Module) -> &'a mut StackSizeCollector;
+    pub fn LLVMRustFinishCollectingStackSizes(
+        M: &'a Module,
+        Collector: &'a mut StackSizeCollector,
+        Callback: StackSizeCallback,
+        Payload: *mut c_void,
+    ) -> bool;
+    pub fn LLVMRustStartCollectingISelStats(M: &'a Module) -> &'a mut ISelStatsCollector;
+    pub fn LLVMRustFinishCollectingISelStats(
+        M: &'a Module,
+        Collector: &'a mut ISelStatsCollector,
+        Callback: ISelStatsCallback,
+        Payload: *mut c_void,
+    ) -> bool;
+
+    pub fn LLVMRustSetupOptimizationRemarks(
+        C: &'a Context,
+        Filename: *const c_char,
+        Passes: *const c_char,
+        Format: *const c_char,
+        WithHotness: bool,
+        HotnessThreshold: u64,
+    ) -> Option<&'a mut RemarkFile>;
+    pub fn LLVMRustFinishOptimizationRemarks(C: &'a Context, File: &'a mut RemarkFile);
+
     #[allow(improper_ctypes)]
     pub fn LLVMRustUnpackSMDiagnostic(
         d: &SMDiagnostic,
@@ -2288,6 +2805,8 @@ pub fn LLVMRustWriteArchive(
         Members: *const &RustArchiveMember<'_>,
         WriteSymbtab: bool,
         Kind: ArchiveKind,
+        Thin: bool,
+        InPlace: bool,
     ) -> LLVMRustResult;
     pub fn LLVMRustArchiveMemberNew(
         Filename: *const c_char,
@@ -2305,14 +2824,19 @@ pub fn LLVMRustWriteImportLibrary(
         MinGW: bool,
     ) -> LLVMRustResult;
 
+    pub fn LLVMRustHasDwarfPackageWriter() -> bool;
+    pub fn LLVMRustWriteDwarfPackage(
+        ExecutablePath: *const c_char,
+        OutPath: *const c_char,
+    ) -> LLVMRustResult;
+
     pub fn LLVMRustSetDataLayoutFromTargetMachine(M: &'a Module, TM: &'a TargetMachine);
 
-    pub fn LLVMRustBuildOperandBundleDef(
-        Name: *const c_char,
-        Inputs: *const &'a Value,
-        NumInputs: c_uint,
-    ) -> &'a mut OperandBundleDef<'a>;
-    pub fn LLVMRustFreeOperandBundleDef(Bundle: &'a mut OperandBundleDef<'a>);
+    pub fn LLVMRustBuildOperandBundles(
+        Bundles: *const OperandBundle<'a>,
+        NumBundles: size_t,
+    ) -> &'a mut OperandBundles<'a>;
+    pub fn LLVMRustFreeOperandBundles(Bundles: &'a mut OperandBundles<'a>);
 
     pub fn LLVMRustPositionBuilderAtStart(B: &Builder<'a>, BB: &'a BasicBlock);
 
@@ -2320,14 +2844,22 @@ pub fn LLVMRustBuildOperandBundleDef(
     pub fn LLVMRustUnsetComdat(V: &Value);
     pub fn LLVMRustSetModulePICLevel(M: &Module);
     pub fn LLVMRustSetModulePIELevel(M: &Module);
+    pub fn LLVMRustSetModuleDirectAccessExternalData(M: &Module, Direct: bool);
     pub fn LLVMRustSetModuleCodeModel(M: &Module, Model: CodeModel);
     pub fn LLVMRustModuleBufferCreate(M: &Module) -> &'static mut ModuleBuffer;
     pub fn LLVMRustModuleBufferPtr(p: &ModuleBuffer) -> *const u8;
     pub fn LLVMRustModuleBufferLen(p: &ModuleBuffer) -> usize;
     pub fn LLVMRustModuleBufferFree(p: &'static mut ModuleBuffer);
-    pub fn LLVMRustModuleCost(M: &Module) -> u64;
+    pub fn LLVMRustSplitModule(
+        M: &Module,
+        N: size_t,
+        Parts: *mut Option<&'static mut ModuleBuffer>,
+    ) -> size_t;
+    pub fn LLVMRustGetModuleCostInfo(M: &Module, Info: &mut ModuleCostInfo);
 
     pub fn LLVMRustThinLTOBufferCreate(M: &Module) -> &'static mut ThinLTOBuffer;
+    pub fn LLVMRustThinLTOBufferWriteToFile(M: &Module, Path: *const c_char) -> LLVMRustResult;
+    pub fn LLVMRustThinLTOBufferCompress(M: &mut ThinLTOBuffer) -> bool;
     pub fn LLVMRustThinLTOBufferFree(M: &'static mut ThinLTOBuffer);
     pub fn LLVMRustThinLTOBufferPtr(M: &ThinLTOBuffer) -> *const c_char;
     pub fn LLVMRustThinLTOBufferLen(M: &ThinLTOBuffer) -> size_t;
@@ -2336,21 +2868,46 @@ pub fn LLVMRustCreateThinLTOData(
         NumModules: c_uint,
         PreservedSymbols: *const *const c_char,
         PreservedSymbolsLen: c_uint,
+        Threads: c_uint,
+        ImportOptions: &ThinLTOImportOptions,
+    ) -> Option<&'static mut ThinLTOData>;
+    pub fn LLVMRustLoadCachedThinLTOData(
+        PrevData: *const c_char,
+        PrevLen: size_t,
+        Modules: *const ThinLTOModule,
+        NumModules: c_uint,
+        PreservedSymbols: *const *const c_char,
+        PreservedSymbolsLen: c_uint,
+        Threads: c_uint,
+        ImportOptions: &ThinLTOImportOptions,
+        ChangedModules: &mut size_t,
     ) -> Option<&'static mut ThinLTOData>;
+    #[allow(improper_ctypes)]
+    pub fn LLVMRustThinLTODataWrite(Data: &ThinLTOData, Out: &RustString);
     pub fn LLVMRustPrepareThinLTORename(
         Data: &ThinLTOData,
         Module: &Module,
         Target: &TargetMachine,
     ) -> bool;
+    pub fn LLVMRustPrepareThinLTODropDeadSymbols(Data: &ThinLTOData, Module: &Module);
     pub fn LLVMRustPrepareThinLTOResolveWeak(Data: &ThinLTOData, Module: &Module) -> bool;
     pub fn LLVMRustPrepareThinLTOInternalize(Data: &ThinLTOData, Module: &Module) -> bool;
     pub fn LLVMRustPrepareThinLTOImport(
         Data: &ThinLTOData,
         Module: &Module,
         Target: &TargetMachine,
+        CachedLoads: &mut u64,
+        UncachedLoads: &mut u64,
     ) -> bool;
-    pub fn LLVMRustGetThinLTOModuleImports(
-        Data: *const ThinLTOData,
+    pub fn LLVMRustThinLTOWriteIndexShard(
+        Data: &ThinLTOData,
+        ModId: *const c_char,
+        IndexPath: *const c_char,
+        ImportsPath: *const c_char,
+    ) -> LLVMRustResult;
+    pub fn LLVMRustThinLTOGetMemoryUsage(Data: &ThinLTOData, Index: &mut u64, Lists: &mut u64);
+    pub fn LLVMRustGetThinLTOModules(
+        Data: &ThinLTOData,
         ModuleNameCallback: ThinLTOModuleNameCallback,
         CallbackPayload: *mut c_void,
     );
@@ -2361,6 +2918,13 @@ pub fn LLVMRustParseBitcodeForLTO(
         len: usize,
         Identifier: *const c_char,
     ) -> Option<&Module>;
+    pub fn LLVMRustParseBitcodeForLTOLazily(
+        Context: &Context,
+        Data: *const u8,
+        len: usize,
+        Identifier: *const c_char,
+    ) -> Option<&Module>;
+    pub fn LLVMRustMaterializeModule(M: &Module) -> bool;
     pub fn LLVMRustGetBitcodeSliceFromObjectData(
         Data: *const u8,
         len: usize,
@@ -2374,6 +2938,14 @@ pub fn LLVMRustThinLTOGetDICompileUnit(
     pub fn LLVMRustThinLTOPatchDICompileUnit(M: &Module, CU: *mut c_void);
 
     pub fn LLVMRustLinkerNew(M: &'a Module) -> &'a mut Linker<'a>;
+    pub fn LLVMRustLinkerComputeLiveness(
+        linker: &Linker<'_>,
+        bytecodes: *const *const c_char,
+        bytecode_lens: *const size_t,
+        num_bytecodes: size_t,
+        preserved: *const *const c_char,
+        num_preserved: size_t,
+    ) -> LLVMRustResult;
     pub fn LLVMRustLinkerAdd(
         linker: &Linker<'_>,
         bytecode: *const c_char,
@@ -2386,4 +2958,12 @@ pub fn LLVMRustComputeLTOCacheKey(
         mod_id: *const c_char,
         data: &ThinLTOData,
     );
+    #[allow(improper_ctypes)]
+    pub fn LLVMRustComputeLTOCacheKeys(
+        keys_out: &RustString,
+        mod_ids: *const *const c_char,
+        num_modules: size_t,
+        data: &ThinLTOData,
+        threads: c_uint,
+    );
 }
@@ -9,8 +9,9 @@
 pub use self::RealPredicate::*;
 
 use libc::c_uint;
-use rustc_data_structures::small_c_str::SmallCStr;
+use rustc_data_structures::fx::FxHashMap;
 use rustc_llvm::RustString;
+use smallvec::SmallVec;
 use std::cell::RefCell;
 use std::ffi::{CStr, CString};
 use std::str::FromStr;
@@ -150,6 +151,103 @@ pub fn toggle_llfn(&self, idx: AttributePlace, llfn: &Value, set: bool) {
     }
 }
 
+/// Collects the attributes of a function or call site, so that they can all be added to it with
+/// one update of its `AttributeList` rather than one per attribute.
+#[derive(Default)]
+pub struct AttributeListBuilder<'a> {
+    entries: Vec<AttributeEntry<'a>>,
+}
+
+impl<'a> AttributeListBuilder<'a> {
+    fn push(
+        &mut self,
+        idx: AttributePlace,
+        kind: AttributeEntryKind,
+        value: u64,
+        ty: Option<&'a Type>,
+    ) {
+        self.entries.push(AttributeEntry { index: idx.as_uint(), kind, value, ty });
+    }
+
+    pub fn add(&mut self, idx: AttributePlace, attr: Attribute) {
+        self.push(idx, AttributeEntryKind::Enum, attr as u64, None);
+    }
+
+    pub fn add_alignment(&mut self, idx: AttributePlace, bytes: u32) {
+        self.push(idx, AttributeEntryKind::Alignment, bytes.into(), None);
+    }
+
+    pub fn add_dereferenceable(&mut self, idx: AttributePlace, bytes: u64) {
+        self.push(idx, AttributeEntryKind::Dereferenceable, bytes, None);
+    }
+
+    pub fn add_dereferenceable_or_null(&mut self, idx: AttributePlace, bytes: u64) {
+        self.push(idx, AttributeEntryKind::DereferenceableOrNull, bytes, None);
+    }
+
+    pub fn add_byval(&mut self, idx: AttributePlace, ty: &'a Type) {
+        self.push(idx, AttributeEntryKind::ByVal, 0, Some(ty));
+    }
+
+    pub fn add_struct_ret(&mut self, idx: AttributePlace, ty: &'a Type) {
+        self.push(idx, AttributeEntryKind::StructRet, 0, Some(ty));
+    }
+}
+
+/// The attribute lists built from `AttributeListBuilder`s so far, by their attributes. Rust ABIs
+/// only come in a few attribute shapes, so most functions and call sites get a list that was
+/// already built, with one FFI call and no attribute construction.
+#[derive(Default)]
+pub struct AttributeListCache<'ll> {
+    lists: RefCell<FxHashMap<Vec<AttributeEntry<'ll>>, &'ll AttributeList>>,
+}
+
+impl<'ll> AttributeListCache<'ll> {
+    fn get(
+        &self,
+        llcx: &'ll Context,
+        attrs: AttributeListBuilder<'ll>,
+    ) -> Option<&'ll AttributeList> {
+        if attrs.entries.is_empty() {
+            return None;
+        }
+        let mut lists = self.lists.borrow_mut();
+        if let Some(&list) = lists.get(&attrs.entries) {
+            return Some(list);
+        }
+        let list = unsafe {
+            LLVMRustCreateAttributeList(llcx, attrs.entries.as_ptr(), attrs.entries.len())
+        };
+        lists.insert(attrs.entries, list);
+        Some(list)
+    }
+
+    pub fn apply_llfn(&self, llcx: &'ll Context, attrs: AttributeListBuilder<'ll>, llfn: &Value) {
+        if let Some(list) = self.get(llcx, attrs) {
+            unsafe { LLVMRustApplyFunctionAttributeList(llfn, list) }
+        }
+    }
+
+    pub fn apply_callsite(
+        &self,
+        llcx: &'ll Context,
+        attrs: AttributeListBuilder<'ll>,
+        callsite: &Value,
+    ) {
+        if let Some(list) = self.get(llcx, attrs) {
+            unsafe { LLVMRustApplyCallSiteAttributeList(callsite, list) }
+        }
+    }
+}
+
+impl Drop for AttributeListCache<'_> {
+    fn drop(&mut self) {
+        for (_, list) in self.lists.get_mut().drain() {
+            unsafe { LLVMRustDisposeAttributeList(list) }
+        }
+    }
+}
+
 pub fn set_section(llglobal: &Value, section_name: &str) {
     let section_name_cstr = CString::new(section_name).expect("unexpected CString error");
     unsafe {
@@ -260,24 +358,31 @@ pub fn last_error() -> Option<String> {
     }
 }
 
-pub struct OperandBundleDef<'a> {
-    pub raw: &'a mut ffi::OperandBundleDef<'a>,
-}
-
-impl OperandBundleDef<'a> {
-    pub fn new(name: &str, vals: &[&'a Value]) -> Self {
-        let name = SmallCStr::new(name);
-        let def = unsafe {
-            LLVMRustBuildOperandBundleDef(name.as_ptr(), vals.as_ptr(), vals.len() as c_uint)
-        };
-        OperandBundleDef { raw: def }
+/// A set of operand bundles, built once and then attached to any number of calls and invokes.
+pub struct OperandBundles<'a> {
+    pub raw: &'a mut ffi::OperandBundles<'a>,
+}
+
+impl OperandBundles<'a> {
+    pub fn new(bundles: &[(&str, &[&'a Value])]) -> Self {
+        let bundles: SmallVec<[_; 2]> = bundles
+            .iter()
+            .map(|&(tag, inputs)| OperandBundle {
+                tag: tag.as_ptr().cast(),
+                tag_len: tag.len(),
+                inputs: inputs.as_ptr(),
+                num_inputs: inputs.len(),
+            })
+            .collect();
+        let raw = unsafe { LLVMRustBuildOperandBundles(bundles.as_ptr(), bundles.len()) };
+        OperandBundles { raw }
     }
 }
 
-impl Drop for OperandBundleDef<'a> {
+impl Drop for OperandBundles<'a> {
     fn drop(&mut self) {
         unsafe {
-            LLVMRustFreeOperandBundleDef(&mut *(self.raw as *mut _));
+            LLVMRustFreeOperandBundles(&mut *(self.raw as *mut _));
         }
     }
 }
@@ -1,15 +1,16 @@
 use crate::back::write::create_informational_target_machine;
 use crate::{llvm, llvm_util};
-use libc::c_int;
+use libc::{c_char, c_int, c_void};
 use rustc_codegen_ssa::target_features::supported_target_features;
 use rustc_data_structures::fx::FxHashSet;
 use rustc_metadata::dynamic_lib::DynamicLibrary;
 use rustc_middle::bug;
-use rustc_session::config::PrintRequest;
+use rustc_session::config::{InstructionSelector, MachineOutliner, PrintRequest};
 use rustc_session::Session;
 use rustc_span::symbol::Symbol;
 use rustc_target::spec::{MergeFunctions, PanicStrategy};
 use std::ffi::{CStr, CString};
+use std::lazy::SyncOnceCell;
 use tracing::debug;
 
 use std::mem;
@@ -88,15 +89,44 @@ fn llvm_arg_to_arg_name(full_arg: &str) -> &str {
         if !sess.opts.debugging_opts.no_generate_arange_section {
             add("-generate-arange-section", false);
         }
+        // Rust gives every struct, enum and union a unique type identifier, which is all LLVM
+        // needs to move the type into a type unit keyed by its signature.
+        if sess.opts.debugging_opts.debug_types_section {
+            add("-generate-type-units", false);
+        }
+        // The pass pipeline picks the instruction selector from these and the optimization level
+        // whenever it's built, overriding what the target machine was told.
+        match sess.opts.debugging_opts.instruction_selector {
+            InstructionSelector::Default => {}
+            InstructionSelector::FastISel => add("-fast-isel", false),
+            InstructionSelector::SelectionDAG => {
+                add("-fast-isel=false", false);
+                add("-global-isel=false", false);
+            }
+            InstructionSelector::GlobalISel => add("-global-isel", false),
+        }
+        // GlobalISel is told through the target machine, FastISel only has the global option.
+        // Falling back for terminators is part of how it works, not a failure.
+        if sess.opts.debugging_opts.isel_abort_on_fallback {
+            add("-fast-isel-abort=3", false);
+        }
 
-        // FIXME(nagisa): disable the machine outliner by default in LLVM versions 11, where it was
-        // introduced and up.
-        //
-        // This should remain in place until https://reviews.llvm.org/D103167 is fixed. If LLVM
-        // has been upgraded since, consider adjusting the version check below to contain an upper
-        // bound.
-        if llvm_util::get_version() >= (11, 0, 0) {
-            add("-enable-machine-outliner=never", false);
+        match sess.opts.debugging_opts.machine_outliner {
+            // FIXME(nagisa): disable the machine outliner by default in LLVM versions 11, where it
+            // was introduced and up.
+            //
+            // This should remain in place until https://reviews.llvm.org/D103167 is fixed. If LLVM
+            // has been upgraded since, consider adjusting the version check below to contain an
+            // upper bound.
+            MachineOutliner::Never => {
+                if llvm_util::get_version() >= (11, 0, 0) {
+                    add("-enable-machine-outliner=never", false);
+                }
+            }
+            // Leaves it to the target which functions are worth outlining from, the target
+            // machine is told to enable the outliner in `target_machine_factory`.
+            MachineOutliner::TargetDefault => {}
+            MachineOutliner::Always => add("-enable-machine-outliner=always", false),
         }
 
         match sess.opts.debugging_opts.merge_functions.unwrap_or(sess.target.merge_functions) {
@@ -123,8 +153,9 @@ fn llvm_arg_to_arg_name(full_arg: &str) -> &str {
     }
 
     if sess.opts.debugging_opts.llvm_time_trace {
-        // time-trace is not thread safe and running it in parallel will cause seg faults.
-        if !sess.opts.debugging_opts.no_parallel_llvm {
+        // Before LLVM 11 time-trace is not thread safe and running it in parallel will cause
+        // seg faults. Later versions keep a profiler per thread, see `spawn_named_thread`.
+        if get_version() < (11, 0, 0) && !sess.opts.debugging_opts.no_parallel_llvm {
             bug!("`-Z llvm-time-trace` requires `-Z no-parallel-llvm")
         }
 
@@ -226,25 +257,63 @@ pub fn print_passes() {
 
 fn llvm_target_features(tm: &llvm::TargetMachine) -> Vec<(&str, &str)> {
     let len = unsafe { llvm::LLVMRustGetTargetFeaturesCount(tm) };
-    let mut ret = Vec::with_capacity(len);
-    for i in 0..len {
-        unsafe {
-            let mut feature = ptr::null();
-            let mut desc = ptr::null();
-            llvm::LLVMRustGetTargetFeature(tm, i, &mut feature, &mut desc);
-            if feature.is_null() || desc.is_null() {
+    let null = llvm::TargetFeature { feature: ptr::null(), desc: ptr::null() };
+    let mut raw = vec![null; len];
+    let len = unsafe { llvm::LLVMRustGetTargetFeatures(tm, raw.as_mut_ptr(), len) };
+    raw[..len]
+        .iter()
+        .map(|raw| unsafe {
+            if raw.feature.is_null() || raw.desc.is_null() {
                 bug!("LLVM returned a `null` target feature string");
             }
-            let feature = CStr::from_ptr(feature).to_str().unwrap_or_else(|e| {
+            let feature = CStr::from_ptr(raw.feature).to_str().unwrap_or_else(|e| {
                 bug!("LLVM returned a non-utf8 feature string: {}", e);
             });
-            let desc = CStr::from_ptr(desc).to_str().unwrap_or_else(|e| {
+            let desc = CStr::from_ptr(raw.desc).to_str().unwrap_or_else(|e| {
                 bug!("LLVM returned a non-utf8 feature string: {}", e);
             });
-            ret.push((feature, desc));
-        }
+            (feature, desc)
+        })
+        .collect()
+}
+
+/// The features LLVM detected on the host CPU, as `+feature` or `-feature`,
+/// or `None` if it cannot detect them on this host. The host is only probed,
+/// and the failure only reported, the first time this is called.
+fn host_cpu_features(sess: &Session) -> Option<&'static [String]> {
+    static HOST_FEATURES: SyncOnceCell<Option<Vec<String>>> = SyncOnceCell::new();
+
+    unsafe extern "C" fn callback(
+        payload: *mut c_void,
+        name: *const c_char,
+        len: usize,
+        enabled: bool,
+    ) {
+        let features = &mut *(payload as *mut Vec<String>);
+        let name = str::from_utf8(slice::from_raw_parts(name.cast(), len)).unwrap_or_else(|e| {
+            bug!("LLVM returned a non-utf8 host feature name: {}", e);
+        });
+        features.push(format!("{}{}", if enabled { '+' } else { '-' }, name));
     }
-    ret
+
+    HOST_FEATURES
+        .get_or_init(|| {
+            let mut features = Vec::new();
+            let detected = unsafe {
+                llvm::LLVMRustGetHostCPUFeatures(callback, &mut features as *mut _ as *mut c_void)
+            };
+            if !detected {
+                sess.warn(
+                    "could not detect the features of the host CPU, \
+                     `-C target-cpu=native` only selects the CPU model",
+                );
+                return None;
+            }
+            // The map LLVM fills has no meaningful order, keep the output stable.
+            features.sort_unstable();
+            Some(features)
+        })
+        .as_deref()
 }
 
 fn print_target_features(sess: &Session, tm: &llvm::TargetMachine) {
@@ -348,24 +417,11 @@ pub fn llvm_global_features(sess: &Session) -> Vec<String> {
     // -Ctarget-cpu=native
     match sess.opts.cg.target_cpu {
         Some(ref s) if s == "native" => {
-            let features_string = unsafe {
-                let ptr = llvm::LLVMGetHostCPUFeatures();
-                let features_string = if !ptr.is_null() {
-                    CStr::from_ptr(ptr)
-                        .to_str()
-                        .unwrap_or_else(|e| {
-                            bug!("LLVM returned a non-utf8 features string: {}", e);
-                        })
-                        .to_owned()
-                } else {
-                    bug!("could not allocate host CPU features, LLVM returned a `null` string");
-                };
-
-                llvm::LLVMDisposeMessage(ptr);
-
-                features_string
-            };
-            features.extend(features_string.split(",").map(String::from));
+            // The CPU name alone would also enable features that this particular
+            // part, or the hypervisor it runs under, has turned off.
+            if let Some(host_features) = host_cpu_features(sess) {
+                features.extend(host_features.iter().cloned());
+            }
         }
         Some(_) | None => {}
     };
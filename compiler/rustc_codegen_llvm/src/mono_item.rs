@@ -135,6 +135,17 @@ pub(crate) unsafe fn should_assume_dso_local(
             return false;
         }
 
+        // Extern statics are the only thing that copy relocations apply to, functions defined
+        // elsewhere are called through the PLT or, without one, through the GOT. Like with clang,
+        // only executables can rely on copy relocations, definitions that a shared object
+        // exports have to stay interposable.
+        let is_var = llvm::LLVMIsAGlobalVariable(llval).is_some();
+        match (is_var, self.tcx.sess.opts.debugging_opts.direct_access_external_data) {
+            (true, Some(true)) if is_declaration && all_exe => return true,
+            (true, Some(false)) => return false,
+            _ => {}
+        }
+
         // Static relocation model should force copy relocations everywhere.
         if self.tcx.sess.relocation_model() == RelocModel::Static {
             return true;
@@ -17,6 +17,7 @@
 use rustc_target::abi::{AddressSpace, Align, Integer, Size};
 
 use std::fmt;
+use std::hash::{Hash, Hasher};
 use std::ptr;
 
 use libc::c_uint;
@@ -27,6 +28,14 @@ fn eq(&self, other: &Self) -> bool {
     }
 }
 
+impl Eq for Type {}
+
+impl Hash for Type {
+    fn hash<H: Hasher>(&self, hasher: &mut H) {
+        (self as *const Self).hash(hasher);
+    }
+}
+
 impl fmt::Debug for Type {
     fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
         f.write_str(
@@ -66,4 +66,15 @@ fn inject_dll_import_lib(
         dll_imports: &[DllImport],
         tmpdir: &MaybeTempDir,
     );
+
+    /// Packages the split DWARF objects referenced by `executable` into the `dwp` file.
+    /// Returns `None` when the backend cannot do this in-process, in which case the external
+    /// `dwp` tool is used instead.
+    fn write_dwarf_package(
+        _sess: &'a Session,
+        _executable: &Path,
+        _dwp: &Path,
+    ) -> Option<Result<(), String>> {
+        None
+    }
 }
@@ -22,6 +22,7 @@
 use super::archive::ArchiveBuilder;
 use super::command::Command;
 use super::linker::{self, Linker};
+use super::metadata::is_thin_archive;
 use super::rpath::{self, RPathConfig};
 use crate::{
     looks_like_rust_object_file, CodegenResults, CompiledModule, CrateInfo, NativeLib,
@@ -35,6 +36,7 @@
 use tempfile::Builder as TempFileBuilder;
 
 use std::ffi::OsString;
+use std::io::Read;
 use std::iter::FromIterator;
 use std::path::{Path, PathBuf};
 use std::process::{ExitStatus, Output, Stdio};
@@ -57,6 +59,7 @@ pub fn link_binary<'a, B: ArchiveBuilder<'a>>(
 ) {
     let _timer = sess.timer("link_binary");
     let output_metadata = sess.opts.output_types.contains_key(&OutputType::Metadata);
+    let mut wrote_thin_rlib = false;
     for &crate_type in sess.crate_types().iter() {
         // Ignore executable crates if we have -Z no-codegen, as they will error.
         if (sess.opts.debugging_opts.no_codegen || !sess.opts.output_types.should_codegen())
@@ -97,6 +100,9 @@ pub fn link_binary<'a, B: ArchiveBuilder<'a>>(
                     let _timer = sess.timer("link_rlib");
                     link_rlib::<B>(sess, codegen_results, RlibFlavor::Normal, &out_filename, &path)
                         .build();
+                    if sess.opts.debugging_opts.thin_archives {
+                        wrote_thin_rlib |= is_thin_archive_file(&out_filename);
+                    }
                 }
                 CrateType::Staticlib => {
                     link_staticlib::<B>(sess, codegen_results, &out_filename, &path);
@@ -130,7 +136,11 @@ pub fn link_binary<'a, B: ArchiveBuilder<'a>>(
                 }
             };
 
-            if sess.opts.output_types.should_link() && !preserve_objects_for_their_debuginfo(sess) {
+            // Thin rlibs refer to the object files instead of containing them.
+            if sess.opts.output_types.should_link()
+                && !preserve_objects_for_their_debuginfo(sess)
+                && !wrote_thin_rlib
+            {
                 for module in &codegen_results.modules {
                     remove_temps_from_module(module);
                 }
@@ -208,6 +218,14 @@ pub fn emit_metadata(sess: &Session, metadata: &[u8], tmpdir: &MaybeTempDir) ->
     out_filename
 }
 
+/// Returns whether the archive at `path` was written as a thin archive. `-Z thin-archives` falls
+/// back to a regular archive when some member doesn't come from a file.
+fn is_thin_archive_file(path: &Path) -> bool {
+    let mut magic = [0; 8];
+    fs::File::open(path).and_then(|mut file| file.read_exact(&mut magic)).is_ok()
+        && is_thin_archive(&magic)
+}
+
 /// Create an 'rlib'.
 ///
 /// An rlib in its current incarnation is essentially a renamed .a file. The rlib primarily contains
@@ -295,7 +313,21 @@ fn link_rlib<'a, B: ArchiveBuilder<'a>>(
             // the target platform so the rlib can be processed entirely by
             // normal linkers for the platform.
             let metadata = create_metadata_file(sess, &codegen_results.metadata.raw_data);
-            ab.add_file(&emit_metadata(sess, &metadata, tmpdir));
+            if sess.opts.debugging_opts.thin_archives {
+                // A thin rlib only refers to its members, so the metadata has to outlive the
+                // temporary directory. It keeps its name so that it can still be found.
+                let dir = out_filename.with_extension("thin");
+                if let Err(e) = fs::create_dir_all(&dir) {
+                    sess.fatal(&format!("failed to create {}: {}", dir.display(), e));
+                }
+                let path = dir.join(METADATA_FILENAME);
+                if let Err(e) = fs::write(&path, &metadata) {
+                    sess.fatal(&format!("failed to write {}: {}", path.display(), e));
+                }
+                ab.add_file(&path);
+            } else {
+                ab.add_file(&emit_metadata(sess, &metadata, tmpdir));
+            }
 
             // After adding all files to the archive, we need to update the
             // symbol table of the archive. This currently dies on macOS (see
@@ -473,14 +505,13 @@ fn collate_raw_dylibs(
 
     // Rustc already signals an error if we have two imports with the same name but different
     // calling conventions (or function signatures), so we don't have pay attention to those
-    // when ordering.
-    // FIXME: when we add support for ordinals, figure out if we need to do anything if we
-    // have two DllImport values with the same name but different ordinals.
+    // when ordering. Imports with the same name but different ordinals are rejected below, at
+    // the one with the higher ordinal.
     let mut result: Vec<(String, Vec<DllImport>)> = dylib_table
         .into_iter()
         .map(|(lib_name, import_table)| {
             let mut imports = Vec::from_iter(import_table.into_iter());
-            imports.sort_unstable_by_key(|x: &DllImport| x.name.as_str());
+            imports.sort_unstable_by_key(|x: &DllImport| (x.name.as_str(), x.ordinal));
             (lib_name, imports)
         })
         .collect::<Vec<_>>();
@@ -489,13 +520,25 @@ fn collate_raw_dylibs(
     });
     let result = result;
 
-    // Check for multiple imports with the same name but different calling conventions or
-    // (when relevant) argument list sizes.  Rustc only signals an error for this if the
+    // Check for multiple imports with the same name but different ordinals, calling conventions
+    // or (when relevant) argument list sizes.  Rustc only signals an error for this if the
     // declarations are at the same scope level; if one shadows the other, we only get a lint
     // warning.
     for (library, imports) in &result {
         let mut import_table: FxHashMap<Symbol, DllCallingConvention> = FxHashMap::default();
+        let mut ordinal_table: FxHashMap<Symbol, Option<u16>> = FxHashMap::default();
         for import in imports {
+            if let Some(old_ordinal) = ordinal_table.insert(import.name, import.ordinal) {
+                if import.ordinal != old_ordinal {
+                    sess.span_fatal(
+                        import.span,
+                        &format!(
+                            "multiple declarations of external item `{}` from library `{}` have different ordinals",
+                            import.name, library,
+                        ),
+                    );
+                }
+            }
             if let Some(old_convention) =
                 import_table.insert(import.name, import.calling_convention)
             {
@@ -595,10 +638,29 @@ fn escape_stdout_stderr_string(s: &[u8]) -> String {
 
 /// Invoke `llvm-dwp` (shipped alongside rustc) to link `dwo` files from Split DWARF into a `dwp`
 /// file.
-fn link_dwarf_object<'a>(sess: &'a Session, executable_out_filename: &Path) {
+fn link_dwarf_object<'a, B: ArchiveBuilder<'a>>(sess: &'a Session, executable_out_filename: &Path) {
     info!("preparing dwp to {}.dwp", executable_out_filename.to_str().unwrap());
 
     let dwp_out_filename = executable_out_filename.with_extension("dwp");
+
+    // Prefer packaging in-process, which avoids spawning the tool and re-reading the
+    // executable in a separate process; fall back to `rust-llvm-dwp` otherwise.
+    let packaged = sess.time("write_dwarf_package", || {
+        B::write_dwarf_package(sess, executable_out_filename, &dwp_out_filename)
+    });
+    match packaged {
+        Some(Ok(())) => return,
+        Some(Err(e)) => {
+            sess.err(&format!(
+                "failed to write dwarf package `{}`: {}",
+                dwp_out_filename.display(),
+                e
+            ));
+            return;
+        }
+        None => {}
+    }
+
     let mut cmd = Command::new(LLVM_DWP_EXECUTABLE);
     cmd.arg("-e");
     cmd.arg(executable_out_filename);
@@ -988,7 +1050,7 @@ fn is_illegal_instruction(_status: &ExitStatus) -> bool {
         SplitDebuginfo::Packed if sess.target.is_like_msvc => {}
 
         // ... and otherwise we're processing a `*.dwp` packed dwarf file.
-        SplitDebuginfo::Packed => link_dwarf_object(sess, &out_filename),
+        SplitDebuginfo::Packed => link_dwarf_object::<B>(sess, &out_filename),
     }
 
     if sess.target.is_like_osx {
@@ -1970,10 +2032,21 @@ fn add_order_independent_options(
         cmd.no_default_libraries();
     }
 
-    if sess.opts.cg.profile_generate.enabled() || sess.instrument_coverage() {
+    if sess.instrument_pgo() || sess.instrument_coverage() {
         cmd.pgo_gen();
     }
 
+    if let Some(path) = &sess.opts.debugging_opts.symbol_ordering_file {
+        if linker_takes_symbol_ordering_file(sess, flavor) {
+            cmd.symbol_ordering_file(path);
+        } else {
+            sess.warn(
+                "`-Z symbol-ordering-file` is ignored, only lld, ld64 and link.exe are known \
+                 to take a symbol ordering file",
+            );
+        }
+    }
+
     if sess.opts.cg.control_flow_guard != CFGuard::Disabled {
         cmd.control_flow_guard();
     }
@@ -2490,6 +2563,31 @@ fn get_apple_sdk_root(sdk_name: &str) -> Result<String, String> {
     }
 }
 
+/// Whether the linker takes the file of `-Z symbol-ordering-file`. ld64 and
+/// link.exe do, as does lld in every flavor, but GNU ld and gold reject lld's
+/// `--symbol-ordering-file`.
+fn linker_takes_symbol_ordering_file(sess: &Session, flavor: LinkerFlavor) -> bool {
+    let fuse_lld = |args: &[String]| args.iter().any(|arg| arg == "-fuse-ld=lld");
+    match flavor {
+        LinkerFlavor::Gcc | LinkerFlavor::Ld if sess.target.is_like_osx => true,
+        LinkerFlavor::Msvc
+        | LinkerFlavor::Lld(LldFlavor::Link)
+        | LinkerFlavor::Lld(LldFlavor::Ld)
+        | LinkerFlavor::Lld(LldFlavor::Ld64) => true,
+        LinkerFlavor::Ld => {
+            let stem = sess.opts.cg.linker.as_ref().and_then(|linker| linker.file_stem());
+            stem.map_or(false, |stem| stem == "ld.lld")
+        }
+        LinkerFlavor::Gcc => {
+            matches!(sess.opts.debugging_opts.gcc_ld, Some(LdImpl::Lld))
+                || fuse_lld(&sess.opts.cg.link_args)
+                || fuse_lld(&sess.opts.debugging_opts.pre_link_args)
+                || sess.target.pre_link_args.get(&flavor).map_or(false, |args| fuse_lld(args))
+        }
+        _ => false,
+    }
+}
+
 fn add_gcc_ld_path(cmd: &mut dyn Linker, sess: &Session, flavor: LinkerFlavor) {
     if let Some(ld_impl) = sess.opts.debugging_opts.gcc_ld {
         if let LinkerFlavor::Gcc = flavor {
@@ -192,6 +192,7 @@ pub trait Linker {
     fn linker_plugin_lto(&mut self);
     fn add_eh_frame_header(&mut self) {}
     fn add_no_exec(&mut self) {}
+    fn symbol_ordering_file(&mut self, _path: &Path) {}
     fn add_as_needed(&mut self) {}
     fn reset_per_library_state(&mut self) {}
 }
@@ -762,6 +763,17 @@ fn add_no_exec(&mut self) {
         }
     }
 
+    fn symbol_ordering_file(&mut self, path: &Path) {
+        if self.sess.target.is_like_osx {
+            self.linker_arg("-order_file");
+            self.linker_arg(path);
+        } else {
+            let mut arg = OsString::from("--symbol-ordering-file=");
+            arg.push(path);
+            self.linker_arg(arg);
+        }
+    }
+
     fn add_as_needed(&mut self) {
         if self.sess.target.linker_is_gnu && !self.sess.target.is_like_windows {
             self.linker_arg("--as-needed");
@@ -903,6 +915,12 @@ fn control_flow_guard(&mut self) {
         self.cmd.arg("/guard:cf");
     }
 
+    fn symbol_ordering_file(&mut self, path: &Path) {
+        let mut arg = OsString::from("/ORDER:@");
+        arg.push(path);
+        self.cmd.arg(arg);
+    }
+
     fn debuginfo(&mut self, strip: Strip) {
         match strip {
             Strip::None => {
@@ -25,21 +25,34 @@ pub fn cost(&self) -> u64 {
     }
 
     pub fn data(&self) -> &[u8] {
-        let a = self.shared.thin_buffers.get(self.idx).map(|b| b.data());
-        a.unwrap_or_else(|| {
-            let len = self.shared.thin_buffers.len();
-            self.shared.serialized_modules[self.idx - len].data()
-        })
+        self.shared.modules[self.idx].data()
     }
 }
 
 pub struct ThinShared<B: WriteBackendMethods> {
     pub data: B::ThinData,
-    pub thin_buffers: Vec<B::ThinBuffer>,
-    pub serialized_modules: Vec<SerializedModule<B::ModuleBuffer>>,
+    /// The modules taking part in the thin link, indexed like `module_names`.
+    pub modules: Vec<ThinModuleSource<B>>,
     pub module_names: Vec<CString>,
 }
 
+/// Where the bitcode of a module participating in ThinLTO comes from.
+pub enum ThinModuleSource<B: WriteBackendMethods> {
+    /// A module codegened in this session.
+    Local(B::ThinBuffer),
+    /// A module of an upstream crate, or one from the incremental cache.
+    Serialized(SerializedModule<B::ModuleBuffer>),
+}
+
+impl<B: WriteBackendMethods> ThinModuleSource<B> {
+    pub fn data(&self) -> &[u8] {
+        match *self {
+            ThinModuleSource::Local(ref buffer) => buffer.data(),
+            ThinModuleSource::Serialized(ref module) => module.data(),
+        }
+    }
+}
+
 pub enum LtoModuleCodegen<B: WriteBackendMethods> {
     Fat {
         module: Option<ModuleCodegen<B::Module>>,
@@ -95,6 +108,8 @@ pub enum SerializedModule<M: ModuleBufferMethods> {
     Local(M),
     FromRlib(Vec<u8>),
     FromUncompressedFile(Mmap),
+    /// Bitcode that stays inside an rlib the backend has mapped, instead of being copied out.
+    FromMappedRlib(Box<dyn ModuleBufferMethods + Send>),
 }
 
 impl<M: ModuleBufferMethods> SerializedModule<M> {
@@ -103,6 +118,7 @@ pub fn data(&self) -> &[u8] {
             SerializedModule::Local(ref m) => m.data(),
             SerializedModule::FromRlib(ref m) => m,
             SerializedModule::FromUncompressedFile(ref m) => m,
+            SerializedModule::FromMappedRlib(ref m) => m.data(),
         }
     }
 }
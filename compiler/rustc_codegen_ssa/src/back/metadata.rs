@@ -1,7 +1,8 @@
 //! Reading of the rustc metadata for rlibs and dylibs
 
 use std::fs::File;
-use std::path::Path;
+use std::path::{Path, PathBuf};
+use std::str;
 
 use object::{Object, ObjectSection};
 use rustc_data_structures::memmap::Mmap;
@@ -19,27 +20,40 @@
 ///
 /// <dl>
 /// <dt>rlib</dt>
-/// <dd>The metadata can be found in the `lib.rmeta` file inside of the ar archive.</dd>
+/// <dd>The metadata can be found in the `lib.rmeta` file inside of the ar archive, or in the
+/// file it refers to if it is a thin archive (`-Z thin-archives`).</dd>
 /// <dt>dylib</dt>
 /// <dd>The metadata can be found in the `.rustc` section of the shared library.</dd>
 /// </dl>
 pub struct DefaultMetadataLoader;
 
+fn map_file(path: &Path) -> Result<Mmap, String> {
+    let file =
+        File::open(path).map_err(|e| format!("failed to open file '{}': {}", path.display(), e))?;
+    unsafe { Mmap::map(file) }
+        .map_err(|e| format!("failed to mmap file '{}': {}", path.display(), e))
+}
+
 fn load_metadata_with(
     path: &Path,
     f: impl for<'a> FnOnce(&'a [u8]) -> Result<&'a [u8], String>,
 ) -> Result<MetadataRef, String> {
-    let file =
-        File::open(path).map_err(|e| format!("failed to open file '{}': {}", path.display(), e))?;
-    let data = unsafe { Mmap::map(file) }
-        .map_err(|e| format!("failed to mmap file '{}': {}", path.display(), e))?;
+    let data = map_file(path)?;
     let metadata = OwningRef::new(data).try_map(f)?;
     return Ok(rustc_erase_owner!(metadata.map_owner_box()));
 }
 
 impl MetadataLoader for DefaultMetadataLoader {
     fn get_rlib_metadata(&self, _target: &Target, path: &Path) -> Result<MetadataRef, String> {
-        load_metadata_with(path, |data| {
+        let data = map_file(path)?;
+        if is_thin_archive(&data) {
+            let member = find_thin_archive_member(path, &data, METADATA_FILENAME)?;
+            return load_metadata_with(&member, |data| {
+                search_for_metadata(&member, data, ".rmeta")
+            });
+        }
+
+        let metadata = OwningRef::new(data).try_map(|data| {
             let archive = object::read::archive::ArchiveFile::parse(&*data)
                 .map_err(|e| format!("failed to parse rlib '{}': {}", path.display(), e))?;
 
@@ -55,7 +69,8 @@ fn get_rlib_metadata(&self, _target: &Target, path: &Path) -> Result<MetadataRef
             }
 
             Err(format!("metadata not found in rlib '{}'", path.display()))
-        })
+        })?;
+        Ok(rustc_erase_owner!(metadata.map_owner_box()))
     }
 
     fn get_dylib_metadata(&self, _target: &Target, path: &Path) -> Result<MetadataRef, String> {
@@ -63,6 +78,65 @@ fn get_dylib_metadata(&self, _target: &Target, path: &Path) -> Result<MetadataRe
     }
 }
 
+const THIN_ARCHIVE_MAGIC: &[u8] = b"!<thin>\n";
+
+/// Returns whether `data`, the contents of an archive, is a thin archive.
+pub fn is_thin_archive(data: &[u8]) -> bool {
+    data.starts_with(THIN_ARCHIVE_MAGIC)
+}
+
+/// Returns the path of the member called `member_name` in the thin archive `data`, read from
+/// `path`. Thin archives only store the paths of their members, relative to the archive, so the
+/// `object` crate's archive reader can't be used for them.
+fn find_thin_archive_member(
+    path: &Path,
+    data: &[u8],
+    member_name: &str,
+) -> Result<PathBuf, String> {
+    let malformed = || format!("failed to parse thin rlib '{}'", path.display());
+
+    let mut long_names: &[u8] = &[];
+    let mut pos = THIN_ARCHIVE_MAGIC.len();
+    while pos + 60 <= data.len() {
+        let header = &data[pos..pos + 60];
+        pos += 60;
+        let size: usize = str::from_utf8(&header[48..58])
+            .ok()
+            .and_then(|s| s.trim_end().parse().ok())
+            .ok_or_else(malformed)?;
+        let padded_size = size + (size & 1);
+        let name = str::from_utf8(&header[..16]).map_err(|_| malformed())?.trim_end();
+
+        // Only the symbol table and the long name table keep their data in a thin archive.
+        match name {
+            "/" | "/SYM64/" => pos += padded_size,
+            "//" => {
+                long_names = data.get(pos..pos + size).ok_or_else(malformed)?;
+                pos += padded_size;
+            }
+            _ => {
+                let name = match name.strip_prefix('/') {
+                    Some(offset) => {
+                        let offset: usize = offset.parse().map_err(|_| malformed())?;
+                        let rest = long_names.get(offset..).ok_or_else(malformed)?;
+                        let end =
+                            rest.windows(2).position(|w| w == b"/\n").ok_or_else(malformed)?;
+                        str::from_utf8(&rest[..end]).map_err(|_| malformed())?
+                    }
+                    None => name.strip_suffix('/').unwrap_or(name),
+                };
+                let member = Path::new(name);
+                if member.file_name().map_or(false, |n| n == member_name) {
+                    let dir = path.parent().unwrap_or_else(|| Path::new(""));
+                    return Ok(dir.join(member));
+                }
+            }
+        }
+    }
+
+    Err(format!("metadata not found in rlib '{}'", path.display()))
+}
+
 fn search_for_metadata<'a>(
     path: &Path,
     bytes: &'a [u8],
@@ -83,3 +157,6 @@ fn search_for_metadata<'a>(
         .data()
         .map_err(|e| format!("failed to read {} section in '{}': {}", section, path.display(), e))
 }
+
+#[cfg(test)]
+mod tests;
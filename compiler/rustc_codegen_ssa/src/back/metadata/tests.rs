@@ -0,0 +1,71 @@
+use super::{find_thin_archive_member, is_thin_archive};
+use std::path::Path;
+
+fn member_header(name: &str, size: usize) -> String {
+    format!("{:<16}{:<12}{:<6}{:<6}{:<8}{:<10}`\n", name, 0, 0, 0, 644, size)
+}
+
+/// Builds a thin archive referring to `members`, with a symbol table and a long name table
+/// the way `llvm-ar` writes them.
+fn thin_archive(members: &[&str]) -> Vec<u8> {
+    let mut long_names = String::new();
+    let mut headers = String::new();
+    for member in members {
+        if member.len() < 16 {
+            headers.push_str(&member_header(&format!("{}/", member), 0));
+        } else {
+            headers.push_str(&member_header(&format!("/{}", long_names.len()), 0));
+            long_names.push_str(member);
+            long_names.push_str("/\n");
+        }
+    }
+
+    let mut archive = String::from("!<thin>\n");
+    archive.push_str(&member_header("/", 4));
+    archive.push_str("\0\0\0\0");
+    if !long_names.is_empty() {
+        archive.push_str(&member_header("//", long_names.len()));
+        archive.push_str(&long_names);
+        if long_names.len() % 2 == 1 {
+            archive.push('\n');
+        }
+    }
+    archive.push_str(&headers);
+    archive.into_bytes()
+}
+
+#[test]
+fn test_is_thin_archive() {
+    assert!(is_thin_archive(&thin_archive(&["lib.rmeta"])));
+    assert!(!is_thin_archive(b"!<arch>\n"));
+    assert!(!is_thin_archive(b"!<thin"));
+}
+
+#[test]
+fn test_short_member_name() {
+    let archive = thin_archive(&["foo.foo.3a1fbbbh-cgu.0.rcgu.o", "lib.rmeta"]);
+    let member = find_thin_archive_member(Path::new("out/libfoo.rlib"), &archive, "lib.rmeta");
+    assert_eq!(member.unwrap(), Path::new("out/lib.rmeta"));
+}
+
+#[test]
+fn test_long_member_name() {
+    let archive = thin_archive(&["foo.foo.3a1fbbbh-cgu.0.rcgu.o", "libfoo.thin/lib.rmeta"]);
+    let member = find_thin_archive_member(Path::new("out/libfoo.rlib"), &archive, "lib.rmeta");
+    assert_eq!(member.unwrap(), Path::new("out/libfoo.thin/lib.rmeta"));
+}
+
+#[test]
+fn test_missing_member() {
+    let archive = thin_archive(&["foo.foo.3a1fbbbh-cgu.0.rcgu.o"]);
+    assert!(find_thin_archive_member(Path::new("libfoo.rlib"), &archive, "lib.rmeta").is_err());
+}
+
+#[test]
+fn test_truncated_long_name_table() {
+    let mut archive = thin_archive(&["libfoo.thin/lib.rmeta"]);
+    let end = archive.len() - 60;
+    archive.truncate(end - 4);
+    let member = find_thin_archive_member(Path::new("libfoo.rlib"), &archive, "lib.rmeta");
+    assert!(member.is_err());
+}
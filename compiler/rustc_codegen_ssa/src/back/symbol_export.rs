@@ -189,7 +189,7 @@ fn exported_symbols_provider_local(
         }
     }
 
-    if tcx.sess.instrument_coverage() || tcx.sess.opts.cg.profile_generate.enabled() {
+    if tcx.sess.instrument_coverage() || tcx.sess.instrument_pgo() {
         // These are weak symbols that point to the profile version and the
         // profile name, which need to be treated as exported so LTO doesn't nix
         // them.
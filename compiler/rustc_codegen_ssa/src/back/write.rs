@@ -43,6 +43,7 @@
 use std::sync::mpsc::{channel, Receiver, Sender};
 use std::sync::Arc;
 use std::thread;
+use std::time::{Duration, Instant};
 
 const PRE_LTO_BC_EXT: &str = "pre-lto.bc";
 
@@ -83,6 +84,9 @@ pub struct ModuleConfig {
 
     pub pgo_gen: SwitchWithOptPath,
     pub pgo_use: Option<PathBuf>,
+    pub pgo_cs_gen: SwitchWithOptPath,
+    pub pgo_sample_use: Option<PathBuf>,
+    pub pgo_remapping_file: Option<PathBuf>,
     pub instrument_coverage: bool,
     pub instrument_gcov: bool,
 
@@ -97,6 +101,9 @@ pub struct ModuleConfig {
     pub emit_ir: bool,
     pub emit_asm: bool,
     pub emit_obj: EmitObj,
+    /// Produce the assembly by disassembling the object code, rather than by
+    /// running codegen a second time.
+    pub emit_asm_from_obj: bool,
     pub bc_cmdline: String,
 
     // Miscellaneous flags.  These are mostly copied from command-line
@@ -176,6 +183,15 @@ macro_rules! if_regular {
                 SwitchWithOptPath::Disabled
             ),
             pgo_use: if_regular!(sess.opts.cg.profile_use.clone(), None),
+            pgo_cs_gen: if_regular!(
+                sess.opts.debugging_opts.cs_profile_generate.clone(),
+                SwitchWithOptPath::Disabled
+            ),
+            pgo_sample_use: if_regular!(sess.opts.debugging_opts.profile_sample_use.clone(), None),
+            pgo_remapping_file: if_regular!(
+                sess.opts.debugging_opts.profile_remapping_file.clone(),
+                None
+            ),
             instrument_coverage: if_regular!(sess.instrument_coverage(), false),
             instrument_gcov: if_regular!(
                 // compiler_builtins overrides the codegen-units settings,
@@ -213,6 +229,7 @@ macro_rules! if_regular {
                 false
             ),
             emit_obj,
+            emit_asm_from_obj: sess.opts.debugging_opts.asm_from_object,
             bc_cmdline: sess.target.bitcode_llvm_cmdline.clone(),
 
             verify_llvm_ir: sess.verify_llvm_ir(),
@@ -304,6 +321,7 @@ pub struct CodegenContext<B: WriteBackendMethods> {
     pub prof: SelfProfilerRef,
     pub lto: Lto,
     pub no_landing_pads: bool,
+    pub must_emit_unwind_tables: bool,
     pub save_temps: bool,
     pub fewer_names: bool,
     pub exported_symbols: Option<Arc<ExportedSymbols>>,
@@ -354,6 +372,54 @@ pub fn config(&self, kind: ModuleKind) -> &ModuleConfig {
     }
 }
 
+/// Jobserver tokens for a single parallel section of work that is otherwise serial, such as
+/// parts of the thin link. Create it right before the section and drop it right after, so the
+/// tokens are only held while they're used. The current thread keeps running on the token it
+/// already has. Nothing is requested under `-Z no-parallel-llvm`.
+pub struct ExtraTokens {
+    _helper: Option<jobserver::HelperThread>,
+    receiver: Receiver<io::Result<Acquired>>,
+    tokens: Vec<Acquired>,
+    wanted: usize,
+}
+
+impl ExtraTokens {
+    pub fn request<B: WriteBackendMethods>(cgcx: &CodegenContext<B>, wanted: usize) -> ExtraTokens {
+        let (sender, receiver) = channel();
+        let helper = if cgcx.opts.debugging_opts.no_parallel_llvm || wanted == 0 {
+            None
+        } else {
+            rustc_data_structures::jobserver::client()
+                .into_helper_thread(move |token| drop(sender.send(token)))
+                .ok()
+        };
+        if let Some(ref helper) = helper {
+            for _ in 0..wanted {
+                helper.request_token();
+            }
+        }
+        let wanted = if helper.is_some() { wanted } else { 0 };
+        ExtraTokens { _helper: helper, receiver, tokens: Vec::new(), wanted }
+    }
+
+    /// Waits for the requested tokens and returns the number of threads that may run, including
+    /// the current one. Free tokens are handed out almost immediately, but the wait is capped at
+    /// a few milliseconds: a jobserver without free tokens (e.g. under `-j1`) could otherwise
+    /// stall the section indefinitely, and running it on fewer threads is always fine.
+    pub fn acquire(&mut self) -> usize {
+        let deadline = Instant::now() + Duration::from_millis(10);
+        while self.tokens.len() < self.wanted {
+            let timeout = deadline.saturating_duration_since(Instant::now());
+            match self.receiver.recv_timeout(timeout) {
+                Ok(Ok(token)) => self.tokens.push(token),
+                Ok(Err(_)) => self.wanted -= 1,
+                Err(_) => break,
+            }
+        }
+        self.tokens.len() + 1
+    }
+}
+
 fn generate_lto_work<B: ExtraBackendMethods>(
     cgcx: &CodegenContext<B>,
     needs_fat_lto: Vec<FatLTOInput<B>>,
@@ -664,12 +730,15 @@ pub enum WorkItem<B: WriteBackendMethods> {
     CopyPostLtoArtifacts(CachedModuleCodegen),
     /// Performs (Thin)LTO on the given module.
     LTO(lto::LtoModuleCodegen<B>),
+    /// Generates code for a module that is already optimized, such as one of
+    /// the partitions of the fat LTO module.
+    Codegen(ModuleCodegen<B::Module>),
 }
 
 impl<B: WriteBackendMethods> WorkItem<B> {
     pub fn module_kind(&self) -> ModuleKind {
         match *self {
-            WorkItem::Optimize(ref m) => m.kind,
+            WorkItem::Optimize(ref m) | WorkItem::Codegen(ref m) => m.kind,
             WorkItem::CopyPostLtoArtifacts(_) | WorkItem::LTO(_) => ModuleKind::Regular,
         }
     }
@@ -685,6 +754,9 @@ fn start_profiling<'a>(&self, cgcx: &'a CodegenContext<B>) -> TimingGuard<'a> {
             WorkItem::LTO(ref m) => {
                 cgcx.prof.generic_activity_with_arg("codegen_module_perform_lto", m.name())
             }
+            WorkItem::Codegen(ref m) => {
+                cgcx.prof.generic_activity_with_arg("codegen_module_codegen", &m.name[..])
+            }
         }
     }
 
@@ -712,6 +784,12 @@ fn short_description(&self) -> String {
                 #[cfg(not(windows))]
                 return format!("LTO {}", m.name());
             }
+            WorkItem::Codegen(m) => {
+                #[cfg(windows)]
+                return format!("codegen module {}", m.name);
+                #[cfg(not(windows))]
+                return format!("cg {}", m.name);
+            }
         }
     }
 }
@@ -721,6 +799,7 @@ enum WorkItemResult<B: WriteBackendMethods> {
     NeedsLink(ModuleCodegen<B::Module>),
     NeedsFatLTO(FatLTOInput<B>),
     NeedsThinLTO(String, B::ThinBuffer),
+    NeedsCodegen(Vec<ModuleCodegen<B::Module>>),
 }
 
 pub enum FatLTOInput<B: WriteBackendMethods> {
@@ -740,6 +819,7 @@ fn execute_work_item<B: ExtraBackendMethods>(
             Ok(execute_copy_from_cache_work_item(cgcx, module, module_config))
         }
         WorkItem::LTO(module) => execute_lto_work_item(cgcx, module, module_config),
+        WorkItem::Codegen(module) => finish_intra_module_work(cgcx, module, module_config),
     }
 }
 
@@ -821,12 +901,13 @@ fn execute_optimize_work_item<B: ExtraBackendMethods>(
     match lto_type {
         ComputedLtoType::No => finish_intra_module_work(cgcx, module, module_config),
         ComputedLtoType::Thin => {
-            let (name, thin_buffer) = B::prepare_thin(module);
+            let (name, mut thin_buffer) = B::prepare_thin(cgcx, module);
             if let Some(path) = bitcode {
                 fs::write(&path, thin_buffer.data()).unwrap_or_else(|e| {
                     panic!("Error writing pre-lto-bitcode file `{}`: {}", path.display(), e);
                 });
             }
+            B::compress_thin_buffer(cgcx, &name, &mut thin_buffer);
             Ok(WorkItemResult::NeedsThinLTO(name, thin_buffer))
         }
         ComputedLtoType::Fat => match bitcode {
@@ -886,7 +967,31 @@ fn execute_lto_work_item<B: ExtraBackendMethods>(
     mut module: lto::LtoModuleCodegen<B>,
     module_config: &ModuleConfig,
 ) -> Result<WorkItemResult<B>, FatalError> {
+    // With `-Z fat-lto-partitions` the optimized fat LTO module is split up
+    // and each partition is sent back to the coordinator to have its code
+    // generated in parallel. Only do so when object code is all that is
+    // emitted, as the other outputs would also be split, and when no object
+    // file was asked for, which has to come from a single module.
+    let partitions = cgcx.opts.debugging_opts.fat_lto_partitions;
+    let split = partitions > 1
+        && matches!(module, lto::LtoModuleCodegen::Fat { .. })
+        && matches!(module_config.emit_obj, EmitObj::ObjectCode(_))
+        && !module_config.emit_bc
+        && !module_config.emit_ir
+        && !module_config.emit_asm
+        && !cgcx.opts.output_types.contains_key(&OutputType::Object)
+        && !cgcx.opts.debugging_opts.combine_cgu;
+
     let module = unsafe { module.optimize(cgcx)? };
+    if split {
+        let diag_handler = cgcx.create_diag_handler();
+        let mut modules = B::split_fat_lto_module(cgcx, &diag_handler, module, partitions)?;
+        if modules.len() > 1 {
+            return Ok(WorkItemResult::NeedsCodegen(modules));
+        }
+        let module = modules.pop().unwrap();
+        return finish_intra_module_work(cgcx, module, module_config);
+    }
     finish_intra_module_work(cgcx, module, module_config)
 }
 
@@ -923,6 +1028,10 @@ pub enum Message<B: WriteBackendMethods> {
         module: ModuleCodegen<B::Module>,
         worker_id: usize,
     },
+    NeedsCodegen {
+        modules: Vec<ModuleCodegen<B::Module>>,
+        worker_id: usize,
+    },
     Done {
         result: Result<CompiledModule, Option<WorkerFatalError>>,
         worker_id: usize,
@@ -1033,6 +1142,7 @@ fn start_executing_work<B: ExtraBackendMethods>(
         each_linked_rlib_for_lto,
         lto: sess.lto(),
         no_landing_pads: sess.panic_strategy() == PanicStrategy::Abort,
+        must_emit_unwind_tables: sess.must_emit_unwind_tables(),
         fewer_names: sess.fewer_names(),
         save_temps: sess.opts.cg.save_temps,
         opts: Arc::new(sess.opts.clone()),
@@ -1483,6 +1593,17 @@ fn start_executing_work<B: ExtraBackendMethods>(
                     free_worker(worker_id);
                     needs_link.push(module);
                 }
+                Message::NeedsCodegen { modules, worker_id } => {
+                    assert!(started_lto);
+                    free_worker(worker_id);
+                    for module in modules {
+                        // The partitions have no cost estimate, so they sort below everything.
+                        work_items.insert(0, (WorkItem::Codegen(module), 0));
+                        if !cgcx.opts.debugging_opts.no_parallel_llvm {
+                            helper.request_token();
+                        }
+                    }
+                }
                 Message::NeedsFatLTO { result, worker_id } => {
                     assert!(!started_lto);
                     free_worker(worker_id);
@@ -1611,59 +1732,62 @@ fn maybe_start_llvm_timer<'a>(
 pub struct WorkerFatalError;
 
 fn spawn_work<B: ExtraBackendMethods>(cgcx: CodegenContext<B>, work: WorkItem<B>) {
-    let builder = thread::Builder::new().name(work.short_description());
-    builder
-        .spawn(move || {
-            // Set up a destructor which will fire off a message that we're done as
-            // we exit.
-            struct Bomb<B: ExtraBackendMethods> {
-                coordinator_send: Sender<Box<dyn Any + Send>>,
-                result: Option<Result<WorkItemResult<B>, FatalError>>,
-                worker_id: usize,
-            }
-            impl<B: ExtraBackendMethods> Drop for Bomb<B> {
-                fn drop(&mut self) {
-                    let worker_id = self.worker_id;
-                    let msg = match self.result.take() {
-                        Some(Ok(WorkItemResult::Compiled(m))) => {
-                            Message::Done::<B> { result: Ok(m), worker_id }
-                        }
-                        Some(Ok(WorkItemResult::NeedsLink(m))) => {
-                            Message::NeedsLink::<B> { module: m, worker_id }
-                        }
-                        Some(Ok(WorkItemResult::NeedsFatLTO(m))) => {
-                            Message::NeedsFatLTO::<B> { result: m, worker_id }
-                        }
-                        Some(Ok(WorkItemResult::NeedsThinLTO(name, thin_buffer))) => {
-                            Message::NeedsThinLTO::<B> { name, thin_buffer, worker_id }
-                        }
-                        Some(Err(FatalError)) => {
-                            Message::Done::<B> { result: Err(Some(WorkerFatalError)), worker_id }
-                        }
-                        None => Message::Done::<B> { result: Err(None), worker_id },
-                    };
-                    drop(self.coordinator_send.send(Box::new(msg)));
-                }
+    let time_trace = cgcx.opts.debugging_opts.llvm_time_trace;
+
+    B::spawn_named_thread(time_trace, work.short_description(), move || {
+        // Set up a destructor which will fire off a message that we're done as
+        // we exit.
+        struct Bomb<B: ExtraBackendMethods> {
+            coordinator_send: Sender<Box<dyn Any + Send>>,
+            result: Option<Result<WorkItemResult<B>, FatalError>>,
+            worker_id: usize,
+        }
+        impl<B: ExtraBackendMethods> Drop for Bomb<B> {
+            fn drop(&mut self) {
+                let worker_id = self.worker_id;
+                let msg = match self.result.take() {
+                    Some(Ok(WorkItemResult::Compiled(m))) => {
+                        Message::Done::<B> { result: Ok(m), worker_id }
+                    }
+                    Some(Ok(WorkItemResult::NeedsLink(m))) => {
+                        Message::NeedsLink::<B> { module: m, worker_id }
+                    }
+                    Some(Ok(WorkItemResult::NeedsFatLTO(m))) => {
+                        Message::NeedsFatLTO::<B> { result: m, worker_id }
+                    }
+                    Some(Ok(WorkItemResult::NeedsThinLTO(name, thin_buffer))) => {
+                        Message::NeedsThinLTO::<B> { name, thin_buffer, worker_id }
+                    }
+                    Some(Ok(WorkItemResult::NeedsCodegen(modules))) => {
+                        Message::NeedsCodegen::<B> { modules, worker_id }
+                    }
+                    Some(Err(FatalError)) => {
+                        Message::Done::<B> { result: Err(Some(WorkerFatalError)), worker_id }
+                    }
+                    None => Message::Done::<B> { result: Err(None), worker_id },
+                };
+                drop(self.coordinator_send.send(Box::new(msg)));
             }
+        }
 
-            let mut bomb = Bomb::<B> {
-                coordinator_send: cgcx.coordinator_send.clone(),
-                result: None,
-                worker_id: cgcx.worker,
-            };
+        let mut bomb = Bomb::<B> {
+            coordinator_send: cgcx.coordinator_send.clone(),
+            result: None,
+            worker_id: cgcx.worker,
+        };
 
-            // Execute the work itself, and if it finishes successfully then flag
-            // ourselves as a success as well.
-            //
-            // Note that we ignore any `FatalError` coming out of `execute_work_item`,
-            // as a diagnostic was already sent off to the main thread - just
-            // surface that there was an error in this worker.
-            bomb.result = {
-                let _prof_timer = work.start_profiling(&cgcx);
-                Some(execute_work_item(&cgcx, work))
-            };
-        })
-        .expect("failed to spawn thread");
+        // Execute the work itself, and if it finishes successfully then flag
+        // ourselves as a success as well.
+        //
+        // Note that we ignore any `FatalError` coming out of `execute_work_item`,
+        // as a diagnostic was already sent off to the main thread - just
+        // surface that there was an error in this worker.
+        bomb.result = {
+            let _prof_timer = work.start_profiling(&cgcx);
+            Some(execute_work_item(&cgcx, work))
+        };
+    })
+    .expect("failed to spawn thread");
 }
 
 enum SharedEmitterMessage {
@@ -57,6 +57,8 @@ pub enum AtomicRmwBinOp {
     AtomicMin,
     AtomicUMax,
     AtomicUMin,
+    AtomicFAdd,
+    AtomicFSub,
 }
 
 pub enum AtomicOrdering {
@@ -510,7 +510,14 @@ pub fn codegen_intrinsic_call(
                         };
 
                         let ty = substs.type_at(0);
-                        if int_type_width_signed(ty, bx.tcx()).is_some()
+                        if ty.is_floating_point() {
+                            let atom_op = match atom_op {
+                                AtomicRmwBinOp::AtomicAdd => AtomicRmwBinOp::AtomicFAdd,
+                                AtomicRmwBinOp::AtomicSub => AtomicRmwBinOp::AtomicFSub,
+                                _ => return invalid_monomorphization(ty),
+                            };
+                            bx.atomic_rmw(atom_op, args[0].immediate(), args[1].immediate(), order)
+                        } else if int_type_width_signed(ty, bx.tcx()).is_some()
                             || (ty.is_unsafe_ptr() && op == "xchg")
                         {
                             let mut ptr = args[0].immediate();
@@ -51,7 +51,13 @@ unsafe fn codegen(
         module: ModuleCodegen<Self::Module>,
         config: &ModuleConfig,
     ) -> Result<CompiledModule, FatalError>;
-    fn prepare_thin(module: ModuleCodegen<Self::Module>) -> (String, Self::ThinBuffer);
+    fn prepare_thin(
+        cgcx: &CodegenContext<Self>,
+        module: ModuleCodegen<Self::Module>,
+    ) -> (String, Self::ThinBuffer);
+    /// Shrinks the in-memory copy of a buffer from `prepare_thin` that waits for the
+    /// thin link, once everything that writes it to disk is done with it.
+    fn compress_thin_buffer(cgcx: &CodegenContext<Self>, name: &str, buffer: &mut Self::ThinBuffer);
     fn serialize_module(module: ModuleCodegen<Self::Module>) -> (String, Self::ModuleBuffer);
     fn run_lto_pass_manager(
         cgcx: &CodegenContext<Self>,
@@ -59,6 +65,15 @@ fn run_lto_pass_manager(
         config: &ModuleConfig,
         thin: bool,
     ) -> Result<(), FatalError>;
+    /// Splits an optimized fat LTO module into `partitions` modules whose code can be
+    /// generated independently, each in its own context. Returns just `module` if it can't be
+    /// split.
+    fn split_fat_lto_module(
+        cgcx: &CodegenContext<Self>,
+        diag_handler: &Handler,
+        module: ModuleCodegen<Self::Module>,
+        partitions: usize,
+    ) -> Result<Vec<ModuleCodegen<Self::Module>>, FatalError>;
 }
 
 pub trait ThinBufferMethods: Send + Sync {
@@ -346,7 +346,7 @@ fn instant_query_event(
     ) {
         drop(self.exec(event_filter, |profiler| {
             let event_id = StringId::new_virtual(query_invocation_id.0);
-            let thread_id = std::thread::current().id().as_u64().get() as u32;
+            let thread_id = get_thread_id();
 
             profiler.profiler.record_instant_event(
                 event_kind(profiler),
@@ -508,9 +508,17 @@ pub fn query_key_recording_enabled(&self) -> bool {
         self.event_filter_mask.contains(EventFilter::QUERY_KEYS)
     }
 
+    pub fn function_args_recording_enabled(&self) -> bool {
+        self.event_filter_mask.contains(EventFilter::FUNCTION_ARGS)
+    }
+
     pub fn event_id_builder(&self) -> EventIdBuilder<'_> {
         EventIdBuilder::new(&self.profiler)
     }
+
+    pub fn record_instant_event(&self, event_kind: StringId, event_id: EventId) {
+        self.profiler.record_instant_event(event_kind, event_id, get_thread_id());
+    }
 }
 
 #[must_use]
@@ -523,7 +531,7 @@ pub fn start(
         event_kind: StringId,
         event_id: EventId,
     ) -> TimingGuard<'a> {
-        let thread_id = std::thread::current().id().as_u64().get() as u32;
+        let thread_id = get_thread_id();
         let raw_profiler = &profiler.profiler;
         let timing_guard =
             raw_profiler.start_recording_interval_event(event_kind, event_id, thread_id);
@@ -541,6 +549,15 @@ pub fn finish_with_query_invocation_id(self, query_invocation_id: QueryInvocatio
         }
     }
 
+    /// Finishes the event, recording it under `event_id` instead of the id it
+    /// was started with, for events whose arguments aren't known up front.
+    #[inline]
+    pub fn finish_with_override_event_id(self, event_id: EventId) {
+        if let Some(guard) = self.0 {
+            guard.finish_with_override_event_id(event_id);
+        }
+    }
+
     #[inline]
     pub fn none() -> TimingGuard<'a> {
         TimingGuard(None)
@@ -611,6 +628,10 @@ pub fn print_time_passes_entry(
     eprintln!("time: {:>7}{}\t{}", duration_to_secs_str(dur), mem_string, what);
 }
 
+fn get_thread_id() -> u32 {
+    std::thread::current().id().as_u64().get() as u32
+}
+
 // Hack up our own formatting for the duration to make it easier for scripts
 // to parse (always use the same number of decimal places and the same unit).
 pub fn duration_to_secs_str(dur: std::time::Duration) -> String {
@@ -2,7 +2,11 @@
 
 use rustc_data_structures::fx::FxHashSet;
 use rustc_errors::{emitter::HumanReadableErrorType, registry, ColorConfig};
+use rustc_session::config::BasicBlockSections;
+use rustc_session::config::DebugInfoCompression;
+use rustc_session::config::InstructionSelector;
 use rustc_session::config::InstrumentCoverage;
+use rustc_session::config::MachineOutliner;
 use rustc_session::config::Strip;
 use rustc_session::config::{build_configuration, build_session_options, to_crate_config};
 use rustc_session::config::{rustc_optgroups, ErrorOutputType, ExternLocation, Options, Passes};
@@ -619,6 +623,7 @@ macro_rules! untracked {
 
     // Make sure that changing an [UNTRACKED] option leaves the hash unchanged.
     // This list is in alphabetical order.
+    untracked!(archive_update_in_place, true);
     untracked!(ast_json, true);
     untracked!(ast_json_noexpand, true);
     untracked!(borrowck, String::from("other"));
@@ -639,8 +644,12 @@ macro_rules! untracked {
     untracked!(incremental_info, true);
     untracked!(incremental_verify_ich, true);
     untracked!(input_stats, true);
+    untracked!(isel_stats, true);
     untracked!(keep_hygiene_data, true);
     untracked!(link_native_libraries, false);
+    untracked!(llvm_release_function_bodies, true);
+    untracked!(llvm_reuse_codegen_pipelines, true);
+    untracked!(llvm_reuse_pass_pipelines, true);
     untracked!(llvm_time_trace, true);
     untracked!(ls, true);
     untracked!(macro_backtrace, true);
@@ -652,6 +661,7 @@ macro_rules! untracked {
     untracked!(no_parallel_llvm, true);
     untracked!(parse_only, true);
     untracked!(perf_stats, true);
+    untracked!(pgo_symbol_ordering_file, Some(PathBuf::from("symbols.order")));
     // `pre_link_arg` is omitted because it just forwards to `pre_link_args`.
     untracked!(pre_link_args, vec![String::from("abc"), String::from("def")]);
     untracked!(profile_closures, true);
@@ -662,16 +672,26 @@ macro_rules! untracked {
     untracked!(proc_macro_backtrace, true);
     untracked!(query_dep_graph, true);
     untracked!(query_stats, true);
+    untracked!(remark_dir, Some(PathBuf::from("remarks")));
+    untracked!(remark_format, String::from("bitstream"));
+    untracked!(remark_hotness_threshold, Some(100));
     untracked!(save_analysis, true);
     untracked!(self_profile, SwitchWithOptPath::Enabled(None));
     untracked!(self_profile_events, Some(vec![String::new()]));
+    untracked!(self_profile_llvm_min_duration, Some(100));
+    untracked!(self_profile_llvm_sample_every, Some(8));
     untracked!(span_debug, true);
     untracked!(span_free_formats, true);
+    untracked!(stack_size_report, true);
     untracked!(strip, Strip::Debuginfo);
+    untracked!(symbol_ordering_file, Some(PathBuf::from("symbols.order")));
     untracked!(terminal_width, Some(80));
+    untracked!(thinlto_compress_buffers, true);
+    untracked!(thinlto_write_index_shards, true);
     untracked!(threads, 99);
     untracked!(time, true);
     untracked!(time_llvm_passes, true);
+    untracked!(time_llvm_passes_json, true);
     untracked!(time_passes, true);
     untracked!(trace_macros, true);
     untracked!(trim_diagnostic_paths, false);
@@ -696,13 +716,24 @@ macro_rules! tracked {
     tracked!(always_encode_mir, true);
     tracked!(assume_incomplete_release, true);
     tracked!(asm_comments, true);
+    tracked!(asm_from_object, true);
+    tracked!(basic_block_sections, BasicBlockSections::List(PathBuf::from("/path/to/clusters")));
     tracked!(binary_dep_depinfo, true);
     tracked!(chalk, true);
     tracked!(codegen_backend, Some("abc".to_string()));
+    tracked!(coverage_atomic_counters, true);
+    tracked!(coverage_promote_counters, true);
     tracked!(crate_attr, vec!["abc".to_string()]);
+    tracked!(cs_profile_generate, SwitchWithOptPath::Enabled(None));
     tracked!(debug_macros, true);
+    tracked!(debug_types_section, true);
+    tracked!(debuginfo_compression, DebugInfoCompression::Zlib);
     tracked!(dep_info_omit_d_target, true);
+    tracked!(direct_access_external_data, Some(true));
     tracked!(dual_proc_macros, true);
+    tracked!(embed_bitcode_incbin, true);
+    tracked!(fat_lto_dead_strip, true);
+    tracked!(fat_lto_partitions, 4);
     tracked!(fewer_names, Some(true));
     tracked!(force_overflow_checks, Some(true));
     tracked!(force_unstable_if_unmarked, true);
@@ -713,10 +744,19 @@ macro_rules! tracked {
     tracked!(inline_mir, Some(true));
     tracked!(inline_mir_threshold, Some(123));
     tracked!(inline_mir_hint_threshold, Some(123));
+    tracked!(instruction_selector, InstructionSelector::FastISel);
     tracked!(instrument_coverage, Some(InstrumentCoverage::All));
     tracked!(instrument_mcount, true);
+    tracked!(isel_abort_on_fallback, true);
     tracked!(link_only, true);
+    tracked!(llvm_function_time_budget, Some(10));
+    tracked!(llvm_lazy_thin_lto_parsing, true);
+    tracked!(llvm_module_time_budget, Some(1000));
+    tracked!(llvm_parallel_function_simplification, Some(10000));
     tracked!(llvm_plugins, vec![String::from("plugin_name")]);
+    tracked!(llvm_reuse_contexts, true);
+    tracked!(lto_remove_unwind, true);
+    tracked!(machine_outliner, MachineOutliner::Always);
     tracked!(merge_functions, Some(MergeFunctions::Disabled));
     tracked!(mir_emit_retag, true);
     tracked!(mir_opt_level, Some(4));
@@ -732,6 +772,8 @@ macro_rules! tracked {
     tracked!(print_fuel, Some("abc".to_string()));
     tracked!(profile, true);
     tracked!(profile_emit, Some(PathBuf::from("abc")));
+    tracked!(profile_remapping_file, Some(PathBuf::from("abc")));
+    tracked!(profile_sample_use, Some(PathBuf::from("abc")));
     tracked!(profiler_runtime, None);
     tracked!(relax_elf_relocations, Some(true));
     tracked!(relro_level, Some(RelroLevel::Full));
@@ -743,10 +785,19 @@ macro_rules! tracked {
     tracked!(saturating_float_casts, Some(true));
     tracked!(share_generics, Some(true));
     tracked!(show_span, Some(String::from("abc")));
+    tracked!(split_machine_functions, true);
     tracked!(src_hash_algorithm, Some(SourceFileHashAlgorithm::Sha1));
     tracked!(symbol_mangling_version, Some(SymbolManglingVersion::V0));
     tracked!(teach, true);
+    tracked!(thin_archives, true);
     tracked!(thinlto, Some(true));
+    tracked!(thinlto_import_cold_multiplier, Some(0.5));
+    tracked!(thinlto_import_hot_multiplier, Some(5.0));
+    tracked!(thinlto_import_instr_limit, Some(50));
+    tracked!(thinlto_import_max_module_functions, Some(100));
+    tracked!(thinlto_import_max_module_instrs, Some(10000));
+    tracked!(thinlto_import_native_bitcode, true);
+    tracked!(thinlto_propagate_global_attrs, true);
     tracked!(thir_unsafeck, true);
     tracked!(tune_cpu, Some(String::from("abc")));
     tracked!(tls_model, Some(TlsModel::GeneralDynamic));
@@ -756,6 +807,7 @@ macro_rules! tracked {
     tracked!(use_ctors_section, Some(true));
     tracked!(verify_llvm_ir, true);
     tracked!(wasi_exec_model, Some(WasiExecModel::Reactor));
+    tracked!(whole_program_visibility, true);
 
     macro_rules! tracked_no_crate_hash {
         ($name: ident, $non_default_value: expr) => {
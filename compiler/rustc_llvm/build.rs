@@ -87,6 +87,7 @@ fn main() {
         "hexagon",
         "riscv",
         "bpf",
+        "dwp",
     ];
 
     let required_components = &[
@@ -1,9 +1,16 @@
 #include "LLVMWrapper.h"
 
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Object/Archive.h"
 #include "llvm/Object/ArchiveWriter.h"
+#include "llvm/Object/IRObjectFile.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Parallel.h"
 #include "llvm/Support/Path.h"
 
+#include <memory>
+#include <mutex>
+
 using namespace llvm;
 using namespace llvm::object;
 
@@ -20,18 +27,74 @@ struct RustArchiveMember {
   ~RustArchiveMember() {}
 };
 
+// An opened archive together with an index of its members. The index is
+// built once when the archive is opened, so that iterating over the members
+// or looking one up by name doesn't walk the member headers again. It is
+// empty if walking the headers failed, in which case the errors are reported
+// by iterating over the archive as usual.
+struct RustSharedArchive {
+  OwningBinary<Archive> Binary;
+  bool Indexed;
+  std::vector<Archive::Child> Children;
+  // Name of a member to its position in `Children`; the first member wins if
+  // the same name occurs more than once.
+  StringMap<size_t> ByName;
+
+  RustSharedArchive(OwningBinary<Archive> Binary)
+      : Binary(std::move(Binary)), Indexed(false) {}
+
+  void buildIndex() {
+    Error Err = Error::success();
+    std::vector<Archive::Child> Found;
+    StringMap<size_t> Names;
+    bool Failed = false;
+    for (const Archive::Child &Child : Binary.getBinary()->children(Err)) {
+      Expected<StringRef> NameOrErr = Child.getName();
+      if (!NameOrErr) {
+        consumeError(NameOrErr.takeError());
+        Failed = true;
+        break;
+      }
+      Names.try_emplace(NameOrErr->trim(), Found.size());
+      Found.push_back(Child);
+    }
+    if (Err) {
+      consumeError(std::move(Err));
+      Failed = true;
+    }
+    if (Failed)
+      return;
+    Children = std::move(Found);
+    ByName = std::move(Names);
+    Indexed = true;
+  }
+};
+
 struct RustArchiveIterator {
   bool First;
   Archive::child_iterator Cur;
   Archive::child_iterator End;
   std::unique_ptr<Error> Err;
+  // Set when iterating over the index of a `RustSharedArchive` instead.
+  const std::vector<Archive::Child> *Indexed;
+  size_t Pos;
 
   RustArchiveIterator(Archive::child_iterator Cur, Archive::child_iterator End,
       std::unique_ptr<Error> Err)
     : First(true),
       Cur(Cur),
       End(End),
-      Err(std::move(Err)) {}
+      Err(std::move(Err)),
+      Indexed(nullptr),
+      Pos(0) {}
+
+  RustArchiveIterator(Archive::child_iterator End,
+                      const std::vector<Archive::Child> *Indexed)
+    : First(true),
+      Cur(End),
+      End(End),
+      Indexed(Indexed),
+      Pos(0) {}
 };
 
 enum class LLVMRustArchiveKind {
@@ -56,13 +119,67 @@ static Archive::Kind fromRust(LLVMRustArchiveKind Kind) {
   }
 }
 
-typedef OwningBinary<Archive> *LLVMRustArchiveRef;
+typedef std::shared_ptr<RustSharedArchive> *LLVMRustArchiveRef;
 typedef RustArchiveMember *LLVMRustArchiveMemberRef;
 typedef Archive::Child *LLVMRustArchiveChildRef;
 typedef Archive::Child const *LLVMRustArchiveChildConstRef;
 typedef RustArchiveIterator *LLVMRustArchiveIteratorRef;
 
+// The same rlibs are opened by several threads at once while linking and
+// during LTO, so an archive that is still open is shared rather than mapped and
+// indexed again, keyed by path and revalidated against the file's modification
+// time and size. The cache doesn't keep archives alive by itself: once the last
+// user closes an archive it's unmapped.
+class LLVMRustArchiveCache {
+  struct Entry {
+    sys::TimePoint<> ModTime;
+    uint64_t Size;
+    std::weak_ptr<RustSharedArchive> Shared;
+  };
+
+  std::mutex Lock;
+  StringMap<Entry> Entries;
+
+public:
+  std::shared_ptr<RustSharedArchive> lookup(StringRef Path,
+                                      const sys::fs::file_status &Status) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    auto It = Entries.find(Path);
+    if (It == Entries.end())
+      return nullptr;
+    const Entry &E = It->second;
+    if (E.ModTime != Status.getLastModificationTime() ||
+        E.Size != Status.getSize())
+      return nullptr;
+    return E.Shared.lock();
+  }
+
+  void insert(StringRef Path, const sys::fs::file_status &Status,
+              std::shared_ptr<RustSharedArchive> Shared) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Entries[Path] = Entry{Status.getLastModificationTime(), Status.getSize(),
+                          std::move(Shared)};
+  }
+
+  void evict(StringRef Path) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Entries.erase(Path);
+  }
+};
+
+static LLVMRustArchiveCache &archiveCache() {
+  static LLVMRustArchiveCache Cache;
+  return Cache;
+}
+
 extern "C" LLVMRustArchiveRef LLVMRustOpenArchive(char *Path) {
+  sys::fs::file_status Status;
+  bool Cacheable = !sys::fs::status(Path, Status);
+  if (Cacheable) {
+    if (auto Cached = archiveCache().lookup(Path, Status))
+      return new std::shared_ptr<RustSharedArchive>(std::move(Cached));
+  }
+
   ErrorOr<std::unique_ptr<MemoryBuffer>> BufOr =
       MemoryBuffer::getFile(Path, -1, false);
   if (!BufOr) {
@@ -78,10 +195,13 @@ extern "C" LLVMRustArchiveRef LLVMRustOpenArchive(char *Path) {
     return nullptr;
   }
 
-  OwningBinary<Archive> *Ret = new OwningBinary<Archive>(
-      std::move(ArchiveOr.get()), std::move(BufOr.get()));
+  auto Ret = std::make_shared<RustSharedArchive>(OwningBinary<Archive>(
+      std::move(ArchiveOr.get()), std::move(BufOr.get())));
+  Ret->buildIndex();
+  if (Cacheable)
+    archiveCache().insert(Path, Status, Ret);
 
-  return Ret;
+  return new std::shared_ptr<RustSharedArchive>(std::move(Ret));
 }
 
 extern "C" void LLVMRustDestroyArchive(LLVMRustArchiveRef RustArchive) {
@@ -90,7 +210,11 @@ extern "C" void LLVMRustDestroyArchive(LLVMRustArchiveRef RustArchive) {
 
 extern "C" LLVMRustArchiveIteratorRef
 LLVMRustArchiveIteratorNew(LLVMRustArchiveRef RustArchive) {
-  Archive *Archive = RustArchive->getBinary();
+  RustSharedArchive &Shared = **RustArchive;
+  Archive *Archive = Shared.Binary.getBinary();
+  if (Shared.Indexed)
+    return new RustArchiveIterator(Archive->child_end(), &Shared.Children);
+
   std::unique_ptr<Error> Err = std::make_unique<Error>(Error::success());
   auto Cur = Archive->child_begin(*Err);
   if (*Err) {
@@ -101,8 +225,103 @@ LLVMRustArchiveIteratorNew(LLVMRustArchiveRef RustArchive) {
   return new RustArchiveIterator(Cur, End, std::move(Err));
 }
 
+extern "C" bool LLVMRustArchiveIsThin(LLVMRustArchiveRef RustArchive) {
+  return (*RustArchive)->Binary.getBinary()->isThin();
+}
+
+struct LLVMRustArchiveMemberInfo {
+  const char *Name;
+  size_t NameLen;
+  const char *Data;
+  size_t DataLen;
+  uint64_t DataOffset;
+  // Points into the archive's index and lives as long as the archive.
+  LLVMRustArchiveChildConstRef Child;
+};
+
+// Describes all members of the archive at once, without allocating anything
+// per member. `*NumMembers` is set to the number of members and the first
+// `Capacity` of them are written to `Members`, so callers can ask for the
+// count first by passing a `Capacity` of zero.
+extern "C" LLVMRustResult
+LLVMRustArchiveGetMembers(LLVMRustArchiveRef RustArchive,
+                          LLVMRustArchiveMemberInfo *Members, size_t Capacity,
+                          size_t *NumMembers) {
+  RustSharedArchive &Shared = **RustArchive;
+  if (!Shared.Indexed) {
+    // Walk the members again to find out what is wrong with them.
+    Error Err = Error::success();
+    Archive *Archive = Shared.Binary.getBinary();
+    for (const Archive::Child &Child : Archive->children(Err)) {
+      Expected<StringRef> NameOrErr = Child.getName();
+      if (!NameOrErr) {
+        LLVMRustSetLastError(toString(NameOrErr.takeError()).c_str());
+        consumeError(std::move(Err));
+        return LLVMRustResult::Failure;
+      }
+    }
+    if (Err)
+      LLVMRustSetLastError(toString(std::move(Err)).c_str());
+    else
+      LLVMRustSetLastError("failed to read archive members");
+    return LLVMRustResult::Failure;
+  }
+
+  *NumMembers = Shared.Children.size();
+  for (size_t I = 0; I < Capacity && I < Shared.Children.size(); I++) {
+    const Archive::Child &Child = Shared.Children[I];
+    // The name was already read successfully when building the index.
+    StringRef Name = cantFail(Child.getName()).trim();
+    Expected<StringRef> BufOrErr = Child.getBuffer();
+    if (!BufOrErr) {
+      LLVMRustSetLastError(toString(BufOrErr.takeError()).c_str());
+      return LLVMRustResult::Failure;
+    }
+    Members[I] = LLVMRustArchiveMemberInfo{
+        Name.data(), Name.size(), BufOrErr->data(), BufOrErr->size(),
+        Child.getDataOffset(), &Child};
+  }
+  return LLVMRustResult::Success;
+}
+
+// Returns the embedded bitcode of the member called `Name` (the `.llvmbc`
+// section of an object file, or the member itself if it is bitcode). The slice
+// points into the mapped archive and lives as long as the archive does.
+extern "C" const char *
+LLVMRustArchiveGetMemberBitcode(LLVMRustArchiveRef RustArchive,
+                                const char *Name, size_t NameLen,
+                                size_t *OutLen) {
+  *OutLen = 0;
+  RustSharedArchive &Shared = **RustArchive;
+  auto It = Shared.ByName.find(StringRef(Name, NameLen));
+  if (It == Shared.ByName.end()) {
+    LLVMRustSetLastError("archive member not found");
+    return nullptr;
+  }
+  const Archive::Child &Child = Shared.Children[It->second];
+  Expected<MemoryBufferRef> BufOrErr = Child.getMemoryBufferRef();
+  if (!BufOrErr) {
+    LLVMRustSetLastError(toString(BufOrErr.takeError()).c_str());
+    return nullptr;
+  }
+  Expected<MemoryBufferRef> BitcodeOrErr =
+      IRObjectFile::findBitcodeInMemBuffer(*BufOrErr);
+  if (!BitcodeOrErr) {
+    LLVMRustSetLastError(toString(BitcodeOrErr.takeError()).c_str());
+    return nullptr;
+  }
+  *OutLen = BitcodeOrErr->getBufferSize();
+  return BitcodeOrErr->getBufferStart();
+}
+
 extern "C" LLVMRustArchiveChildConstRef
 LLVMRustArchiveIteratorNext(LLVMRustArchiveIteratorRef RAI) {
+  if (RAI->Indexed) {
+    if (RAI->Pos == RAI->Indexed->size())
+      return nullptr;
+    return new Archive::Child((*RAI->Indexed)[RAI->Pos++]);
+  }
+
   if (RAI->Cur == RAI->End)
     return nullptr;
 
@@ -167,6 +386,12 @@ extern "C" const char *LLVMRustArchiveChildData(LLVMRustArchiveChildRef Child,
   return Buf.data();
 }
 
+// Returns the offset of `Child`'s data from the start of the archive file.
+extern "C" uint64_t
+LLVMRustArchiveChildDataOffset(LLVMRustArchiveChildConstRef Child) {
+  return Child->getDataOffset();
+}
+
 extern "C" LLVMRustArchiveMemberRef
 LLVMRustArchiveMemberNew(char *Filename, char *Name,
                          LLVMRustArchiveChildRef Child) {
@@ -182,38 +407,120 @@ extern "C" void LLVMRustArchiveMemberFree(LLVMRustArchiveMemberRef Member) {
   delete Member;
 }
 
+#if LLVM_VERSION_GE(11, 0)
+// Overwrites the existing file `Dst` with `Contents`, writing only the blocks
+// that actually differ. When an archive is rebuilt with most members
+// unchanged, everything in front of the first member whose size changed is
+// left alone on disk. Returns false if `Dst` couldn't be updated, in which
+// case it has to be rewritten completely.
+static bool updateFileInPlace(const char *Dst, StringRef Contents) {
+  int FD;
+  if (sys::fs::openFileForReadWrite(Dst, FD, sys::fs::CD_OpenExisting,
+                                    sys::fs::OF_None))
+    return false;
+  raw_fd_ostream OS(FD, /*shouldClose=*/true);
+  sys::fs::file_t File = sys::fs::convertFDToNativeFile(FD);
+
+  const size_t BlockSize = 1 << 16;
+  SmallVector<char, 0> Old;
+  Old.resize(BlockSize);
+  for (size_t Offset = 0; Offset < Contents.size(); Offset += BlockSize) {
+    StringRef New = Contents.substr(Offset, BlockSize);
+    Expected<size_t> ReadOrErr = sys::fs::readNativeFileSlice(
+        File, makeMutableArrayRef(Old.data(), New.size()), Offset);
+    if (!ReadOrErr) {
+      consumeError(ReadOrErr.takeError());
+      return false;
+    }
+    if (*ReadOrErr == New.size() && StringRef(Old.data(), New.size()) == New)
+      continue;
+    OS.seek(Offset);
+    OS << New;
+  }
+  OS.flush();
+  if (OS.has_error()) {
+    OS.clear_error();
+    return false;
+  }
+
+  // Drop what's left of a longer old archive. Also bump the modification time
+  // even if nothing changed, so build systems see the archive as rebuilt.
+  if (sys::fs::resize_file(FD, Contents.size()) ||
+      sys::fs::setLastAccessAndModificationTime(
+          FD, std::chrono::system_clock::now()))
+    return false;
+  return true;
+}
+#endif
+
 extern "C" LLVMRustResult
 LLVMRustWriteArchive(char *Dst, size_t NumMembers,
                      const LLVMRustArchiveMemberRef *NewMembers,
-                     bool WriteSymbtab, LLVMRustArchiveKind RustKind) {
+                     bool WriteSymbtab, LLVMRustArchiveKind RustKind,
+                     bool Thin, bool InPlace) {
+
+  // A thin archive only records where its members are, which doesn't work
+  // for members taken from other archives; write a regular one for those.
+  for (size_t I = 0; Thin && I < NumMembers; I++) {
+    if (!NewMembers[I]->Filename)
+      Thin = false;
+  }
 
-  std::vector<NewArchiveMember> Members;
+  std::vector<NewArchiveMember> Members(NumMembers);
+  std::vector<std::string> Errors(NumMembers);
   auto Kind = fromRust(RustKind);
 
-  for (size_t I = 0; I < NumMembers; I++) {
+  // Members added from files are read (and stat'ed) here; do that for all of
+  // them in parallel. Each result goes to its own slot, so the archive's
+  // member order doesn't depend on scheduling.
+  auto LoadMember = [&](size_t I) {
     auto Member = NewMembers[I];
     assert(Member->Name);
-    if (Member->Filename) {
-      Expected<NewArchiveMember> MOrErr =
-          NewArchiveMember::getFile(Member->Filename, true);
-      if (!MOrErr) {
-        LLVMRustSetLastError(toString(MOrErr.takeError()).c_str());
-        return LLVMRustResult::Failure;
-      }
+    Expected<NewArchiveMember> MOrErr =
+        Member->Filename ? NewArchiveMember::getFile(Member->Filename, true)
+                         : NewArchiveMember::getOldMember(Member->Child, true);
+    if (!MOrErr) {
+      Errors[I] = toString(MOrErr.takeError());
+      return;
+    }
+    // Thin archives refer to their members by path, computed by the writer
+    // from the full name.
+    if (Member->Filename && !Thin)
       MOrErr->MemberName = sys::path::filename(MOrErr->MemberName);
-      Members.push_back(std::move(*MOrErr));
-    } else {
-      Expected<NewArchiveMember> MOrErr =
-          NewArchiveMember::getOldMember(Member->Child, true);
-      if (!MOrErr) {
-        LLVMRustSetLastError(toString(MOrErr.takeError()).c_str());
-        return LLVMRustResult::Failure;
-      }
-      Members.push_back(std::move(*MOrErr));
+    Members[I] = std::move(*MOrErr);
+  };
+#if LLVM_VERSION_GE(15, 0)
+  parallelFor(0, NumMembers, LoadMember);
+#else
+  parallelForEachN(0, NumMembers, LoadMember);
+#endif
+  for (const std::string &Error : Errors) {
+    if (!Error.empty()) {
+      LLVMRustSetLastError(Error.c_str());
+      return LLVMRustResult::Failure;
+    }
+  }
+
+  archiveCache().evict(Dst);
+
+#if LLVM_VERSION_GE(11, 0)
+  // The whole archive is built in memory first, so members copied from `Dst`
+  // itself are read before it is modified.
+  if (InPlace && sys::fs::exists(Dst)) {
+    Expected<std::unique_ptr<MemoryBuffer>> BufOrErr =
+        writeArchiveToBuffer(Members, WriteSymbtab, Kind, true, Thin);
+    if (!BufOrErr) {
+      LLVMRustSetLastError(toString(BufOrErr.takeError()).c_str());
+      return LLVMRustResult::Failure;
     }
+    if (updateFileInPlace(Dst, (*BufOrErr)->getBuffer()))
+      return LLVMRustResult::Success;
   }
+#else
+  (void)InPlace;
+#endif
 
-  auto Result = writeArchive(Dst, Members, WriteSymbtab, Kind, true, false);
+  auto Result = writeArchive(Dst, Members, WriteSymbtab, Kind, true, Thin);
   if (!Result)
     return LLVMRustResult::Success;
   LLVMRustSetLastError(toString(std::move(Result)).c_str());
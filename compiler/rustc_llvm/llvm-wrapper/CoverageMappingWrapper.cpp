@@ -3,6 +3,7 @@
 #include "llvm/ProfileData/Coverage/CoverageMappingWriter.h"
 #include "llvm/ProfileData/InstrProf.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/Parallel.h"
 
 #include <iostream>
 
@@ -19,19 +20,22 @@ struct LLVMRustCounterMappingRegion {
   coverage::CounterMappingRegion::RegionKind Kind;
 };
 
+// `Filenames[i]` is `FilenameLens[i]` bytes long and need not be
+// NUL-terminated.
 extern "C" void LLVMRustCoverageWriteFilenamesSectionToBuffer(
     const char* const Filenames[],
+    const size_t FilenameLens[],
     size_t FilenamesLen,
     RustStringRef BufferOut) {
 #if LLVM_VERSION_GE(13,0)
   SmallVector<std::string,32> FilenameRefs;
   for (size_t i = 0; i < FilenamesLen; i++) {
-    FilenameRefs.push_back(std::string(Filenames[i]));
+    FilenameRefs.push_back(std::string(Filenames[i], FilenameLens[i]));
   }
 #else
   SmallVector<StringRef,32> FilenameRefs;
   for (size_t i = 0; i < FilenamesLen; i++) {
-    FilenameRefs.push_back(StringRef(Filenames[i]));
+    FilenameRefs.push_back(StringRef(Filenames[i], FilenameLens[i]));
   }
 #endif
   auto FilenamesWriter = coverage::CoverageFilenamesSectionWriter(
@@ -40,14 +44,22 @@ extern "C" void LLVMRustCoverageWriteFilenamesSectionToBuffer(
   FilenamesWriter.write(OS);
 }
 
-extern "C" void LLVMRustCoverageWriteMappingToBuffer(
+// How many of the entries of each of the flat arrays passed to
+// `LLVMRustCoverageWriteMappingsToBuffer` belong to one function.
+struct LLVMRustCoverageFunctionMapping {
+  uint32_t NumVirtualFileMappingIDs;
+  uint32_t NumExpressions;
+  uint32_t NumMappingRegions;
+};
+
+static void writeMapping(
     const unsigned *VirtualFileMappingIDs,
     unsigned NumVirtualFileMappingIDs,
     const coverage::CounterExpression *Expressions,
     unsigned NumExpressions,
-    LLVMRustCounterMappingRegion *RustMappingRegions,
+    const LLVMRustCounterMappingRegion *RustMappingRegions,
     unsigned NumMappingRegions,
-    RustStringRef BufferOut) {
+    raw_ostream &OS) {
   // Convert from FFI representation to LLVM representation.
   SmallVector<coverage::CounterMappingRegion, 0> MappingRegions;
   MappingRegions.reserve(NumMappingRegions);
@@ -61,20 +73,72 @@ extern "C" void LLVMRustCoverageWriteMappingToBuffer(
       makeArrayRef(VirtualFileMappingIDs, NumVirtualFileMappingIDs),
       makeArrayRef(Expressions, NumExpressions),
       MappingRegions);
-  RawRustStringOstream OS(BufferOut);
   CoverageMappingWriter.write(OS);
 }
 
+// Encodes the coverage mappings of `NumFunctions` functions at once. The
+// virtual file mappings, expressions and regions of all functions are passed
+// as one flat array each, in function order, with `Functions` saying how many
+// entries of each belong to which function. The mappings are encoded in
+// parallel and then appended to `BufferOut` in function order;
+// `Offsets[I]..Offsets[I + 1]` is where function `I` ended up, and functions
+// without any regions are left empty.
+extern "C" void LLVMRustCoverageWriteMappingsToBuffer(
+    const LLVMRustCoverageFunctionMapping *Functions,
+    size_t NumFunctions,
+    const unsigned *VirtualFileMappingIDs,
+    const coverage::CounterExpression *Expressions,
+    const LLVMRustCounterMappingRegion *RustMappingRegions,
+    size_t *Offsets,
+    RustStringRef BufferOut) {
+  // Where each function's entries start in the flat arrays.
+  struct Start {
+    size_t VirtualFileMappingID, Expression, MappingRegion;
+  };
+  std::vector<Start> Starts(NumFunctions);
+  Start Next = {0, 0, 0};
+  for (size_t I = 0; I < NumFunctions; I++) {
+    Starts[I] = Next;
+    Next.VirtualFileMappingID += Functions[I].NumVirtualFileMappingIDs;
+    Next.Expression += Functions[I].NumExpressions;
+    Next.MappingRegion += Functions[I].NumMappingRegions;
+  }
+
+  std::vector<std::string> Encoded(NumFunctions);
+  auto Encode = [&](size_t I) {
+    const LLVMRustCoverageFunctionMapping &F = Functions[I];
+    if (F.NumMappingRegions == 0)
+      return;
+    raw_string_ostream OS(Encoded[I]);
+    writeMapping(VirtualFileMappingIDs + Starts[I].VirtualFileMappingID,
+                 F.NumVirtualFileMappingIDs,
+                 Expressions + Starts[I].Expression, F.NumExpressions,
+                 RustMappingRegions + Starts[I].MappingRegion,
+                 F.NumMappingRegions, OS);
+  };
+#if LLVM_VERSION_GE(15, 0)
+  parallelFor(0, NumFunctions, Encode);
+#else
+  parallelForEachN(0, NumFunctions, Encode);
+#endif
+
+  size_t Size = 0;
+  for (size_t I = 0; I < NumFunctions; I++) {
+    Offsets[I] = Size;
+    Size += Encoded[I].size();
+  }
+  Offsets[NumFunctions] = Size;
+
+  RawRustStringOstream OS(BufferOut);
+  for (const std::string &Mapping : Encoded)
+    OS << Mapping;
+}
+
 extern "C" LLVMValueRef LLVMRustCoverageCreatePGOFuncNameVar(LLVMValueRef F, const char *FuncName) {
   StringRef FuncNameRef(FuncName);
   return wrap(createPGOFuncNameVar(*cast<Function>(unwrap(F)), FuncNameRef));
 }
 
-extern "C" uint64_t LLVMRustCoverageHashCString(const char *StrVal) {
-  StringRef StrRef(StrVal);
-  return IndexedInstrProf::ComputeHash(StrRef);
-}
-
 extern "C" uint64_t LLVMRustCoverageHashByteArray(
     const char *Bytes,
     unsigned NumBytes) {
@@ -82,6 +146,18 @@ extern "C" uint64_t LLVMRustCoverageHashByteArray(
   return IndexedInstrProf::ComputeHash(StrRef);
 }
 
+// Hashes `Num` byte strings at once, the `i`th being `Lens[i]` bytes at
+// `Bytes[i]`, into `Hashes[i]`.
+extern "C" void LLVMRustCoverageHashByteArrays(
+    const char *const Bytes[],
+    const size_t Lens[],
+    size_t Num,
+    uint64_t *Hashes) {
+  for (size_t i = 0; i < Num; i++) {
+    Hashes[i] = IndexedInstrProf::ComputeHash(StringRef(Bytes[i], Lens[i]));
+  }
+}
+
 static void WriteSectionNameToString(LLVMModuleRef M,
                                      InstrProfSectKind SK,
                                      RustStringRef Str) {
@@ -1,4 +1,6 @@
 #include "llvm/Linker/Linker.h"
+#include "llvm/IR/ModuleSummaryIndex.h"
+#include "llvm/Transforms/IPO/FunctionImport.h"
 
 #include "LLVMWrapper.h"
 
@@ -6,10 +8,19 @@ using namespace llvm;
 
 struct RustLinker {
   Linker L;
+  Module &Dst;
   LLVMContext &Ctx;
 
+  // Filled in by `LLVMRustLinkerComputeLiveness`: the combined summary of the
+  // inputs that carry one, the globals each of those inputs defines, and the
+  // module id under which each input's bitcode was read.
+  std::unique_ptr<ModuleSummaryIndex> Index;
+  StringMap<GVSummaryMapTy> DefinedGlobals;
+  DenseMap<const char *, std::string> ModuleIds;
+
   RustLinker(Module &M) :
     L(M),
+    Dst(M),
     Ctx(M.getContext())
   {}
 };
@@ -26,13 +37,111 @@ LLVMRustLinkerFree(RustLinker *L) {
   delete L;
 }
 
+// Adds the GUIDs of everything `M` declares to `Roots`. For a module without a
+// summary its declarations are a conservative stand-in for what its
+// definitions reference.
+static void addDeclarationRoots(const Module &M,
+                                DenseSet<GlobalValue::GUID> &Roots) {
+  for (const GlobalValue &GV : M.global_values())
+    if (GV.isDeclaration())
+      Roots.insert(GV.getGUID());
+}
+
+// Computes which globals of the fat LTO inputs `BCs` are live, before any of
+// them is linked, so that `LLVMRustLinkerAdd` only links in the live ones.
+//
+// The inputs that carry a ThinLTO summary (upstream rlibs) are read into one
+// combined index, whose dead symbol analysis starts from the `Preserved`
+// symbols, from what the destination module declares, and from what the
+// inputs without a summary declare; everything those inputs define is kept.
+extern "C" LLVMRustResult
+LLVMRustLinkerComputeLiveness(RustLinker *L, const char **BCs,
+                              const size_t *Lens, size_t NumBCs,
+                              const char **Preserved, size_t NumPreserved) {
+  auto Index = std::make_unique<ModuleSummaryIndex>(/* HaveGVs = */ false);
+  DenseSet<GlobalValue::GUID> Roots;
+  for (size_t i = 0; i < NumPreserved; i++)
+    Roots.insert(GlobalValue::getGUID(Preserved[i]));
+  addDeclarationRoots(L->Dst, Roots);
+
+  DenseMap<const char *, std::string> ModuleIds;
+  for (size_t i = 0; i < NumBCs; i++) {
+    MemoryBufferRef Buf(StringRef(BCs[i], Lens[i]), "<rustc fat lto input>");
+    Expected<std::vector<BitcodeModule>> BMs = getBitcodeModuleList(Buf);
+    if (!BMs) {
+      LLVMRustSetLastError(toString(BMs.takeError()).c_str());
+      return LLVMRustResult::Failure;
+    }
+    if (BMs->size() != 1) {
+      LLVMRustSetLastError("Expected a single module");
+      return LLVMRustResult::Failure;
+    }
+    Expected<BitcodeLTOInfo> LTOInfo = BMs->front().getLTOInfo();
+    if (!LTOInfo) {
+      LLVMRustSetLastError(toString(LTOInfo.takeError()).c_str());
+      return LLVMRustResult::Failure;
+    }
+    if (LTOInfo->HasSummary) {
+      std::string ModuleId = "fat-lto-input-" + std::to_string(i);
+      if (Error Err = BMs->front().readSummary(*Index, ModuleId, i)) {
+        LLVMRustSetLastError(toString(std::move(Err)).c_str());
+        return LLVMRustResult::Failure;
+      }
+      ModuleIds[BCs[i]] = std::move(ModuleId);
+      continue;
+    }
+
+    // Only the module-level records are read here, not any function bodies.
+    LLVMContext ScratchCtx;
+    Expected<std::unique_ptr<Module>> MOrErr =
+        getLazyBitcodeModule(Buf, ScratchCtx);
+    if (!MOrErr) {
+      LLVMRustSetLastError(toString(MOrErr.takeError()).c_str());
+      return LLVMRustResult::Failure;
+    }
+    addDeclarationRoots(**MOrErr, Roots);
+  }
+
+  auto IsPrevailing = [](GlobalValue::GUID) {
+    return PrevailingType::Unknown;
+  };
+  computeDeadSymbolsWithConstProp(*Index, Roots, IsPrevailing,
+                                  /* ImportEnabled = */ false);
+  Index->collectDefinedGVSummariesPerModule(L->DefinedGlobals);
+  L->Index = std::move(Index);
+  L->ModuleIds = std::move(ModuleIds);
+  return LLVMRustResult::Success;
+}
+
+// Turns the globals of `M` that the combined index found dead into
+// declarations, and removes them where nothing refers to them anymore.
+//
+// This is `dropDeadSymbols` from `lib/LTO/LTOBackend.cpp`.
+static void dropDeadSymbols(Module &M, const GVSummaryMapTy &DefinedGlobals,
+                            const ModuleSummaryIndex &Index) {
+  std::vector<GlobalValue *> DeadGVs;
+  for (GlobalValue &GV : M.global_values())
+    if (GlobalValueSummary *GVS = DefinedGlobals.lookup(GV.getGUID()))
+      if (!Index.isGlobalValueLive(GVS)) {
+        DeadGVs.push_back(&GV);
+        convertToDeclaration(GV);
+      }
+  for (GlobalValue *GV : DeadGVs) {
+    GV->removeDeadConstantUsers();
+    if (GV->use_empty())
+      GV->eraseFromParent();
+  }
+}
+
+// The bitcode is borrowed, not copied: the lazily loaded module only reads
+// from it until `linkInModule` has materialized what it needs, and the caller
+// keeps the buffer alive for at least that long.
 extern "C" bool
-LLVMRustLinkerAdd(RustLinker *L, char *BC, size_t Len) {
-  std::unique_ptr<MemoryBuffer> Buf =
-      MemoryBuffer::getMemBufferCopy(StringRef(BC, Len));
+LLVMRustLinkerAdd(RustLinker *L, const char *BC, size_t Len) {
+  MemoryBufferRef Buf(StringRef(BC, Len), "<rustc fat lto input>");
 
   Expected<std::unique_ptr<Module>> SrcOrError =
-      llvm::getLazyBitcodeModule(Buf->getMemBufferRef(), L->Ctx);
+      llvm::getLazyBitcodeModule(Buf, L->Ctx);
   if (!SrcOrError) {
     LLVMRustSetLastError(toString(SrcOrError.takeError()).c_str());
     return false;
@@ -40,6 +149,14 @@ LLVMRustLinkerAdd(RustLinker *L, char *BC, size_t Len) {
 
   auto Src = std::move(*SrcOrError);
 
+  // Dropping the dead globals while `Src` is still lazy means their bodies are
+  // never even read, let alone linked.
+  if (L->Index) {
+    auto Id = L->ModuleIds.find(BC);
+    if (Id != L->ModuleIds.end())
+      dropDeadSymbols(*Src, L->DefinedGlobals[Id->second], *L->Index);
+  }
+
   if (L->L.linkInModule(std::move(Src))) {
     LLVMRustSetLastError("");
     return false;
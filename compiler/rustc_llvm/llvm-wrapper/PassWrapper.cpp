@@ -1,43 +1,67 @@
 #include <stdio.h>
 
+#include <chrono>
+#include <mutex>
+#include <list>
 #include <vector>
 #include <set>
 
 #include "LLVMWrapper.h"
 
 #include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/CodeGen/TargetSubtargetInfo.h"
 #include "llvm/InitializePasses.h"
 #include "llvm/IR/AutoUpgrade.h"
 #include "llvm/IR/AssemblyAnnotationWriter.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCDisassembler/MCDisassembler.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstPrinter.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCObjectFileInfo.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/Linker/Linker.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Object/IRObjectFile.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/StandardInstrumentations.h"
+#include "llvm/ProfileData/InstrProfReader.h"
 #include "llvm/Support/CBindingWrapping.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/EndianStream.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/JSON.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/Transforms/IPO/AlwaysInliner.h"
 #include "llvm/Transforms/IPO/FunctionImport.h"
+#include "llvm/Transforms/IPO/WholeProgramDevirt.h"
 #include "llvm/Transforms/Utils/FunctionImportUtils.h"
 #include "llvm/LTO/LTO.h"
 #include "llvm-c/Transforms/PassManagerBuilder.h"
 
 #include "llvm/Transforms/Instrumentation.h"
 #include "llvm/Transforms/Instrumentation/AddressSanitizer.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Transforms/Instrumentation/GCOVProfiler.h"
 #include "llvm/Transforms/Instrumentation/InstrProfiling.h"
 #include "llvm/Transforms/Instrumentation/ThreadSanitizer.h"
 #include "llvm/Transforms/Instrumentation/MemorySanitizer.h"
 #include "llvm/Transforms/Instrumentation/HWAddressSanitizer.h"
 #include "llvm/Transforms/Utils/CanonicalizeAliases.h"
+#include "llvm/Transforms/Utils/Local.h"
 #include "llvm/Transforms/Utils/NameAnonGlobals.h"
 
 using namespace llvm;
@@ -52,6 +76,10 @@ DEFINE_STDCXX_CONVERSION_FUNCTIONS(PassManagerBuilder,
                                    LLVMPassManagerBuilderRef)
 #endif
 
+// Defined with the rest of the ThinLTO support below.
+struct LLVMRustThinLTOData;
+static const ModuleSummaryIndex *getThinLTOIndex(const LLVMRustThinLTOData *Data);
+
 extern "C" void LLVMInitializePasses() {
   PassRegistry &Registry = *PassRegistry::getPassRegistry();
   initializeCore(Registry);
@@ -72,6 +100,23 @@ extern "C" void LLVMTimeTraceProfilerInitialize() {
       /* ProcName */ "rustc");
 }
 
+// Each thread records into its own profiler; worker threads start theirs with
+// this and hand it over with `LLVMTimeTraceProfilerFinishThread` when they exit,
+// so that `LLVMTimeTraceProfilerFinish` can write them out together with the
+// main thread's trace. Before LLVM 11 there's a single profiler for the whole
+// process, which `LLVMTimeTraceProfilerInitialize` has already started.
+extern "C" void LLVMTimeTraceProfilerInitializeThread() {
+#if LLVM_VERSION_GE(11, 0)
+  LLVMTimeTraceProfilerInitialize();
+#endif
+}
+
+extern "C" void LLVMTimeTraceProfilerFinishThread() {
+#if LLVM_VERSION_GE(11, 0)
+  timeTraceProfilerFinishThread();
+#endif
+}
+
 extern "C" void LLVMTimeTraceProfilerFinish(const char* FileName) {
   StringRef FN(FileName);
   std::error_code EC;
@@ -155,8 +200,10 @@ extern "C" void LLVMRustAddPass(LLVMPassManagerRef PMR, LLVMPassRef RustPass) {
 extern "C"
 void LLVMRustPassManagerBuilderPopulateThinLTOPassManager(
   LLVMPassManagerBuilderRef PMBR,
-  LLVMPassManagerRef PMR
+  LLVMPassManagerRef PMR,
+  const LLVMRustThinLTOData *ThinLTOData
 ) {
+  unwrap(PMBR)->ImportSummary = getThinLTOIndex(ThinLTOData);
   unwrap(PMBR)->populateThinLTOPassManager(*unwrap(PMR));
 }
 
@@ -377,6 +424,70 @@ static Reloc::Model fromRust(LLVMRustRelocModel RustReloc) {
   report_fatal_error("Bad RelocModel.");
 }
 
+enum class LLVMRustBasicBlockSections {
+  None,
+  All,
+  Labels,
+  List,
+};
+
+#if LLVM_VERSION_GE(11, 0)
+static BasicBlockSection fromRust(LLVMRustBasicBlockSections Sections) {
+  switch (Sections) {
+  case LLVMRustBasicBlockSections::None:
+    return BasicBlockSection::None;
+  case LLVMRustBasicBlockSections::All:
+    return BasicBlockSection::All;
+  case LLVMRustBasicBlockSections::Labels:
+    return BasicBlockSection::Labels;
+  case LLVMRustBasicBlockSections::List:
+    return BasicBlockSection::List;
+  }
+  report_fatal_error("Bad BasicBlockSections.");
+}
+#endif
+
+enum class LLVMRustDebugCompression {
+  None,
+  Zlib,
+};
+
+enum class LLVMRustMachineOutliner {
+  Never,
+  TargetDefault,
+  Always,
+};
+
+enum class LLVMRustISelAbort {
+  Default,
+  Abort,
+  Fallback,
+  FallbackWithDiag,
+};
+
+static GlobalISelAbortMode fromRust(LLVMRustISelAbort Abort) {
+  switch (Abort) {
+  case LLVMRustISelAbort::Abort:
+    return GlobalISelAbortMode::Enable;
+  case LLVMRustISelAbort::Fallback:
+    return GlobalISelAbortMode::Disable;
+  case LLVMRustISelAbort::FallbackWithDiag:
+    return GlobalISelAbortMode::DisableWithDiag;
+  default:
+    report_fatal_error("Bad ISelAbort.");
+  }
+}
+
+// Targets pick their GlobalISel abort mode in their constructor (AArch64 falls
+// back to SelectionDAG at -O0, for example), so this has to be applied on top
+// of that. The instruction selector itself is picked through `-fast-isel` and
+// `-global-isel` in `configure_llvm`, which override whatever is set on the
+// target machine when a pass pipeline is built.
+static void setISelAbort(TargetMachine *TM, LLVMRustISelAbort Abort) {
+  if (Abort != LLVMRustISelAbort::Default)
+    TM->setGlobalISelAbort(fromRust(Abort));
+}
+
 #ifdef LLVM_RUSTLLVM
 /// getLongestEntryLength - Return the length of the longest entry in the table.
 template<typename KV>
@@ -413,14 +524,24 @@ extern "C" size_t LLVMRustGetTargetFeaturesCount(LLVMTargetMachineRef TM) {
   return FeatTable.size();
 }
 
-extern "C" void LLVMRustGetTargetFeature(LLVMTargetMachineRef TM, size_t Index,
-                                         const char** Feature, const char** Desc) {
+struct LLVMRustTargetFeature {
+  const char *Feature;
+  const char *Desc;
+};
+
+// Fills `Features` with the first `Len` entries of the feature table, which
+// `LLVMRustGetTargetFeaturesCount` gives the size of, and returns how many
+// were written. The strings are static.
+extern "C" size_t LLVMRustGetTargetFeatures(LLVMTargetMachineRef TM,
+                                            LLVMRustTargetFeature *Features,
+                                            size_t Len) {
   const TargetMachine *Target = unwrap(TM);
   const MCSubtargetInfo *MCInfo = Target->getMCSubtargetInfo();
   const ArrayRef<SubtargetFeatureKV> FeatTable = MCInfo->getFeatureTable();
-  const SubtargetFeatureKV Feat = FeatTable[Index];
-  *Feature = Feat.Key;
-  *Desc = Feat.Desc;
+  size_t N = std::min(Len, FeatTable.size());
+  for (size_t I = 0; I < N; I++)
+    Features[I] = {FeatTable[I].Key, FeatTable[I].Desc};
+  return N;
 }
 
 #else
@@ -433,15 +554,112 @@ extern "C" size_t LLVMRustGetTargetFeaturesCount(LLVMTargetMachineRef) {
   return 0;
 }
 
-extern "C" void LLVMRustGetTargetFeature(LLVMTargetMachineRef, const char**, const char**) {}
+extern "C" size_t LLVMRustGetTargetFeatures(LLVMTargetMachineRef, void *, size_t) {
+  return 0;
+}
 #endif
 
+extern "C" typedef void (*LLVMRustHostCPUFeatureCallback)(void *, // payload
+                                                          const char *, // feature name
+                                                          size_t, // feature name length
+                                                          bool); // enabled
+
+// Reports every feature the host CPU was probed for, along with whether it is
+// actually usable. Unlike the CPU name this also reflects features that are
+// fused off on a given part or masked by a hypervisor. Returns false if the
+// features of this host cannot be detected at all.
+extern "C" bool LLVMRustGetHostCPUFeatures(LLVMRustHostCPUFeatureCallback Callback,
+                                           void *CallbackPayload) {
+  StringMap<bool> HostFeatures;
+  if (!sys::getHostCPUFeatures(HostFeatures))
+    return false;
+  for (auto &Feature : HostFeatures) {
+    StringRef Name = Feature.getKey();
+    Callback(CallbackPayload, Name.data(), Name.size(), Feature.getValue());
+  }
+  return true;
+}
+
 extern "C" const char* LLVMRustGetHostCPUName(size_t *len) {
   StringRef Name = sys::getHostCPUName();
   *len = Name.size();
   return Name.data();
 }
 
+// Creating a TargetMachine looks up the target, parses the feature string and
+// builds the subtarget tables, which adds up when every codegen unit and every
+// LTO backend asks for one. Disposed TargetMachines are therefore kept in a
+// process-wide pool keyed by everything they were created from, and handed out
+// again with their options reset. The pool is shared between threads because
+// rustc runs each work item on a fresh thread.
+//
+// The split DWARF file name is different for every codegen unit, so it isn't
+// part of the key and is set again on each machine taken from the pool.
+namespace {
+class LLVMRustTargetMachineCache {
+  // The options a TargetMachine had right after construction, which includes
+  // what the target itself set up on top of the ones it was created with.
+  struct Entry {
+    std::string Key;
+    TargetOptions Options;
+  };
+
+  std::mutex Lock;
+  // Idle TargetMachines of all keys, least recently disposed first.
+  std::list<TargetMachine *> Idle;
+  DenseMap<TargetMachine *, Entry> Entries;
+
+  // More than this many idle instances would only happen if many backends
+  // finished at once, don't hold on to them forever. The oldest idle instance
+  // is dropped to make room, whatever its key.
+  static constexpr size_t MaxIdle = 16;
+
+public:
+  TargetMachine *take(const std::string &Key, const char *SplitDwarfFile) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    auto It = std::find_if(Idle.rbegin(), Idle.rend(), [&](TargetMachine *TM) {
+      return Entries.find(TM)->second.Key == Key;
+    });
+    if (It == Idle.rend())
+      return nullptr;
+    TargetMachine *TM = *It;
+    Idle.erase(std::next(It).base());
+    // Codegen adjusts the options of the TargetMachine it runs with (e.g. from
+    // function attributes), start the next user from a clean slate.
+    TM->Options = Entries[TM].Options;
+    TM->Options.MCOptions.SplitDwarfFile = SplitDwarfFile ? SplitDwarfFile : "";
+    return TM;
+  }
+
+  void created(TargetMachine *TM, std::string Key) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Entries[TM] = Entry{std::move(Key), TM->Options};
+  }
+
+  void dispose(TargetMachine *TM) {
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      if (Entries.count(TM)) {
+        Idle.push_back(TM);
+        if (Idle.size() <= MaxIdle)
+          return;
+        TM = Idle.front();
+        Idle.pop_front();
+        Entries.erase(TM);
+      }
+    }
+    delete TM;
+  }
+};
+} // namespace
+
+// Intentionally leaked, so that no TargetMachine is destroyed during static
+// destruction.
+static LLVMRustTargetMachineCache &getTargetMachineCache() {
+  static LLVMRustTargetMachineCache *Cache = new LLVMRustTargetMachineCache();
+  return *Cache;
+}
+
 extern "C" LLVMTargetMachineRef LLVMRustCreateTargetMachine(
     const char *TripleStr, const char *CPU, const char *Feature,
     const char *ABIStr, LLVMRustCodeModel RustCM, LLVMRustRelocModel RustReloc,
@@ -454,20 +672,19 @@ extern "C" LLVMTargetMachineRef LLVMRustCreateTargetMachine(
     bool EmitStackSizeSection,
     bool RelaxELFRelocations,
     bool UseInitArray,
+    bool SplitMachineFunctions,
+    LLVMRustBasicBlockSections BBSections,
+    const char *BBSectionsListPath,
+    LLVMRustDebugCompression DebugCompression,
+    LLVMRustMachineOutliner MachineOutliner,
+    LLVMRustISelAbort ISelAbort,
     const char *SplitDwarfFile) {
 
   auto OptLevel = fromRust(RustOptLevel);
   auto RM = fromRust(RustReloc);
   auto CM = fromRust(RustCM);
 
-  std::string Error;
   Triple Trip(Triple::normalize(TripleStr));
-  const llvm::Target *TheTarget =
-      TargetRegistry::lookupTarget(Trip.getTriple(), Error);
-  if (TheTarget == nullptr) {
-    LLVMRustSetLastError(Error.c_str());
-    return nullptr;
-  }
 
   TargetOptions Options;
 
@@ -500,19 +717,173 @@ extern "C" LLVMTargetMachineRef LLVMRustCreateTargetMachine(
 
   Options.EmitStackSizeSection = EmitStackSizeSection;
 
+  // Moves the blocks that the profile says are cold out of their function
+  // into a `.text.split.` section of their own. Only does anything with
+  // profile data, and only on ELF targets.
+#if LLVM_VERSION_GE(12, 0)
+  Options.EnableMachineFunctionSplitter = SplitMachineFunctions;
+#else
+  (void)SplitMachineFunctions;
+#endif
+
+  // Basic-block sections give post-link optimizers the freedom to reorder the
+  // blocks of a function, `Labels` only emits the address map they need to
+  // attribute samples to blocks. The cluster list for `List` is typically
+  // produced from a profile of a previous build.
+#if LLVM_VERSION_GE(11, 0)
+  Options.BBSections = fromRust(BBSections);
+  if (BBSections == LLVMRustBasicBlockSections::List) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+        MemoryBuffer::getFile(BBSectionsListPath);
+    if (!BufOrErr) {
+      std::string Msg = std::string("failed to read basic block sections list `") +
+                        BBSectionsListPath + "`: " + BufOrErr.getError().message();
+      LLVMRustSetLastError(Msg.c_str());
+      return nullptr;
+    }
+    Options.BBSectionsFuncListBuf = std::move(*BufOrErr);
+  }
+#else
+  if (BBSections != LLVMRustBasicBlockSections::None) {
+    LLVMRustSetLastError("basic block sections require LLVM 11 or later");
+    return nullptr;
+  }
+  (void)BBSectionsListPath;
+#endif
+
+  // Compress the `.debug_*` sections (as `SHF_COMPRESSED` sections) while the
+  // object is written, rather than in a separate objcopy step afterwards.
+  switch (DebugCompression) {
+  case LLVMRustDebugCompression::None:
+    break;
+  case LLVMRustDebugCompression::Zlib:
+    if (!zlib::isAvailable()) {
+      LLVMRustSetLastError("zlib debug info compression requires LLVM built with zlib");
+      return nullptr;
+    }
+    Options.CompressDebugSections = DebugCompressionType::Z;
+    break;
+  }
+
+  // Whether the outliner runs on every function or only where the target says
+  // it's profitable is decided by `-enable-machine-outliner`, which is set in
+  // `configure_llvm` to match. Targets supporting the latter mode turn on
+  // `SupportsDefaultOutlining` from their constructor.
+  Options.EnableMachineOutliner = MachineOutliner != LLVMRustMachineOutliner::Never;
+
+  std::string Key;
+  raw_string_ostream KeyOS(Key);
+  KeyOS << Trip.getTriple() << '\0' << CPU << '\0' << Feature << '\0' << ABIStr
+        << '\0' << (int)RustCM << ',' << (int)RustReloc << ',' << (int)RustOptLevel
+        << ',' << UseSoftFloat << FunctionSections << DataSections << TrapUnreachable
+        << Singlethread << AsmComments << EmitStackSizeSection
+        << RelaxELFRelocations << UseInitArray << SplitMachineFunctions << ','
+        << (int)BBSections << '\0' << (BBSectionsListPath ? BBSectionsListPath : "")
+        << '\0' << (int)DebugCompression << ',' << (int)MachineOutliner << ','
+        << (int)ISelAbort;
+  KeyOS.flush();
+
+  LLVMRustTargetMachineCache &Cache = getTargetMachineCache();
+  if (TargetMachine *TM = Cache.take(Key, SplitDwarfFile)) {
+    setISelAbort(TM, ISelAbort);
+    return wrap(TM);
+  }
+
+  std::string Error;
+  const llvm::Target *TheTarget =
+      TargetRegistry::lookupTarget(Trip.getTriple(), Error);
+  if (TheTarget == nullptr) {
+    LLVMRustSetLastError(Error.c_str());
+    return nullptr;
+  }
+
   TargetMachine *TM = TheTarget->createTargetMachine(
       Trip.getTriple(), CPU, Feature, Options, RM, CM, OptLevel);
+  if (TM) {
+    Cache.created(TM, std::move(Key));
+    setISelAbort(TM, ISelAbort);
+  }
   return wrap(TM);
 }
 
 extern "C" void LLVMRustDisposeTargetMachine(LLVMTargetMachineRef TM) {
-  delete unwrap(TM);
+  getTargetMachineCache().dispose(unwrap(TM));
+}
+
+// Whether the instrumentation profile at `Path` also has context-sensitive
+// counts, which `-Z cs-profile-generate` builds produce once merged into the
+// regular profile. Unreadable profiles are reported by the passes using them.
+extern "C" bool LLVMRustProfileHasCSIRLevel(const char *Path) {
+  auto ReaderOrErr = IndexedInstrProfReader::create(Path);
+  if (!ReaderOrErr) {
+    consumeError(ReaderOrErr.takeError());
+    return false;
+  }
+  return (*ReaderOrErr)->hasCSIRLevelProfile();
+}
+
+// Writes the functions that the instrumentation profile at `ProfilePath` has
+// counts for to `OutPath`, one symbol per line and hottest first, as linkers
+// expect a symbol ordering file. A function is as hot as its most executed
+// block. Functions never executed are left out, so the linker puts them after
+// the ones listed. The name that a local function has in the profile is
+// prefixed with its file name, which is dropped again, and `SymbolPrefix` is
+// put in front of every name for targets whose symbols have one.
+extern "C" LLVMRustResult
+LLVMRustWritePGOSymbolOrdering(const char *ProfilePath, const char *OutPath,
+                               const char *SymbolPrefix) {
+  auto ReaderOrErr = IndexedInstrProfReader::create(ProfilePath);
+  if (!ReaderOrErr) {
+    LLVMRustSetLastError(toString(ReaderOrErr.takeError()).c_str());
+    return LLVMRustResult::Failure;
+  }
+  InstrProfReader &Reader = **ReaderOrErr;
+
+  // The same function can have records with different CFG hashes, from
+  // different versions of it.
+  StringMap<uint64_t> Hotness;
+  for (const NamedInstrProfRecord &Record : Reader) {
+    StringRef Name = Record.Name;
+    size_t Delim = Name.find_last_of(":;");
+    if (Delim != StringRef::npos)
+      Name = Name.drop_front(Delim + 1);
+    uint64_t MaxCount = 0;
+    for (uint64_t Count : Record.Counts)
+      MaxCount = std::max(MaxCount, Count);
+    if (MaxCount == 0)
+      continue;
+    uint64_t &Hot = Hotness[Name];
+    Hot = std::max(Hot, MaxCount);
+  }
+  if (Error E = Reader.getError()) {
+    LLVMRustSetLastError(toString(std::move(E)).c_str());
+    return LLVMRustResult::Failure;
+  }
+
+  std::vector<std::pair<uint64_t, StringRef>> Ranked;
+  for (const auto &Entry : Hotness)
+    Ranked.emplace_back(Entry.getValue(), Entry.getKey());
+  llvm::sort(Ranked, [](const std::pair<uint64_t, StringRef> &A,
+                        const std::pair<uint64_t, StringRef> &B) {
+    return A.first != B.first ? A.first > B.first : A.second < B.second;
+  });
+
+  std::error_code EC;
+  raw_fd_ostream OS(OutPath, EC, sys::fs::OF_Text);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  for (const auto &Entry : Ranked)
+    OS << SymbolPrefix << Entry.second << '\n';
+  return LLVMRustResult::Success;
 }
 
 extern "C" void LLVMRustConfigurePassManagerBuilder(
     LLVMPassManagerBuilderRef PMBR, LLVMRustCodeGenOptLevel OptLevel,
     bool MergeFunctions, bool SLPVectorize, bool LoopVectorize, bool PrepareForThinLTO,
-    const char* PGOGenPath, const char* PGOUsePath) {
+    const char* PGOGenPath, const char* PGOUsePath, bool PGOUseCSProfile,
+    const char* PGOCSGenPath, const char* PGOSampleUsePath) {
   unwrap(PMBR)->MergeFunctions = MergeFunctions;
   unwrap(PMBR)->SLPVectorize = SLPVectorize;
   unwrap(PMBR)->OptLevel = fromRust(OptLevel);
@@ -527,6 +898,18 @@ extern "C" void LLVMRustConfigurePassManagerBuilder(
   if (PGOUsePath) {
     assert(!PGOGenPath);
     unwrap(PMBR)->PGOInstrUse = PGOUsePath;
+    // The legacy pass manager names the context-sensitive profile through
+    // the same field as the regular one.
+    if (PGOCSGenPath) {
+      unwrap(PMBR)->EnablePGOCSInstrGen = true;
+      unwrap(PMBR)->PGOInstrGen = PGOCSGenPath;
+    } else if (PGOUseCSProfile) {
+      unwrap(PMBR)->EnablePGOCSInstrUse = true;
+    }
+  }
+  if (PGOSampleUsePath) {
+    assert(!PGOGenPath && !PGOUsePath);
+    unwrap(PMBR)->PGOSampleUse = PGOSampleUsePath;
   }
 }
 
@@ -602,10 +985,96 @@ static CodeGenFileType fromRust(LLVMRustFileType Type) {
   }
 }
 
+// The object writers only need to seek back to patch up headers, which a
+// regular file supports, so they write to one directly instead of collecting
+// the whole output in a `buffer_ostream` first. Pipes and character devices
+// still need the buffer.
+class LLVMRustEmissionStream {
+  raw_fd_ostream &OS;
+  std::unique_ptr<buffer_ostream> Buffer;
+
+public:
+  explicit LLVMRustEmissionStream(raw_fd_ostream &OS) : OS(OS) {
+    if (!OS.supportsSeeking())
+      Buffer = std::make_unique<buffer_ostream>(OS);
+  }
+
+  raw_pwrite_stream &get() {
+    if (Buffer)
+      return *Buffer;
+    return OS;
+  }
+};
+
+namespace {
+// Drops the IR of every function as soon as the AsmPrinter is done with it.
+// The MachineFunction is already gone by then (`addPassesToEmitFile` ends with
+// `FreeMachineFunction`), so a module being emitted no longer needs all of its
+// IR and machine code alive at once. Only the body goes: the Function itself
+// and its metadata are still needed by the end of the module. Functions with a
+// block whose address is taken keep their body, as it would replace the block
+// address with a constant.
+//
+// A declaration must have external linkage and no comdat, so the function gets
+// those once its body is gone. If it had local linkage it stays `dso_local`,
+// so the functions emitted after it still call it directly. Private functions
+// keep their body, as their symbol name depends on their linkage.
+class LLVMRustReleaseFunctionBodies : public FunctionPass {
+public:
+  static char ID;
+  LLVMRustReleaseFunctionBodies() : FunctionPass(ID) {}
+
+  bool runOnFunction(Function &F) override {
+    if (F.hasPrivateLinkage())
+      return false;
+    for (BasicBlock &BB : F)
+      if (BB.hasAddressTaken())
+        return false;
+    bool WasLocal = F.hasLocalLinkage();
+    for (BasicBlock &BB : F)
+      BB.dropAllReferences();
+    while (!F.empty())
+      F.begin()->eraseFromParent();
+    F.setLinkage(GlobalValue::ExternalLinkage);
+    F.setComdat(nullptr);
+    if (WasLocal)
+      F.setDSOLocal(true);
+    return true;
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesAll();
+  }
+
+  StringRef getPassName() const override {
+    return "Release function bodies after emission";
+  }
+};
+} // namespace
+
+char LLVMRustReleaseFunctionBodies::ID = 0;
+
+// Adds the passes emitting a module as `FileType` to `PM`, and if asked to,
+// the one releasing each function's IR once it has been emitted. That's only
+// done for ELF: at the end of the module, the COFF and wasm printers tell a
+// defined function from one that's only declared by whether it has a body.
+static bool addPassesToEmitFile(TargetMachine *TM, legacy::PassManagerBase &PM,
+                                raw_pwrite_stream &Out,
+                                raw_pwrite_stream *DwoOut,
+                                CodeGenFileType FileType,
+                                bool ReleaseFunctionBodies) {
+  if (TM->addPassesToEmitFile(PM, Out, DwoOut, FileType, false))
+    return true;
+  if (ReleaseFunctionBodies && TM->getTargetTriple().isOSBinFormatELF())
+    PM.add(new LLVMRustReleaseFunctionBodies());
+  return false;
+}
+
 extern "C" LLVMRustResult
 LLVMRustWriteOutputFile(LLVMTargetMachineRef Target, LLVMPassManagerRef PMR,
                         LLVMModuleRef M, const char *Path, const char *DwoPath,
-                        LLVMRustFileType RustFileType) {
+                        LLVMRustFileType RustFileType,
+                        bool ReleaseFunctionBodies) {
   llvm::legacy::PassManager *PM = unwrap<llvm::legacy::PassManager>(PMR);
   auto FileType = fromRust(RustFileType);
 
@@ -619,7 +1088,7 @@ LLVMRustWriteOutputFile(LLVMTargetMachineRef Target, LLVMPassManagerRef PMR,
     return LLVMRustResult::Failure;
   }
 
-  buffer_ostream BOS(OS);
+  LLVMRustEmissionStream Out(OS);
   if (DwoPath) {
     raw_fd_ostream DOS(DwoPath, EC, sys::fs::OF_None);
     EC.clear();
@@ -629,11 +1098,13 @@ LLVMRustWriteOutputFile(LLVMTargetMachineRef Target, LLVMPassManagerRef PMR,
       LLVMRustSetLastError(ErrorInfo.c_str());
       return LLVMRustResult::Failure;
     }
-    buffer_ostream DBOS(DOS);
-    unwrap(Target)->addPassesToEmitFile(*PM, BOS, &DBOS, FileType, false);
+    LLVMRustEmissionStream DwoOut(DOS);
+    addPassesToEmitFile(unwrap(Target), *PM, Out.get(), &DwoOut.get(), FileType,
+                        ReleaseFunctionBodies);
     PM->run(*unwrap(M));
   } else {
-    unwrap(Target)->addPassesToEmitFile(*PM, BOS, nullptr, FileType, false);
+    addPassesToEmitFile(unwrap(Target), *PM, Out.get(), nullptr, FileType,
+                        ReleaseFunctionBodies);
     PM->run(*unwrap(M));
   }
 
@@ -644,180 +1115,1098 @@ LLVMRustWriteOutputFile(LLVMTargetMachineRef Target, LLVMPassManagerRef PMR,
   return LLVMRustResult::Success;
 }
 
-extern "C" typedef void (*LLVMRustSelfProfileBeforePassCallback)(void*, // LlvmSelfProfiler
-                                                      const char*,      // pass name
-                                                      const char*);     // IR name
-extern "C" typedef void (*LLVMRustSelfProfileAfterPassCallback)(void*); // LlvmSelfProfiler
-
-std::string LLVMRustwrappedIrGetName(const llvm::Any &WrappedIr) {
-  if (any_isa<const Module *>(WrappedIr))
-    return any_cast<const Module *>(WrappedIr)->getName().str();
-  if (any_isa<const Function *>(WrappedIr))
-    return any_cast<const Function *>(WrappedIr)->getName().str();
-  if (any_isa<const Loop *>(WrappedIr))
-    return any_cast<const Loop *>(WrappedIr)->getName().str();
-  if (any_isa<const LazyCallGraph::SCC *>(WrappedIr))
-    return any_cast<const LazyCallGraph::SCC *>(WrappedIr)->getName();
-  return "<UNKNOWN>";
+// Like `LLVMRustWriteOutputFile`, but emits into `Out` instead of a file. The
+// DWO of split DWARF still goes to `DwoPath`, if given. Disposes the pass
+// manager in all cases.
+static LLVMRustResult emitToBuffer(TargetMachine *TM, LLVMPassManagerRef PMR,
+                                   Module &M, const char *DwoPath,
+                                   CodeGenFileType FileType,
+                                   bool ReleaseFunctionBodies,
+                                   SmallVectorImpl<char> &Out) {
+  llvm::legacy::PassManager *PM = unwrap<llvm::legacy::PassManager>(PMR);
+  raw_svector_ostream OS(Out);
+  if (DwoPath) {
+    std::error_code EC;
+    raw_fd_ostream DOS(DwoPath, EC, sys::fs::OF_None);
+    if (EC) {
+      LLVMDisposePassManager(PMR);
+      LLVMRustSetLastError(EC.message().c_str());
+      return LLVMRustResult::Failure;
+    }
+    LLVMRustEmissionStream DwoOut(DOS);
+    addPassesToEmitFile(TM, *PM, OS, &DwoOut.get(), FileType,
+                        ReleaseFunctionBodies);
+    PM->run(M);
+  } else {
+    addPassesToEmitFile(TM, *PM, OS, nullptr, FileType, ReleaseFunctionBodies);
+    PM->run(M);
+  }
+  LLVMDisposePassManager(PMR);
+  return LLVMRustResult::Success;
 }
 
+// An output stream that can be pointed at a different stream for every module,
+// so that a codegen pipeline, whose AsmPrinter keeps a reference to the stream
+// it was built with, can be used for more than one output file.
+class LLVMRustRetargetableStream : public raw_pwrite_stream {
+  raw_pwrite_stream *Target = nullptr;
 
-void LLVMSelfProfileInitializeCallbacks(
-    PassInstrumentationCallbacks& PIC, void* LlvmSelfProfiler,
-    LLVMRustSelfProfileBeforePassCallback BeforePassCallback,
-    LLVMRustSelfProfileAfterPassCallback AfterPassCallback) {
-#if LLVM_VERSION_GE(12, 0)
-  PIC.registerBeforeNonSkippedPassCallback([LlvmSelfProfiler, BeforePassCallback](
-                                           StringRef Pass, llvm::Any Ir) {
-    std::string PassName = Pass.str();
-    std::string IrName = LLVMRustwrappedIrGetName(Ir);
-    BeforePassCallback(LlvmSelfProfiler, PassName.c_str(), IrName.c_str());
-  });
-
-  PIC.registerAfterPassCallback(
-      [LlvmSelfProfiler, AfterPassCallback](StringRef Pass, llvm::Any IR,
-                                            const PreservedAnalyses &Preserved) {
-        AfterPassCallback(LlvmSelfProfiler);
-      });
-
-  PIC.registerAfterPassInvalidatedCallback(
-      [LlvmSelfProfiler, AfterPassCallback](StringRef Pass, const PreservedAnalyses &Preserved) {
-        AfterPassCallback(LlvmSelfProfiler);
-      });
-#else
-  PIC.registerBeforePassCallback([LlvmSelfProfiler, BeforePassCallback](
-                                     StringRef Pass, llvm::Any Ir) {
-    std::string PassName = Pass.str();
-    std::string IrName = LLVMRustwrappedIrGetName(Ir);
-    BeforePassCallback(LlvmSelfProfiler, PassName.c_str(), IrName.c_str());
-    return true;
-  });
-
-  PIC.registerAfterPassCallback(
-      [LlvmSelfProfiler, AfterPassCallback](StringRef Pass, llvm::Any Ir) {
-        AfterPassCallback(LlvmSelfProfiler);
-      });
-
-  PIC.registerAfterPassInvalidatedCallback(
-      [LlvmSelfProfiler, AfterPassCallback](StringRef Pass) {
-        AfterPassCallback(LlvmSelfProfiler);
-      });
-#endif
-
-  PIC.registerBeforeAnalysisCallback([LlvmSelfProfiler, BeforePassCallback](
-                                         StringRef Pass, llvm::Any Ir) {
-    std::string PassName = Pass.str();
-    std::string IrName = LLVMRustwrappedIrGetName(Ir);
-    BeforePassCallback(LlvmSelfProfiler, PassName.c_str(), IrName.c_str());
-  });
+  void write_impl(const char *Ptr, size_t Size) override {
+    Target->write(Ptr, Size);
+  }
+  void pwrite_impl(const char *Ptr, size_t Size, uint64_t Offset) override {
+    Target->pwrite(Ptr, Size, Offset);
+  }
+  uint64_t current_pos() const override { return Target ? Target->tell() : 0; }
 
-  PIC.registerAfterAnalysisCallback(
-      [LlvmSelfProfiler, AfterPassCallback](StringRef Pass, llvm::Any Ir) {
-        AfterPassCallback(LlvmSelfProfiler);
-      });
-}
+public:
+  LLVMRustRetargetableStream() { SetUnbuffered(); }
 
-enum class LLVMRustOptStage {
-  PreLinkNoLTO,
-  PreLinkThinLTO,
-  PreLinkFatLTO,
-  ThinLTO,
-  FatLTO,
+  void setTarget(raw_pwrite_stream *NewTarget) {
+    flush();
+    Target = NewTarget;
+  }
 };
 
-struct LLVMRustSanitizerOptions {
-  bool SanitizeAddress;
-  bool SanitizeAddressRecover;
-  bool SanitizeMemory;
-  bool SanitizeMemoryRecover;
-  int  SanitizeMemoryTrackOrigins;
-  bool SanitizeThread;
-  bool SanitizeHWAddress;
-  bool SanitizeHWAddressRecover;
+// A legacy codegen pass manager built once with `addPassesToEmitFile` and run
+// on many modules. The MachineModuleInfo and the AsmPrinter's streamer reset
+// themselves at the end of every module, so only the output needs switching.
+struct LLVMRustCodegenPipeline {
+  LLVMRustRetargetableStream OS;
+  legacy::PassManager PM;
 };
 
-extern "C" LLVMRustResult
-LLVMRustOptimizeWithNewPassManager(
-    LLVMModuleRef ModuleRef,
-    LLVMTargetMachineRef TMRef,
-    LLVMRustPassBuilderOptLevel OptLevelRust,
-    LLVMRustOptStage OptStage,
-    bool NoPrepopulatePasses, bool VerifyIR, bool UseThinLTOBuffers,
-    bool MergeFunctions, bool UnrollLoops, bool SLPVectorize, bool LoopVectorize,
-    bool DisableSimplifyLibCalls, bool EmitLifetimeMarkers,
-    LLVMRustSanitizerOptions *SanitizerOptions,
-    const char *PGOGenPath, const char *PGOUsePath,
-    bool InstrumentCoverage, bool InstrumentGCOV,
-    void* LlvmSelfProfiler,
-    LLVMRustSelfProfileBeforePassCallback BeforePassCallback,
-    LLVMRustSelfProfileAfterPassCallback AfterPassCallback,
-    const char *ExtraPasses, size_t ExtraPassesLen) {
-  Module *TheModule = unwrap(ModuleRef);
+extern "C" LLVMRustCodegenPipeline *
+LLVMRustCreateCodegenPipeline(LLVMTargetMachineRef TMRef,
+                              bool DisableSimplifyLibCalls,
+                              LLVMRustFileType RustFileType,
+                              bool ReleaseFunctionBodies) {
   TargetMachine *TM = unwrap(TMRef);
-  PassBuilder::OptimizationLevel OptLevel = fromRust(OptLevelRust);
+  auto Pipeline = std::make_unique<LLVMRustCodegenPipeline>();
+  Pipeline->PM.add(createTargetTransformInfoWrapperPass(TM->getTargetIRAnalysis()));
+  TargetLibraryInfoImpl TLII(TM->getTargetTriple());
+  if (DisableSimplifyLibCalls)
+    TLII.disableAllFunctions();
+  Pipeline->PM.add(new TargetLibraryInfoWrapperPass(TLII));
+  if (addPassesToEmitFile(TM, Pipeline->PM, Pipeline->OS, nullptr,
+                          fromRust(RustFileType), ReleaseFunctionBodies)) {
+    LLVMRustSetLastError("target does not support this kind of output");
+    return nullptr;
+  }
+  return Pipeline.release();
+}
 
+extern "C" LLVMRustResult
+LLVMRustRunCodegenPipeline(LLVMRustCodegenPipeline *Pipeline, LLVMModuleRef M,
+                           const char *Path) {
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  LLVMRustEmissionStream Out(OS);
+  Pipeline->OS.setTarget(&Out.get());
+  Pipeline->PM.run(*unwrap(M));
+  Pipeline->OS.setTarget(nullptr);
+  return LLVMRustResult::Success;
+}
 
-  PipelineTuningOptions PTO;
-  PTO.LoopUnrolling = UnrollLoops;
-  PTO.LoopInterleaving = UnrollLoops;
-  PTO.LoopVectorization = LoopVectorize;
-  PTO.SLPVectorization = SLPVectorize;
-#if LLVM_VERSION_GE(12, 0)
-  PTO.MergeFunctions = MergeFunctions;
-#else
-  // MergeFunctions is not supported by NewPM in older LLVM versions.
-  (void) MergeFunctions;
-#endif
+extern "C" void LLVMRustFreeCodegenPipeline(LLVMRustCodegenPipeline *Pipeline) {
+  delete Pipeline;
+}
 
-  // FIXME: We may want to expose this as an option.
-  bool DebugPassManager = false;
+// The disassembler only needs the context for symbolization, which isn't used
+// here.
+struct LLVMRustDisassemblerContext {
+#if LLVM_VERSION_GE(13, 0)
+  MCContext Ctx;
 
-  PassInstrumentationCallbacks PIC;
-#if LLVM_VERSION_GE(12, 0)
-  StandardInstrumentations SI(DebugPassManager);
+  explicit LLVMRustDisassemblerContext(const TargetMachine &TM)
+      : Ctx(TM.getTargetTriple(), TM.getMCAsmInfo(), TM.getMCRegisterInfo(),
+            TM.getMCSubtargetInfo()) {}
 #else
-  StandardInstrumentations SI;
+  MCObjectFileInfo MOFI;
+  MCContext Ctx;
+
+  explicit LLVMRustDisassemblerContext(const TargetMachine &TM)
+      : Ctx(TM.getMCAsmInfo(), TM.getMCRegisterInfo(), &MOFI) {}
 #endif
-  SI.registerCallbacks(PIC);
+};
 
-  if (LlvmSelfProfiler){
-    LLVMSelfProfileInitializeCallbacks(PIC,LlvmSelfProfiler,BeforePassCallback,AfterPassCallback);
-  }
+extern "C" bool LLVMRustTargetMachineHasDisassembler(LLVMTargetMachineRef TM) {
+  const TargetMachine &Target = *unwrap(TM);
+  LLVMRustDisassemblerContext DC(Target);
+  std::unique_ptr<MCDisassembler> DisAsm(
+      Target.getTarget().createMCDisassembler(*Target.getMCSubtargetInfo(), DC.Ctx));
+  return DisAsm != nullptr;
+}
 
-  Optional<PGOOptions> PGOOpt;
-  if (PGOGenPath) {
-    assert(!PGOUsePath);
-    PGOOpt = PGOOptions(PGOGenPath, "", "", PGOOptions::IRInstr);
-  } else if (PGOUsePath) {
-    assert(!PGOGenPath);
-    PGOOpt = PGOOptions(PGOUsePath, "", "", PGOOptions::IRUse);
+// Writes a listing of the code sections of `Obj` to `OS`: the instructions of
+// each section, the symbols defined in it as labels, and the relocations that
+// apply to an instruction as a comment after it.
+static bool disassembleObject(const TargetMachine &TM,
+                              const object::ObjectFile &Obj, raw_ostream &OS,
+                              std::string &Error) {
+  const Target &T = TM.getTarget();
+  const Triple &TT = TM.getTargetTriple();
+  const MCAsmInfo *MAI = TM.getMCAsmInfo();
+  const MCRegisterInfo *MRI = TM.getMCRegisterInfo();
+  const MCInstrInfo *MII = TM.getMCInstrInfo();
+  const MCSubtargetInfo *STI = TM.getMCSubtargetInfo();
+  LLVMRustDisassemblerContext DC(TM);
+  std::unique_ptr<MCDisassembler> DisAsm(T.createMCDisassembler(*STI, DC.Ctx));
+  std::unique_ptr<MCInstPrinter> IP(T.createMCInstPrinter(
+      TT, MAI->getAssemblerDialect(), *MAI, *MII, *MRI));
+  if (!DisAsm || !IP) {
+    Error = "no disassembler for target " + TT.str();
+    return false;
   }
 
-#if LLVM_VERSION_GE(12, 0) && !LLVM_VERSION_GE(13,0)
-  PassBuilder PB(DebugPassManager, TM, PTO, PGOOpt, &PIC);
-#else
-  PassBuilder PB(TM, PTO, PGOOpt, &PIC);
+  std::map<uint64_t, std::vector<std::pair<uint64_t, StringRef>>> Labels;
+  for (const object::SymbolRef &Sym : Obj.symbols()) {
+    Expected<object::SymbolRef::Type> TypeOrErr = Sym.getType();
+    if (!TypeOrErr) {
+      consumeError(TypeOrErr.takeError());
+      continue;
+    }
+    // Section and file symbols.
+    if (*TypeOrErr == object::SymbolRef::ST_Debug)
+      continue;
+    Expected<object::section_iterator> SecOrErr = Sym.getSection();
+    if (!SecOrErr) {
+      consumeError(SecOrErr.takeError());
+      continue;
+    }
+    Expected<StringRef> NameOrErr = Sym.getName();
+    if (!NameOrErr) {
+      consumeError(NameOrErr.takeError());
+      continue;
+    }
+    Expected<uint64_t> AddrOrErr = Sym.getAddress();
+    if (!AddrOrErr) {
+      consumeError(AddrOrErr.takeError());
+      continue;
+    }
+    if (*SecOrErr == Obj.section_end() || NameOrErr->empty())
+      continue;
+    Labels[(*SecOrErr)->getIndex()].emplace_back(*AddrOrErr, *NameOrErr);
+  }
+
+  // ELF keeps relocations in sections of their own, COFF and Mach-O attach
+  // them to the section they apply to.
+  std::map<uint64_t, std::multimap<uint64_t, std::string>> Relocs;
+  for (const object::SectionRef &Sec : Obj.sections()) {
+    Expected<object::section_iterator> RelocatedOrErr = Sec.getRelocatedSection();
+    if (!RelocatedOrErr) {
+      consumeError(RelocatedOrErr.takeError());
+      continue;
+    }
+    object::SectionRef Target =
+        *RelocatedOrErr == Obj.section_end() ? Sec : **RelocatedOrErr;
+    for (const object::RelocationRef &Reloc : Sec.relocations()) {
+      SmallString<32> Comment;
+      Reloc.getTypeName(Comment);
+      object::symbol_iterator SI = Reloc.getSymbol();
+      if (SI != Obj.symbol_end()) {
+        Expected<StringRef> NameOrErr = SI->getName();
+        if (NameOrErr) {
+          Comment += ' ';
+          Comment += *NameOrErr;
+        } else {
+          consumeError(NameOrErr.takeError());
+        }
+      }
+      Relocs[Target.getIndex()].emplace(Reloc.getOffset(), Comment.str().str());
+    }
+  }
+
+  for (const object::SectionRef &Sec : Obj.sections()) {
+    if (!Sec.isText() || Sec.getSize() == 0)
+      continue;
+    Expected<StringRef> NameOrErr = Sec.getName();
+    if (!NameOrErr) {
+      Error = toString(NameOrErr.takeError());
+      return false;
+    }
+    Expected<StringRef> ContentsOrErr = Sec.getContents();
+    if (!ContentsOrErr) {
+      Error = toString(ContentsOrErr.takeError());
+      return false;
+    }
+    ArrayRef<uint8_t> Bytes = arrayRefFromStringRef(*ContentsOrErr);
+    uint64_t SectionAddr = Sec.getAddress();
+
+    std::vector<std::pair<uint64_t, StringRef>> &SecLabels = Labels[Sec.getIndex()];
+    llvm::stable_sort(SecLabels, [](const std::pair<uint64_t, StringRef> &A,
+                                    const std::pair<uint64_t, StringRef> &B) {
+      return A.first < B.first;
+    });
+    std::multimap<uint64_t, std::string> &SecRelocs = Relocs[Sec.getIndex()];
+
+    OS << "\t.section\t" << *NameOrErr << "\n";
+    size_t NextLabel = 0;
+    for (uint64_t Offset = 0; Offset < Bytes.size();) {
+      uint64_t Address = SectionAddr + Offset;
+      for (; NextLabel < SecLabels.size() && SecLabels[NextLabel].first <= Address;
+           ++NextLabel)
+        OS << SecLabels[NextLabel].second << ":\n";
+
+      MCInst Inst;
+      uint64_t Size = 0;
+      if (DisAsm->getInstruction(Inst, Size, Bytes.slice(Offset), Address,
+                                 nulls()) == MCDisassembler::Success) {
+        IP->printInst(&Inst, Address, "", *STI, OS);
+      } else {
+        Size = std::min<uint64_t>(std::max<uint64_t>(Size, 1), Bytes.size() - Offset);
+        OS << "\t.byte\t";
+        for (uint64_t I = 0; I < Size; I++)
+          OS << (I ? ", " : "") << format_hex(Bytes[Offset + I], 4);
+      }
+      for (auto It = SecRelocs.lower_bound(Offset),
+                End = SecRelocs.lower_bound(Offset + Size);
+           It != End; ++It)
+        OS << "\t" << MAI->getCommentString() << " " << It->second;
+      OS << "\n";
+      Offset += Size;
+    }
+  }
+  return true;
+}
+
+// Runs the backend once to produce the object file, and writes the assembly
+// listing by disassembling that object instead of running instruction
+// selection and register allocation a second time on a clone of the module.
+extern "C" LLVMRustResult
+LLVMRustWriteObjectAndAssemblyFiles(LLVMTargetMachineRef Target,
+                                    LLVMPassManagerRef PMR, LLVMModuleRef M,
+                                    const char *ObjPath, const char *DwoPath,
+                                    const char *AsmPath,
+                                    bool ReleaseFunctionBodies) {
+  TargetMachine *TM = unwrap(Target);
+
+  SmallVector<char, 0> ObjBuffer;
+  if (emitToBuffer(TM, PMR, *unwrap(M), DwoPath, CGFT_ObjectFile,
+                   ReleaseFunctionBodies, ObjBuffer) !=
+      LLVMRustResult::Success)
+    return LLVMRustResult::Failure;
+
+  std::error_code EC;
+  {
+    raw_fd_ostream OS(ObjPath, EC, sys::fs::OF_None);
+    if (EC) {
+      LLVMRustSetLastError(EC.message().c_str());
+      return LLVMRustResult::Failure;
+    }
+    OS << StringRef(ObjBuffer.data(), ObjBuffer.size());
+  }
+
+  Expected<std::unique_ptr<object::ObjectFile>> ObjOrErr =
+      object::ObjectFile::createObjectFile(
+          MemoryBufferRef(StringRef(ObjBuffer.data(), ObjBuffer.size()), ObjPath));
+  if (!ObjOrErr) {
+    LLVMRustSetLastError(toString(ObjOrErr.takeError()).c_str());
+    return LLVMRustResult::Failure;
+  }
+
+  raw_fd_ostream AsmOS(AsmPath, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  std::string Error;
+  if (!disassembleObject(*TM, **ObjOrErr, AsmOS, Error)) {
+    LLVMRustSetLastError(Error.c_str());
+    return LLVMRustResult::Failure;
+  }
+  return LLVMRustResult::Success;
+}
+
+enum class LLVMRustIRUnitKind {
+  Module,
+  Function,
+  Loop,
+  SCC,
+  Other,
+};
+
+// The names are only valid for the duration of the call. Instruction counts
+// are -1 where they weren't measured: for analyses, and after passes that
+// deleted the IR unit they ran on.
+extern "C" typedef void (*LLVMRustSelfProfileBeforePassCallback)(void*, // LlvmSelfProfiler
+                                                      const char*,      // pass name
+                                                      size_t,           // pass name length
+                                                      const char*,      // IR name
+                                                      size_t,           // IR name length
+                                                      LLVMRustIRUnitKind,
+                                                      int64_t);         // instruction count
+extern "C" typedef void (*LLVMRustSelfProfileAfterPassCallback)(void*,    // LlvmSelfProfiler
+                                                     int64_t); // instruction count
+extern "C" typedef void (*LLVMRustSelfProfileSlowPassCallback)(void*, // LlvmSelfProfiler
+                                                    const char*,      // pass name
+                                                    size_t,           // pass name length
+                                                    const char*,      // IR name
+                                                    size_t,           // IR name length
+                                                    LLVMRustIRUnitKind,
+                                                    uint64_t);        // nanoseconds
+extern "C" typedef void (*LLVMRustSelfProfilePassSummaryCallback)(void*, // LlvmSelfProfiler
+                                                       const char*,      // pass name
+                                                       size_t,           // pass name length
+                                                       uint64_t,         // executions
+                                                       uint64_t);        // nanoseconds
+
+// Recording every pass executed on every function and loop is too expensive
+// to leave on all the time. With `SampleEvery` > 1 only every Nth of those is
+// handed to the self-profiler. The others are timed here instead: with
+// `MinDurationNanos` > 0 those that took at least that long are reported
+// through `SlowPassCallback` once they're done, and everything else is added
+// up per pass and reported through `SummaryCallback` at the end of each run.
+// Passes on modules and SCCs are always handed to the self-profiler.
+struct LLVMRustPassSamplingOptions {
+  unsigned SampleEvery;
+  uint64_t MinDurationNanos;
+  LLVMRustSelfProfileSlowPassCallback SlowPassCallback;
+  LLVMRustSelfProfilePassSummaryCallback SummaryCallback;
+};
+
+// The callbacks fire for every pass and analysis run on every IR unit, so
+// names are handed out without copying them. SCCs don't have a name of their
+// own, theirs is printed into `Scratch`, which is reused from one call to the
+// next.
+static StringRef LLVMRustwrappedIrGetName(const llvm::Any &WrappedIr,
+                                          std::string &Scratch,
+                                          LLVMRustIRUnitKind &Kind) {
+  if (any_isa<const Module *>(WrappedIr)) {
+    Kind = LLVMRustIRUnitKind::Module;
+    return any_cast<const Module *>(WrappedIr)->getName();
+  }
+  if (any_isa<const Function *>(WrappedIr)) {
+    Kind = LLVMRustIRUnitKind::Function;
+    return any_cast<const Function *>(WrappedIr)->getName();
+  }
+  if (any_isa<const Loop *>(WrappedIr)) {
+    Kind = LLVMRustIRUnitKind::Loop;
+    return any_cast<const Loop *>(WrappedIr)->getName();
+  }
+  if (any_isa<const LazyCallGraph::SCC *>(WrappedIr)) {
+    Kind = LLVMRustIRUnitKind::SCC;
+    Scratch.clear();
+    raw_string_ostream OS(Scratch);
+    OS << *any_cast<const LazyCallGraph::SCC *>(WrappedIr);
+    return OS.str();
+  }
+  Kind = LLVMRustIRUnitKind::Other;
+  return "<UNKNOWN>";
+}
+
+static int64_t LLVMRustwrappedIrInstructionCount(const llvm::Any &WrappedIr) {
+  if (any_isa<const Module *>(WrappedIr))
+    return any_cast<const Module *>(WrappedIr)->getInstructionCount();
+  if (any_isa<const Function *>(WrappedIr))
+    return any_cast<const Function *>(WrappedIr)->getInstructionCount();
+  if (any_isa<const Loop *>(WrappedIr)) {
+    int64_t Count = 0;
+    for (const BasicBlock *BB : any_cast<const Loop *>(WrappedIr)->blocks())
+      Count += BB->size();
+    return Count;
+  }
+  if (any_isa<const LazyCallGraph::SCC *>(WrappedIr)) {
+    int64_t Count = 0;
+    for (const LazyCallGraph::Node &N : *any_cast<const LazyCallGraph::SCC *>(WrappedIr))
+      Count += N.getFunction().getInstructionCount();
+    return Count;
+  }
+  return -1;
+}
+
+class LLVMRustPassSampler {
+public:
+  LLVMRustPassSampler(void *LlvmSelfProfiler,
+                      LLVMRustSelfProfileBeforePassCallback BeforePassCallback,
+                      LLVMRustSelfProfileAfterPassCallback AfterPassCallback,
+                      const LLVMRustPassSamplingOptions *Options)
+      : LlvmSelfProfiler(LlvmSelfProfiler), BeforePassCallback(BeforePassCallback),
+        AfterPassCallback(AfterPassCallback) {
+    if (Options) {
+      Sampling = true;
+      SampleEvery = Options->SampleEvery;
+      MinDurationNanos = Options->MinDurationNanos;
+      SlowPassCallback = Options->SlowPassCallback;
+      SummaryCallback = Options->SummaryCallback;
+    }
+  }
+
+  void before(StringRef Pass, const llvm::Any &Ir, bool IsAnalysis) {
+    LLVMRustIRUnitKind Kind;
+    StringRef IrName = LLVMRustwrappedIrGetName(Ir, Scratch, Kind);
+    bool FineGrained = Kind == LLVMRustIRUnitKind::Function ||
+                       Kind == LLVMRustIRUnitKind::Loop;
+    bool Forwarded = !Sampling || !FineGrained || SampleEvery <= 1 ||
+                     FineGrainedRuns++ % SampleEvery == 0;
+    // A pass that runs other passes (a pass manager or an adaptor) isn't
+    // timed on its own, as its time is that of the passes it runs. Analyses
+    // don't count, they're run on behalf of the pass that asked for them.
+    if (Depth > 0 && !IsAnalysis)
+      Stack[Depth - 1].RunsPasses = true;
+    // The frames are kept around when they're popped, so that the names
+    // copied into them below don't need to be allocated again and again.
+    if (Depth == Stack.size())
+      Stack.emplace_back();
+    Frame &F = Stack[Depth++];
+    F.Pass = Pass;
+    F.Kind = Kind;
+    F.Forwarded = Forwarded;
+    F.RunsPasses = false;
+    F.CountInstructions = Forwarded && !IsAnalysis;
+    F.ChildNanos = 0;
+    if (!Forwarded && SlowPassCallback && MinDurationNanos > 0)
+      F.IrName.assign(IrName.data(), IrName.size());
+    if (Sampling)
+      F.Start = std::chrono::steady_clock::now();
+    if (Forwarded)
+      BeforePassCallback(LlvmSelfProfiler, Pass.data(), Pass.size(), IrName.data(),
+                         IrName.size(), Kind,
+                         F.CountInstructions ? LLVMRustwrappedIrInstructionCount(Ir) : -1);
+  }
+
+  void after(const llvm::Any *Ir) {
+    if (Depth == 0)
+      return;
+    Frame &F = Stack[--Depth];
+    if (Sampling) {
+      uint64_t Nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - F.Start).count();
+      if (Depth > 0)
+        Stack[Depth - 1].ChildNanos += Nanos;
+      if (!F.Forwarded && !F.RunsPasses) {
+        uint64_t SelfNanos = Nanos - std::min(Nanos, F.ChildNanos);
+        if (SlowPassCallback && MinDurationNanos > 0 && SelfNanos >= MinDurationNanos) {
+          SlowPassCallback(LlvmSelfProfiler, F.Pass.data(), F.Pass.size(),
+                           F.IrName.data(), F.IrName.size(), F.Kind, Nanos);
+        } else {
+          PassStats &Stats = Summary[F.Pass];
+          Stats.Executions++;
+          Stats.Nanos += SelfNanos;
+        }
+      }
+    }
+    if (F.Forwarded)
+      AfterPassCallback(LlvmSelfProfiler,
+                        Ir && F.CountInstructions ? LLVMRustwrappedIrInstructionCount(*Ir) : -1);
+  }
+
+  // Reports the passes that weren't recorded individually since the last
+  // call.
+  void flush() {
+    if (SummaryCallback)
+      for (const auto &Entry : Summary)
+        SummaryCallback(LlvmSelfProfiler, Entry.getKey().data(), Entry.getKey().size(),
+                        Entry.getValue().Executions, Entry.getValue().Nanos);
+    Summary.clear();
+  }
+
+private:
+  struct Frame {
+    StringRef Pass;
+    std::string IrName;
+    LLVMRustIRUnitKind Kind;
+    bool Forwarded;
+    bool RunsPasses;
+    bool CountInstructions;
+    uint64_t ChildNanos;
+    std::chrono::steady_clock::time_point Start;
+  };
+  struct PassStats {
+    uint64_t Executions = 0;
+    uint64_t Nanos = 0;
+  };
+
+  void *LlvmSelfProfiler;
+  LLVMRustSelfProfileBeforePassCallback BeforePassCallback;
+  LLVMRustSelfProfileAfterPassCallback AfterPassCallback;
+  LLVMRustSelfProfileSlowPassCallback SlowPassCallback = nullptr;
+  LLVMRustSelfProfilePassSummaryCallback SummaryCallback = nullptr;
+  bool Sampling = false;
+  unsigned SampleEvery = 0;
+  uint64_t MinDurationNanos = 0;
+
+  uint64_t FineGrainedRuns = 0;
+  std::vector<Frame> Stack;
+  size_t Depth = 0;
+  StringMap<PassStats> Summary;
+  std::string Scratch;
+};
+
+std::shared_ptr<LLVMRustPassSampler> LLVMSelfProfileInitializeCallbacks(
+    PassInstrumentationCallbacks& PIC, void* LlvmSelfProfiler,
+    LLVMRustSelfProfileBeforePassCallback BeforePassCallback,
+    LLVMRustSelfProfileAfterPassCallback AfterPassCallback,
+    const LLVMRustPassSamplingOptions *SamplingOptions) {
+  auto Sampler = std::make_shared<LLVMRustPassSampler>(
+      LlvmSelfProfiler, BeforePassCallback, AfterPassCallback, SamplingOptions);
+  LLVMRustPassSampler *S = Sampler.get();
+
+#if LLVM_VERSION_GE(12, 0)
+  PIC.registerBeforeNonSkippedPassCallback([S](StringRef Pass, llvm::Any Ir) {
+    S->before(Pass, Ir, /*IsAnalysis=*/false);
+  });
+
+  PIC.registerAfterPassCallback(
+      [S](StringRef Pass, llvm::Any IR, const PreservedAnalyses &Preserved) {
+        S->after(&IR);
+      });
+
+  PIC.registerAfterPassInvalidatedCallback(
+      [S](StringRef Pass, const PreservedAnalyses &Preserved) {
+        S->after(nullptr);
+      });
+#else
+  PIC.registerBeforePassCallback([S](StringRef Pass, llvm::Any Ir) {
+    S->before(Pass, Ir, /*IsAnalysis=*/false);
+    return true;
+  });
+
+  PIC.registerAfterPassCallback([S](StringRef Pass, llvm::Any Ir) {
+    S->after(&Ir);
+  });
+
+  PIC.registerAfterPassInvalidatedCallback([S](StringRef Pass) {
+    S->after(nullptr);
+  });
 #endif
 
+  PIC.registerBeforeAnalysisCallback([S](StringRef Pass, llvm::Any Ir) {
+    S->before(Pass, Ir, /*IsAnalysis=*/true);
+  });
+
+  PIC.registerAfterAnalysisCallback([S](StringRef Pass, llvm::Any Ir) {
+    S->after(nullptr);
+  });
+
+  return Sampler;
+}
+
+// Compile-time budgets for the optimization pipeline. Once a function has
+// spent `FunctionBudgetNanos` in passes, or the module `ModuleBudgetNanos`,
+// the expensive optional passes are skipped from then on, and they're always
+// skipped on cold functions. Each pass is charged as soon as it's done, so a
+// budget can run out in the middle of a function's pipeline. `SkippedPasses`
+// is set to the number of passes skipped that way. A budget of 0 means no
+// limit.
+struct LLVMRustOptimizationBudget {
+  uint64_t FunctionBudgetNanos;
+  uint64_t ModuleBudgetNanos;
+  uint64_t SkippedPasses;
+};
+
+class LLVMRustBudgetTracker {
+public:
+  // The pipeline doesn't say which of its passes are expensive, so the set
+  // is fixed here, by the names the default pipelines report them under. It
+  // holds the loop transforms, vectorizers and value numbering passes, whose
+  // cost grows faster than the size of the function, and which only make the
+  // code better, so nothing later depends on them having run.
+  explicit LLVMRustBudgetTracker(LLVMRustOptimizationBudget *Budget)
+      : Budget(Budget) {
+    for (const char *Pass : {"LoopUnrollPass", "LoopFullUnrollPass",
+                             "LoopUnrollAndJamPass", "LoopVectorizePass",
+                             "SLPVectorizerPass", "GVN", "NewGVNPass",
+                             "SimpleLoopUnswitchPass", "LoopDistributePass",
+                             "LoopInterchangePass"})
+      Expensive.insert(Pass);
+  }
+
+  void registerCallbacks(PassInstrumentationCallbacks &PIC);
+
+  void start() {
+    ModuleSpent = 0;
+    Spent.clear();
+    Stack.clear();
+    Budget->SkippedPasses = 0;
+  }
+
+private:
+  struct Frame {
+    const Function *F;
+    uint64_t ChildNanos;
+    std::chrono::steady_clock::time_point Start;
+  };
+
+  static uint64_t nanosSince(std::chrono::steady_clock::time_point Start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - Start).count();
+  }
+
+  // Loop passes are charged to the function containing the loop.
+  static const Function *functionOf(const llvm::Any &IR) {
+    if (any_isa<const Function *>(IR))
+      return any_cast<const Function *>(IR);
+    if (any_isa<const Loop *>(IR))
+      return any_cast<const Loop *>(IR)->getHeader()->getParent();
+    return nullptr;
+  }
+
+  static bool isCold(const Function &F) {
+    if (F.hasFnAttribute(Attribute::Cold))
+      return true;
+    auto EntryCount = F.getEntryCount();
+    return EntryCount.hasValue() && EntryCount->getCount() == 0;
+  }
+
+  void before(const llvm::Any &IR) {
+    Stack.push_back({functionOf(IR), 0, std::chrono::steady_clock::now()});
+  }
+
+  // Pass managers and adaptors are passes of their own, so a pass is only
+  // charged for the time not spent in the passes nested in it.
+  void after() {
+    if (Stack.empty())
+      return;
+    Frame Done = Stack.back();
+    Stack.pop_back();
+    uint64_t Nanos = nanosSince(Done.Start);
+    if (!Stack.empty())
+      Stack.back().ChildNanos += Nanos;
+    uint64_t SelfNanos = Nanos - std::min(Nanos, Done.ChildNanos);
+    ModuleSpent += SelfNanos;
+    if (Done.F)
+      Spent[Done.F] += SelfNanos;
+  }
+
+  bool shouldRun(StringRef Pass, const llvm::Any &IR) {
+    Pass.consume_front("llvm::");
+    if (!Expensive.count(Pass))
+      return true;
+    const Function *F = functionOf(IR);
+    if (!F)
+      return true;
+    bool OverBudget =
+        (Budget->ModuleBudgetNanos && ModuleSpent >= Budget->ModuleBudgetNanos) ||
+        (Budget->FunctionBudgetNanos && Spent.lookup(F) >= Budget->FunctionBudgetNanos);
+    if (!OverBudget && !isCold(*F))
+      return true;
+    Budget->SkippedPasses++;
+    return false;
+  }
+
+  LLVMRustOptimizationBudget *Budget;
+  StringSet<> Expensive;
+  uint64_t ModuleSpent = 0;
+  DenseMap<const Function *, uint64_t> Spent;
+  std::vector<Frame> Stack;
+};
+
+void LLVMRustBudgetTracker::registerCallbacks(PassInstrumentationCallbacks &PIC) {
+#if LLVM_VERSION_GE(12, 0)
+  PIC.registerShouldRunOptionalPassCallback([this](StringRef Pass, llvm::Any IR) {
+    return shouldRun(Pass, IR);
+  });
+  PIC.registerBeforeNonSkippedPassCallback([this](StringRef Pass, llvm::Any IR) {
+    before(IR);
+  });
+  PIC.registerAfterPassCallback(
+      [this](StringRef Pass, llvm::Any IR, const PreservedAnalyses &Preserved) {
+        after();
+      });
+  PIC.registerAfterPassInvalidatedCallback(
+      [this](StringRef Pass, const PreservedAnalyses &Preserved) { after(); });
+#else
+  // Before LLVM 12 a pass can't be skipped without also skipping the ones
+  // the pipeline relies on, so budgets aren't enforced.
+  (void)PIC;
+#endif
+}
+
+// `LLVMRustSimplifyFunctionsInParallel` marks the functions it has already run
+// the function simplification pipeline over with this attribute. The regular
+// pipeline then doesn't run that again on them while it walks the call graph,
+// until a pass working on the call graph changes them (the inliner inlining
+// something into them, say). The attribute is removed once the regular pipeline
+// is done with the module.
+static const char PresimplifiedAttr[] = "rustc-presimplified";
+
+class LLVMRustPresimplifiedFunctions {
+public:
+  void registerCallbacks(PassInstrumentationCallbacks &PIC);
+
+  void start(const Module &M) {
+    Active = llvm::any_of(M, [](const Function &F) {
+      return F.hasFnAttribute(PresimplifiedAttr);
+    });
+    AdaptorDepth = 0;
+    Changed.clear();
+  }
+
+  void finish(Module &M) {
+    if (!Active)
+      return;
+    for (Function &F : M)
+      F.removeFnAttr(PresimplifiedAttr);
+  }
+
+private:
+  // The function simplification pipeline is what the call graph walk runs on
+  // each function through this adaptor.
+  static bool isFunctionAdaptor(StringRef Pass) {
+    Pass.consume_front("llvm::");
+    return Pass.startswith("CGSCCToFunctionPassAdaptor");
+  }
+
+  static bool changesFunctions(StringRef Pass) {
+    Pass.consume_front("llvm::");
+    return Pass == "InlinerPass" || Pass == "ArgumentPromotionPass";
+  }
+
+  bool shouldRun(const llvm::Any &IR) {
+    if (!Active || AdaptorDepth == 0)
+      return true;
+    const Function *F = nullptr;
+    if (any_isa<const Function *>(IR))
+      F = any_cast<const Function *>(IR);
+    else if (any_isa<const Loop *>(IR))
+      F = any_cast<const Loop *>(IR)->getHeader()->getParent();
+    return !F || !F->hasFnAttribute(PresimplifiedAttr) || Changed.count(F);
+  }
+
+  bool Active = false;
+  unsigned AdaptorDepth = 0;
+  DenseSet<const Function *> Changed;
+};
+
+void LLVMRustPresimplifiedFunctions::registerCallbacks(PassInstrumentationCallbacks &PIC) {
+#if LLVM_VERSION_GE(12, 0)
+  PIC.registerShouldRunOptionalPassCallback([this](StringRef Pass, llvm::Any IR) {
+    return shouldRun(IR);
+  });
+  PIC.registerBeforeNonSkippedPassCallback([this](StringRef Pass, llvm::Any IR) {
+    if (Active && isFunctionAdaptor(Pass))
+      AdaptorDepth++;
+  });
+  PIC.registerAfterPassCallback(
+      [this](StringRef Pass, llvm::Any IR, const PreservedAnalyses &Preserved) {
+        if (!Active)
+          return;
+        if (isFunctionAdaptor(Pass)) {
+          AdaptorDepth--;
+        } else if (changesFunctions(Pass) && !Preserved.areAllPreserved() &&
+                   any_isa<const LazyCallGraph::SCC *>(IR)) {
+          for (const LazyCallGraph::Node &N : *any_cast<const LazyCallGraph::SCC *>(IR))
+            Changed.insert(&N.getFunction());
+        }
+      });
+  PIC.registerAfterPassInvalidatedCallback(
+      [this](StringRef Pass, const PreservedAnalyses &Preserved) {
+        if (Active && isFunctionAdaptor(Pass))
+          AdaptorDepth--;
+      });
+#else
+  // Before LLVM 12 a pass can't be skipped without also skipping the ones
+  // the pipeline relies on, so everything is simplified again.
+  (void)PIC;
+#endif
+}
+
+// The time spent in each pass over one run of the pipeline, and by how many
+// instructions the pass changed the IR it ran on, for `-Z time-llvm-passes-json`.
+// A pass isn't charged for the passes nested in it, so the time of a pass
+// manager or adaptor is only its own overhead, but its instruction delta does
+// include the changes made by the passes it ran.
+class LLVMRustPassTimings {
+public:
+  void registerCallbacks(PassInstrumentationCallbacks &PIC);
+
+  // Writes a JSON array with one object per pass, in the order the passes
+  // first ran.
+  void writeJSON(RustStringRef Out) const {
+    RawRustStringOstream OS(Out);
+    json::OStream J(OS);
+    J.array([&] {
+      for (const PassTiming &T : Passes)
+        J.object([&] {
+          J.attribute("pass", T.Name);
+          J.attribute("executions", int64_t(T.Executions));
+          J.attribute("wall", T.Time.getWallTime());
+          J.attribute("user", T.Time.getUserTime());
+          J.attribute("system", T.Time.getSystemTime());
+          J.attribute("instructions", T.InstructionDelta);
+        });
+    });
+  }
+
+private:
+  struct Frame {
+    unsigned Pass;
+    int64_t Instructions;
+    TimeRecord Resumed;
+  };
+  struct PassTiming {
+    std::string Name;
+    uint64_t Executions = 0;
+    TimeRecord Time;
+    int64_t InstructionDelta = 0;
+  };
+
+  void charge(const Frame &F, const TimeRecord &Now) {
+    Passes[F.Pass].Time += Now;
+    Passes[F.Pass].Time -= F.Resumed;
+  }
+
+  void before(StringRef Pass, const llvm::Any &IR) {
+    if (!Stack.empty())
+      charge(Stack.back(), TimeRecord::getCurrentTime(false));
+    auto Entry = Index.try_emplace(Pass, Passes.size());
+    if (Entry.second) {
+      Passes.emplace_back();
+      Passes.back().Name = Pass.str();
+    }
+    int64_t Instructions = LLVMRustwrappedIrInstructionCount(IR);
+    Stack.push_back({Entry.first->second, Instructions, TimeRecord::getCurrentTime(true)});
+  }
+
+  // `IR` is null if the pass invalidated the IR unit it ran on.
+  void after(const llvm::Any *IR) {
+    if (Stack.empty())
+      return;
+    Frame F = Stack.back();
+    Stack.pop_back();
+    charge(F, TimeRecord::getCurrentTime(false));
+    PassTiming &T = Passes[F.Pass];
+    T.Executions++;
+    if (IR && F.Instructions >= 0) {
+      int64_t Instructions = LLVMRustwrappedIrInstructionCount(*IR);
+      if (Instructions >= 0)
+        T.InstructionDelta += Instructions - F.Instructions;
+    }
+    if (!Stack.empty())
+      Stack.back().Resumed = TimeRecord::getCurrentTime(true);
+  }
+
+  StringMap<unsigned> Index;
+  std::vector<PassTiming> Passes;
+  std::vector<Frame> Stack;
+};
+
+void LLVMRustPassTimings::registerCallbacks(PassInstrumentationCallbacks &PIC) {
+#if LLVM_VERSION_GE(12, 0)
+  PIC.registerBeforeNonSkippedPassCallback([this](StringRef Pass, llvm::Any IR) {
+    before(Pass, IR);
+  });
+  PIC.registerAfterPassCallback(
+      [this](StringRef Pass, llvm::Any IR, const PreservedAnalyses &Preserved) {
+        after(&IR);
+      });
+  PIC.registerAfterPassInvalidatedCallback(
+      [this](StringRef Pass, const PreservedAnalyses &Preserved) { after(nullptr); });
+#else
+  PIC.registerBeforePassCallback([this](StringRef Pass, llvm::Any IR) {
+    before(Pass, IR);
+    return true;
+  });
+  PIC.registerAfterPassCallback([this](StringRef Pass, llvm::Any IR) {
+    after(&IR);
+  });
+  PIC.registerAfterPassInvalidatedCallback([this](StringRef Pass) {
+    after(nullptr);
+  });
+#endif
+}
+
+enum class LLVMRustOptStage {
+  PreLinkNoLTO,
+  PreLinkThinLTO,
+  PreLinkFatLTO,
+  ThinLTO,
+  FatLTO,
+};
+
+struct LLVMRustSanitizerOptions {
+  bool SanitizeAddress;
+  bool SanitizeAddressRecover;
+  bool SanitizeMemory;
+  bool SanitizeMemoryRecover;
+  int  SanitizeMemoryTrackOrigins;
+  bool SanitizeThread;
+  bool SanitizeHWAddress;
+  bool SanitizeHWAddressRecover;
+};
+
+// How the counters inserted for `-Z instrument-coverage` are updated: with
+// atomic increments, so that counts stay exact when several threads run the
+// same code, and/or kept in registers inside loops and only written back to
+// memory on loop exit.
+struct LLVMRustInstrProfOptions {
+  bool Atomic;
+  bool DoCounterPromotion;
+};
+
+static InstrProfOptions fromRust(const LLVMRustInstrProfOptions &Rust) {
+  InstrProfOptions Options;
+  Options.Atomic = Rust.Atomic;
+  Options.DoCounterPromotion = Rust.DoCounterPromotion;
+  return Options;
+}
+
+extern "C" LLVMPassRef
+LLVMRustCreateInstrProfilingPass(const LLVMRustInstrProfOptions *Options) {
+  return wrap(createInstrProfilingLegacyPass(fromRust(*Options), false));
+}
+
+// With whole-program visibility every vtable without an explicit visibility
+// is treated as if nothing outside of the LTO unit could derive from it, which
+// lets whole-program devirtualization act on it. That's only sound when
+// producing an executable nothing else links against.
+//
+// This is for the merged module of fat LTO, before running the LTO pipeline;
+// for ThinLTO the same is done to the combined index during the thin link.
+extern "C" void
+LLVMRustUpdateVCallVisibility(LLVMModuleRef M, bool WholeProgramVisibility) {
 #if LLVM_VERSION_GE(13, 0)
+  updateVCallVisibilityInModule(*unwrap(M), WholeProgramVisibility,
+                                /*DynamicExportSymbols=*/{});
+#elif LLVM_VERSION_GE(11, 0)
+  updateVCallVisibilityInModule(*unwrap(M), WholeProgramVisibility);
+#else
+  (void) M;
+  (void) WholeProgramVisibility;
+#endif
+}
+
+// Everything the new pass manager needs to run an optimization pipeline: the
+// pass builder, the analysis managers and the pipeline itself. Once built this
+// is independent of any particular module, so `LLVMRustCreateNewPMPipeline`
+// keeps it around to run over many modules, while
+// `LLVMRustOptimizeWithNewPassManager` builds one for a single run.
+struct LLVMRustNewPMPipeline {
+  PassInstrumentationCallbacks PIC;
+  std::unique_ptr<StandardInstrumentations> SI;
+  std::unique_ptr<PassBuilder> PB;
   LoopAnalysisManager LAM;
   FunctionAnalysisManager FAM;
   CGSCCAnalysisManager CGAM;
   ModuleAnalysisManager MAM;
+  std::unique_ptr<TargetLibraryInfoImpl> TLII;
+  ModulePassManager MPM;
+
+  // The self-profiler of the current run of a reusable pipeline, which the
+  // instrumentation callbacks forward to. See `LLVMRustRunNewPMPipeline`.
+  void *SelfProfiler = nullptr;
+  LLVMRustSelfProfileBeforePassCallback BeforePassCallback = nullptr;
+  LLVMRustSelfProfileAfterPassCallback AfterPassCallback = nullptr;
+  LLVMRustSelfProfileSlowPassCallback SlowPassCallback = nullptr;
+  LLVMRustSelfProfilePassSummaryCallback PassSummaryCallback = nullptr;
+  std::shared_ptr<LLVMRustPassSampler> Sampler;
+  std::unique_ptr<LLVMRustBudgetTracker> Budget;
+  std::unique_ptr<LLVMRustPassTimings> Timings;
+  LLVMRustPresimplifiedFunctions Presimplified;
+};
+
+static LLVMRustResult
+buildNewPMPipeline(
+    LLVMRustNewPMPipeline &P,
+    TargetMachine *TM,
+    const Triple &TargetTriple,
+    LLVMRustPassBuilderOptLevel OptLevelRust,
+    LLVMRustOptStage OptStage,
+    bool NoPrepopulatePasses, bool VerifyIR, bool UseThinLTOBuffers,
+    bool MergeFunctions, bool UnrollLoops, bool SLPVectorize, bool LoopVectorize,
+    bool DisableSimplifyLibCalls, bool EmitLifetimeMarkers,
+    LLVMRustSanitizerOptions *SanitizerOptions,
+    const char *PGOGenPath, const char *PGOUsePath, bool PGOUseCSProfile,
+    const char *PGOCSGenPath, const char *PGOSampleUsePath,
+    const char *PGORemappingPath,
+    const LLVMRustInstrProfOptions *InstrumentCoverage, bool InstrumentGCOV,
+    void* LlvmSelfProfiler,
+    LLVMRustSelfProfileBeforePassCallback BeforePassCallback,
+    LLVMRustSelfProfileAfterPassCallback AfterPassCallback,
+    const LLVMRustPassSamplingOptions *SamplingOptions,
+    LLVMRustOptimizationBudget *Budget, bool TimePasses,
+    const char *ExtraPasses, size_t ExtraPassesLen,
+    const LLVMRustThinLTOData *ThinLTOData) {
+  PassBuilder::OptimizationLevel OptLevel = fromRust(OptLevelRust);
+
+
+  PipelineTuningOptions PTO;
+  PTO.LoopUnrolling = UnrollLoops;
+  PTO.LoopInterleaving = UnrollLoops;
+  PTO.LoopVectorization = LoopVectorize;
+  PTO.SLPVectorization = SLPVectorize;
+#if LLVM_VERSION_GE(12, 0)
+  PTO.MergeFunctions = MergeFunctions;
 #else
-  LoopAnalysisManager LAM(DebugPassManager);
-  FunctionAnalysisManager FAM(DebugPassManager);
-  CGSCCAnalysisManager CGAM(DebugPassManager);
-  ModuleAnalysisManager MAM(DebugPassManager);
+  // MergeFunctions is not supported by NewPM in older LLVM versions.
+  (void) MergeFunctions;
 #endif
 
-  FAM.registerPass([&] { return PB.buildDefaultAAPipeline(); });
+  // FIXME: We may want to expose this as an option.
+  bool DebugPassManager = false;
+
+  PassInstrumentationCallbacks &PIC = P.PIC;
+#if LLVM_VERSION_GE(12, 0)
+  P.SI = std::make_unique<StandardInstrumentations>(DebugPassManager);
+#else
+  P.SI = std::make_unique<StandardInstrumentations>();
+#endif
+  P.SI->registerCallbacks(PIC);
+
+  if (LlvmSelfProfiler){
+    P.Sampler = LLVMSelfProfileInitializeCallbacks(PIC, LlvmSelfProfiler, BeforePassCallback,
+                                                   AfterPassCallback, SamplingOptions);
+  }
+
+  if (Budget) {
+    P.Budget = std::make_unique<LLVMRustBudgetTracker>(Budget);
+    P.Budget->registerCallbacks(PIC);
+  }
+
+  if (TimePasses) {
+    P.Timings = std::make_unique<LLVMRustPassTimings>();
+    P.Timings->registerCallbacks(PIC);
+  }
+
+  P.Presimplified.registerCallbacks(PIC);
+
+  Optional<PGOOptions> PGOOpt;
+  if (PGOGenPath) {
+    assert(!PGOUsePath && !PGOCSGenPath && !PGOSampleUsePath);
+    PGOOpt = PGOOptions(PGOGenPath, "", "", PGOOptions::IRInstr);
+  } else if (PGOUsePath) {
+    assert(!PGOGenPath && !PGOSampleUsePath);
+    PGOOptions::CSPGOAction CSAction = PGOOptions::NoCSAction;
+    if (PGOCSGenPath)
+      CSAction = PGOOptions::CSIRInstr;
+    else if (PGOUseCSProfile)
+      CSAction = PGOOptions::CSIRUse;
+    PGOOpt = PGOOptions(PGOUsePath, PGOCSGenPath ? PGOCSGenPath : "",
+                        PGORemappingPath ? PGORemappingPath : "",
+                        PGOOptions::IRUse, CSAction);
+  } else if (PGOSampleUsePath) {
+    assert(!PGOGenPath && !PGOCSGenPath);
+    PGOOpt = PGOOptions(PGOSampleUsePath, "", PGORemappingPath ? PGORemappingPath : "",
+                        PGOOptions::SampleUse);
+  }
 
-  Triple TargetTriple(TheModule->getTargetTriple());
-  std::unique_ptr<TargetLibraryInfoImpl> TLII(new TargetLibraryInfoImpl(TargetTriple));
+#if LLVM_VERSION_GE(12, 0) && !LLVM_VERSION_GE(13,0)
+  P.PB = std::make_unique<PassBuilder>(DebugPassManager, TM, PTO, PGOOpt, &PIC);
+#else
+  P.PB = std::make_unique<PassBuilder>(TM, PTO, PGOOpt, &PIC);
+#endif
+  PassBuilder &PB = *P.PB;
+
+  // These outlive this function when the pipeline is reused, so the analysis
+  // registrations below must not capture any of its locals by reference.
+  LoopAnalysisManager &LAM = P.LAM;
+  FunctionAnalysisManager &FAM = P.FAM;
+  CGSCCAnalysisManager &CGAM = P.CGAM;
+  ModuleAnalysisManager &MAM = P.MAM;
+
+  PassBuilder *PBPtr = P.PB.get();
+  FAM.registerPass([PBPtr] { return PBPtr->buildDefaultAAPipeline(); });
+
+  P.TLII = std::make_unique<TargetLibraryInfoImpl>(TargetTriple);
+  TargetLibraryInfoImpl *TLII = P.TLII.get();
   if (DisableSimplifyLibCalls)
     TLII->disableAllFunctions();
-  FAM.registerPass([&] { return TargetLibraryAnalysis(*TLII); });
+  FAM.registerPass([TLII] { return TargetLibraryAnalysis(*TLII); });
 
   PB.registerModuleAnalyses(MAM);
   PB.registerCGSCCAnalyses(CGAM);
@@ -854,9 +2243,9 @@ LLVMRustOptimizeWithNewPassManager(
   }
 
   if (InstrumentCoverage) {
+    InstrProfOptions Options = fromRust(*InstrumentCoverage);
     PipelineStartEPCallbacks.push_back(
-      [](ModulePassManager &MPM, PassBuilder::OptimizationLevel Level) {
-        InstrProfOptions Options;
+      [Options](ModulePassManager &MPM, PassBuilder::OptimizationLevel Level) {
         MPM.addPass(InstrProfiling(Options, false));
       }
     );
@@ -963,11 +2352,7 @@ LLVMRustOptimizeWithNewPassManager(
     }
   }
 
-#if LLVM_VERSION_GE(13, 0)
-  ModulePassManager MPM;
-#else
-  ModulePassManager MPM(DebugPassManager);
-#endif
+  ModulePassManager &MPM = P.MPM;
   bool NeedThinLTOBufferPasses = UseThinLTOBuffers;
   if (!NoPrepopulatePasses) {
     if (OptLevel == PassBuilder::OptimizationLevel::O0) {
@@ -997,7 +2382,8 @@ LLVMRustOptimizeWithNewPassManager(
 
       MPM.addPass(AlwaysInlinerPass(EmitLifetimeMarkers));
 
-      if (PGOOpt) {
+      if (PGOOpt && (PGOOpt->Action == PGOOptions::IRInstr ||
+                     PGOOpt->Action == PGOOptions::IRUse)) {
         PB.addPGOInstrPassesForO0(
             MPM, DebugPassManager, PGOOpt->Action == PGOOptions::IRInstr,
             /*IsCS=*/false, PGOOpt->ProfileFile, PGOOpt->ProfileRemappingFile);
@@ -1055,15 +2441,19 @@ LLVMRustOptimizeWithNewPassManager(
 #endif
         break;
       case LLVMRustOptStage::ThinLTO:
-        // FIXME: Does it make sense to pass the ModuleSummaryIndex?
-        // It only seems to be needed for C++ specific optimizations.
+        // The combined index carries the whole-program devirtualization
+        // decisions made during the thin link, which the backend pipeline
+        // applies to this module.
 #if LLVM_VERSION_GE(12, 0)
-        MPM = PB.buildThinLTODefaultPipeline(OptLevel, nullptr);
+        MPM = PB.buildThinLTODefaultPipeline(OptLevel, getThinLTOIndex(ThinLTOData));
 #else
-        MPM = PB.buildThinLTODefaultPipeline(OptLevel, DebugPassManager, nullptr);
+        MPM = PB.buildThinLTODefaultPipeline(OptLevel, DebugPassManager,
+                                             getThinLTOIndex(ThinLTOData));
 #endif
         break;
       case LLVMRustOptStage::FatLTO:
+        // There's no combined index for fat LTO: the merged module is the
+        // whole program, and whole-program devirtualization runs on its IR.
 #if LLVM_VERSION_GE(12, 0)
         MPM = PB.buildLTODefaultPipeline(OptLevel, nullptr);
 #else
@@ -1087,11 +2477,429 @@ LLVMRustOptimizeWithNewPassManager(
     MPM.addPass(NameAnonGlobalPass());
   }
 
+  return LLVMRustResult::Success;
+}
+
+static void runNewPMPipeline(LLVMRustNewPMPipeline &P, Module &M) {
   // Upgrade all calls to old intrinsics first.
-  for (Module::iterator I = TheModule->begin(), E = TheModule->end(); I != E;)
+  for (Module::iterator I = M.begin(), E = M.end(); I != E;)
     UpgradeCallsToIntrinsic(&*I++); // must be post-increment, as we remove
 
-  MPM.run(*TheModule, MAM);
+  if (P.Budget)
+    P.Budget->start();
+  P.Presimplified.start(M);
+  P.MPM.run(M, P.MAM);
+  P.Presimplified.finish(M);
+  if (P.Sampler)
+    P.Sampler->flush();
+
+  // Nothing cached about this module means anything for the next one, and the
+  // results hold on to pointers into it. Clearing the module analyses also
+  // clears the inner analysis managers through their proxies, but doing them
+  // all explicitly doesn't leave that to chance.
+  P.MAM.clear();
+  P.CGAM.clear();
+  P.FAM.clear();
+  P.LAM.clear();
+}
+
+extern "C" LLVMRustResult
+LLVMRustOptimizeWithNewPassManager(
+    LLVMModuleRef ModuleRef,
+    LLVMTargetMachineRef TMRef,
+    LLVMRustPassBuilderOptLevel OptLevelRust,
+    LLVMRustOptStage OptStage,
+    bool NoPrepopulatePasses, bool VerifyIR, bool UseThinLTOBuffers,
+    bool MergeFunctions, bool UnrollLoops, bool SLPVectorize, bool LoopVectorize,
+    bool DisableSimplifyLibCalls, bool EmitLifetimeMarkers,
+    LLVMRustSanitizerOptions *SanitizerOptions,
+    const char *PGOGenPath, const char *PGOUsePath, bool PGOUseCSProfile,
+    const char *PGOCSGenPath, const char *PGOSampleUsePath,
+    const char *PGORemappingPath,
+    const LLVMRustInstrProfOptions *InstrumentCoverage, bool InstrumentGCOV,
+    void* LlvmSelfProfiler,
+    LLVMRustSelfProfileBeforePassCallback BeforePassCallback,
+    LLVMRustSelfProfileAfterPassCallback AfterPassCallback,
+    const LLVMRustPassSamplingOptions *SamplingOptions,
+    LLVMRustOptimizationBudget *Budget, RustStringRef PassTimingsOut,
+    const char *ExtraPasses, size_t ExtraPassesLen,
+    const LLVMRustThinLTOData *ThinLTOData) {
+  Module *TheModule = unwrap(ModuleRef);
+  LLVMRustNewPMPipeline P;
+  LLVMRustResult Result = buildNewPMPipeline(
+      P, unwrap(TMRef), Triple(TheModule->getTargetTriple()), OptLevelRust,
+      OptStage, NoPrepopulatePasses, VerifyIR, UseThinLTOBuffers,
+      MergeFunctions, UnrollLoops, SLPVectorize, LoopVectorize,
+      DisableSimplifyLibCalls, EmitLifetimeMarkers, SanitizerOptions,
+      PGOGenPath, PGOUsePath, PGOUseCSProfile, PGOCSGenPath, PGOSampleUsePath,
+      PGORemappingPath,
+      InstrumentCoverage, InstrumentGCOV,
+      LlvmSelfProfiler, BeforePassCallback, AfterPassCallback, SamplingOptions,
+      Budget, PassTimingsOut != nullptr, ExtraPasses, ExtraPassesLen,
+      ThinLTOData);
+  if (Result != LLVMRustResult::Success)
+    return Result;
+  runNewPMPipeline(P, *TheModule);
+  if (P.Timings)
+    P.Timings->writeJSON(PassTimingsOut);
+  return LLVMRustResult::Success;
+}
+
+static void forwardBeforePassCallback(void *Pipeline, const char *PassName,
+                                      size_t PassNameLen, const char *IrName,
+                                      size_t IrNameLen, LLVMRustIRUnitKind Kind,
+                                      int64_t InstructionCount) {
+  auto *P = static_cast<LLVMRustNewPMPipeline *>(Pipeline);
+  if (P->SelfProfiler)
+    P->BeforePassCallback(P->SelfProfiler, PassName, PassNameLen, IrName,
+                          IrNameLen, Kind, InstructionCount);
+}
+
+static void forwardAfterPassCallback(void *Pipeline, int64_t InstructionCount) {
+  auto *P = static_cast<LLVMRustNewPMPipeline *>(Pipeline);
+  if (P->SelfProfiler)
+    P->AfterPassCallback(P->SelfProfiler, InstructionCount);
+}
+
+static void forwardSlowPassCallback(void *Pipeline, const char *PassName,
+                                    size_t PassNameLen, const char *IrName,
+                                    size_t IrNameLen, LLVMRustIRUnitKind Kind,
+                                    uint64_t Nanos) {
+  auto *P = static_cast<LLVMRustNewPMPipeline *>(Pipeline);
+  if (P->SelfProfiler)
+    P->SlowPassCallback(P->SelfProfiler, PassName, PassNameLen, IrName, IrNameLen,
+                        Kind, Nanos);
+}
+
+static void forwardPassSummaryCallback(void *Pipeline, const char *PassName,
+                                       size_t PassNameLen, uint64_t Executions,
+                                       uint64_t Nanos) {
+  auto *P = static_cast<LLVMRustNewPMPipeline *>(Pipeline);
+  if (P->SelfProfiler)
+    P->PassSummaryCallback(P->SelfProfiler, PassName, PassNameLen, Executions, Nanos);
+}
+
+// Builds a pipeline with the same settings as `LLVMRustOptimizeWithNewPassManager`
+// that can be run over any number of modules with `LLVMRustRunNewPMPipeline`,
+// instead of setting up the pass builder, analysis managers and pipeline
+// again for every module. That only works for passes that don't carry state
+// from one module to the next, which rules out the sanitizers and the
+// instrumentation passes, as well as arbitrary extra passes.
+//
+// The pipeline is bound to `TMRef`, which must outlive it. If `SelfProfile`
+// is set the pipeline reports to whatever profiler each run is given.
+extern "C" LLVMRustNewPMPipeline *
+LLVMRustCreateNewPMPipeline(
+    LLVMTargetMachineRef TMRef,
+    LLVMRustPassBuilderOptLevel OptLevelRust,
+    LLVMRustOptStage OptStage,
+    bool NoPrepopulatePasses, bool VerifyIR, bool UseThinLTOBuffers,
+    bool MergeFunctions, bool UnrollLoops, bool SLPVectorize, bool LoopVectorize,
+    bool DisableSimplifyLibCalls, bool EmitLifetimeMarkers,
+    const char *PGOUsePath, bool PGOUseCSProfile, const char *PGOSampleUsePath,
+    const char *PGORemappingPath,
+    bool SelfProfile,
+    LLVMRustSelfProfileBeforePassCallback BeforePassCallback,
+    LLVMRustSelfProfileAfterPassCallback AfterPassCallback,
+    const LLVMRustPassSamplingOptions *SamplingOptions,
+    const LLVMRustThinLTOData *ThinLTOData) {
+  TargetMachine *TM = unwrap(TMRef);
+  auto P = std::make_unique<LLVMRustNewPMPipeline>();
+  P->BeforePassCallback = BeforePassCallback;
+  P->AfterPassCallback = AfterPassCallback;
+  Optional<LLVMRustPassSamplingOptions> Sampling;
+  if (SamplingOptions) {
+    P->SlowPassCallback = SamplingOptions->SlowPassCallback;
+    P->PassSummaryCallback = SamplingOptions->SummaryCallback;
+    Sampling = *SamplingOptions;
+    Sampling->SlowPassCallback = forwardSlowPassCallback;
+    Sampling->SummaryCallback = forwardPassSummaryCallback;
+  }
+  LLVMRustResult Result = buildNewPMPipeline(
+      *P, TM, TM->getTargetTriple(), OptLevelRust, OptStage,
+      NoPrepopulatePasses, VerifyIR, UseThinLTOBuffers, MergeFunctions,
+      UnrollLoops, SLPVectorize, LoopVectorize, DisableSimplifyLibCalls,
+      EmitLifetimeMarkers, /*SanitizerOptions=*/nullptr,
+      /*PGOGenPath=*/nullptr, PGOUsePath, PGOUseCSProfile, /*PGOCSGenPath=*/nullptr,
+      PGOSampleUsePath, PGORemappingPath, /*InstrumentCoverage=*/nullptr,
+      /*InstrumentGCOV=*/false, SelfProfile ? P.get() : nullptr,
+      forwardBeforePassCallback, forwardAfterPassCallback,
+      Sampling ? Sampling.getPointer() : nullptr, /*Budget=*/nullptr,
+      /*TimePasses=*/false, /*ExtraPasses=*/nullptr, /*ExtraPassesLen=*/0, ThinLTOData);
+  if (Result != LLVMRustResult::Success)
+    return nullptr;
+  return P.release();
+}
+
+extern "C" void
+LLVMRustRunNewPMPipeline(LLVMRustNewPMPipeline *P, LLVMModuleRef ModuleRef,
+                         void *LlvmSelfProfiler) {
+  P->SelfProfiler = LlvmSelfProfiler;
+  runNewPMPipeline(*P, *unwrap(ModuleRef));
+  P->SelfProfiler = nullptr;
+}
+
+extern "C" void
+LLVMRustFreeNewPMPipeline(LLVMRustNewPMPipeline *P) {
+  delete P;
+}
+
+// Declared here for `LLVMRustSimplifyFunctionsInParallel`, defined with the
+// rest of the ThinLTO support below.
+extern "C" void
+LLVMRustThinLTOPatchDICompileUnit(LLVMModuleRef Mod, DICompileUnit *Unit);
+
+// Runs LLVM's function simplification pipeline over the functions of `M` in
+// up to `Threads` parts, each on a thread of its own, as a head start for the
+// regular, serial pipeline on codegen units that are too big to have been split
+// up further. Codegen units are optimized on several threads at once already,
+// so the caller picks `Threads` from the jobserver tokens it holds. Modules with
+// fewer than `MinInstructions` instructions are left alone. The functions are
+// marked with `PresimplifiedAttr`, for the regular pipeline not to simplify
+// them again.
+//
+// LLVM IR can't be worked on from several threads at once, so the module is
+// serialized, every thread parses its own copy into its own context, turns
+// the functions it isn't responsible for into declarations and simplifies the
+// rest, and the results are linked back into `M`, replacing the original
+// bodies. For the linker to do that every local symbol is made external (and
+// given a name if it had none) while the copies are out, and restored
+// afterwards. The same goes for the comdats of the functions, as the linker
+// keeps the body it already has for a function in a comdat no matter what.
+// Modules that can't be taken apart like that (aliases, block
+// addresses, more than one compile unit) are left alone as well.
+extern "C" LLVMRustResult
+LLVMRustSimplifyFunctionsInParallel(LLVMModuleRef ModuleRef,
+                                    LLVMTargetMachineRef TMRef,
+                                    LLVMRustPassBuilderOptLevel OptLevelRust,
+                                    bool DisableSimplifyLibCalls,
+                                    unsigned Threads,
+                                    size_t MinInstructions) {
+  Module &M = *unwrap(ModuleRef);
+  TargetMachine *TM = unwrap(TMRef);
+  PassBuilder::OptimizationLevel OptLevel = fromRust(OptLevelRust);
+  if (OptLevel == PassBuilder::OptimizationLevel::O0 ||
+      M.getInstructionCount() < MinInstructions)
+    return LLVMRustResult::Success;
+  if (!M.alias_empty() || !M.ifunc_empty() ||
+      std::distance(M.debug_compile_units_begin(), M.debug_compile_units_end()) > 1)
+    return LLVMRustResult::Success;
+
+  std::vector<Function *> Defined;
+  for (Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    for (BasicBlock &BB : F)
+      if (BB.hasAddressTaken())
+        return LLVMRustResult::Success;
+    Defined.push_back(&F);
+  }
+  size_t NumParts = std::min<size_t>(Threads, Defined.size());
+  if (NumParts < 2)
+    return LLVMRustResult::Success;
+
+  DICompileUnit *Unit = nullptr;
+  for (DICompileUnit *CU : M.debug_compile_units())
+    Unit = CU;
+  // Linking the copies back in appends their named metadata to ours.
+  std::vector<std::pair<NamedMDNode *, std::vector<MDNode *>>> NamedMD;
+  for (NamedMDNode &NMD : M.named_metadata()) {
+    std::vector<MDNode *> Ops(NMD.op_begin(), NMD.op_end());
+    NamedMD.emplace_back(&NMD, std::move(Ops));
+  }
+
+  // Make every local symbol external, and remember how to undo that.
+  struct LocalSymbol {
+    std::string Name;
+    GlobalValue::LinkageTypes Linkage;
+    bool WasUnnamed;
+  };
+  std::vector<LocalSymbol> Locals;
+  for (GlobalValue &GV : M.global_values()) {
+    if (!GV.hasLocalLinkage())
+      continue;
+    bool WasUnnamed = !GV.hasName();
+    if (WasUnnamed)
+      GV.setName("rust.parallel.simplify");
+    Locals.push_back({GV.getName().str(), GV.getLinkage(), WasUnnamed});
+    GV.setLinkage(GlobalValue::ExternalLinkage);
+  }
+  auto RestoreLocals = [&]() {
+    for (const LocalSymbol &Local : Locals) {
+      GlobalValue *GV = M.getNamedValue(Local.Name);
+      if (!GV)
+        continue;
+      GV->setLinkage(Local.Linkage);
+      if (Local.WasUnnamed)
+        GV->setName("");
+    }
+  };
+
+  // Drop the functions' comdats, and remember how to undo that.
+  std::vector<std::pair<std::string, Comdat *>> Comdats;
+  for (Function *F : Defined) {
+    if (Comdat *C = F->getComdat()) {
+      Comdats.emplace_back(F->getName().str(), C);
+      F->setComdat(nullptr);
+    }
+  }
+  auto RestoreComdats = [&]() {
+    for (auto &Entry : Comdats)
+      if (Function *F = M.getFunction(Entry.first))
+        F->setComdat(Entry.second);
+  };
+
+  // Deal the functions out biggest first to whichever part has the fewest
+  // instructions so far. What a function simplifies to doesn't depend on
+  // which other functions share its part, since all it can see of them is
+  // their declarations.
+  std::stable_sort(Defined.begin(), Defined.end(), [](Function *A, Function *B) {
+    return A->getInstructionCount() > B->getInstructionCount();
+  });
+  std::vector<uint64_t> PartSizes(NumParts);
+  StringMap<size_t> PartOf;
+  for (Function *F : Defined) {
+    size_t Part = std::min_element(PartSizes.begin(), PartSizes.end()) - PartSizes.begin();
+    PartSizes[Part] += F->getInstructionCount();
+    PartOf[F->getName()] = Part;
+  }
+
+  SmallVector<char, 0> Bitcode;
+  {
+    raw_svector_ostream OS(Bitcode);
+    WriteBitcodeToFile(M, OS);
+  }
+
+  std::vector<SmallVector<char, 0>> Results(NumParts);
+  std::vector<std::string> Errors(NumParts);
+  {
+#if LLVM_VERSION_GE(11, 0)
+    ThreadPool Pool(heavyweight_hardware_concurrency(NumParts));
+#else
+    ThreadPool Pool(NumParts);
+#endif
+    for (size_t Part = 0; Part < NumParts; Part++) {
+      Pool.async([&, Part]() {
+        LLVMContext Context;
+        Expected<std::unique_ptr<Module>> PartOrErr = parseBitcodeFile(
+            MemoryBufferRef(StringRef(Bitcode.data(), Bitcode.size()),
+                            M.getModuleIdentifier()),
+            Context);
+        if (!PartOrErr) {
+          Errors[Part] = toString(PartOrErr.takeError());
+          return;
+        }
+        Module &PartM = **PartOrErr;
+        for (Function &F : PartM) {
+          if (F.isDeclaration() || PartOf.lookup(F.getName()) == Part)
+            continue;
+          F.deleteBody();
+          F.setComdat(nullptr);
+        }
+
+        // Target machines aren't thread-safe, so every part gets its own.
+        std::unique_ptr<TargetMachine> PartTM(TM->getTarget().createTargetMachine(
+            TM->getTargetTriple().str(), TM->getTargetCPU(),
+            TM->getTargetFeatureString(), TM->Options, TM->getRelocationModel(),
+            TM->getCodeModel(), TM->getOptLevel()));
+
+#if LLVM_VERSION_GE(12, 0) && !LLVM_VERSION_GE(13, 0)
+        PassBuilder PB(/*DebugLogging=*/false, PartTM.get());
+#else
+        PassBuilder PB(PartTM.get());
+#endif
+        LoopAnalysisManager LAM;
+        FunctionAnalysisManager FAM;
+        CGSCCAnalysisManager CGAM;
+        ModuleAnalysisManager MAM;
+        FAM.registerPass([&] { return PB.buildDefaultAAPipeline(); });
+        TargetLibraryInfoImpl TLII(Triple(PartM.getTargetTriple()));
+        if (DisableSimplifyLibCalls)
+          TLII.disableAllFunctions();
+        FAM.registerPass([&] { return TargetLibraryAnalysis(TLII); });
+        PB.registerModuleAnalyses(MAM);
+        PB.registerCGSCCAnalyses(CGAM);
+        PB.registerFunctionAnalyses(FAM);
+        PB.registerLoopAnalyses(LAM);
+        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+        ModulePassManager MPM;
+        MPM.addPass(RequireAnalysisPass<ProfileSummaryAnalysis, Module>());
+#if LLVM_VERSION_GE(12, 0)
+        MPM.addPass(createModuleToFunctionPassAdaptor(
+            PB.buildFunctionSimplificationPipeline(OptLevel, ThinOrFullLTOPhase::None)));
+#else
+        MPM.addPass(createModuleToFunctionPassAdaptor(
+            PB.buildFunctionSimplificationPipeline(OptLevel, PassBuilder::ThinLTOPhase::None)));
+#endif
+        MPM.run(PartM, MAM);
+
+        // Only send back what's new: the simplified bodies, and any globals
+        // the passes created (e.g. switch lookup tables). Everything else
+        // already exists in `M`.
+        std::vector<GlobalVariable *> Appending;
+        for (GlobalVariable &GV : PartM.globals()) {
+          if (!M.getNamedValue(GV.getName()))
+            continue;
+          if (GV.hasAppendingLinkage()) {
+            Appending.push_back(&GV);
+            continue;
+          }
+          GV.setInitializer(nullptr);
+          GV.setLinkage(GlobalValue::ExternalLinkage);
+          GV.setComdat(nullptr);
+        }
+        for (GlobalVariable *GV : Appending)
+          GV->eraseFromParent();
+
+        raw_svector_ostream OS(Results[Part]);
+        WriteBitcodeToFile(PartM, OS);
+      });
+    }
+    Pool.wait();
+  }
+  // Nothing has changed in `M` yet, apart from the linkages and comdats.
+  for (const std::string &Error : Errors) {
+    if (!Error.empty()) {
+      RestoreComdats();
+      RestoreLocals();
+      LLVMRustSetLastError(Error.c_str());
+      return LLVMRustResult::Failure;
+    }
+  }
+
+  for (size_t Part = 0; Part < NumParts; Part++) {
+    Expected<std::unique_ptr<Module>> PartOrErr = parseBitcodeFile(
+        MemoryBufferRef(StringRef(Results[Part].data(), Results[Part].size()),
+                        M.getModuleIdentifier()),
+        M.getContext());
+    if (!PartOrErr) {
+      RestoreComdats();
+      RestoreLocals();
+      LLVMRustSetLastError(toString(PartOrErr.takeError()).c_str());
+      return LLVMRustResult::Failure;
+    }
+    if (Linker::linkModules(M, std::move(*PartOrErr), Linker::Flags::OverrideFromSrc)) {
+      RestoreComdats();
+      RestoreLocals();
+      LLVMRustSetLastError("failed to link simplified functions back into the module");
+      return LLVMRustResult::Failure;
+    }
+  }
+
+  for (const auto &Entry : PartOf)
+    if (Function *F = M.getFunction(Entry.getKey()))
+      F->addFnAttr(PresimplifiedAttr);
+
+  RestoreComdats();
+  RestoreLocals();
+  for (auto &Entry : NamedMD) {
+    Entry.first->clearOperands();
+    for (MDNode *Op : Entry.second)
+      Entry.first->addOperand(Op);
+  }
+  if (Unit)
+    LLVMRustThinLTOPatchDICompileUnit(wrap(&M), Unit);
   return LLVMRustResult::Success;
 }
 
@@ -1110,6 +2918,10 @@ namespace {
 class RustAssemblyAnnotationWriter : public AssemblyAnnotationWriter {
   DemangleFn Demangle;
   std::vector<char> Buf;
+  // The same callees are annotated over and over again, so remember what
+  // every symbol demangled to (an empty string when there is nothing to print)
+  // instead of calling back into Rust each time.
+  StringMap<std::string> Cache;
 
 public:
   RustAssemblyAnnotationWriter(DemangleFn Demangle) : Demangle(Demangle) {}
@@ -1121,6 +2933,14 @@ public:
       return StringRef();
     }
 
+    auto Inserted = Cache.try_emplace(name);
+    if (Inserted.second) {
+      Inserted.first->second = DemangleUncached(name).str();
+    }
+    return Inserted.first->second;
+  }
+
+  StringRef DemangleUncached(StringRef name) {
     if (Buf.size() < name.size() * 2) {
       // Semangled name usually shorter than mangled,
       // but allocate twice as much memory just in case
@@ -1195,6 +3015,10 @@ LLVMRustPrintModule(LLVMModuleRef M, const char *Path, DemangleFn Demangle) {
     return LLVMRustResult::Failure;
   }
 
+  // `formatted_raw_ostream` takes over the buffer of the stream it wraps, so
+  // make it large enough that big modules are written in few system calls.
+  OS.SetBufferSize(1 << 20);
+
   RustAssemblyAnnotationWriter AAW(Demangle);
   formatted_raw_ostream FOS(OS);
   unwrap(M)->print(FOS, &AAW);
@@ -1227,17 +3051,20 @@ extern "C" void LLVMRustAddAlwaysInlinePass(LLVMPassManagerBuilderRef PMBR,
   unwrap(PMBR)->Inliner = llvm::createAlwaysInlinerLegacyPass(AddLifetimes);
 }
 
-extern "C" void LLVMRustRunRestrictionPass(LLVMModuleRef M, char **Symbols,
-                                           size_t Len) {
+// Internalizes every global of `M` except the `Len` symbols given as
+// (not necessarily NUL-terminated) `Symbols[I]`/`Lens[I]` slices.
+extern "C" void LLVMRustRunRestrictionPass(LLVMModuleRef M,
+                                           const char **Symbols,
+                                           const size_t *Lens, size_t Len) {
   llvm::legacy::PassManager passes;
 
-  auto PreserveFunctions = [=](const GlobalValue &GV) {
-    for (size_t I = 0; I < Len; I++) {
-      if (GV.getName() == Symbols[I]) {
-        return true;
-      }
-    }
-    return false;
+  DenseSet<StringRef> Preserved;
+  Preserved.reserve(Len);
+  for (size_t I = 0; I < Len; I++)
+    Preserved.insert(StringRef(Symbols[I], Lens[I]));
+
+  auto PreserveFunctions = [&](const GlobalValue &GV) {
+    return Preserved.count(GV.getName()) != 0;
   };
 
   passes.add(llvm::createInternalizePass(PreserveFunctions));
@@ -1245,7 +3072,14 @@ extern "C" void LLVMRustRunRestrictionPass(LLVMModuleRef M, char **Symbols,
   passes.run(*unwrap(M));
 }
 
-extern "C" void LLVMRustMarkAllFunctionsNounwind(LLVMModuleRef M) {
+// Marks every function of a module that only holds `panic=abort` code as
+// not unwinding. With `RemoveInvokes` the invokes are also turned into plain
+// calls, and the landing pads that leaves unreachable are deleted, and with
+// `RemoveUWTable` the functions no longer ask for an unwind table entry. The
+// latter must only be set when the target doesn't require unwind tables.
+extern "C" void LLVMRustMarkAllFunctionsNounwind(LLVMModuleRef M,
+                                                 bool RemoveInvokes,
+                                                 bool RemoveUWTable) {
   for (Module::iterator GV = unwrap(M)->begin(), E = unwrap(M)->end(); GV != E;
        ++GV) {
     GV->setDoesNotThrow();
@@ -1253,7 +3087,19 @@ extern "C" void LLVMRustMarkAllFunctionsNounwind(LLVMModuleRef M) {
     if (F == nullptr)
       continue;
 
+    if (RemoveUWTable)
+      F->removeFnAttr(Attribute::UWTable);
+
+    bool Changed = false;
     for (Function::iterator B = F->begin(), BE = F->end(); B != BE; ++B) {
+      if (RemoveInvokes) {
+        // An invoke is always a terminator, and rewriting it keeps the block.
+        if (InvokeInst *II = dyn_cast<InvokeInst>(B->getTerminator())) {
+          changeToCall(II);
+          Changed = true;
+        }
+        continue;
+      }
       for (BasicBlock::iterator I = B->begin(), IE = B->end(); I != IE; ++I) {
         if (isa<InvokeInst>(I)) {
           InvokeInst *CI = cast<InvokeInst>(I);
@@ -1261,6 +3107,8 @@ extern "C" void LLVMRustMarkAllFunctionsNounwind(LLVMModuleRef M) {
         }
       }
     }
+    if (Changed)
+      removeUnreachableBlocks(*F);
   }
 }
 
@@ -1279,6 +3127,16 @@ extern "C" void LLVMRustSetModulePIELevel(LLVMModuleRef M) {
   unwrap(M)->setPIELevel(PIELevel::Level::Large);
 }
 
+// Tells LLVM whether the extern variables it declares itself, e.g. for
+// sanitizers, can be accessed without going through the GOT. The ones rustc
+// declares are already marked `dso_local` to match. This is the flag that
+// `Module::setDirectAccessExternalData` sets in the LLVM versions that have
+// it, earlier ones ignore it.
+extern "C" void LLVMRustSetModuleDirectAccessExternalData(LLVMModuleRef M,
+                                                          bool Direct) {
+  unwrap(M)->addModuleFlag(Module::Max, "direct-access-external-data", Direct);
+}
+
 extern "C" void LLVMRustSetModuleCodeModel(LLVMModuleRef M,
                                            LLVMRustCodeModel Model) {
   auto CM = fromRust(Model);
@@ -1315,9 +3173,31 @@ extern "C" void LLVMRustSetModuleCodeModel(LLVMModuleRef M,
 // and various online resources about ThinLTO to make heads or tails of all
 // this.
 
+// Knobs for how much ThinLTO imports across modules. The first three
+// override LLVM's `-import-instr-limit`, `-import-hot-multiplier` and
+// `-import-cold-multiplier` (unless those were given explicitly with
+// `-C llvm-args`), and are ignored when negative. The last two cap the total
+// number of functions and instructions imported into any one module, where
+// zero means no limit. `WholeProgramVisibility` enables whole-program
+// visibility for the devirtualization done during the thin link, see
+// `LLVMRustUpdateVCallVisibility`.
+struct LLVMRustThinLTOImportOptions {
+  int InstrLimit;
+  float HotMultiplier;
+  float ColdMultiplier;
+  size_t MaxModuleFunctions;
+  size_t MaxModuleInstrs;
+  bool WholeProgramVisibility;
+  bool PropagateGlobalAttributes;
+};
+
 // This is a shared data structure which *must* be threadsafe to share
 // read-only amongst threads. This also corresponds basically to the arguments
 // of the `ProcessThinLTOModule` function in the LLVM source.
+// Identifies the contents of a module for the thin link cache, see
+// `LLVMRustThinLTOModule::key`.
+typedef std::array<uint64_t, 2> ThinLTOModuleKey;
+
 struct LLVMRustThinLTOData {
   // The combined index that is the global analysis over all modules we're
   // performing ThinLTO for. This is mostly managed by LLVM.
@@ -1328,6 +3208,23 @@ struct LLVMRustThinLTOData {
   // from.
   StringMap<MemoryBufferRef> ModuleMap;
 
+  // Backing storage for the modules in `ModuleMap` which were passed in as a
+  // region of a file on disk rather than as an in-memory buffer. These are
+  // mapped rather than read where possible, so their bitcode is only paged in
+  // once something actually looks at it.
+  std::vector<std::unique_ptr<MemoryBuffer>> FileBuffers;
+
+  // The key of every module passed in, saved along with the thin link so
+  // a later session can tell whether it still applies.
+  StringMap<ThinLTOModuleKey> ModuleKeys;
+
+  // The layout of each module's bitcode (where its module, string table and
+  // symbol table blocks are), as found when reading the summaries. This is
+  // independent of any `LLVMContext`, so the import loader shares it between
+  // all the modules importing from a given module rather than re-scanning the
+  // bitcode every time.
+  StringMap<BitcodeModule> BitcodeModules;
+
   // A set that we manage of everything we *don't* want internalized. Note that
   // this includes all transitive references right now as well, but it may not
   // always!
@@ -1340,73 +3237,395 @@ struct LLVMRustThinLTOData {
   StringMap<GVSummaryMapTy> ModuleToDefinedGVSummaries;
   StringMap<std::map<GlobalValue::GUID, GlobalValue::LinkageTypes>> ResolvedODR;
 
+  // The options the import lists above were computed with.
+  LLVMRustThinLTOImportOptions ImportOptions = {-1, -1, -1, 0, 0, false, false};
+
   LLVMRustThinLTOData() : Index(/* HaveGVs = */ false) {}
 };
 
 // Just an argument to the `LLVMRustCreateThinLTOData` function below.
+//
+// If `path` is null then the module's bitcode is the `len` bytes at `data`,
+// otherwise it is the `len` bytes at `offset` in the file at `path` (typically
+// the `.llvmbc` section of an object inside an rlib).
 struct LLVMRustThinLTOModule {
   const char *identifier;
   const char *data;
   size_t len;
+  const char *path;
+  uint64_t offset;
+  // The module is native bitcode (e.g. from clang) that is linked in as-is
+  // rather than going through LTO, so it's only there to import from.
+  bool import_only;
+  // Changes whenever the module's bitcode does. The caller picks how to compute
+  // it, e.g. from the metadata of the file a module is mapped from rather than
+  // by hashing its contents.
+  uint64_t key[2];
+};
+
+static const ModuleSummaryIndex *getThinLTOIndex(const LLVMRustThinLTOData *Data) {
+  return Data ? &Data->Index : nullptr;
+}
+
+// A ThinLTO buffer compressed by `LLVMRustThinLTOBufferCompress` is this magic,
+// the little-endian size of the original bitcode, and then the zlib stream.
+// The framing only ever lives in memory: the buffer is written to disk before
+// it's compressed. Bitcode always starts with 'BC' (or the wrapper magic), so
+// the two can't be confused.
+static const char ThinLTOCompressedMagic[] = "RSTLTOZ1";
+static const size_t ThinLTOCompressedMagicSize = sizeof(ThinLTOCompressedMagic) - 1;
+static const size_t ThinLTOCompressedHeaderSize =
+    ThinLTOCompressedMagicSize + sizeof(uint64_t);
+
+static bool isCompressedThinLTOBuffer(StringRef Data) {
+  return Data.size() >= ThinLTOCompressedHeaderSize &&
+         Data.startswith(StringRef(ThinLTOCompressedMagic, ThinLTOCompressedMagicSize));
+}
+
+// Returns a decompressed copy of `Data`, which has to be compressed. Every
+// reader of a compressed buffer makes its own copy, and drops it as soon as
+// it's done, so the plain bitcode of a module is only around while it's used.
+static Expected<std::unique_ptr<MemoryBuffer>>
+decompressThinLTOBuffer(StringRef Data, StringRef Identifier) {
+  if (!zlib::isAvailable())
+    return createStringError(inconvertibleErrorCode(),
+                             "%s is compressed but LLVM was built without zlib",
+                             Identifier.str().c_str());
+  size_t Size = support::endian::read64le(Data.data() + ThinLTOCompressedMagicSize);
+  std::unique_ptr<WritableMemoryBuffer> Out =
+      WritableMemoryBuffer::getNewUninitMemBuffer(Size, Identifier);
+  if (!Out)
+    return createStringError(inconvertibleErrorCode(),
+                             "failed to allocate %zu bytes for %s", Size,
+                             Identifier.str().c_str());
+  size_t OutSize = Size;
+  if (Error Err = zlib::uncompress(Data.drop_front(ThinLTOCompressedHeaderSize),
+                                   Out->getBufferStart(), OutSize))
+    return std::move(Err);
+  if (OutSize != Size)
+    return createStringError(inconvertibleErrorCode(),
+                             "%s is truncated", Identifier.str().c_str());
+  return std::unique_ptr<MemoryBuffer>(std::move(Out));
+}
+
+// Returns the bitcode of `Module`, mapping it from disk into `Owned` if it's
+// file-backed. The result is still compressed if the module's buffer is.
+static Expected<MemoryBufferRef>
+getThinLTOModuleBuffer(const LLVMRustThinLTOModule &Module,
+                       std::unique_ptr<MemoryBuffer> &Owned) {
+  if (!Module.path)
+    return MemoryBufferRef(StringRef(Module.data, Module.len), Module.identifier);
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+      MemoryBuffer::getFileSlice(Module.path, Module.len, Module.offset);
+  if (!BufOrErr)
+    return createStringError(BufOrErr.getError(), "failed to map %s: %s",
+                             Module.path, BufOrErr.getError().message().c_str());
+  Owned = std::move(*BufOrErr);
+  return MemoryBufferRef(Owned->getBuffer(), Module.identifier);
+}
+
+// This is copied from `lib/LTO/ThinLTOCodeGenerator.cpp`, not sure what it
+// does.
+static const GlobalValueSummary *
+getFirstDefinitionForLinker(const GlobalValueSummaryList &GVSummaryList) {
+  auto StrongDefForLinker = llvm::find_if(
+      GVSummaryList, [](const std::unique_ptr<GlobalValueSummary> &Summary) {
+        auto Linkage = Summary->linkage();
+        return !GlobalValue::isAvailableExternallyLinkage(Linkage) &&
+               !GlobalValue::isWeakForLinker(Linkage);
+      });
+  if (StrongDefForLinker != GVSummaryList.end())
+    return StrongDefForLinker->get();
+
+  auto FirstDefForLinker = llvm::find_if(
+      GVSummaryList, [](const std::unique_ptr<GlobalValueSummary> &Summary) {
+        auto Linkage = Summary->linkage();
+        return !GlobalValue::isAvailableExternallyLinkage(Linkage);
+      });
+  if (FirstDefForLinker == GVSummaryList.end())
+    return nullptr;
+  return FirstDefForLinker->get();
+}
+
+// LLVM's import computation only reads its thresholds from the
+// `-import-instr-limit`, `-import-hot-multiplier` and `-import-cold-multiplier`
+// options. This points those at the values of `Options` for as long as it's
+// alive, and puts back whatever they were before afterwards, so a session
+// neither sees the thresholds of an earlier one nor leaks its own. The lock is
+// held throughout, as other sessions in the same process may be computing
+// imports at the same time. Options given explicitly with `-C llvm-args` are
+// left alone.
+class ScopedImportThresholds {
+  static std::mutex &lock() {
+    static std::mutex Lock;
+    return Lock;
+  }
+
+  template <typename T> struct Override {
+    cl::opt<T> *Opt = nullptr;
+    T Saved{};
+
+    void set(StringRef Name, T Value) {
+      auto &Opts = cl::getRegisteredOptions();
+      auto It = Opts.find(Name);
+      if (It == Opts.end() || It->second->getNumOccurrences() != 0)
+        return;
+      Opt = static_cast<cl::opt<T> *>(It->second);
+      Saved = *Opt;
+      Opt->setValue(Value);
+    }
+
+    ~Override() {
+      if (Opt)
+        Opt->setValue(Saved);
+    }
+  };
+
+  std::lock_guard<std::mutex> Guard;
+  Override<unsigned> InstrLimit;
+  Override<float> HotMultiplier;
+  Override<float> ColdMultiplier;
+
+public:
+  explicit ScopedImportThresholds(const LLVMRustThinLTOImportOptions &Options)
+      : Guard(lock()) {
+    if (Options.InstrLimit >= 0)
+      InstrLimit.set("import-instr-limit", Options.InstrLimit);
+    if (Options.HotMultiplier >= 0)
+      HotMultiplier.set("import-hot-multiplier", Options.HotMultiplier);
+    if (Options.ColdMultiplier >= 0)
+      ColdMultiplier.set("import-cold-multiplier", Options.ColdMultiplier);
+  }
 };
 
-// This is copied from `lib/LTO/ThinLTOCodeGenerator.cpp`, not sure what it
-// does.
-static const GlobalValueSummary *
-getFirstDefinitionForLinker(const GlobalValueSummaryList &GVSummaryList) {
-  auto StrongDefForLinker = llvm::find_if(
-      GVSummaryList, [](const std::unique_ptr<GlobalValueSummary> &Summary) {
-        auto Linkage = Summary->linkage();
-        return !GlobalValue::isAvailableExternallyLinkage(Linkage) &&
-               !GlobalValue::isWeakForLinker(Linkage);
-      });
-  if (StrongDefForLinker != GVSummaryList.end())
-    return StrongDefForLinker->get();
+// Trims `ImportList` to fit into the per-module caps of `Options`. Smaller
+// functions are kept first as those are the most likely to get inlined. This
+// only ever drops imports, so the export lists computed alongside the import
+// lists stay conservatively correct.
+static void
+capImportList(const ModuleSummaryIndex &Index,
+              const LLVMRustThinLTOImportOptions &Options,
+              FunctionImporter::ImportMapTy &ImportList) {
+  if (Options.MaxModuleFunctions == 0 && Options.MaxModuleInstrs == 0)
+    return;
+
+  struct Candidate {
+    unsigned InstCount;
+    GlobalValue::GUID GUID;
+    StringRef FromModule;
+  };
+  std::vector<Candidate> Candidates;
+  for (auto &FromModule : ImportList) {
+    for (GlobalValue::GUID GUID : FromModule.getValue()) {
+      auto *Summary = Index.findSummaryInModule(GUID, FromModule.getKey());
+      if (auto *FS = dyn_cast_or_null<FunctionSummary>(Summary))
+        Candidates.push_back({FS->instCount(), GUID, FromModule.getKey()});
+    }
+  }
+  llvm::sort(Candidates, [](const Candidate &A, const Candidate &B) {
+    return std::tie(A.InstCount, A.GUID, A.FromModule) <
+           std::tie(B.InstCount, B.GUID, B.FromModule);
+  });
+
+  size_t Functions = 0, Instrs = 0;
+  for (const Candidate &C : Candidates) {
+    bool Fits =
+      (Options.MaxModuleFunctions == 0 || Functions < Options.MaxModuleFunctions) &&
+      (Options.MaxModuleInstrs == 0 || Instrs + C.InstCount <= Options.MaxModuleInstrs);
+    if (Fits) {
+      Functions++;
+      Instrs += C.InstCount;
+      continue;
+    }
+    ImportList[C.FromModule].erase(C.GUID);
+  }
+}
 
-  auto FirstDefForLinker = llvm::find_if(
-      GVSummaryList, [](const std::unique_ptr<GlobalValueSummary> &Summary) {
-        auto Linkage = Summary->linkage();
-        return !GlobalValue::isAvailableExternallyLinkage(Linkage);
-      });
-  if (FirstDefForLinker == GVSummaryList.end())
-    return nullptr;
-  return FirstDefForLinker->get();
+// Keeps anything from being imported out of an import-only module that would
+// need one of the module's local symbols promoted, since the module itself
+// isn't compiled again to go along with that.
+static void
+restrictImportOnlyModule(const GVSummaryMapTy &DefinedGVSummaries) {
+  auto IsLocal = [](ValueInfo VI) {
+    for (auto &Summary : VI.getSummaryList())
+      if (GlobalValue::isLocalLinkage(Summary->linkage()))
+        return true;
+    return false;
+  };
+  for (auto &Defined : DefinedGVSummaries) {
+    GlobalValueSummary *Summary = Defined.second;
+    bool NeedsPromotion = GlobalValue::isLocalLinkage(Summary->linkage()) ||
+                          llvm::any_of(Summary->refs(), IsLocal);
+    if (auto *FS = dyn_cast<FunctionSummary>(Summary))
+      for (auto &Call : FS->calls())
+        NeedsPromotion |= IsLocal(Call.first);
+    if (NeedsPromotion)
+      Summary->setNotEligibleToImport();
+  }
+}
+
+// Read-only and write-only global variables are internalized into the modules
+// importing them, which can then fold their loads or drop their stores. That's
+// only sound if every access is visible to the thin link, and we only see the
+// modules of one crate: other crates (and C code) may still access anything
+// that's externally visible. So the attributes are only kept for variables
+// with local linkage, before any of them are promoted.
+static void restrictGlobalAttributesToLocals(ModuleSummaryIndex &Index) {
+  for (auto &I : Index) {
+    for (auto &Summary : I.second.SummaryList) {
+      if (GlobalValue::isLocalLinkage(Summary->linkage()))
+        continue;
+      // An alias refers to the same memory as its aliasee.
+      if (auto *GVS = dyn_cast<GlobalVarSummary>(Summary->getBaseObject())) {
+        GVS->setReadOnly(false);
+        GVS->setWriteOnly(false);
+      }
+    }
+  }
 }
 
 // The main entry point for creating the global ThinLTO analysis. The structure
 // here is basically the same as before threads are spawned in the `run`
 // function of `lib/LTO/ThinLTOCodeGenerator.cpp`.
+//
+// `Threads` is the number of threads used for the parts of ingestion that can
+// run independently for each module, or 0 to use the hardware concurrency.
+// Reading the summaries themselves, which is most of the work, stays serial:
+// the bitcode reader writes straight into the combined index, and summaries
+// can't be moved from one index to another afterwards.
+// `ImportOptions` may be null to use LLVM's defaults.
 extern "C" LLVMRustThinLTOData*
 LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
                           int num_modules,
                           const char **preserved_symbols,
-                          int num_symbols) {
+                          int num_symbols,
+                          unsigned Threads,
+                          const LLVMRustThinLTOImportOptions *ImportOptions) {
+  // Import-only modules that can't be read, or have no summary, are left out
+  // rather than failing the thin link: they're only an opportunity.
   auto Ret = std::make_unique<LLVMRustThinLTOData>();
+  if (ImportOptions)
+    Ret->ImportOptions = *ImportOptions;
+
+  // Locating each module's summary in its bitcode and hashing the preserved
+  // symbols doesn't touch the combined index, so that's done on a thread pool
+  // up front. Reading a summary writes straight into the combined index
+  // though, so merging is done afterwards on this thread in module order,
+  // which also keeps module ids (and so the index) deterministic.
+  std::vector<MemoryBufferRef> Buffers(num_modules);
+  // Plain copies of the compressed buffers, only kept until the summaries are
+  // read. The backends decompress the modules they read again themselves.
+  std::vector<std::unique_ptr<MemoryBuffer>> Decompressed(num_modules);
+  std::vector<Optional<BitcodeModule>> BitcodeModules(num_modules);
+  std::vector<std::string> Errors(num_modules);
+  Ret->FileBuffers.resize(num_modules);
+  std::vector<GlobalValue::GUID> PreservedGUIDs(num_symbols);
+  {
+#if LLVM_VERSION_GE(11, 0)
+    ThreadPool Pool(heavyweight_hardware_concurrency(Threads));
+#else
+    ThreadPool Pool(Threads ? Threads : heavyweight_hardware_concurrency());
+#endif
+    for (int i = 0; i < num_modules; i++) {
+      Pool.async([&, i]() {
+        Expected<MemoryBufferRef> BufOrErr =
+            getThinLTOModuleBuffer(modules[i], Ret->FileBuffers[i]);
+        if (!BufOrErr) {
+          Errors[i] = toString(BufOrErr.takeError());
+          return;
+        }
+        Buffers[i] = *BufOrErr;
+        MemoryBufferRef Bitcode = Buffers[i];
+        if (isCompressedThinLTOBuffer(Bitcode.getBuffer())) {
+          Expected<std::unique_ptr<MemoryBuffer>> PlainOrErr =
+              decompressThinLTOBuffer(Bitcode.getBuffer(), modules[i].identifier);
+          if (!PlainOrErr) {
+            Errors[i] = toString(PlainOrErr.takeError());
+            return;
+          }
+          Decompressed[i] = std::move(*PlainOrErr);
+          Bitcode = Decompressed[i]->getMemBufferRef();
+        }
+        Expected<std::vector<BitcodeModule>> BMs = getBitcodeModuleList(Bitcode);
+        if (!BMs) {
+          Errors[i] = toString(BMs.takeError());
+          return;
+        }
+        if (BMs->size() != 1) {
+          Errors[i] = "Expected a single module";
+          return;
+        }
+        BitcodeModule &BM = BMs->front();
+        Expected<BitcodeLTOInfo> LTOInfo = BM.getLTOInfo();
+        if (!LTOInfo) {
+          Errors[i] = toString(LTOInfo.takeError());
+          return;
+        }
+        if (!LTOInfo->HasSummary) {
+          Errors[i] = "Could not find module summary";
+          return;
+        }
+        BitcodeModules[i] = BM;
+      });
+    }
+    // Convert the preserved symbols set from string to GUID, this is then
+    // needed for internalization.
+    const int SymbolsPerTask = 4096;
+    for (int i = 0; i < num_symbols; i += SymbolsPerTask) {
+      Pool.async([&, i]() {
+        int End = std::min(i + SymbolsPerTask, num_symbols);
+        for (int j = i; j < End; j++)
+          PreservedGUIDs[j] = GlobalValue::getGUID(preserved_symbols[j]);
+      });
+    }
+    Pool.wait();
+  }
 
   // Load each module's summary and merge it into one combined index
+  bool HaveImportOnly = false;
   for (int i = 0; i < num_modules; i++) {
     auto module = &modules[i];
-    StringRef buffer(module->data, module->len);
-    MemoryBufferRef mem_buffer(buffer, module->identifier);
-
-    Ret->ModuleMap[module->identifier] = mem_buffer;
+    // Import-only modules that are left out still get a key, so that the
+    // next session sees the same set of modules.
+    Ret->ModuleKeys[module->identifier] = {module->key[0], module->key[1]};
+    if (!BitcodeModules[i] && module->import_only)
+      continue;
+    Ret->ModuleMap[module->identifier] = Buffers[i];
 
-    if (Error Err = readModuleSummaryIndex(mem_buffer, Ret->Index, i)) {
+    if (!BitcodeModules[i]) {
+      LLVMRustSetLastError(Errors[i].c_str());
+      return nullptr;
+    }
+    if (Error Err = BitcodeModules[i]->readSummary(Ret->Index, module->identifier, i)) {
       LLVMRustSetLastError(toString(std::move(Err)).c_str());
       return nullptr;
     }
+    // The layout of a decompressed copy is no use once the copy is gone.
+    if (!Decompressed[i])
+      Ret->BitcodeModules.insert(std::make_pair(module->identifier, *BitcodeModules[i]));
+    HaveImportOnly |= module->import_only;
   }
 
+  // The names of the values in the index point into the string tables of the
+  // modules they were read from, move those of decompressed modules into the
+  // index before the copies are freed.
+  if (llvm::any_of(Decompressed, [](const auto &Buf) { return Buf != nullptr; })) {
+    for (auto &I : Ret->Index)
+      I.second.U.Name = Ret->Index.saveString(I.second.U.Name);
+  }
+  Decompressed.clear();
+
   // Collect for each module the list of function it defines (GUID -> Summary)
   Ret->Index.collectDefinedGVSummariesPerModule(Ret->ModuleToDefinedGVSummaries);
-
-  // Convert the preserved symbols set from string to GUID, this is then needed
-  // for internalization.
-  for (int i = 0; i < num_symbols; i++) {
-    auto GUID = GlobalValue::getGUID(preserved_symbols[i]);
-    Ret->GUIDPreservedSymbols.insert(GUID);
+  for (int i = 0; i < num_modules; i++) {
+    auto Defined = Ret->ModuleToDefinedGVSummaries.find(modules[i].identifier);
+    if (modules[i].import_only && Defined != Ret->ModuleToDefinedGVSummaries.end())
+      restrictImportOnlyModule(Defined->getValue());
   }
 
+  Ret->GUIDPreservedSymbols.insert(PreservedGUIDs.begin(), PreservedGUIDs.end());
+
   // Collect the import/export lists for all modules from the call-graph in the
   // combined index
   //
@@ -1416,15 +3635,52 @@ LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
   };
   // We don't have a complete picture in our use of ThinLTO, just our immediate
   // crate, so we need `ImportEnabled = false` to limit internalization.
-  // Otherwise, we sometimes lose `static` values -- see #60184.
+  // Otherwise, we sometimes lose `static` values -- see #60184. When asked to,
+  // the read-only/write-only propagation that this also disables is run
+  // anyway, and then undone for everything that's externally visible.
+  const LLVMRustThinLTOImportOptions &Opts = Ret->ImportOptions;
   computeDeadSymbolsWithConstProp(Ret->Index, Ret->GUIDPreservedSymbols,
-                                  deadIsPrevailing, /* ImportEnabled = */ false);
-  ComputeCrossModuleImport(
-    Ret->Index,
-    Ret->ModuleToDefinedGVSummaries,
-    Ret->ImportLists,
-    Ret->ExportLists
-  );
+                                  deadIsPrevailing,
+                                  /* ImportEnabled = */ Opts.PropagateGlobalAttributes);
+  if (Opts.PropagateGlobalAttributes)
+    restrictGlobalAttributesToLocals(Ret->Index);
+
+  // Devirtualize on the index, before importing so the new direct calls can
+  // be imported along with everything else. This is copied from `runThinLTO`
+  // in `lib/LTO/LTO.cpp`.
+#if LLVM_VERSION_GE(13, 0)
+  updateVCallVisibilityInIndex(Ret->Index, Opts.WholeProgramVisibility,
+                               /*DynamicExportSymbols=*/{});
+#elif LLVM_VERSION_GE(11, 0)
+  updateVCallVisibilityInIndex(Ret->Index, Opts.WholeProgramVisibility);
+#endif
+  std::set<GlobalValue::GUID> DevirtExportedGUIDs;
+  std::map<ValueInfo, std::vector<VTableSlotSummary>> LocalWPDTargetsMap;
+  runWholeProgramDevirtOnIndex(Ret->Index, DevirtExportedGUIDs, LocalWPDTargetsMap);
+
+  // Nothing is imported into import-only modules, so they're left out of the
+  // modules imports are computed for. That also keeps them from making
+  // anything in the other modules look exported.
+  {
+    ScopedImportThresholds Thresholds(Opts);
+    if (HaveImportOnly) {
+      StringMap<GVSummaryMapTy> ImportingModules = Ret->ModuleToDefinedGVSummaries;
+      for (int i = 0; i < num_modules; i++)
+        if (modules[i].import_only)
+          ImportingModules.erase(modules[i].identifier);
+      ComputeCrossModuleImport(Ret->Index, ImportingModules, Ret->ImportLists,
+                               Ret->ExportLists);
+    } else {
+      ComputeCrossModuleImport(
+        Ret->Index,
+        Ret->ModuleToDefinedGVSummaries,
+        Ret->ImportLists,
+        Ret->ExportLists
+      );
+    }
+  }
+  for (auto &ImportList : Ret->ImportLists)
+    capImportList(Ret->Index, Opts, ImportList.getValue());
 
   // Resolve LinkOnce/Weak symbols, this has to be computed early be cause it
   // impacts the caching.
@@ -1464,7 +3720,7 @@ LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
   // summaries in the index, and we basically just only want to ensure that dead
   // symbols are internalized. Otherwise everything that's already external
   // linkage will stay as external, and internal will stay as internal.
-  std::set<GlobalValue::GUID> ExportedGUIDs;
+  std::set<GlobalValue::GUID> ExportedGUIDs = std::move(DevirtExportedGUIDs);
   for (auto &List : Ret->Index) {
     for (auto &GVS: List.second.SummaryList) {
       if (GlobalValue::isLocalLinkage(GVS->linkage()))
@@ -1480,6 +3736,9 @@ LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
       ExportList->second.count(VI)) ||
       ExportedGUIDs.count(VI.getGUID());
   };
+  // Devirtualization targets that are local to one module but now called
+  // from another get promoted along with everything else exported.
+  updateIndexWPDForExports(Ret->Index, isExported, LocalWPDTargetsMap);
   thinLTOInternalizeAndPromoteInIndex(Ret->Index, isExported, isPrevailing);
 
   return Ret.release();
@@ -1490,6 +3749,342 @@ LLVMRustFreeThinLTOData(LLVMRustThinLTOData *Data) {
   delete Data;
 }
 
+// Below is a cache of the thin link for incremental compilation. Running the
+// thin link (reading every summary, computing dead symbols, import/export
+// lists and prevailing copies) is a whole-program analysis over the combined
+// index, and LLVM has no way to drop the summaries of a single module from an
+// index once they've been merged in. So rather than patching the graph in
+// place we save the result of the previous session's analysis along with the
+// key of every module that went into it. If the next session feeds in modules
+// with exactly the same keys, the same preserved symbols and the same options
+// we restore the analysis wholesale, and otherwise we fall back to
+// `LLVMRustCreateThinLTOData`.
+//
+// The layout is a small header followed by little-endian integers and
+// length-prefixed strings:
+//
+//    magic, format version, LLVM major version
+//    module table:        (identifier, key)*
+//    preserved symbols:   GUID*
+//    import options:      `LLVMRustThinLTOImportOptions`, field by field
+//    combined index:      summary-only bitcode from `writeIndexToFile`
+//    import lists:        (module, (source module, GUID*)*)*
+//    export lists:        (module, GUID*)*
+//    resolved linkages:   (module, (GUID, linkage)*)*
+//
+// Anything we don't recognize (older format, different LLVM, truncated file)
+// is treated as if there were no previous session.
+static const char ThinLTODataMagic[8] = {'R', 'S', 'T', 'L', 'T', 'O', 'I', 'X'};
+static const uint32_t ThinLTODataVersion = 4;
+
+namespace {
+class ThinLTODataWriter {
+  raw_ostream &OS;
+
+public:
+  ThinLTODataWriter(raw_ostream &OS) : OS(OS) {}
+
+  void bytes(StringRef Bytes) { OS << Bytes; }
+  void u8(uint8_t V) { OS << static_cast<char>(V); }
+  void u32(uint32_t V) { support::endian::write<uint32_t>(OS, V, support::little); }
+  void u64(uint64_t V) { support::endian::write<uint64_t>(OS, V, support::little); }
+  void str(StringRef S) {
+    u32(S.size());
+    bytes(S);
+  }
+};
+
+class ThinLTODataReader {
+  StringRef Data;
+  bool Failed = false;
+
+public:
+  ThinLTODataReader(StringRef Data) : Data(Data) {}
+
+  bool failed() const { return Failed; }
+
+  StringRef bytes(uint64_t Len) {
+    if (Failed || Data.size() < Len) {
+      Failed = true;
+      return StringRef();
+    }
+    StringRef Ret = Data.take_front(Len);
+    Data = Data.drop_front(Len);
+    return Ret;
+  }
+  uint8_t u8() {
+    StringRef B = bytes(1);
+    return Failed ? 0 : B[0];
+  }
+  uint32_t u32() {
+    StringRef B = bytes(4);
+    return Failed ? 0 : support::endian::read32le(B.data());
+  }
+  uint64_t u64() {
+    StringRef B = bytes(8);
+    return Failed ? 0 : support::endian::read64le(B.data());
+  }
+  StringRef str() { return bytes(u32()); }
+};
+}
+
+extern "C" void
+LLVMRustThinLTODataWrite(const LLVMRustThinLTOData *Data, RustStringRef Out) {
+  RawRustStringOstream OS(Out);
+  ThinLTODataWriter W(OS);
+
+  W.bytes(StringRef(ThinLTODataMagic, sizeof(ThinLTODataMagic)));
+  W.u32(ThinLTODataVersion);
+  W.u32(LLVM_VERSION_MAJOR);
+
+  W.u32(Data->ModuleKeys.size());
+  for (const auto &Module : Data->ModuleKeys) {
+    W.str(Module.getKey());
+    W.u64(Module.getValue()[0]);
+    W.u64(Module.getValue()[1]);
+  }
+
+  std::vector<GlobalValue::GUID> Preserved(Data->GUIDPreservedSymbols.begin(),
+                                           Data->GUIDPreservedSymbols.end());
+  llvm::sort(Preserved);
+  W.u32(Preserved.size());
+  for (GlobalValue::GUID GUID : Preserved)
+    W.u64(GUID);
+
+  const LLVMRustThinLTOImportOptions &Opts = Data->ImportOptions;
+  W.u32(Opts.InstrLimit);
+  W.u32(FloatToBits(Opts.HotMultiplier));
+  W.u32(FloatToBits(Opts.ColdMultiplier));
+  W.u64(Opts.MaxModuleFunctions);
+  W.u64(Opts.MaxModuleInstrs);
+  W.u8(Opts.WholeProgramVisibility);
+  W.u8(Opts.PropagateGlobalAttributes);
+
+  std::string IndexBuf;
+  raw_string_ostream IndexOS(IndexBuf);
+  writeIndexToFile(Data->Index, IndexOS);
+  IndexOS.flush();
+  W.u64(IndexBuf.size());
+  W.bytes(IndexBuf);
+
+  W.u32(Data->ImportLists.size());
+  for (const auto &ImportList : Data->ImportLists) {
+    W.str(ImportList.getKey());
+    W.u32(ImportList.getValue().size());
+    for (const auto &FromModule : ImportList.getValue()) {
+      W.str(FromModule.getKey());
+      W.u32(FromModule.getValue().size());
+      for (GlobalValue::GUID GUID : FromModule.getValue())
+        W.u64(GUID);
+    }
+  }
+
+  W.u32(Data->ExportLists.size());
+  for (const auto &ExportList : Data->ExportLists) {
+    W.str(ExportList.getKey());
+    W.u32(ExportList.getValue().size());
+    for (const ValueInfo &VI : ExportList.getValue())
+      W.u64(VI.getGUID());
+  }
+
+  W.u32(Data->ResolvedODR.size());
+  for (const auto &Resolved : Data->ResolvedODR) {
+    W.str(Resolved.getKey());
+    W.u32(Resolved.getValue().size());
+    for (const auto &Linkage : Resolved.getValue()) {
+      W.u64(Linkage.first);
+      W.u8(Linkage.second);
+    }
+  }
+}
+
+// Attempts to restore the thin link computed by a previous session from
+// `PrevData` (as written by `LLVMRustThinLTODataWrite`). `*ChangedModules` is
+// set to the number of modules which were added, removed or whose key differs
+// from the previous session. The previous analysis is only reused when that
+// number is zero and the preserved symbols and options are the same,
+// otherwise this is equivalent to `LLVMRustCreateThinLTOData`. Whenever the
+// analysis is rebuilt `*ChangedModules` is nonzero, if nothing but the
+// preserved symbols or options changed it counts every module as changed.
+extern "C" LLVMRustThinLTOData*
+LLVMRustLoadCachedThinLTOData(const char *PrevData, size_t PrevLen,
+                         LLVMRustThinLTOModule *modules,
+                         int num_modules,
+                         const char **preserved_symbols,
+                         int num_symbols,
+                         unsigned Threads,
+                         const LLVMRustThinLTOImportOptions *ImportOptions,
+                         size_t *ChangedModules) {
+  size_t Changed = num_modules;
+  auto Rebuild = [&]() {
+    *ChangedModules = Changed != 0 ? Changed : num_modules;
+    return LLVMRustCreateThinLTOData(modules, num_modules,
+                                     preserved_symbols, num_symbols, Threads,
+                                     ImportOptions);
+  };
+
+  ThinLTODataReader R(StringRef(PrevData, PrevLen));
+  if (R.bytes(sizeof(ThinLTODataMagic)) != StringRef(ThinLTODataMagic, sizeof(ThinLTODataMagic)) ||
+      R.u32() != ThinLTODataVersion ||
+      R.u32() != LLVM_VERSION_MAJOR)
+    return Rebuild();
+
+  StringMap<ThinLTOModuleKey> PrevKeys;
+  uint32_t NumPrevModules = R.u32();
+  for (uint32_t i = 0; i < NumPrevModules && !R.failed(); i++) {
+    StringRef Identifier = R.str();
+    uint64_t Hi = R.u64();
+    uint64_t Lo = R.u64();
+    PrevKeys[Identifier] = {Hi, Lo};
+  }
+  if (R.failed())
+    return Rebuild();
+
+  // Only the keys are compared, so nothing has to be read from the modules
+  // themselves to find out whether the cache is still good.
+  Changed = 0;
+  for (int i = 0; i < num_modules; i++) {
+    auto module = &modules[i];
+    auto Prev = PrevKeys.find(module->identifier);
+    if (Prev == PrevKeys.end() ||
+        Prev->second != ThinLTOModuleKey{module->key[0], module->key[1]})
+      Changed++;
+    else
+      PrevKeys.erase(Prev);
+  }
+  // Whatever is left over was part of the previous session but not this one.
+  Changed += PrevKeys.size();
+  if (Changed != 0)
+    return Rebuild();
+
+  auto Ret = std::make_unique<LLVMRustThinLTOData>();
+  Ret->FileBuffers.resize(num_modules);
+  for (int i = 0; i < num_modules; i++) {
+    auto module = &modules[i];
+    Ret->ModuleKeys[module->identifier] = {module->key[0], module->key[1]};
+    Expected<MemoryBufferRef> BufOrErr =
+        getThinLTOModuleBuffer(*module, Ret->FileBuffers[i]);
+    if (!BufOrErr) {
+      consumeError(BufOrErr.takeError());
+      // Left out of the thin link, as in `LLVMRustCreateThinLTOData`.
+      if (module->import_only)
+        continue;
+      return Rebuild();
+    }
+    Ret->ModuleMap[module->identifier] = *BufOrErr;
+  }
+
+  for (int i = 0; i < num_symbols; i++)
+    Ret->GUIDPreservedSymbols.insert(GlobalValue::getGUID(preserved_symbols[i]));
+  uint32_t NumPreserved = R.u32();
+  if (R.failed() || NumPreserved != Ret->GUIDPreservedSymbols.size())
+    return Rebuild();
+  for (uint32_t i = 0; i < NumPreserved; i++) {
+    if (!Ret->GUIDPreservedSymbols.count(R.u64()))
+      return Rebuild();
+  }
+
+  if (ImportOptions)
+    Ret->ImportOptions = *ImportOptions;
+  const LLVMRustThinLTOImportOptions &Opts = Ret->ImportOptions;
+  if (R.u32() != static_cast<uint32_t>(Opts.InstrLimit) ||
+      R.u32() != FloatToBits(Opts.HotMultiplier) ||
+      R.u32() != FloatToBits(Opts.ColdMultiplier) ||
+      R.u64() != Opts.MaxModuleFunctions ||
+      R.u64() != Opts.MaxModuleInstrs ||
+      R.u8() != Opts.WholeProgramVisibility ||
+      R.u8() != Opts.PropagateGlobalAttributes)
+    return Rebuild();
+
+  StringRef IndexBuf = R.bytes(R.u64());
+  if (R.failed())
+    return Rebuild();
+  if (Error Err = readModuleSummaryIndex(MemoryBufferRef(IndexBuf, "thin-lto-index"),
+                                         Ret->Index, 0)) {
+    consumeError(std::move(Err));
+    return Rebuild();
+  }
+
+  uint32_t NumImportLists = R.u32();
+  for (uint32_t i = 0; i < NumImportLists && !R.failed(); i++) {
+    auto &ImportList = Ret->ImportLists[R.str()];
+    uint32_t NumFromModules = R.u32();
+    for (uint32_t j = 0; j < NumFromModules && !R.failed(); j++) {
+      auto &FromModule = ImportList[R.str()];
+      uint32_t NumGUIDs = R.u32();
+      for (uint32_t k = 0; k < NumGUIDs && !R.failed(); k++)
+        FromModule.insert(R.u64());
+    }
+  }
+
+  uint32_t NumExportLists = R.u32();
+  for (uint32_t i = 0; i < NumExportLists && !R.failed(); i++) {
+    auto &ExportList = Ret->ExportLists[R.str()];
+    uint32_t NumGUIDs = R.u32();
+    for (uint32_t j = 0; j < NumGUIDs && !R.failed(); j++)
+      ExportList.insert(Ret->Index.getOrInsertValueInfo(R.u64()));
+  }
+
+  uint32_t NumResolved = R.u32();
+  for (uint32_t i = 0; i < NumResolved && !R.failed(); i++) {
+    auto &Resolved = Ret->ResolvedODR[R.str()];
+    uint32_t NumLinkages = R.u32();
+    for (uint32_t j = 0; j < NumLinkages && !R.failed(); j++) {
+      GlobalValue::GUID GUID = R.u64();
+      Resolved[GUID] = static_cast<GlobalValue::LinkageTypes>(R.u8());
+    }
+  }
+  if (R.failed())
+    return Rebuild();
+
+  Ret->Index.collectDefinedGVSummariesPerModule(Ret->ModuleToDefinedGVSummaries);
+  *ChangedModules = 0;
+  return Ret.release();
+}
+
+// Distributed ThinLTO support. Rather than running every backend in-process
+// against the shared `LLVMRustThinLTOData`, the thin link can write out for
+// each module an index shard containing just the summaries that module needs,
+// plus the list of modules it imports from. This is the same shape as LLVM's
+// `-thinlto-index-only` output, so a backend on another machine then only
+// needs the shard and the listed bitcode files.
+
+// Writes the index shard for `ModId` to `IndexPath` and, if `ImportsPath` is
+// not null, the list of modules it imports from to `ImportsPath`.
+extern "C" LLVMRustResult
+LLVMRustThinLTOWriteIndexShard(const LLVMRustThinLTOData *Data,
+                               const char *ModId,
+                               const char *IndexPath,
+                               const char *ImportsPath) {
+  std::map<std::string, GVSummaryMapTy> ModuleToSummariesForIndex;
+  const auto &ImportList = Data->ImportLists.lookup(ModId);
+  gatherImportedSummariesForModule(ModId, Data->ModuleToDefinedGVSummaries,
+                                   ImportList, ModuleToSummariesForIndex);
+
+  std::error_code EC;
+  raw_fd_ostream OS(IndexPath, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  writeIndexToFile(Data->Index, OS, &ModuleToSummariesForIndex);
+  OS.close();
+  if (OS.has_error()) {
+    LLVMRustSetLastError(OS.error().message().c_str());
+    OS.clear_error();
+    return LLVMRustResult::Failure;
+  }
+
+  if (ImportsPath) {
+    EC = EmitImportsFiles(ModId, ImportsPath, ModuleToSummariesForIndex);
+    if (EC) {
+      LLVMRustSetLastError(EC.message().c_str());
+      return LLVMRustResult::Failure;
+    }
+  }
+  return LLVMRustResult::Success;
+}
+
 // Below are the various passes that happen *per module* when doing ThinLTO.
 //
 // In other words, these are the functions that are all run concurrently
@@ -1539,6 +4134,23 @@ LLVMRustPrepareThinLTOResolveWeak(const LLVMRustThinLTOData *Data, LLVMModuleRef
   return true;
 }
 
+// Turns the definitions that nothing live refers to, according to the index,
+// into declarations, as LLVM's own ThinLTO backend does before resolving weak
+// symbols. Aliases are left to the optimizer, they'd have to be replaced
+// rather than converted in place.
+extern "C" void
+LLVMRustPrepareThinLTODropDeadSymbols(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
+  Module &Mod = *unwrap(M);
+  const auto &DefinedGlobals = Data->ModuleToDefinedGVSummaries.lookup(Mod.getModuleIdentifier());
+  for (GlobalObject &GO : Mod.global_objects()) {
+    if (!isa<Function>(GO) && !isa<GlobalVariable>(GO))
+      continue;
+    GlobalValueSummary *Summary = DefinedGlobals.lookup(GO.getGUID());
+    if (Summary && !Data->Index.isGlobalValueLive(Summary))
+      convertToDeclaration(GO);
+  }
+}
+
 extern "C" bool
 LLVMRustPrepareThinLTOInternalize(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
   Module &Mod = *unwrap(M);
@@ -1547,17 +4159,43 @@ LLVMRustPrepareThinLTOInternalize(const LLVMRustThinLTOData *Data, LLVMModuleRef
   return true;
 }
 
+// `*CachedLoads` is set to the number of modules imported from that could be
+// loaded with the bitcode layout found by the thin link, `*UncachedLoads` to
+// the number that had to be scanned again (because they were compressed, or
+// the thin link was restored from the incremental cache).
 extern "C" bool
 LLVMRustPrepareThinLTOImport(const LLVMRustThinLTOData *Data, LLVMModuleRef M,
-                             LLVMTargetMachineRef TM) {
+                             LLVMTargetMachineRef TM, uint64_t *CachedLoads,
+                             uint64_t *UncachedLoads) {
   Module &Mod = *unwrap(M);
   TargetMachine &Target = *unwrap(TM);
+  *CachedLoads = 0;
+  *UncachedLoads = 0;
 
   const auto &ImportList = Data->ImportLists.lookup(Mod.getModuleIdentifier());
   auto Loader = [&](StringRef Identifier) {
     const auto &Memory = Data->ModuleMap.lookup(Identifier);
     auto &Context = Mod.getContext();
-    auto MOrErr = getLazyBitcodeModule(Memory, Context, true, true);
+    auto Cached = Data->BitcodeModules.find(Identifier);
+    auto MOrErr = [&]() -> Expected<std::unique_ptr<Module>> {
+      // A compressed module is decompressed for this import only, the copy
+      // goes away with the source module once the importer is done with it.
+      if (isCompressedThinLTOBuffer(Memory.getBuffer())) {
+        ++*UncachedLoads;
+        Expected<std::unique_ptr<MemoryBuffer>> PlainOrErr =
+            decompressThinLTOBuffer(Memory.getBuffer(), Identifier);
+        if (!PlainOrErr)
+          return PlainOrErr.takeError();
+        return getOwningLazyBitcodeModule(std::move(*PlainOrErr), Context, true, true);
+      }
+      if (Cached == Data->BitcodeModules.end()) {
+        ++*UncachedLoads;
+        return getLazyBitcodeModule(Memory, Context, true, true);
+      }
+      ++*CachedLoads;
+      BitcodeModule BM = Cached->second;
+      return BM.getLazyModule(Context, true, true);
+    }();
 
     if (!MOrErr)
       return MOrErr;
@@ -1601,12 +4239,52 @@ LLVMRustPrepareThinLTOImport(const LLVMRustThinLTOData *Data, LLVMModuleRef M,
   return true;
 }
 
+template <typename T> static uint64_t containerBytes(const T &Container) {
+  return Container.size() * sizeof(typename T::value_type);
+}
+
+// Estimates how many bytes `Data` takes up, split into the combined index and
+// the import, export and resolution lists computed from it, from the number
+// and size of their entries.
+extern "C" void
+LLVMRustThinLTOGetMemoryUsage(const LLVMRustThinLTOData *Data,
+                              uint64_t *Index, uint64_t *Lists) {
+  *Index = 0;
+  for (auto &Entry : Data->Index) {
+    *Index += sizeof(Entry);
+    for (auto &Summary : Entry.second.SummaryList) {
+      *Index += containerBytes(Summary->refs());
+      if (auto *FS = dyn_cast<FunctionSummary>(Summary.get()))
+        *Index += sizeof(FunctionSummary) + containerBytes(FS->calls());
+      else
+        *Index += sizeof(GlobalVarSummary);
+    }
+  }
+  for (auto &Path : Data->Index.modulePaths())
+    *Index += sizeof(Path) + Path.getKey().size();
+
+  *Lists = 0;
+  for (auto &Imports : Data->ImportLists)
+    for (auto &FromModule : Imports.getValue())
+      *Lists += FromModule.getKey().size() + containerBytes(FromModule.getValue());
+  for (auto &Exports : Data->ExportLists)
+    *Lists += containerBytes(Exports.getValue());
+  for (auto &Defined : Data->ModuleToDefinedGVSummaries)
+    *Lists += Defined.getValue().getMemorySize();
+  for (auto &Resolved : Data->ResolvedODR)
+    *Lists += containerBytes(Resolved.getValue());
+}
+
 extern "C" typedef void (*LLVMRustModuleNameCallback)(void*, // payload
                                                       const char*, // importing module name
-                                                      const char*); // imported module name
-
-// Calls `module_name_callback` for each module import done by ThinLTO.
-// The callback is provided with regular null-terminated C strings.
+                                                      const char*, // imported module name
+                                                      size_t, // imported functions
+                                                      size_t); // imported instructions
+
+// Calls `module_name_callback` for each module import done by ThinLTO, along
+// with the number of functions imported over that edge and their total
+// instruction count. The callback is provided with regular null-terminated C
+// strings.
 extern "C" void
 LLVMRustGetThinLTOModules(const LLVMRustThinLTOData *data,
                                 LLVMRustModuleNameCallback module_name_callback,
@@ -1616,9 +4294,19 @@ LLVMRustGetThinLTOModules(const LLVMRustThinLTOData *data,
     const auto& imports = importing_module.getValue();
     for (const auto& imported_module : imports) {
       const std::string imported_module_id = imported_module.getKey().str();
+      size_t functions = 0, instructions = 0;
+      for (GlobalValue::GUID GUID : imported_module.getValue()) {
+        auto *Summary = data->Index.findSummaryInModule(GUID, imported_module.getKey());
+        if (auto *FS = dyn_cast_or_null<FunctionSummary>(Summary)) {
+          functions++;
+          instructions += FS->instCount();
+        }
+      }
       module_name_callback(callback_payload,
                            importing_module_id.c_str(),
-                           imported_module_id.c_str());
+                           imported_module_id.c_str(),
+                           functions,
+                           instructions);
     }
   }
 }
@@ -1635,20 +4323,69 @@ struct LLVMRustThinLTOBuffer {
   std::string data;
 };
 
+static void writeThinLTOBitcode(Module &M, raw_ostream &OS) {
+  legacy::PassManager PM;
+  PM.add(createWriteThinLTOBitcodePass(OS));
+  PM.run(M);
+}
+
 extern "C" LLVMRustThinLTOBuffer*
 LLVMRustThinLTOBufferCreate(LLVMModuleRef M) {
   auto Ret = std::make_unique<LLVMRustThinLTOBuffer>();
   {
     raw_string_ostream OS(Ret->data);
-    {
-      legacy::PassManager PM;
-      PM.add(createWriteThinLTOBitcodePass(OS));
-      PM.run(*unwrap(M));
-    }
+    writeThinLTOBitcode(*unwrap(M), OS);
   }
   return Ret.release();
 }
 
+// Writes the same bytes as `LLVMRustThinLTOBufferCreate` straight to `Path`,
+// without materializing the whole buffer in memory first.
+extern "C" LLVMRustResult
+LLVMRustThinLTOBufferWriteToFile(LLVMModuleRef M, const char *Path) {
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  writeThinLTOBitcode(*unwrap(M), OS);
+  OS.close();
+  if (OS.has_error()) {
+    LLVMRustSetLastError(OS.error().message().c_str());
+    OS.clear_error();
+    return LLVMRustResult::Failure;
+  }
+  return LLVMRustResult::Success;
+}
+
+// Replaces the contents of `Buffer` with a zlib-compressed copy, to keep the
+// serialized form of finished codegen units small while they wait for the
+// ThinLTO index to be built. The buffer stays compressed after that: the thin
+// link, the import loader and `LLVMRustParseBitcodeForLTO` each decompress a
+// temporary copy of it when they read it.
+//
+// Returns false, leaving the buffer as it was, if LLVM has no zlib support.
+extern "C" bool
+LLVMRustThinLTOBufferCompress(LLVMRustThinLTOBuffer *Buffer) {
+  if (!zlib::isAvailable())
+    return false;
+  SmallVector<char, 0> Compressed;
+  if (Error Err = zlib::compress(Buffer->data, Compressed)) {
+    consumeError(std::move(Err));
+    return false;
+  }
+  std::string Data;
+  Data.reserve(ThinLTOCompressedHeaderSize + Compressed.size());
+  Data.append(ThinLTOCompressedMagic, ThinLTOCompressedMagicSize);
+  char Size[sizeof(uint64_t)];
+  support::endian::write64le(Size, Buffer->data.size());
+  Data.append(Size, sizeof(Size));
+  Data.append(Compressed.begin(), Compressed.end());
+  Buffer->data = std::move(Data);
+  return true;
+}
+
 extern "C" void
 LLVMRustThinLTOBufferFree(LLVMRustThinLTOBuffer *Buffer) {
   delete Buffer;
@@ -1674,6 +4411,19 @@ LLVMRustParseBitcodeForLTO(LLVMContextRef Context,
                            const char *identifier) {
   StringRef Data(data, len);
   MemoryBufferRef Buffer(Data, identifier);
+  // The module is fully materialized below, so a decompressed copy only has
+  // to live until we return.
+  std::unique_ptr<MemoryBuffer> Decompressed;
+  if (isCompressedThinLTOBuffer(Data)) {
+    Expected<std::unique_ptr<MemoryBuffer>> BufOrErr =
+        decompressThinLTOBuffer(Data, identifier);
+    if (!BufOrErr) {
+      LLVMRustSetLastError(toString(BufOrErr.takeError()).c_str());
+      return nullptr;
+    }
+    Decompressed = std::move(*BufOrErr);
+    Buffer = Decompressed->getMemBufferRef();
+  }
   unwrap(Context)->enableDebugTypeODRUniquing();
   Expected<std::unique_ptr<Module>> SrcOrError =
       parseBitcodeFile(Buffer, *unwrap(Context));
@@ -1684,6 +4434,48 @@ LLVMRustParseBitcodeForLTO(LLVMContextRef Context,
   return wrap(std::move(*SrcOrError).release());
 }
 
+// Like `LLVMRustParseBitcodeForLTO`, but only reads the module's globals and
+// metadata. Function bodies are read when something needs them, so those the
+// ThinLTO preparation steps turn into declarations are never read at all, and
+// `LLVMRustMaterializeModule` reads the rest. `data` has to outlive that, a
+// decompressed copy of it is owned by the module.
+extern "C" LLVMModuleRef
+LLVMRustParseBitcodeForLTOLazily(LLVMContextRef Context,
+                                 const char *data,
+                                 size_t len,
+                                 const char *identifier) {
+  StringRef Data(data, len);
+  std::unique_ptr<MemoryBuffer> Buffer;
+  if (isCompressedThinLTOBuffer(Data)) {
+    Expected<std::unique_ptr<MemoryBuffer>> BufOrErr =
+        decompressThinLTOBuffer(Data, identifier);
+    if (!BufOrErr) {
+      LLVMRustSetLastError(toString(BufOrErr.takeError()).c_str());
+      return nullptr;
+    }
+    Buffer = std::move(*BufOrErr);
+  } else {
+    Buffer = MemoryBuffer::getMemBuffer(Data, identifier,
+                                        /*RequiresNullTerminator=*/false);
+  }
+  unwrap(Context)->enableDebugTypeODRUniquing();
+  Expected<std::unique_ptr<Module>> SrcOrError =
+      getOwningLazyBitcodeModule(std::move(Buffer), *unwrap(Context));
+  if (!SrcOrError) {
+    LLVMRustSetLastError(toString(SrcOrError.takeError()).c_str());
+    return nullptr;
+  }
+  return wrap(std::move(*SrcOrError).release());
+}
+
+extern "C" bool LLVMRustMaterializeModule(LLVMModuleRef M) {
+  if (Error Err = unwrap(M)->materializeAll()) {
+    LLVMRustSetLastError(toString(std::move(Err)).c_str());
+    return false;
+  }
+  return true;
+}
+
 // Find the bitcode section in the object file data and return it as a slice.
 // Fail if the bitcode section is present but empty.
 //
@@ -1746,18 +4538,34 @@ LLVMRustThinLTOPatchDICompileUnit(LLVMModuleRef Mod, DICompileUnit *Unit) {
       return;
   }
 
-  // Use LLVM's built-in `DebugInfoFinder` to find a bunch of debuginfo and
-  // process it recursively. Note that we used to specifically iterate over
-  // instructions to ensure we feed everything into it, but `processModule`
-  // started doing this the same way in LLVM 7 (commit d769eb36ab2b8).
-  DebugInfoFinder Finder;
-  Finder.processModule(*M);
-
-  // After we've found all our debuginfo, rewrite all subprograms to point to
-  // the same `DICompileUnit`.
-  for (auto &F : Finder.subprograms()) {
-    F->replaceUnit(Unit);
+  // Rewrite all subprograms to point to the same `DICompileUnit`. Only
+  // subprogram definitions refer to a compile unit, and those are attached to
+  // functions, are the scopes functions have been inlined from, or are
+  // imported by a compile unit, so that's all we need to look at rather than
+  // walking the whole debuginfo graph the way `DebugInfoFinder` does.
+  SmallPtrSet<const MDNode *, 32> Visited;
+  auto Patch = [&](DISubprogram *SP) {
+    if (SP && SP->isDefinition() && Visited.insert(SP).second)
+      SP->replaceUnit(Unit);
+  };
+  for (Function &F : *M) {
+    Patch(F.getSubprogram());
+    for (Instruction &I : instructions(F)) {
+      // A location that wasn't inlined is in `F`'s own subprogram.
+      const DILocation *Loc = I.getDebugLoc().get();
+      if (!Loc || !Loc->getInlinedAt())
+        continue;
+      for (; Loc && Visited.insert(Loc).second; Loc = Loc->getInlinedAt())
+        Patch(Loc->getScope()->getSubprogram());
+    }
   }
+  for (DICompileUnit *CU : M->debug_compile_units())
+    for (DIImportedEntity *IE : CU->getImportedEntities()) {
+      if (auto *SP = dyn_cast_or_null<DISubprogram>(IE->getEntity()))
+        Patch(SP);
+      if (auto *Scope = dyn_cast_or_null<DILocalScope>(IE->getScope()))
+        Patch(Scope->getSubprogram());
+    }
 
   // Erase any other references to other `DICompileUnit` instances, the verifier
   // will later ensure that we don't actually have any other stale references to
@@ -1767,6 +4575,37 @@ LLVMRustThinLTOPatchDICompileUnit(LLVMModuleRef Mod, DICompileUnit *Unit) {
   MD->addOperand(Unit);
 }
 
+// The sets of CFI function definitions and declarations in the combined index,
+// as GUIDs, which feed into every module's cache key.
+struct ThinLTOCfiGUIDs {
+  std::set<GlobalValue::GUID> Defs;
+  std::set<GlobalValue::GUID> Decls;
+
+  // Based on the 'InProcessThinBackend' constructor in LLVM
+  explicit ThinLTOCfiGUIDs(const ModuleSummaryIndex &Index) {
+    for (auto &Name : Index.cfiFunctionDefs())
+      Defs.insert(
+          GlobalValue::getGUID(GlobalValue::dropLLVMManglingEscape(Name)));
+    for (auto &Name : Index.cfiFunctionDecls())
+      Decls.insert(
+          GlobalValue::getGUID(GlobalValue::dropLLVMManglingEscape(Name)));
+  }
+};
+
+static void computeThinLTOCacheKey(SmallString<40> &Key, const char *ModId,
+                                   const LLVMRustThinLTOData *Data,
+                                   const ThinLTOCfiGUIDs &Cfi) {
+  llvm::lto::Config conf;
+  const auto &ImportList = Data->ImportLists.lookup(ModId);
+  const auto &ExportList = Data->ExportLists.lookup(ModId);
+  const auto &ResolvedODR = Data->ResolvedODR.lookup(ModId);
+  const auto &DefinedGlobals = Data->ModuleToDefinedGVSummaries.lookup(ModId);
+
+  llvm::computeLTOCacheKey(Key, conf, Data->Index, ModId,
+      ImportList, ExportList, ResolvedODR, DefinedGlobals, Cfi.Defs, Cfi.Decls
+  );
+}
+
 // Computes the LTO cache key for the provided 'ModId' in the given 'Data',
 // storing the result in 'KeyOut'.
 // Currently, this cache key is a SHA-1 hash of anything that could affect
@@ -1777,25 +4616,32 @@ LLVMRustThinLTOPatchDICompileUnit(LLVMModuleRef Mod, DICompileUnit *Unit) {
 extern "C" void
 LLVMRustComputeLTOCacheKey(RustStringRef KeyOut, const char *ModId, LLVMRustThinLTOData *Data) {
   SmallString<40> Key;
-  llvm::lto::Config conf;
-  const auto &ImportList = Data->ImportLists.lookup(ModId);
-  const auto &ExportList = Data->ExportLists.lookup(ModId);
-  const auto &ResolvedODR = Data->ResolvedODR.lookup(ModId);
-  const auto &DefinedGlobals = Data->ModuleToDefinedGVSummaries.lookup(ModId);
-  std::set<GlobalValue::GUID> CfiFunctionDefs;
-  std::set<GlobalValue::GUID> CfiFunctionDecls;
-
-  // Based on the 'InProcessThinBackend' constructor in LLVM
-  for (auto &Name : Data->Index.cfiFunctionDefs())
-    CfiFunctionDefs.insert(
-        GlobalValue::getGUID(GlobalValue::dropLLVMManglingEscape(Name)));
-  for (auto &Name : Data->Index.cfiFunctionDecls())
-    CfiFunctionDecls.insert(
-        GlobalValue::getGUID(GlobalValue::dropLLVMManglingEscape(Name)));
+  computeThinLTOCacheKey(Key, ModId, Data, ThinLTOCfiGUIDs(Data->Index));
+  LLVMRustStringWriteImpl(KeyOut, Key.c_str(), Key.size());
+}
 
-  llvm::computeLTOCacheKey(Key, conf, Data->Index, ModId,
-      ImportList, ExportList, ResolvedODR, DefinedGlobals, CfiFunctionDefs, CfiFunctionDecls
-  );
+// Like `LLVMRustComputeLTOCacheKey`, but for all of the `NumModules` modules in
+// `ModIds` at once. The CFI sets are only computed once, and the keys are
+// hashed on `Threads` threads (0 for the hardware concurrency). The keys are
+// written to `KeysOut` in order, each followed by a newline.
+extern "C" void
+LLVMRustComputeLTOCacheKeys(RustStringRef KeysOut, const char **ModIds,
+                            size_t NumModules, const LLVMRustThinLTOData *Data,
+                            unsigned Threads) {
+  ThinLTOCfiGUIDs Cfi(Data->Index);
+  std::vector<SmallString<40>> Keys(NumModules);
+  {
+#if LLVM_VERSION_GE(11, 0)
+    ThreadPool Pool(heavyweight_hardware_concurrency(Threads));
+#else
+    ThreadPool Pool(Threads ? Threads : heavyweight_hardware_concurrency());
+#endif
+    for (size_t i = 0; i < NumModules; i++)
+      Pool.async([&, i]() { computeThinLTOCacheKey(Keys[i], ModIds[i], Data, Cfi); });
+    Pool.wait();
+  }
 
-  LLVMRustStringWriteImpl(KeyOut, Key.c_str(), Key.size());
+  RawRustStringOstream OS(KeysOut);
+  for (const auto &Key : Keys)
+    OS << Key << '\n';
 }
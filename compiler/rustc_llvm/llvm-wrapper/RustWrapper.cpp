@@ -1,18 +1,47 @@
 #include "LLVMWrapper.h"
+#include "llvm/Analysis/CFG.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/DiagnosticInfo.h"
 #include "llvm/IR/DiagnosticPrinter.h"
 #include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Intrinsics.h"
+#if LLVM_VERSION_GE(11, 0)
+#include "llvm/IR/LLVMRemarkStreamer.h"
+#include "llvm/Remarks/RemarkStreamer.h"
+#else
+#include "llvm/IR/RemarkStreamer.h"
+#endif
 #include "llvm/Object/Archive.h"
 #include "llvm/Object/COFFImportFile.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Bitcode/BitcodeWriterPass.h"
 #include "llvm/Support/Signals.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+#if LLVM_VERSION_GE(13, 0) && defined(LLVM_COMPONENT_DWP)
+#include "llvm/DWP/DWP.h"
+#include "llvm/DebugInfo/DWARF/DWARFContext.h"
+#include "llvm/MC/MCAsmBackend.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCCodeEmitter.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCObjectFileInfo.h"
+#include "llvm/MC/MCObjectWriter.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/MCTargetOptions.h"
+#include "llvm/Support/ToolOutputFile.h"
+#endif
 #include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringSet.h"
 
 #include <iostream>
+#include <map>
+#include <mutex>
 
 //===----------------------------------------------------------------------===
 //
@@ -81,6 +110,104 @@ extern "C" unsigned int LLVMRustGetInstructionCount(LLVMModuleRef M) {
   return unwrap(M)->getInstructionCount();
 }
 
+struct LLVMRustFunctionSize {
+  const char *Name;
+  size_t NameLen;
+  unsigned Instructions;
+  unsigned BasicBlocks;
+  unsigned Allocas;
+};
+
+extern "C" typedef void (*LLVMRustFunctionSizeCallback)(void *, // payload
+                                                        const LLVMRustFunctionSize *);
+
+// Walks `M` once and reports the size of every function defined in it. The
+// name is not null-terminated and only lives as long as the function does.
+extern "C" void LLVMRustGetFunctionSizes(LLVMModuleRef M,
+                                         LLVMRustFunctionSizeCallback Callback,
+                                         void *CallbackPayload) {
+  for (const Function &F : *unwrap(M)) {
+    if (F.isDeclaration())
+      continue;
+    StringRef Name = F.getName();
+    LLVMRustFunctionSize Size = {Name.data(), Name.size(), 0, 0, 0};
+    for (const BasicBlock &BB : F) {
+      Size.BasicBlocks++;
+      Size.Instructions += BB.size();
+      for (const Instruction &I : BB)
+        if (isa<AllocaInst>(I))
+          Size.Allocas++;
+    }
+    Callback(CallbackPayload, &Size);
+  }
+}
+
+struct LLVMRustModuleMemoryUsage {
+  uint64_t IR;
+  uint64_t Metadata;
+};
+
+// Estimates how many bytes the IR of `M` (globals, functions, blocks and
+// instructions with their operands) and the metadata reachable from it take
+// up, from the number and size of the objects they're made of. Subclasses are
+// counted as their base class, and constants and types aren't counted at all,
+// since they live in the context and may be shared with other modules.
+extern "C" void LLVMRustGetModuleMemoryUsage(LLVMModuleRef M,
+                                             LLVMRustModuleMemoryUsage *Usage) {
+  Module &Mod = *unwrap(M);
+  SmallPtrSet<const Metadata *, 32> Seen;
+  SmallVector<const Metadata *, 64> Worklist;
+  auto AddMD = [&](const Metadata *MD) {
+    if (MD && Seen.insert(MD).second)
+      Worklist.push_back(MD);
+  };
+  SmallVector<std::pair<unsigned, MDNode *>, 4> MDs;
+  auto AddAttachments = [&](const auto &Object) {
+    MDs.clear();
+    Object.getAllMetadata(MDs);
+    for (auto &MD : MDs)
+      AddMD(MD.second);
+  };
+
+  uint64_t IR = 0;
+  for (const GlobalVariable &GV : Mod.globals()) {
+    IR += sizeof(GlobalVariable) + GV.getName().size();
+    AddAttachments(GV);
+  }
+  for (const Function &F : Mod) {
+    IR += sizeof(Function) + F.arg_size() * sizeof(Argument) + F.getName().size();
+    AddAttachments(F);
+    for (const BasicBlock &BB : F) {
+      IR += sizeof(BasicBlock);
+      for (const Instruction &I : BB) {
+        IR += sizeof(Instruction) + I.getNumOperands() * sizeof(Use);
+        AddAttachments(I);
+        for (const Use &U : I.operands())
+          if (auto *MAV = dyn_cast<MetadataAsValue>(U))
+            AddMD(MAV->getMetadata());
+      }
+    }
+  }
+  for (const NamedMDNode &NMD : Mod.named_metadata())
+    for (const MDNode *N : NMD.operands())
+      AddMD(N);
+
+  uint64_t Metadata = 0;
+  while (!Worklist.empty()) {
+    const llvm::Metadata *MD = Worklist.pop_back_val();
+    if (auto *S = dyn_cast<MDString>(MD)) {
+      Metadata += sizeof(MDString) + S->getLength();
+    } else if (auto *N = dyn_cast<MDNode>(MD)) {
+      Metadata += sizeof(MDNode) + N->getNumOperands() * sizeof(MDOperand);
+      for (const MDOperand &Op : N->operands())
+        AddMD(Op.get());
+    } else {
+      Metadata += sizeof(ValueAsMetadata);
+    }
+  }
+  *Usage = {IR, Metadata};
+}
+
 extern "C" void LLVMRustSetLastError(const char *Err) {
   free((void *)LastError);
   LastError = strdup(Err);
@@ -92,6 +219,110 @@ extern "C" LLVMContextRef LLVMRustContextCreate(bool shouldDiscardNames) {
   return wrap(ctx);
 }
 
+// Every codegen unit and every LTO backend module used to get a context of its
+// own, so the types, constants, metadata strings and attribute lists they share
+// were interned again and freed again each time. Contexts handed out by
+// `LLVMRustContextTake` are therefore returned to a process-wide pool when
+// their module is released, and later given to the next module on whichever
+// worker thread asks first. A context never serves two modules at once.
+//
+// Whatever a module interned stays in the context after the module is gone,
+// and LLVM does not expose how much memory that is. Uniqued metadata is the
+// worst of it: the debug locations, scopes and subprograms of a module are
+// almost never shared with the next one, but live as long as the context. So
+// a context whose module carried debug info is retired rather than pooled.
+// Otherwise the pool counts the modules and instructions each context has
+// served and retires it past `MaxModulesPerContext` modules or
+// `MaxInstructionsPerContext` instructions, which bounds the growth of the
+// interned types and constants.
+namespace {
+class LLVMRustContextPool {
+  struct Usage {
+    size_t Modules = 0;
+    uint64_t Instructions = 0;
+  };
+
+  std::mutex Lock;
+  std::vector<LLVMContext *> Free;
+  DenseMap<LLVMContext *, Usage> Owned;
+
+  static constexpr size_t MaxIdle = 64;
+  static constexpr size_t MaxModulesPerContext = 256;
+  static constexpr uint64_t MaxInstructionsPerContext = 1 << 22;
+
+public:
+  LLVMContext *take() {
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      if (!Free.empty()) {
+        LLVMContext *Ctx = Free.back();
+        Free.pop_back();
+        return Ctx;
+      }
+    }
+    auto *Ctx = new LLVMContext();
+    std::lock_guard<std::mutex> Guard(Lock);
+    Owned[Ctx] = Usage();
+    return Ctx;
+  }
+
+  // Returns false if `Ctx` isn't pooled, in which case the caller owns it.
+  bool give(LLVMContext *Ctx, uint64_t Instructions, bool HadDebugInfo) {
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      auto It = Owned.find(Ctx);
+      if (It == Owned.end())
+        return false;
+      Usage &U = It->second;
+      U.Modules++;
+      U.Instructions += Instructions;
+      if (!HadDebugInfo && U.Modules < MaxModulesPerContext &&
+          U.Instructions < MaxInstructionsPerContext && Free.size() < MaxIdle) {
+        Free.push_back(Ctx);
+        return true;
+      }
+      Owned.erase(It);
+    }
+    // Deleting a context can take a while, don't hold the lock for it.
+    delete Ctx;
+    return true;
+  }
+};
+} // namespace
+
+static LLVMRustContextPool &contextPool() {
+  static LLVMRustContextPool Pool;
+  return Pool;
+}
+
+extern "C" LLVMContextRef LLVMRustContextTake(bool shouldDiscardNames) {
+  LLVMContext *Ctx = contextPool().take();
+  Ctx->setDiscardValueNames(shouldDiscardNames);
+  return wrap(Ctx);
+}
+
+// Disposes of `M` and of its context `C`. Contexts that came from
+// `LLVMRustContextTake` go back to the pool instead, with the module deleted
+// and the per-module state rustc installs on a context reset.
+extern "C" void LLVMRustContextRelease(LLVMContextRef C, LLVMModuleRef M) {
+  LLVMContext *Ctx = unwrap(C);
+  uint64_t Instructions = 0;
+  bool HadDebugInfo = false;
+  if (M) {
+    Module *Mod = unwrap(M);
+    Instructions = Mod->getInstructionCount();
+    HadDebugInfo = Mod->getNamedMetadata("llvm.dbg.cu") != nullptr;
+    delete Mod;
+  }
+  Ctx->setDiagnosticHandler(std::make_unique<DiagnosticHandler>());
+#if LLVM_VERSION_LT(13, 0)
+  Ctx->setInlineAsmDiagnosticHandler(nullptr, nullptr);
+#endif
+  Ctx->setYieldCallback(nullptr, nullptr);
+  if (!contextPool().give(Ctx, Instructions, HadDebugInfo))
+    delete Ctx;
+}
+
 extern "C" void LLVMRustSetNormalizedTarget(LLVMModuleRef M,
                                             const char *Triple) {
   unwrap(M)->setTargetTriple(Triple::normalize(Triple));
@@ -217,55 +448,6 @@ extern "C" void LLVMRustAddCallSiteAttrString(LLVMValueRef Instr, unsigned Index
   Call->addAttribute(Index, Attr);
 }
 
-
-extern "C" void LLVMRustAddAlignmentCallSiteAttr(LLVMValueRef Instr,
-                                                 unsigned Index,
-                                                 uint32_t Bytes) {
-  CallBase *Call = unwrap<CallBase>(Instr);
-  AttrBuilder B;
-  B.addAlignmentAttr(Bytes);
-  Call->setAttributes(Call->getAttributes().addAttributes(
-      Call->getContext(), Index, B));
-}
-
-extern "C" void LLVMRustAddDereferenceableCallSiteAttr(LLVMValueRef Instr,
-                                                       unsigned Index,
-                                                       uint64_t Bytes) {
-  CallBase *Call = unwrap<CallBase>(Instr);
-  AttrBuilder B;
-  B.addDereferenceableAttr(Bytes);
-  Call->setAttributes(Call->getAttributes().addAttributes(
-      Call->getContext(), Index, B));
-}
-
-extern "C" void LLVMRustAddDereferenceableOrNullCallSiteAttr(LLVMValueRef Instr,
-                                                             unsigned Index,
-                                                             uint64_t Bytes) {
-  CallBase *Call = unwrap<CallBase>(Instr);
-  AttrBuilder B;
-  B.addDereferenceableOrNullAttr(Bytes);
-  Call->setAttributes(Call->getAttributes().addAttributes(
-      Call->getContext(), Index, B));
-}
-
-extern "C" void LLVMRustAddByValCallSiteAttr(LLVMValueRef Instr, unsigned Index,
-                                             LLVMTypeRef Ty) {
-  CallBase *Call = unwrap<CallBase>(Instr);
-  Attribute Attr = Attribute::getWithByValType(Call->getContext(), unwrap(Ty));
-  Call->addAttribute(Index, Attr);
-}
-
-extern "C" void LLVMRustAddStructRetCallSiteAttr(LLVMValueRef Instr, unsigned Index,
-                                                 LLVMTypeRef Ty) {
-  CallBase *Call = unwrap<CallBase>(Instr);
-#if LLVM_VERSION_GE(12, 0)
-  Attribute Attr = Attribute::getWithStructRetType(Call->getContext(), unwrap(Ty));
-#else
-  Attribute Attr = Attribute::get(Call->getContext(), Attribute::StructRet);
-#endif
-  Call->addAttribute(Index, Attr);
-}
-
 extern "C" void LLVMRustAddFunctionAttribute(LLVMValueRef Fn, unsigned Index,
                                              LLVMRustAttribute RustAttr) {
   Function *A = unwrap<Function>(Fn);
@@ -274,48 +456,107 @@ extern "C" void LLVMRustAddFunctionAttribute(LLVMValueRef Fn, unsigned Index,
   A->addAttributes(Index, B);
 }
 
-extern "C" void LLVMRustAddAlignmentAttr(LLVMValueRef Fn,
-                                         unsigned Index,
-                                         uint32_t Bytes) {
-  Function *A = unwrap<Function>(Fn);
-  AttrBuilder B;
-  B.addAlignmentAttr(Bytes);
-  A->addAttributes(Index, B);
+enum class LLVMRustAttributeEntryKind {
+  Enum,
+  Alignment,
+  Dereferenceable,
+  DereferenceableOrNull,
+  ByVal,
+  StructRet,
+};
+
+// One attribute to add at `Index`. `Value` is the `LLVMRustAttribute` of an
+// `Enum` entry and the byte count of the integer ones, `Ty` the type of the
+// `ByVal` and `StructRet` ones.
+struct LLVMRustAttributeEntry {
+  unsigned Index;
+  LLVMRustAttributeEntryKind Kind;
+  uint64_t Value;
+  LLVMTypeRef Ty;
+};
+
+static AttributeList mergeAttributeLists(LLVMContext &C, AttributeList PAL,
+                                         AttributeList Added) {
+  if (PAL.isEmpty())
+    return Added;
+  return AttributeList::get(C, {PAL, Added});
+}
+
+// Adds all of `Entries` to `PAL`. The attributes of each index are gathered
+// first, so the context interns one new attribute set per index and one new
+// list in total, instead of a new list per attribute.
+static AttributeList addAttributeEntries(LLVMContext &C, AttributeList PAL,
+                                         const LLVMRustAttributeEntry *Entries,
+                                         size_t NumEntries) {
+  // Ordered by index, which `AttributeList::get` requires.
+  std::map<unsigned, AttrBuilder> Builders;
+  for (size_t I = 0; I < NumEntries; I++) {
+    const LLVMRustAttributeEntry &E = Entries[I];
+#if LLVM_VERSION_GE(14, 0)
+    AttrBuilder &B = Builders.emplace(E.Index, AttrBuilder(C)).first->second;
+#else
+    AttrBuilder &B = Builders[E.Index];
+#endif
+    switch (E.Kind) {
+    case LLVMRustAttributeEntryKind::Enum:
+      B.addAttribute(fromRust((LLVMRustAttribute)E.Value));
+      break;
+    case LLVMRustAttributeEntryKind::Alignment:
+      B.addAlignmentAttr(E.Value);
+      break;
+    case LLVMRustAttributeEntryKind::Dereferenceable:
+      B.addDereferenceableAttr(E.Value);
+      break;
+    case LLVMRustAttributeEntryKind::DereferenceableOrNull:
+      B.addDereferenceableOrNullAttr(E.Value);
+      break;
+    case LLVMRustAttributeEntryKind::ByVal:
+      B.addByValAttr(unwrap(E.Ty));
+      break;
+    case LLVMRustAttributeEntryKind::StructRet:
+#if LLVM_VERSION_GE(12, 0)
+      B.addStructRetAttr(unwrap(E.Ty));
+#else
+      B.addAttribute(Attribute::StructRet);
+#endif
+      break;
+    }
+  }
+
+  SmallVector<std::pair<unsigned, AttributeSet>, 8> Sets;
+  for (auto &Entry : Builders)
+    Sets.emplace_back(Entry.first, AttributeSet::get(C, Entry.second));
+  return mergeAttributeLists(C, PAL, AttributeList::get(C, Sets));
 }
 
-extern "C" void LLVMRustAddDereferenceableAttr(LLVMValueRef Fn, unsigned Index,
-                                               uint64_t Bytes) {
-  Function *A = unwrap<Function>(Fn);
-  AttrBuilder B;
-  B.addDereferenceableAttr(Bytes);
-  A->addAttributes(Index, B);
+// Most functions and call sites share one of a few attribute shapes, so the
+// Rust side builds the attribute list of each shape once and keeps a handle to
+// it. The list itself is interned in (and lives as long as) the context, the
+// handle only needs to be disposed of.
+extern "C" AttributeList *
+LLVMRustCreateAttributeList(LLVMContextRef C,
+                            const LLVMRustAttributeEntry *Entries,
+                            size_t NumEntries) {
+  return new AttributeList(
+      addAttributeEntries(*unwrap(C), AttributeList(), Entries, NumEntries));
 }
 
-extern "C" void LLVMRustAddDereferenceableOrNullAttr(LLVMValueRef Fn,
-                                                     unsigned Index,
-                                                     uint64_t Bytes) {
-  Function *A = unwrap<Function>(Fn);
-  AttrBuilder B;
-  B.addDereferenceableOrNullAttr(Bytes);
-  A->addAttributes(Index, B);
+extern "C" void LLVMRustDisposeAttributeList(AttributeList *List) {
+  delete List;
 }
 
-extern "C" void LLVMRustAddByValAttr(LLVMValueRef Fn, unsigned Index,
-                                     LLVMTypeRef Ty) {
+extern "C" void LLVMRustApplyFunctionAttributeList(LLVMValueRef Fn,
+                                                   const AttributeList *List) {
   Function *F = unwrap<Function>(Fn);
-  Attribute Attr = Attribute::getWithByValType(F->getContext(), unwrap(Ty));
-  F->addAttribute(Index, Attr);
+  F->setAttributes(
+      mergeAttributeLists(F->getContext(), F->getAttributes(), *List));
 }
 
-extern "C" void LLVMRustAddStructRetAttr(LLVMValueRef Fn, unsigned Index,
-                                         LLVMTypeRef Ty) {
-  Function *F = unwrap<Function>(Fn);
-#if LLVM_VERSION_GE(12, 0)
-  Attribute Attr = Attribute::getWithStructRetType(F->getContext(), unwrap(Ty));
-#else
-  Attribute Attr = Attribute::get(F->getContext(), Attribute::StructRet);
-#endif
-  F->addAttribute(Index, Attr);
+extern "C" void LLVMRustApplyCallSiteAttributeList(LLVMValueRef Instr,
+                                                   const AttributeList *List) {
+  CallBase *Call = unwrap<CallBase>(Instr);
+  Call->setAttributes(
+      mergeAttributeLists(Call->getContext(), Call->getAttributes(), *List));
 }
 
 extern "C" void LLVMRustAddFunctionAttrStringValue(LLVMValueRef Fn,
@@ -348,6 +589,52 @@ extern "C" void LLVMRustSetFastMath(LLVMValueRef V) {
   }
 }
 
+// These values **must** match ffi::FastMathFlags.
+enum class LLVMRustFastMathFlags : uint32_t {
+  None = 0,
+  AllowReassoc = (1 << 0),
+  NoNaNs = (1 << 1),
+  NoInfs = (1 << 2),
+  NoSignedZeros = (1 << 3),
+  AllowReciprocal = (1 << 4),
+  AllowContract = (1 << 5),
+  ApproxFunc = (1 << 6),
+};
+
+inline LLVMRustFastMathFlags operator&(LLVMRustFastMathFlags A,
+                                       LLVMRustFastMathFlags B) {
+  return static_cast<LLVMRustFastMathFlags>(static_cast<uint32_t>(A) &
+                                            static_cast<uint32_t>(B));
+}
+
+inline bool isSet(LLVMRustFastMathFlags F) {
+  return F != LLVMRustFastMathFlags::None;
+}
+
+// Enable only the given subset of the fast-math flags, for code that can be
+// reassociated or contracted but has to keep its NaN and infinity semantics.
+// Flags that are already set are left alone.
+extern "C" void LLVMRustSetFastMathFlags(LLVMValueRef V,
+                                         LLVMRustFastMathFlags Flags) {
+  auto I = dyn_cast<Instruction>(unwrap<Value>(V));
+  if (!I || !isa<FPMathOperator>(I))
+    return;
+  if (isSet(Flags & LLVMRustFastMathFlags::AllowReassoc))
+    I->setHasAllowReassoc(true);
+  if (isSet(Flags & LLVMRustFastMathFlags::NoNaNs))
+    I->setHasNoNaNs(true);
+  if (isSet(Flags & LLVMRustFastMathFlags::NoInfs))
+    I->setHasNoInfs(true);
+  if (isSet(Flags & LLVMRustFastMathFlags::NoSignedZeros))
+    I->setHasNoSignedZeros(true);
+  if (isSet(Flags & LLVMRustFastMathFlags::AllowReciprocal))
+    I->setHasAllowReciprocal(true);
+  if (isSet(Flags & LLVMRustFastMathFlags::AllowContract))
+    I->setHasAllowContract(true);
+  if (isSet(Flags & LLVMRustFastMathFlags::ApproxFunc))
+    I->setHasApproxFunc(true);
+}
+
 extern "C" LLVMValueRef
 LLVMRustBuildAtomicLoad(LLVMBuilderRef B, LLVMTypeRef Ty, LLVMValueRef Source,
                         const char *Name, LLVMAtomicOrdering Order) {
@@ -411,6 +698,39 @@ LLVMRustBuildAtomicFence(LLVMBuilderRef B, LLVMAtomicOrdering Order,
   return wrap(unwrap(B)->CreateFence(fromRust(Order), fromRust(Scope)));
 }
 
+enum class LLVMRustAtomicRmwFloatOp {
+  FAdd,
+  FSub,
+};
+
+static AtomicRMWInst::BinOp fromRust(LLVMRustAtomicRmwFloatOp Op) {
+  switch (Op) {
+  case LLVMRustAtomicRmwFloatOp::FAdd:
+    return AtomicRMWInst::FAdd;
+  case LLVMRustAtomicRmwFloatOp::FSub:
+    return AtomicRMWInst::FSub;
+  default:
+    report_fatal_error("bad AtomicRmwFloatOp.");
+  }
+}
+
+// Floating-point atomicrmw, which would otherwise need a compare-exchange
+// loop.
+extern "C" LLVMValueRef
+LLVMRustBuildAtomicRMWFloat(LLVMBuilderRef B, LLVMRustAtomicRmwFloatOp Op,
+                            LLVMValueRef Dst, LLVMValueRef Val,
+                            LLVMAtomicOrdering Order,
+                            LLVMRustSynchronizationScope Scope) {
+#if LLVM_VERSION_GE(13, 0)
+  return wrap(unwrap(B)->CreateAtomicRMW(fromRust(Op), unwrap(Dst), unwrap(Val),
+                                         llvm::MaybeAlign(), fromRust(Order),
+                                         fromRust(Scope)));
+#else
+  return wrap(unwrap(B)->CreateAtomicRMW(fromRust(Op), unwrap(Dst), unwrap(Val),
+                                         fromRust(Order), fromRust(Scope)));
+#endif
+}
+
 enum class LLVMRustAsmDialect {
   Att,
   Intel,
@@ -1280,6 +1600,340 @@ extern "C" void LLVMRustSetInlineAsmDiagnosticHandler(
 #endif
 }
 
+namespace {
+// Forwards diagnostics to rustc's handler, and answers LLVM's "is this remark
+// enabled" queries from the passes named by `-C remark`, so that passes don't
+// build remarks nobody asked for and so that those built anyway (LLVM does
+// not consult the handler before delivering a remark) never reach Rust.
+class RustDiagnosticHandler final : public DiagnosticHandler {
+public:
+  RustDiagnosticHandler(LLVMDiagnosticHandler Callback, void *CallbackContext,
+                        bool RemarkAllPasses, StringSet<> RemarkPasses)
+      : Callback(Callback), CallbackContext(CallbackContext),
+        RemarkAllPasses(RemarkAllPasses),
+        RemarkPasses(std::move(RemarkPasses)) {}
+
+  bool handleDiagnostics(const DiagnosticInfo &DI) override {
+    // Remarks are delivered whether or not they are enabled. Optimization
+    // failures always report themselves as enabled, so they still get through.
+    if (auto *Remark = dyn_cast<DiagnosticInfoOptimizationBase>(&DI))
+      if (!Remark->isEnabled())
+        return true;
+    if (!Callback)
+      return false;
+    Callback(wrap(&DI), CallbackContext);
+    return true;
+  }
+
+  bool isAnalysisRemarkEnabled(StringRef PassName) const override {
+    return isRemarkEnabled(PassName);
+  }
+
+  bool isMissedOptRemarkEnabled(StringRef PassName) const override {
+    return isRemarkEnabled(PassName);
+  }
+
+  bool isPassedOptRemarkEnabled(StringRef PassName) const override {
+    return isRemarkEnabled(PassName);
+  }
+
+  bool isAnyRemarkEnabled() const override {
+    return RemarkAllPasses || !RemarkPasses.empty();
+  }
+
+private:
+  bool isRemarkEnabled(StringRef PassName) const {
+    return RemarkAllPasses || RemarkPasses.count(PassName);
+  }
+
+  LLVMDiagnosticHandler Callback;
+  void *CallbackContext;
+  bool RemarkAllPasses;
+  StringSet<> RemarkPasses;
+};
+} // namespace
+
+// Replaces the context's diagnostic handler with one that hands diagnostics to
+// `Callback` and only enables remarks for all passes, or for the
+// `RemarkPassesLen` pass names in `RemarkPasses`.
+extern "C" void LLVMRustContextConfigureDiagnosticHandler(
+    LLVMContextRef C, LLVMDiagnosticHandler Callback, void *CallbackContext,
+    bool RemarkAllPasses, const char *const *RemarkPasses,
+    size_t RemarkPassesLen) {
+  StringSet<> Passes;
+  for (size_t I = 0; I < RemarkPassesLen; I++)
+    Passes.insert(RemarkPasses[I]);
+  unwrap(C)->setDiagnosticHandler(std::make_unique<RustDiagnosticHandler>(
+      Callback, CallbackContext, RemarkAllPasses, std::move(Passes)));
+}
+
+// Collects the stack frame size codegen settles on for every function of a
+// module. Codegen reports the frames larger than a function's
+// "warn-stack-size" threshold as diagnostics, so with a threshold of 0 that's
+// every function that has a frame at all; the collector sits in front of the
+// context's diagnostic handler while the module is lowered and keeps those
+// reports to itself.
+class LLVMRustStackSizeCollector final : public DiagnosticHandler {
+public:
+  explicit LLVMRustStackSizeCollector(std::unique_ptr<DiagnosticHandler> Inner)
+      : Inner(std::move(Inner)) {}
+
+  bool handleDiagnostics(const DiagnosticInfo &DI) override {
+    if (auto *StackSize = dyn_cast<DiagnosticInfoStackSize>(&DI)) {
+      FrameSizes[&StackSize->getFunction()] = StackSize->getResourceSize();
+      return true;
+    }
+    return Inner->handleDiagnostics(DI);
+  }
+
+  bool isAnalysisRemarkEnabled(StringRef PassName) const override {
+    return Inner->isAnalysisRemarkEnabled(PassName);
+  }
+
+  bool isMissedOptRemarkEnabled(StringRef PassName) const override {
+    return Inner->isMissedOptRemarkEnabled(PassName);
+  }
+
+  bool isPassedOptRemarkEnabled(StringRef PassName) const override {
+    return Inner->isPassedOptRemarkEnabled(PassName);
+  }
+
+  bool isAnyRemarkEnabled() const override {
+    return Inner->isAnyRemarkEnabled();
+  }
+
+  std::unique_ptr<DiagnosticHandler> Inner;
+  // Looked at up front, as the bodies may be gone once they're emitted.
+  std::vector<Function *> Defined;
+  DenseSet<const Function *> DynamicAllocas;
+  DenseMap<const Function *, uint64_t> FrameSizes;
+};
+
+#if LLVM_VERSION_LT(13, 0)
+// Before LLVM 13 codegen only reports frame sizes above the global
+// `-warn-stack-size`. This sets it to 0 for as long as any module is being
+// collected from, and puts it back once the last one is done, so code emitted
+// otherwise is left alone. An explicit `-C llvm-args=-warn-stack-size=...`
+// wins.
+static std::mutex WarnStackSizeLock;
+static unsigned WarnStackSizeUsers = 0;
+static cl::Option *WarnStackSizeOpt = nullptr;
+
+static void acquireWarnStackSize() {
+  std::lock_guard<std::mutex> Guard(WarnStackSizeLock);
+  if (WarnStackSizeUsers++ != 0)
+    return;
+  auto &Opts = cl::getRegisteredOptions();
+  auto It = Opts.find("warn-stack-size");
+  if (It == Opts.end() || It->second->getNumOccurrences() != 0)
+    return;
+  WarnStackSizeOpt = It->second;
+  WarnStackSizeOpt->addOccurrence(0, "warn-stack-size", "0");
+}
+
+static void releaseWarnStackSize() {
+  std::lock_guard<std::mutex> Guard(WarnStackSizeLock);
+  if (--WarnStackSizeUsers != 0 || !WarnStackSizeOpt)
+    return;
+  WarnStackSizeOpt->reset();
+  WarnStackSizeOpt = nullptr;
+}
+#endif
+
+// Starts collecting the frame sizes of the functions of `M`. The returned
+// collector has to be handed to `LLVMRustFinishCollectingStackSizes` before
+// anything else replaces the diagnostic handler of the module's context.
+extern "C" LLVMRustStackSizeCollector *
+LLVMRustStartCollectingStackSizes(LLVMModuleRef M) {
+  Module &Mod = *unwrap(M);
+  LLVMContext &Ctx = Mod.getContext();
+  auto Collector =
+      std::make_unique<LLVMRustStackSizeCollector>(Ctx.getDiagnosticHandler());
+  for (Function &F : Mod) {
+    if (F.isDeclaration())
+      continue;
+#if LLVM_VERSION_GE(13, 0)
+    F.addFnAttr("warn-stack-size", "0");
+#endif
+    Collector->Defined.push_back(&F);
+    for (const BasicBlock &BB : F)
+      for (const Instruction &I : BB)
+        if (auto *Alloca = dyn_cast<AllocaInst>(&I))
+          if (!Alloca->isStaticAlloca())
+            Collector->DynamicAllocas.insert(&F);
+  }
+#if LLVM_VERSION_LT(13, 0)
+  acquireWarnStackSize();
+#endif
+  LLVMRustStackSizeCollector *Result = Collector.get();
+  Ctx.setDiagnosticHandler(std::move(Collector));
+  return Result;
+}
+
+typedef void (*LLVMRustStackSizeCallback)(void *, const char *, size_t,
+                                          uint64_t, bool);
+
+// Puts back the diagnostic handler `LLVMRustStartCollectingStackSizes` found,
+// and calls `Callback` with the name of every function defined in `M`, its
+// frame size in bytes and whether it has allocas of a size only known at run
+// time, which the frame size doesn't account for. Returns false, without
+// reporting anything, if `Collector` is no longer the context's handler.
+extern "C" bool
+LLVMRustFinishCollectingStackSizes(LLVMModuleRef M,
+                                   LLVMRustStackSizeCollector *Collector,
+                                   LLVMRustStackSizeCallback Callback,
+                                   void *Payload) {
+  LLVMContext &Ctx = unwrap(M)->getContext();
+#if LLVM_VERSION_LT(13, 0)
+  releaseWarnStackSize();
+#endif
+  if (Ctx.getDiagHandlerPtr() != Collector)
+    return false;
+  std::unique_ptr<DiagnosticHandler> Handler = Ctx.getDiagnosticHandler();
+  Ctx.setDiagnosticHandler(std::move(Collector->Inner));
+
+  for (Function *F : Collector->Defined) {
+#if LLVM_VERSION_GE(13, 0)
+    F->removeFnAttr("warn-stack-size");
+#endif
+    StringRef Name = F->getName();
+    Callback(Payload, Name.data(), Name.size(), Collector->FrameSizes.lookup(F),
+             Collector->DynamicAllocas.count(F));
+  }
+  return true;
+}
+
+// Counts, per function, how often instruction selection fell back to a slower
+// selector: FastISel hands the rest of a block to SelectionDAG whenever it
+// can't select an instruction, and reports that as a missed remark, GlobalISel
+// falls back for a whole function. Everything is passed on to the handler it
+// wraps.
+class LLVMRustISelStatsCollector final : public DiagnosticHandler {
+public:
+  explicit LLVMRustISelStatsCollector(std::unique_ptr<DiagnosticHandler> Inner)
+      : Inner(std::move(Inner)) {}
+
+  bool handleDiagnostics(const DiagnosticInfo &DI) override {
+    if (auto *Remark = dyn_cast<DiagnosticInfoOptimizationBase>(&DI)) {
+      if (Remark->getPassName() == "sdagisel" &&
+          Remark->getRemarkName() == "FastISelFailure")
+        ++FastISelFallbacks[&Remark->getFunction()];
+    } else if (auto *Fallback = dyn_cast<DiagnosticInfoISelFallback>(&DI)) {
+      GlobalISelFallbacks.insert(&Fallback->getFunction());
+    }
+    return Inner->handleDiagnostics(DI);
+  }
+
+  bool isAnalysisRemarkEnabled(StringRef PassName) const override {
+    return Inner->isAnalysisRemarkEnabled(PassName);
+  }
+
+  bool isMissedOptRemarkEnabled(StringRef PassName) const override {
+    return Inner->isMissedOptRemarkEnabled(PassName);
+  }
+
+  bool isPassedOptRemarkEnabled(StringRef PassName) const override {
+    return Inner->isPassedOptRemarkEnabled(PassName);
+  }
+
+  bool isAnyRemarkEnabled() const override {
+    return Inner->isAnyRemarkEnabled();
+  }
+
+  std::unique_ptr<DiagnosticHandler> Inner;
+  // Recorded up front, as the bodies may be gone once they're emitted.
+  std::vector<const Function *> Defined;
+  DenseMap<const Function *, uint64_t> FastISelFallbacks;
+  DenseSet<const Function *> GlobalISelFallbacks;
+};
+
+// Starts counting instruction selection fallbacks in the functions of `M`.
+// GlobalISel only reports them if its abort mode is `DisableWithDiag`. Like
+// the stack size collector this wraps the context's diagnostic handler, so the
+// returned collector has to be handed to `LLVMRustFinishCollectingISelStats`
+// before the stack size collector started earlier is finished.
+extern "C" LLVMRustISelStatsCollector *
+LLVMRustStartCollectingISelStats(LLVMModuleRef M) {
+  Module &Mod = *unwrap(M);
+  LLVMContext &Ctx = Mod.getContext();
+  auto Collector =
+      std::make_unique<LLVMRustISelStatsCollector>(Ctx.getDiagnosticHandler());
+  for (const Function &F : Mod)
+    if (!F.isDeclaration())
+      Collector->Defined.push_back(&F);
+  LLVMRustISelStatsCollector *Result = Collector.get();
+  Ctx.setDiagnosticHandler(std::move(Collector));
+  return Result;
+}
+
+typedef void (*LLVMRustISelStatsCallback)(void *, const char *, size_t,
+                                          uint64_t, bool);
+
+// Puts back the diagnostic handler `LLVMRustStartCollectingISelStats` found,
+// and calls `Callback` with the name of every function defined in `M`, the
+// number of times FastISel fell back to SelectionDAG in it and whether
+// GlobalISel fell back for it. Returns false, without reporting anything, if
+// `Collector` is no longer the context's handler.
+extern "C" bool
+LLVMRustFinishCollectingISelStats(LLVMModuleRef M,
+                                  LLVMRustISelStatsCollector *Collector,
+                                  LLVMRustISelStatsCallback Callback,
+                                  void *Payload) {
+  LLVMContext &Ctx = unwrap(M)->getContext();
+  if (Ctx.getDiagHandlerPtr() != Collector)
+    return false;
+  std::unique_ptr<DiagnosticHandler> Handler = Ctx.getDiagnosticHandler();
+  Ctx.setDiagnosticHandler(std::move(Collector->Inner));
+
+  for (const Function *F : Collector->Defined) {
+    StringRef Name = F->getName();
+    Callback(Payload, Name.data(), Name.size(),
+             Collector->FastISelFallbacks.lookup(F),
+             Collector->GlobalISelFallbacks.count(F));
+  }
+  return true;
+}
+
+// Installs LLVM's remark streamer on the context so that optimization remarks
+// are serialized straight into `Filename` in the given format ("yaml" or
+// "bitstream"), filtered by the `Passes` regex. The returned file must be
+// handed back to `LLVMRustFinishOptimizationRemarks` once the passes that
+// may emit remarks have finished running.
+extern "C" ToolOutputFile *
+LLVMRustSetupOptimizationRemarks(LLVMContextRef C, const char *Filename,
+                                 const char *Passes, const char *Format,
+                                 bool WithHotness, uint64_t HotnessThreshold) {
+#if LLVM_VERSION_GE(11, 0)
+  auto FileOrErr = setupLLVMOptimizationRemarks(
+      *unwrap(C), Filename, Passes, Format, WithHotness, HotnessThreshold);
+#else
+  auto FileOrErr = setupOptimizationRemarks(
+      *unwrap(C), Filename, Passes, Format, WithHotness, HotnessThreshold);
+#endif
+  if (!FileOrErr) {
+    LLVMRustSetLastError(toString(FileOrErr.takeError()).c_str());
+    return nullptr;
+  }
+  return FileOrErr->release();
+}
+
+extern "C" void LLVMRustFinishOptimizationRemarks(LLVMContextRef C,
+                                                  ToolOutputFile *File) {
+  // The streamers refer to the file's stream, and the bitstream serializer
+  // only writes its trailing metadata when destroyed, so tear them down
+  // before closing the file.
+  LLVMContext &Ctx = *unwrap(C);
+#if LLVM_VERSION_GE(11, 0)
+  Ctx.setLLVMRemarkStreamer(nullptr);
+  Ctx.setMainRemarkStreamer(nullptr);
+#else
+  Ctx.setRemarkStreamer(nullptr);
+#endif
+  Ctx.setDiagnosticsHotnessRequested(false);
+  File->keep();
+  delete File;
+}
+
 extern "C" bool LLVMRustUnpackSMDiagnostic(LLVMSMDiagnosticRef DRef,
                                            RustStringRef MessageOut,
                                            RustStringRef BufferOut,
@@ -1382,25 +2036,54 @@ extern "C" void LLVMRustAddHandler(LLVMValueRef CatchSwitchRef,
   cast<CatchSwitchInst>(CatchSwitch)->addHandler(unwrap(Handler));
 }
 
-extern "C" OperandBundleDef *LLVMRustBuildOperandBundleDef(const char *Name,
-                                                           LLVMValueRef *Inputs,
-                                                           unsigned NumInputs) {
-  return new OperandBundleDef(Name, makeArrayRef(unwrap(Inputs), NumInputs));
+// An operand bundle described by the caller. The tag and inputs are borrowed
+// for the duration of `LLVMRustBuildOperandBundles` only.
+struct LLVMRustOperandBundle {
+  const char *Tag;
+  size_t TagLen;
+  LLVMValueRef *Inputs;
+  size_t NumInputs;
+};
+
+// The bundles attached to every call and invoke built with it, e.g. the
+// `funclet` bundle of each call inside an MSVC cleanup pad. The set is built
+// once and then only referenced, so building a call allocates nothing for it.
+struct LLVMRustOperandBundles {
+  SmallVector<OperandBundleDef, 1> Defs;
+};
+
+extern "C" LLVMRustOperandBundles *
+LLVMRustBuildOperandBundles(const LLVMRustOperandBundle *Bundles,
+                            size_t NumBundles) {
+  auto *Ret = new LLVMRustOperandBundles();
+  Ret->Defs.reserve(NumBundles);
+  for (size_t I = 0; I < NumBundles; I++) {
+    const LLVMRustOperandBundle &Bundle = Bundles[I];
+    Ret->Defs.emplace_back(
+        std::string(Bundle.Tag, Bundle.TagLen),
+        makeArrayRef(unwrap(Bundle.Inputs), Bundle.NumInputs));
+  }
+  return Ret;
 }
 
-extern "C" void LLVMRustFreeOperandBundleDef(OperandBundleDef *Bundle) {
-  delete Bundle;
+extern "C" void LLVMRustFreeOperandBundles(LLVMRustOperandBundles *Bundles) {
+  delete Bundles;
+}
+
+static ArrayRef<OperandBundleDef>
+bundleDefs(const LLVMRustOperandBundles *Bundles) {
+  if (!Bundles)
+    return None;
+  return Bundles->Defs;
 }
 
 extern "C" LLVMValueRef LLVMRustBuildCall(LLVMBuilderRef B, LLVMValueRef Fn,
                                           LLVMValueRef *Args, unsigned NumArgs,
-                                          OperandBundleDef *Bundle) {
+                                          const LLVMRustOperandBundles *Bundles) {
   Value *Callee = unwrap(Fn);
   FunctionType *FTy = cast<FunctionType>(Callee->getType()->getPointerElementType());
-  unsigned Len = Bundle ? 1 : 0;
-  ArrayRef<OperandBundleDef> Bundles = makeArrayRef(Bundle, Len);
   return wrap(unwrap(B)->CreateCall(
-      FTy, Callee, makeArrayRef(unwrap(Args), NumArgs), Bundles));
+      FTy, Callee, makeArrayRef(unwrap(Args), NumArgs), bundleDefs(Bundles)));
 }
 
 extern "C" LLVMValueRef LLVMRustGetInstrProfIncrementIntrinsic(LLVMModuleRef M) {
@@ -1428,6 +2111,39 @@ extern "C" LLVMValueRef LLVMRustBuildMemMove(LLVMBuilderRef B,
       unwrap(Size), IsVolatile));
 }
 
+// Marks a load or store as unlikely to be reused soon, so that the backend
+// can use a streaming access that bypasses the cache (`movnt*` on x86). The
+// node always has to hold the integer 1, see the LangRef entries for load
+// and store.
+extern "C" void LLVMRustSetNontemporal(LLVMValueRef V) {
+  Instruction *I = unwrap<Instruction>(V);
+  LLVMContext &C = I->getContext();
+  Metadata *One = ConstantAsMetadata::get(ConstantInt::get(Type::getInt32Ty(C), 1));
+  I->setMetadata(LLVMContext::MD_nontemporal, MDNode::get(C, One));
+}
+
+// Emits `llvm.prefetch`. `Locality` goes from 0 (no temporal locality) to 3
+// (keep in all levels of cache) and, like the other operands, has to be an
+// immediate, which is why it is not passed as an `LLVMValueRef`.
+extern "C" LLVMValueRef LLVMRustBuildPrefetch(LLVMBuilderRef B, LLVMValueRef Ptr,
+                                              bool IsWrite, unsigned Locality,
+                                              bool IsData) {
+  IRBuilder<> &Builder = *unwrap(B);
+  Value *P = unwrap(Ptr);
+  Module *M = Builder.GetInsertBlock()->getModule();
+  Function *F;
+  if (Intrinsic::isOverloaded(Intrinsic::prefetch)) {
+    F = Intrinsic::getDeclaration(M, Intrinsic::prefetch, {P->getType()});
+  } else {
+    P = Builder.CreatePointerCast(
+        P, Builder.getInt8PtrTy(P->getType()->getPointerAddressSpace()));
+    F = Intrinsic::getDeclaration(M, Intrinsic::prefetch);
+  }
+  Value *Ops[] = {P, Builder.getInt32(IsWrite), Builder.getInt32(Locality),
+                  Builder.getInt32(IsData)};
+  return wrap(Builder.CreateCall(F, Ops));
+}
+
 extern "C" LLVMValueRef LLVMRustBuildMemSet(LLVMBuilderRef B,
                                             LLVMValueRef Dst, unsigned DstAlign,
                                             LLVMValueRef Val,
@@ -1439,15 +2155,13 @@ extern "C" LLVMValueRef LLVMRustBuildMemSet(LLVMBuilderRef B,
 extern "C" LLVMValueRef
 LLVMRustBuildInvoke(LLVMBuilderRef B, LLVMValueRef Fn, LLVMValueRef *Args,
                     unsigned NumArgs, LLVMBasicBlockRef Then,
-                    LLVMBasicBlockRef Catch, OperandBundleDef *Bundle,
-                    const char *Name) {
+                    LLVMBasicBlockRef Catch,
+                    const LLVMRustOperandBundles *Bundles, const char *Name) {
   Value *Callee = unwrap(Fn);
   FunctionType *FTy = cast<FunctionType>(Callee->getType()->getPointerElementType());
-  unsigned Len = Bundle ? 1 : 0;
-  ArrayRef<OperandBundleDef> Bundles = makeArrayRef(Bundle, Len);
   return wrap(unwrap(B)->CreateInvoke(FTy, Callee, unwrap(Then), unwrap(Catch),
                                       makeArrayRef(unwrap(Args), NumArgs),
-                                      Bundles, Name));
+                                      bundleDefs(Bundles), Name));
 }
 
 extern "C" void LLVMRustPositionBuilderAtStart(LLVMBuilderRef B,
@@ -1621,16 +2335,18 @@ struct LLVMRustModuleBuffer {
   std::string data;
 };
 
+static void writeModuleBitcode(Module &M, raw_ostream &OS) {
+  legacy::PassManager PM;
+  PM.add(createBitcodeWriterPass(OS));
+  PM.run(M);
+}
+
 extern "C" LLVMRustModuleBuffer*
 LLVMRustModuleBufferCreate(LLVMModuleRef M) {
   auto Ret = std::make_unique<LLVMRustModuleBuffer>();
   {
     raw_string_ostream OS(Ret->data);
-    {
-      legacy::PassManager PM;
-      PM.add(createBitcodeWriterPass(OS));
-      PM.run(*unwrap(M));
-    }
+    writeModuleBitcode(*unwrap(M), OS);
   }
   return Ret.release();
 }
@@ -1650,10 +2366,71 @@ LLVMRustModuleBufferLen(const LLVMRustModuleBuffer *Buffer) {
   return Buffer->data.length();
 }
 
-extern "C" uint64_t
-LLVMRustModuleCost(LLVMModuleRef M) {
-  auto f = unwrap(M)->functions();
-  return std::distance(std::begin(f), std::end(f));
+// Partitions `M` into `N` modules with `SplitModule` and writes each of them
+// to its own buffer in `Parts`, so that they can be parsed into separate
+// contexts and code generated in parallel. Local symbols that are referenced
+// from more than one partition are given hidden external linkage by
+// `SplitModule` rather than being duplicated. `M` may be modified and should
+// not be used afterwards. Returns the number of buffers written, or 0 without
+// touching `M` if it has module-level inline assembly: that would be copied
+// into every partition, each of which would then define its symbols.
+extern "C" size_t
+LLVMRustSplitModule(LLVMModuleRef M, size_t N, LLVMRustModuleBuffer **Parts) {
+  if (!unwrap(M)->getModuleInlineAsm().empty())
+    return 0;
+
+  size_t NumParts = 0;
+  auto WritePart = [&](std::unique_ptr<Module> Part) {
+    auto Buffer = std::make_unique<LLVMRustModuleBuffer>();
+    {
+      raw_string_ostream OS(Buffer->data);
+      writeModuleBitcode(*Part, OS);
+    }
+    Parts[NumParts++] = Buffer.release();
+  };
+#if LLVM_VERSION_GE(14, 0)
+  SplitModule(*unwrap(M), N, WritePart);
+#else
+  SplitModule(CloneModule(*unwrap(M)), N, WritePart);
+#endif
+  return NumParts;
+}
+
+struct LLVMRustModuleCostInfo {
+  uint64_t Functions;
+  uint64_t Instructions;
+  uint64_t BasicBlocks;
+  uint64_t Loops;
+  uint64_t Calls;
+};
+
+// Measures the code in the module that the backend will actually have to work
+// on, i.e. only functions with a body. Loops are counted as the distinct
+// targets of back edges, which avoids building dominator trees and loop info
+// for every function just to estimate a cost.
+extern "C" void
+LLVMRustGetModuleCostInfo(LLVMModuleRef M, LLVMRustModuleCostInfo *Info) {
+  *Info = {};
+  SmallVector<std::pair<const BasicBlock *, const BasicBlock *>, 8> BackEdges;
+  SmallPtrSet<const BasicBlock *, 8> Headers;
+  for (Function &F : *unwrap(M)) {
+    if (F.isDeclaration())
+      continue;
+    Info->Functions++;
+    Info->BasicBlocks += F.size();
+    for (BasicBlock &BB : F) {
+      Info->Instructions += BB.size();
+      for (Instruction &I : BB)
+        if (isa<CallBase>(I) && !isa<DbgInfoIntrinsic>(I))
+          Info->Calls++;
+    }
+    BackEdges.clear();
+    Headers.clear();
+    FindFunctionBackedges(F, BackEdges);
+    for (auto &Edge : BackEdges)
+      Headers.insert(Edge.second);
+    Info->Loops += Headers.size();
+  }
 }
 
 // Vector reductions:
@@ -1714,6 +2491,92 @@ LLVMRustBuildVectorReduceFMax(LLVMBuilderRef B, LLVMValueRef Src, bool NoNaN) {
 #endif
 }
 
+// Masked memory operations. `Alignment` is that of the whole vector for
+// loads and stores and that of a single element for the others. Lanes whose
+// mask bit is clear are not accessed and, for loads, are taken from
+// `PassThru`, or left undefined if it is null.
+extern "C" LLVMValueRef
+LLVMRustBuildMaskedLoad(LLVMBuilderRef B, LLVMTypeRef Ty, LLVMValueRef Ptr,
+                        unsigned Alignment, LLVMValueRef Mask,
+                        LLVMValueRef PassThru) {
+#if LLVM_VERSION_GE(13, 0)
+  return wrap(unwrap(B)->CreateMaskedLoad(unwrap(Ty), unwrap(Ptr), Align(Alignment),
+                                          unwrap(Mask), unwrap(PassThru)));
+#elif LLVM_VERSION_GE(11, 0)
+  return wrap(unwrap(B)->CreateMaskedLoad(unwrap(Ptr), Align(Alignment),
+                                          unwrap(Mask), unwrap(PassThru)));
+#else
+  return wrap(unwrap(B)->CreateMaskedLoad(unwrap(Ptr), Alignment,
+                                          unwrap(Mask), unwrap(PassThru)));
+#endif
+}
+extern "C" LLVMValueRef
+LLVMRustBuildMaskedStore(LLVMBuilderRef B, LLVMValueRef Val, LLVMValueRef Ptr,
+                         unsigned Alignment, LLVMValueRef Mask) {
+#if LLVM_VERSION_GE(11, 0)
+  return wrap(unwrap(B)->CreateMaskedStore(unwrap(Val), unwrap(Ptr), Align(Alignment),
+                                           unwrap(Mask)));
+#else
+  return wrap(unwrap(B)->CreateMaskedStore(unwrap(Val), unwrap(Ptr), Alignment,
+                                           unwrap(Mask)));
+#endif
+}
+extern "C" LLVMValueRef
+LLVMRustBuildMaskedGather(LLVMBuilderRef B, LLVMTypeRef Ty, LLVMValueRef Ptrs,
+                          unsigned Alignment, LLVMValueRef Mask,
+                          LLVMValueRef PassThru) {
+#if LLVM_VERSION_GE(13, 0)
+  return wrap(unwrap(B)->CreateMaskedGather(unwrap(Ty), unwrap(Ptrs), Align(Alignment),
+                                            unwrap(Mask), unwrap(PassThru)));
+#elif LLVM_VERSION_GE(11, 0)
+  return wrap(unwrap(B)->CreateMaskedGather(unwrap(Ptrs), Align(Alignment),
+                                            unwrap(Mask), unwrap(PassThru)));
+#else
+  return wrap(unwrap(B)->CreateMaskedGather(unwrap(Ptrs), Alignment,
+                                            unwrap(Mask), unwrap(PassThru)));
+#endif
+}
+extern "C" LLVMValueRef
+LLVMRustBuildMaskedScatter(LLVMBuilderRef B, LLVMValueRef Val, LLVMValueRef Ptrs,
+                           unsigned Alignment, LLVMValueRef Mask) {
+#if LLVM_VERSION_GE(11, 0)
+  return wrap(unwrap(B)->CreateMaskedScatter(unwrap(Val), unwrap(Ptrs), Align(Alignment),
+                                             unwrap(Mask)));
+#else
+  return wrap(unwrap(B)->CreateMaskedScatter(unwrap(Val), unwrap(Ptrs), Alignment,
+                                             unwrap(Mask)));
+#endif
+}
+
+// IRBuilder has no helpers for expanding loads and compressing stores, which
+// read and write the active lanes contiguously starting at `Ptr`.
+static CallInst *createMaskedExpandCompress(IRBuilder<> &Builder, Intrinsic::ID ID,
+                                            Type *VecTy, ArrayRef<Value *> Args,
+                                            unsigned PtrArg, unsigned Alignment) {
+  Module *M = Builder.GetInsertBlock()->getModule();
+  Function *F = Intrinsic::getDeclaration(M, ID, {VecTy});
+  CallInst *CI = Builder.CreateCall(F, Args);
+  CI->addParamAttr(PtrArg, Attribute::getWithAlignment(CI->getContext(), Align(Alignment)));
+  return CI;
+}
+extern "C" LLVMValueRef
+LLVMRustBuildMaskedExpandLoad(LLVMBuilderRef B, LLVMTypeRef Ty, LLVMValueRef Ptr,
+                              unsigned Alignment, LLVMValueRef Mask,
+                              LLVMValueRef PassThru) {
+  Type *VecTy = unwrap(Ty);
+  Value *Fallback = PassThru ? unwrap(PassThru) : UndefValue::get(VecTy);
+  return wrap(createMaskedExpandCompress(*unwrap(B), Intrinsic::masked_expandload, VecTy,
+                                         {unwrap(Ptr), unwrap(Mask), Fallback}, 0, Alignment));
+}
+extern "C" LLVMValueRef
+LLVMRustBuildMaskedCompressStore(LLVMBuilderRef B, LLVMValueRef Val, LLVMValueRef Ptr,
+                                 unsigned Alignment, LLVMValueRef Mask) {
+  Value *V = unwrap(Val);
+  return wrap(createMaskedExpandCompress(*unwrap(B), Intrinsic::masked_compressstore,
+                                         V->getType(), {V, unwrap(Ptr), unwrap(Mask)}, 1,
+                                         Alignment));
+}
+
 extern "C" LLVMValueRef
 LLVMRustBuildMinNum(LLVMBuilderRef B, LLVMValueRef LHS, LLVMValueRef RHS) {
     return wrap(unwrap(B)->CreateMinNum(unwrap(LHS),unwrap(RHS)));
@@ -1723,11 +2586,16 @@ LLVMRustBuildMaxNum(LLVMBuilderRef B, LLVMValueRef LHS, LLVMValueRef RHS) {
     return wrap(unwrap(B)->CreateMaxNum(unwrap(LHS),unwrap(RHS)));
 }
 
-// This struct contains all necessary info about a symbol exported from a DLL.
-// At the moment, it's just the symbol's name, but we use a separate struct to
-// make it easier to add other information like ordinal later.
+// This struct contains all necessary info about a symbol exported from a DLL:
+// its name, its ordinal if it has one, and whether it's data rather than code.
+// Symbols with an ordinal are imported by that ordinal alone, so that the
+// loader doesn't have to look their names up.
 struct LLVMRustCOFFShortExport {
   const char* name;
+  bool ordinal_present;
+  // The value of `ordinal` is only meaningful if `ordinal_present` is true.
+  uint16_t ordinal;
+  bool data;
 };
 
 // Machine must be a COFF machine type, as defined in PE specs.
@@ -1748,9 +2616,9 @@ extern "C" LLVMRustResult LLVMRustWriteImportLibrary(
       std::string{},    // ExtName
       std::string{},    // SymbolName
       std::string{},    // AliasTarget
-      0,                // Ordinal
-      false,            // Noname
-      false,            // Data
+      Exports[i].ordinal_present ? Exports[i].ordinal : (uint16_t) 0, // Ordinal
+      Exports[i].ordinal_present, // Noname
+      Exports[i].data,  // Data
       false,            // Private
       false             // Constant
     });
@@ -1773,3 +2641,133 @@ extern "C" LLVMRustResult LLVMRustWriteImportLibrary(
     return LLVMRustResult::Success;
   }
 }
+
+#if LLVM_VERSION_GE(13, 0) && defined(LLVM_COMPONENT_DWP)
+// Collects the DWO files referenced by the skeleton compile units of an
+// executable, mirroring `llvm-dwp -e`.
+static Expected<std::vector<std::string>>
+getDwoFilenames(const object::ObjectFile &Obj) {
+  std::unique_ptr<DWARFContext> Ctx = DWARFContext::create(Obj);
+  std::vector<std::string> Paths;
+  StringSet<> Seen;
+  for (const auto &CU : Ctx->compile_units()) {
+    const DWARFDie &Die = CU->getUnitDIE();
+    std::string DwoName = dwarf::toString(
+        Die.find({dwarf::DW_AT_dwo_name, dwarf::DW_AT_GNU_dwo_name}), "");
+    if (DwoName.empty())
+      continue;
+    std::string CompDir = dwarf::toString(Die.find(dwarf::DW_AT_comp_dir), "");
+    SmallString<128> Path(DwoName);
+    if (!CompDir.empty())
+      sys::fs::make_absolute(CompDir, Path);
+    // Every codegen unit of an upstream crate may be listed more than once.
+    if (Seen.insert(Path).second)
+      Paths.emplace_back(Path.str());
+  }
+  return std::move(Paths);
+}
+#endif
+
+extern "C" bool LLVMRustHasDwarfPackageWriter() {
+#if LLVM_VERSION_GE(13, 0) && defined(LLVM_COMPONENT_DWP)
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Packages the DWO files referenced by `ExecutablePath` into the DWARF
+// package `OutPath`. String and type unit deduplication is done by LLVM's
+// DWP writer, exactly as in `llvm-dwp`.
+extern "C" LLVMRustResult
+LLVMRustWriteDwarfPackage(const char *ExecutablePath, const char *OutPath) {
+#if LLVM_VERSION_GE(13, 0) && defined(LLVM_COMPONENT_DWP)
+  auto ObjOrErr = object::ObjectFile::createObjectFile(ExecutablePath);
+  if (!ObjOrErr) {
+    LLVMRustSetLastError(toString(ObjOrErr.takeError()).c_str());
+    return LLVMRustResult::Failure;
+  }
+  const object::ObjectFile &Obj = *ObjOrErr->getBinary();
+
+  auto InputsOrErr = getDwoFilenames(Obj);
+  if (!InputsOrErr) {
+    LLVMRustSetLastError(toString(InputsOrErr.takeError()).c_str());
+    return LLVMRustResult::Failure;
+  }
+
+  std::string ErrorStr;
+  Triple TheTriple = Obj.makeTriple();
+  const Target *TheTarget =
+      TargetRegistry::lookupTarget("", TheTriple, ErrorStr);
+  if (!TheTarget) {
+    LLVMRustSetLastError(ErrorStr.c_str());
+    return LLVMRustResult::Failure;
+  }
+  std::string TripleName = TheTriple.getTriple();
+
+  MCTargetOptions MCOptions;
+  std::unique_ptr<MCRegisterInfo> MRI(TheTarget->createMCRegInfo(TripleName));
+  std::unique_ptr<MCAsmInfo> MAI(
+      TheTarget->createMCAsmInfo(*MRI, TripleName, MCOptions));
+  std::unique_ptr<MCSubtargetInfo> MSTI(
+      TheTarget->createMCSubtargetInfo(TripleName, "", ""));
+  std::unique_ptr<MCInstrInfo> MII(TheTarget->createMCInstrInfo());
+  if (!MRI || !MAI || !MSTI || !MII) {
+    LLVMRustSetLastError("no MC support for the executable's target");
+    return LLVMRustResult::Failure;
+  }
+  MCContext MC(TheTriple, MAI.get(), MRI.get(), MSTI.get());
+  std::unique_ptr<MCObjectFileInfo> MOFI(
+      TheTarget->createMCObjectFileInfo(MC, /*PIC=*/false));
+  MC.setObjectFileInfo(MOFI.get());
+
+  MCAsmBackend *MAB = TheTarget->createMCAsmBackend(*MSTI, *MRI, MCOptions);
+#if LLVM_VERSION_GE(15, 0)
+  MCCodeEmitter *MCE = TheTarget->createMCCodeEmitter(*MII, MC);
+#else
+  MCCodeEmitter *MCE = TheTarget->createMCCodeEmitter(*MII, *MRI, MC);
+#endif
+  if (!MAB || !MCE) {
+    LLVMRustSetLastError(
+        "no object emission support for the executable's target");
+    return LLVMRustResult::Failure;
+  }
+
+  std::error_code EC;
+  ToolOutputFile OutFile(OutPath, EC, sys::fs::OF_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  std::unique_ptr<buffer_ostream> BOS;
+  raw_pwrite_stream *OS = &OutFile.os();
+  if (!OutFile.os().supportsSeeking()) {
+    BOS = std::make_unique<buffer_ostream>(OutFile.os());
+    OS = BOS.get();
+  }
+
+  std::unique_ptr<MCStreamer> MS(TheTarget->createMCObjectStreamer(
+      TheTriple, MC, std::unique_ptr<MCAsmBackend>(MAB),
+      MAB->createObjectWriter(*OS), std::unique_ptr<MCCodeEmitter>(MCE),
+      *MSTI, MCOptions.MCRelaxAll, MCOptions.MCIncrementalLinkerCompatible,
+      /*DWARFMustBeAtTheEnd=*/false));
+
+#if LLVM_VERSION_GE(16, 0)
+  Error Err = llvm::write(*MS, *InputsOrErr, OnCuIndexOverflow::HardStop);
+#else
+  Error Err = llvm::write(*MS, *InputsOrErr);
+#endif
+  if (Err) {
+    LLVMRustSetLastError(toString(std::move(Err)).c_str());
+    return LLVMRustResult::Failure;
+  }
+  MS->Finish();
+  BOS.reset();
+  OutFile.keep();
+  return LLVMRustResult::Success;
+#else
+  LLVMRustSetLastError(
+      "DWARF packaging requires LLVM 13 built with the DWP library");
+  return LLVMRustResult::Failure;
+#endif
+}
@@ -56,7 +56,8 @@ fn init() { }
         LLVMInitializeX86Target,
         LLVMInitializeX86TargetMC,
         LLVMInitializeX86AsmPrinter,
-        LLVMInitializeX86AsmParser
+        LLVMInitializeX86AsmParser,
+        LLVMInitializeX86Disassembler
     );
     init_target!(
         llvm_component = "arm",
@@ -64,7 +65,8 @@ fn init() { }
         LLVMInitializeARMTarget,
         LLVMInitializeARMTargetMC,
         LLVMInitializeARMAsmPrinter,
-        LLVMInitializeARMAsmParser
+        LLVMInitializeARMAsmParser,
+        LLVMInitializeARMDisassembler
     );
     init_target!(
         llvm_component = "aarch64",
@@ -72,7 +74,8 @@ fn init() { }
         LLVMInitializeAArch64Target,
         LLVMInitializeAArch64TargetMC,
         LLVMInitializeAArch64AsmPrinter,
-        LLVMInitializeAArch64AsmParser
+        LLVMInitializeAArch64AsmParser,
+        LLVMInitializeAArch64Disassembler
     );
     init_target!(
         llvm_component = "amdgpu",
@@ -80,7 +83,8 @@ fn init() { }
         LLVMInitializeAMDGPUTarget,
         LLVMInitializeAMDGPUTargetMC,
         LLVMInitializeAMDGPUAsmPrinter,
-        LLVMInitializeAMDGPUAsmParser
+        LLVMInitializeAMDGPUAsmParser,
+        LLVMInitializeAMDGPUDisassembler
     );
     init_target!(
         llvm_component = "avr",
@@ -88,7 +92,8 @@ fn init() { }
         LLVMInitializeAVRTarget,
         LLVMInitializeAVRTargetMC,
         LLVMInitializeAVRAsmPrinter,
-        LLVMInitializeAVRAsmParser
+        LLVMInitializeAVRAsmParser,
+        LLVMInitializeAVRDisassembler
     );
     init_target!(
         llvm_component = "mips",
@@ -96,7 +101,8 @@ fn init() { }
         LLVMInitializeMipsTarget,
         LLVMInitializeMipsTargetMC,
         LLVMInitializeMipsAsmPrinter,
-        LLVMInitializeMipsAsmParser
+        LLVMInitializeMipsAsmParser,
+        LLVMInitializeMipsDisassembler
     );
     init_target!(
         llvm_component = "powerpc",
@@ -104,7 +110,8 @@ fn init() { }
         LLVMInitializePowerPCTarget,
         LLVMInitializePowerPCTargetMC,
         LLVMInitializePowerPCAsmPrinter,
-        LLVMInitializePowerPCAsmParser
+        LLVMInitializePowerPCAsmParser,
+        LLVMInitializePowerPCDisassembler
     );
     init_target!(
         llvm_component = "systemz",
@@ -112,7 +119,8 @@ fn init() { }
         LLVMInitializeSystemZTarget,
         LLVMInitializeSystemZTargetMC,
         LLVMInitializeSystemZAsmPrinter,
-        LLVMInitializeSystemZAsmParser
+        LLVMInitializeSystemZAsmParser,
+        LLVMInitializeSystemZDisassembler
     );
     init_target!(
         llvm_component = "jsbackend",
@@ -126,7 +134,8 @@ fn init() { }
         LLVMInitializeMSP430Target,
         LLVMInitializeMSP430TargetMC,
         LLVMInitializeMSP430AsmPrinter,
-        LLVMInitializeMSP430AsmParser
+        LLVMInitializeMSP430AsmParser,
+        LLVMInitializeMSP430Disassembler
     );
     init_target!(
         llvm_component = "riscv",
@@ -134,7 +143,8 @@ fn init() { }
         LLVMInitializeRISCVTarget,
         LLVMInitializeRISCVTargetMC,
         LLVMInitializeRISCVAsmPrinter,
-        LLVMInitializeRISCVAsmParser
+        LLVMInitializeRISCVAsmParser,
+        LLVMInitializeRISCVDisassembler
     );
     init_target!(
         llvm_component = "sparc",
@@ -142,7 +152,8 @@ fn init() { }
         LLVMInitializeSparcTarget,
         LLVMInitializeSparcTargetMC,
         LLVMInitializeSparcAsmPrinter,
-        LLVMInitializeSparcAsmParser
+        LLVMInitializeSparcAsmParser,
+        LLVMInitializeSparcDisassembler
     );
     init_target!(
         llvm_component = "nvptx",
@@ -157,7 +168,8 @@ fn init() { }
         LLVMInitializeHexagonTarget,
         LLVMInitializeHexagonTargetMC,
         LLVMInitializeHexagonAsmPrinter,
-        LLVMInitializeHexagonAsmParser
+        LLVMInitializeHexagonAsmParser,
+        LLVMInitializeHexagonDisassembler
     );
     init_target!(
         llvm_component = "webassembly",
@@ -165,7 +177,8 @@ fn init() { }
         LLVMInitializeWebAssemblyTarget,
         LLVMInitializeWebAssemblyTargetMC,
         LLVMInitializeWebAssemblyAsmPrinter,
-        LLVMInitializeWebAssemblyAsmParser
+        LLVMInitializeWebAssemblyAsmParser,
+        LLVMInitializeWebAssemblyDisassembler
     );
     init_target!(
         llvm_component = "bpf",
@@ -173,6 +186,7 @@ fn init() { }
         LLVMInitializeBPFTarget,
         LLVMInitializeBPFTargetMC,
         LLVMInitializeBPFAsmPrinter,
-        LLVMInitializeBPFAsmParser
+        LLVMInitializeBPFAsmParser,
+        LLVMInitializeBPFDisassembler
     );
 }
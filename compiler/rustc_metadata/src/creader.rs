@@ -779,7 +779,7 @@ fn inject_profiler_runtime(&mut self, krate: &ast::Crate) {
         if !(profiler_runtime.is_some()
             && (self.sess.instrument_coverage()
                 || self.sess.opts.debugging_opts.profile
-                || self.sess.opts.cg.profile_generate.enabled()))
+                || self.sess.instrument_pgo()))
         {
             return;
         }
@@ -2,6 +2,7 @@
 use rustc_data_structures::fx::FxHashSet;
 use rustc_errors::struct_span_err;
 use rustc_hir as hir;
+use rustc_hir::def::DefKind;
 use rustc_hir::itemlikevisit::ItemLikeVisitor;
 use rustc_middle::middle::cstore::{DllCallingConvention, DllImport, NativeLib};
 use rustc_middle::ty::{List, ParamEnv, ParamEnvAnd, Ty, TyCtxt};
@@ -410,7 +411,11 @@ fn i686_arg_list_size(&self, item: &hir::ForeignItemRef<'_>) -> usize {
     }
 
     fn build_dll_import(&self, abi: Abi, item: &hir::ForeignItemRef<'_>) -> DllImport {
-        let calling_convention = if self.tcx.sess.target.arch == "x86" {
+        let is_fn = self.tcx.def_kind(item.id.def_id) == DefKind::Fn;
+        let calling_convention = if !is_fn {
+            // Statics are only ever decorated like C functions.
+            DllCallingConvention::C
+        } else if self.tcx.sess.target.arch == "x86" {
             match abi {
                 Abi::C { .. } | Abi::Cdecl => DllCallingConvention::C,
                 Abi::Stdcall { .. } | Abi::System { .. } => {
@@ -436,6 +441,12 @@ fn build_dll_import(&self, abi: Abi, item: &hir::ForeignItemRef<'_>) -> DllImpor
                 }
             }
         };
-        DllImport { name: item.ident.name, ordinal: None, calling_convention, span: item.span }
+        DllImport {
+            name: item.ident.name,
+            ordinal: self.tcx.codegen_fn_attrs(item.id.def_id).link_ordinal,
+            is_fn,
+            calling_convention,
+            span: item.span,
+        }
     }
 }
@@ -78,7 +78,11 @@ pub struct NativeLib {
 #[derive(Clone, Debug, PartialEq, Eq, Encodable, Decodable, Hash, HashStable)]
 pub struct DllImport {
     pub name: Symbol,
+    /// The `#[link_ordinal]` of the import, if any. Imports with an ordinal are
+    /// bound by it rather than by name.
     pub ordinal: Option<u16>,
+    /// Whether the import is a function rather than a static.
+    pub is_fn: bool,
     /// Calling convention for the function.
     ///
     /// On x86_64, this is always `DllCallingConvention::C`; on i686, it can be any
@@ -188,6 +188,61 @@ pub fn enabled(&self) -> bool {
     }
 }
 
+/// The different settings that the `-Z basic-block-sections` flag can have.
+#[derive(Clone, PartialEq, Hash, Debug)]
+pub enum BasicBlockSections {
+    /// `-Z basic-block-sections=all`: put every basic block in its own section.
+    All,
+    /// `-Z basic-block-sections=labels`: keep the usual layout, but emit a
+    /// basic-block address map (`.llvm_bb_addr_map`) for post-link optimizers.
+    Labels,
+    /// `-Z basic-block-sections=list=<file>`: only split off the clusters of
+    /// blocks named in the given file.
+    List(PathBuf),
+    /// `-Z basic-block-sections=none`
+    None,
+}
+
+impl BasicBlockSections {
+    pub fn enabled(&self) -> bool {
+        *self != BasicBlockSections::None
+    }
+}
+
+/// The different settings that the `-Z debuginfo-compression` flag can have.
+#[derive(Clone, Copy, PartialEq, Hash, Debug)]
+pub enum DebugInfoCompression {
+    /// `-Z debuginfo-compression=none`
+    None,
+    /// `-Z debuginfo-compression=zlib`
+    Zlib,
+}
+
+/// The different settings that the `-Z instruction-selector` flag can have.
+#[derive(Clone, Copy, PartialEq, Hash, Debug)]
+pub enum InstructionSelector {
+    /// `-Z instruction-selector=default`: whatever the target uses at the optimization level.
+    Default,
+    /// `-Z instruction-selector=fast`
+    FastISel,
+    /// `-Z instruction-selector=selection-dag`
+    SelectionDAG,
+    /// `-Z instruction-selector=global`
+    GlobalISel,
+}
+
+/// The different settings that the `-Z machine-outliner` flag can have.
+#[derive(Clone, Copy, PartialEq, Hash, Debug)]
+pub enum MachineOutliner {
+    /// `-Z machine-outliner=never`
+    Never,
+    /// `-Z machine-outliner=default`: outline where the target considers it profitable, which
+    /// for most targets that support it means in functions optimized for size.
+    TargetDefault,
+    /// `-Z machine-outliner=always`
+    Always,
+}
+
 #[derive(Copy, Clone, Debug, PartialEq, Eq, PartialOrd, Ord, Hash)]
 #[derive(Encodable, Decodable)]
 pub enum SymbolManglingVersion {
@@ -2006,10 +2061,42 @@ pub fn build_session_options(matches: &getopts::Matches) -> Options {
         );
     }
 
+    if debugging_opts.cs_profile_generate.enabled() && cg.profile_use.is_none() {
+        early_error(error_format, "option `-Z cs-profile-generate` requires `-C profile-use`");
+    }
+
+    if debugging_opts.pgo_symbol_ordering_file.is_some() && cg.profile_use.is_none() {
+        early_error(error_format, "option `-Z pgo-symbol-ordering-file` requires `-C profile-use`");
+    }
+
+    if debugging_opts.profile_remapping_file.is_some()
+        && cg.profile_use.is_none()
+        && debugging_opts.profile_sample_use.is_none()
+    {
+        early_error(
+            error_format,
+            "option `-Z profile-remapping-file` requires `-C profile-use` or \
+            `-Z profile-sample-use`",
+        );
+    }
+
+    if debugging_opts.profile_sample_use.is_some()
+        && (cg.profile_generate.enabled() || cg.profile_use.is_some())
+    {
+        early_error(
+            error_format,
+            "option `-Z profile-sample-use` cannot be combined with `-C profile-generate` \
+            or `-C profile-use`",
+        );
+    }
+
     if debugging_opts.instrument_coverage.is_some()
         && debugging_opts.instrument_coverage != Some(InstrumentCoverage::Off)
     {
-        if cg.profile_generate.enabled() || cg.profile_use.is_some() {
+        if cg.profile_generate.enabled()
+            || cg.profile_use.is_some()
+            || debugging_opts.profile_sample_use.is_some()
+        {
             early_error(
                 error_format,
                 "option `-Z instrument-coverage` is not compatible with either `-C profile-use` \
@@ -2078,6 +2165,20 @@ pub fn build_session_options(matches: &getopts::Matches) -> Options {
         early_warn(error_format, "-C remark requires \"-C debuginfo=n\" to show source locations");
     }
 
+    if debugging_opts.remark_dir.is_some() && cg.remark.is_empty() {
+        early_warn(error_format, "-Z remark-dir has no effect without -C remark");
+    }
+
+    if !matches!(&debugging_opts.remark_format[..], "yaml" | "bitstream") {
+        early_error(
+            error_format,
+            &format!(
+                "unknown remark format `{}`, expected `yaml` or `bitstream`",
+                debugging_opts.remark_format
+            ),
+        );
+    }
+
     let externs = parse_externs(matches, &debugging_opts, error_format);
     let extern_dep_specs = parse_extern_dep_specs(matches, &debugging_opts, error_format);
 
@@ -2427,9 +2528,10 @@ pub fn needs_analysis(&self) -> bool {
 crate mod dep_tracking {
     use super::LdImpl;
     use super::{
-        CFGuard, CrateType, DebugInfo, ErrorOutputType, InstrumentCoverage, LinkerPluginLto,
-        LtoCli, OptLevel, OutputType, OutputTypes, Passes, SourceFileHashAlgorithm,
-        SwitchWithOptPath, SymbolManglingVersion, TrimmedDefPaths,
+        BasicBlockSections, CFGuard, CrateType, DebugInfo, DebugInfoCompression, ErrorOutputType,
+        InstructionSelector, InstrumentCoverage, LinkerPluginLto, LtoCli, MachineOutliner,
+        OptLevel, OutputType, OutputTypes, Passes, SourceFileHashAlgorithm, SwitchWithOptPath,
+        SymbolManglingVersion, TrimmedDefPaths,
     };
     use crate::lint;
     use crate::options::WasiExecModel;
@@ -2463,6 +2565,12 @@ fn hash(&self, hasher: &mut DefaultHasher, _: ErrorOutputType, _for_crate_hash:
         )+};
     }
 
+    impl DepTrackingHash for f32 {
+        fn hash(&self, hasher: &mut DefaultHasher, _: ErrorOutputType, _for_crate_hash: bool) {
+            Hash::hash(&self.to_bits(), hasher);
+        }
+    }
+
     impl<T: DepTrackingHash> DepTrackingHash for Option<T> {
         fn hash(
             &self,
@@ -2512,6 +2620,10 @@ fn hash(
         LinkerPluginLto,
         SplitDebuginfo,
         SwitchWithOptPath,
+        BasicBlockSections,
+        DebugInfoCompression,
+        InstructionSelector,
+        MachineOutliner,
         SymbolManglingVersion,
         SourceFileHashAlgorithm,
         TrimmedDefPaths,
@@ -364,6 +364,12 @@ mod desc {
         "either a boolean (`yes`, `no`, `on`, `off`, etc), `thin`, `fat`, or omitted";
     pub const parse_linker_plugin_lto: &str =
         "either a boolean (`yes`, `no`, `on`, `off`, etc), or the path to the linker plugin";
+    pub const parse_basic_block_sections: &str =
+        "one of: `all`, `labels`, `list=<file>`, or `none`";
+    pub const parse_debuginfo_compression: &str = "either `none` or `zlib`";
+    pub const parse_instruction_selector: &str =
+        "one of: `default`, `fast`, `selection-dag`, or `global`";
+    pub const parse_machine_outliner: &str = "one of: `never`, `default`, or `always`";
     pub const parse_switch_with_opt_path: &str =
         "an optional path to the profiling data output directory";
     pub const parse_merge_functions: &str = "one of: `disabled`, `trampolines`, or `aliases`";
@@ -779,6 +785,50 @@ mod parse {
         true
     }
 
+    crate fn parse_basic_block_sections(slot: &mut BasicBlockSections, v: Option<&str>) -> bool {
+        *slot = match v {
+            Some("all") => BasicBlockSections::All,
+            Some("labels") => BasicBlockSections::Labels,
+            Some("none") => BasicBlockSections::None,
+            Some(s) => match s.strip_prefix("list=") {
+                Some(path) if !path.is_empty() => BasicBlockSections::List(PathBuf::from(path)),
+                _ => return false,
+            },
+            None => return false,
+        };
+        true
+    }
+
+    crate fn parse_debuginfo_compression(slot: &mut DebugInfoCompression, v: Option<&str>) -> bool {
+        *slot = match v {
+            Some("none") => DebugInfoCompression::None,
+            Some("zlib") => DebugInfoCompression::Zlib,
+            _ => return false,
+        };
+        true
+    }
+
+    crate fn parse_instruction_selector(slot: &mut InstructionSelector, v: Option<&str>) -> bool {
+        *slot = match v {
+            Some("default") => InstructionSelector::Default,
+            Some("fast") => InstructionSelector::FastISel,
+            Some("selection-dag") => InstructionSelector::SelectionDAG,
+            Some("global") => InstructionSelector::GlobalISel,
+            _ => return false,
+        };
+        true
+    }
+
+    crate fn parse_machine_outliner(slot: &mut MachineOutliner, v: Option<&str>) -> bool {
+        *slot = match v {
+            Some("never") => MachineOutliner::Never,
+            Some("default") => MachineOutliner::TargetDefault,
+            Some("always") => MachineOutliner::Always,
+            _ => return false,
+        };
+        true
+    }
+
     crate fn parse_switch_with_opt_path(slot: &mut SwitchWithOptPath, v: Option<&str>) -> bool {
         *slot = match v {
             None => SwitchWithOptPath::Enabled(None),
@@ -1004,14 +1054,25 @@ mod parse {
         "only allow the listed language features to be enabled in code (space separated)"),
     always_encode_mir: bool = (false, parse_bool, [TRACKED],
         "encode MIR of all functions into the crate metadata (default: no)"),
+    archive_update_in_place: bool = (false, parse_bool, [UNTRACKED],
+        "when rewriting an existing archive, only write the parts of the file that changed \
+        instead of replacing it; not crash-safe (default: no)"),
     assume_incomplete_release: bool = (false, parse_bool, [TRACKED],
         "make cfg(version) treat the current version as incomplete (default: no)"),
     asm_comments: bool = (false, parse_bool, [TRACKED],
         "generate comments into the assembly (may change behavior) (default: no)"),
+    asm_from_object: bool = (false, parse_bool, [TRACKED],
+        "when emitting both assembly and object code, run codegen only once and write the \
+        assembly as a disassembly listing of the object (default: no)"),
     ast_json: bool = (false, parse_bool, [UNTRACKED],
         "print the AST as JSON and halt (default: no)"),
     ast_json_noexpand: bool = (false, parse_bool, [UNTRACKED],
         "print the pre-expansion AST as JSON and halt (default: no)"),
+    basic_block_sections: BasicBlockSections = (BasicBlockSections::None,
+        parse_basic_block_sections, [TRACKED],
+        "place basic blocks in sections of their own for post-link layout optimization: \
+        `all`, `labels` (only emit a basic-block address map), `list=<file>` (only the \
+        clusters listed in the file), or `none` (default: none)"),
     binary_dep_depinfo: bool = (false, parse_bool, [TRACKED],
         "include artifacts (sysroot, crate dependencies) used during compilation in dep-info \
         (default: no)"),
@@ -1025,10 +1086,27 @@ mod parse {
         "the backend to use"),
     combine_cgu: bool = (false, parse_bool, [TRACKED],
         "combine CGUs into a single one"),
+    coverage_atomic_counters: bool = (false, parse_bool, [TRACKED],
+        "update the counters of `-Z instrument-coverage` atomically, so that counts stay exact \
+        when several threads run the same code (default: no)"),
+    coverage_promote_counters: bool = (false, parse_bool, [TRACKED],
+        "keep the counters of `-Z instrument-coverage` in registers inside loops and only \
+        write them back to memory when the loop exits (default: no)"),
     crate_attr: Vec<String> = (Vec::new(), parse_string_push, [TRACKED],
         "inject the given attribute in the crate"),
+    cs_profile_generate: SwitchWithOptPath = (SwitchWithOptPath::Disabled,
+        parse_switch_with_opt_path, [TRACKED],
+        "compile the program with context-sensitive profiling instrumentation, on top of the \
+        optimizations done with the profile given to `-C profile-use`"),
     debug_macros: bool = (false, parse_bool, [TRACKED],
         "emit line numbers debug info inside macros (default: no)"),
+    debug_types_section: bool = (false, parse_bool, [TRACKED],
+        "emit the debuginfo of each named composite type into a type unit of its own, which the \
+        linker keeps only once however many codegen units and crates emit it; ELF only \
+        (default: no)"),
+    debuginfo_compression: DebugInfoCompression = (DebugInfoCompression::None,
+        parse_debuginfo_compression, [TRACKED],
+        "compress the debug info sections of emitted objects: `none` or `zlib` (default: none)"),
     deduplicate_diagnostics: bool = (true, parse_bool, [UNTRACKED],
         "deduplicate identical diagnostics (default: yes)"),
     dep_info_omit_d_target: bool = (false, parse_bool, [TRACKED],
@@ -1037,6 +1115,10 @@ mod parse {
     dep_tasks: bool = (false, parse_bool, [UNTRACKED],
         "print tasks that execute and the color their dep node gets (requires debug build) \
         (default: no)"),
+    direct_access_external_data: Option<bool> = (None, parse_opt_bool, [TRACKED],
+        "access extern statics defined outside the crate directly from executables, relying on \
+        copy relocations if they end up in a shared library, or always through the GOT \
+        (default: directly only with the static relocation model)"),
     dont_buffer_diagnostics: bool = (false, parse_bool, [UNTRACKED],
         "emit diagnostics rather than buffering (breaks NLL error downgrading, sorting) \
         (default: no)"),
@@ -1069,10 +1151,19 @@ mod parse {
         computed `block` spans (one span encompassing a block's terminator and \
         all statements). If `-Z instrument-coverage` is also enabled, create \
         an additional `.html` file showing the computed coverage spans."),
+    embed_bitcode_incbin: bool = (false, parse_bool, [TRACKED],
+        "with `-C embed-bitcode`, have the assembler copy the bitcode into the object from a \
+        temporary file instead of adding it to the module as a constant (default: no)"),
     emit_future_incompat_report: bool = (false, parse_bool, [UNTRACKED],
         "emits a future-incompatibility report for lints (RFC 2834)"),
     emit_stack_sizes: bool = (false, parse_bool, [UNTRACKED],
         "emit a section containing stack size metadata (default: no)"),
+    fat_lto_dead_strip: bool = (false, parse_bool, [TRACKED],
+        "before linking the fat LTO module, use the summaries of upstream crates to leave out \
+        globals that are unreachable from the exported symbols (default: no)"),
+    fat_lto_partitions: usize = (1, parse_number, [TRACKED],
+        "split the module produced by fat LTO into this many partitions after optimization, \
+        and generate code for them in parallel (default: 1)"),
     fewer_names: Option<bool> = (None, parse_opt_bool, [TRACKED],
         "reduce memory use by retaining fewer names within compilation artifacts (LLVM-IR) \
         (default: no)"),
@@ -1113,6 +1204,12 @@ mod parse {
         "control whether `#[inline]` functions are in all CGUs"),
     input_stats: bool = (false, parse_bool, [UNTRACKED],
         "gather statistics about the input (default: no)"),
+    instruction_selector: InstructionSelector = (InstructionSelector::Default,
+        parse_instruction_selector, [TRACKED],
+        "select machine instructions with `fast` (FastISel, falling back to SelectionDAG for \
+        what it can't handle), `selection-dag` or `global` (GlobalISel, falling back to \
+        SelectionDAG for functions it can't handle), or what the target uses at the \
+        optimization level (default: default)"),
     instrument_coverage: Option<InstrumentCoverage> = (None, parse_instrument_coverage, [TRACKED],
         "instrument the generated code to support LLVM source-based code coverage \
         reports (note, the compiler build config must include `profiler = true`); \
@@ -1123,18 +1220,60 @@ mod parse {
         `=off` (default)"),
     instrument_mcount: bool = (false, parse_bool, [TRACKED],
         "insert function instrument code for mcount-based tracing (default: no)"),
+    isel_abort_on_fallback: bool = (false, parse_bool, [TRACKED],
+        "abort when the instruction selector has to fall back to SelectionDAG (default: no)"),
+    isel_stats: bool = (false, parse_bool, [UNTRACKED],
+        "write how often instruction selection fell back to SelectionDAG while emitting each \
+        module, to `<crate>.<module>.isel-stats.json` next to the other temporary outputs \
+        (default: no)"),
     keep_hygiene_data: bool = (false, parse_bool, [UNTRACKED],
         "keep hygiene data after analysis (default: no)"),
     link_native_libraries: bool = (true, parse_bool, [UNTRACKED],
         "link native libraries in the linker invocation (default: yes)"),
     link_only: bool = (false, parse_bool, [TRACKED],
         "link the `.rlink` file generated by `-Z no-link` (default: no)"),
+    llvm_function_time_budget: Option<u64> = (None, parse_opt_number, [TRACKED],
+        "stop running expensive optional LLVM passes (unrolling, vectorization, GVN) on a function \
+        once it has spent this many milliseconds in the new pass manager, and never run them on \
+        cold functions; makes the output depend on timing (default: no limit)"),
+    llvm_lazy_thin_lto_parsing: bool = (false, parse_bool, [TRACKED],
+        "only read the function bodies of a ThinLTO module that are still needed after dead \
+        symbols have been dropped and weak symbols resolved, instead of all of them up front \
+        (default: no)"),
+    llvm_module_time_budget: Option<u64> = (None, parse_opt_number, [TRACKED],
+        "stop running expensive optional LLVM passes once a module has spent this many \
+        milliseconds in the new pass manager, and never run them on cold functions; makes the \
+        output depend on timing (default: no limit)"),
+    llvm_parallel_function_simplification: Option<usize> = (None, parse_opt_number, [TRACKED],
+        "simplify the functions of codegen units with at least this many LLVM instructions \
+        on several threads before running the regular optimization pipeline (default: never)"),
     llvm_plugins: Vec<String> = (Vec::new(), parse_list, [TRACKED],
         "a list LLVM plugins to enable (space separated)"),
+    llvm_release_function_bodies: bool = (false, parse_bool, [UNTRACKED],
+        "free the LLVM IR of each function as soon as its machine code has been emitted, \
+        lowering peak memory usage during codegen; ELF targets only (default: no)"),
+    llvm_reuse_codegen_pipelines: bool = (false, parse_bool, [UNTRACKED],
+        "build the backend's code generation pipeline once and reuse it for every module \
+        emitted with the same settings (default: no)"),
+    llvm_reuse_contexts: bool = (false, parse_bool, [TRACKED],
+        "give each new module a context that an earlier module of this session is done with, \
+        instead of creating one for every module (default: no)"),
+    llvm_reuse_pass_pipelines: bool = (false, parse_bool, [UNTRACKED],
+        "build each distinct new pass manager pipeline once and reuse it for every module \
+        optimized with the same settings (default: no)"),
     llvm_time_trace: bool = (false, parse_bool, [UNTRACKED],
         "generate JSON tracing data file from LLVM data (default: no)"),
     ls: bool = (false, parse_bool, [UNTRACKED],
         "list the symbols defined by a library crate (default: no)"),
+    lto_remove_unwind: bool = (false, parse_bool, [TRACKED],
+        "when all of an LTO module is `panic=abort`, also turn invokes into plain calls, delete \
+        the landing pads that become unreachable and, unless the target needs unwind tables, \
+        drop the `uwtable` attribute from every function (default: no)"),
+    machine_outliner: MachineOutliner = (MachineOutliner::Never, parse_machine_outliner, [TRACKED],
+        "move repeated instruction sequences into functions of their own after instruction \
+        selection: `never`, `default` to outline where the target deems it profitable \
+        (typically functions optimized for size), or `always` to outline from every function \
+        (default: never)"),
     macro_backtrace: bool = (false, parse_bool, [UNTRACKED],
         "show macro backtraces (default: no)"),
     merge_functions: Option<MergeFunctions> = (None, parse_merge_functions, [TRACKED],
@@ -1179,6 +1318,9 @@ mod parse {
         "parse only; do not compile, assemble, or link (default: no)"),
     perf_stats: bool = (false, parse_bool, [UNTRACKED],
         "print some performance-related statistics (default: no)"),
+    pgo_symbol_ordering_file: Option<PathBuf> = (None, parse_opt_pathbuf, [UNTRACKED],
+        "write the functions `-C profile-use` has counts for to this file, hottest first, \
+        for use with `-Z symbol-ordering-file`"),
     plt: Option<bool> = (None, parse_opt_bool, [TRACKED],
         "whether to use the PLT when calling into shared libraries;
         only has effect for PIC code on systems with ELF binaries
@@ -1214,6 +1356,13 @@ mod parse {
     profile_emit: Option<PathBuf> = (None, parse_opt_pathbuf, [TRACKED],
         "file path to emit profiling data at runtime when using 'profile' \
         (default based on relative source path)"),
+    profile_remapping_file: Option<PathBuf> = (None, parse_opt_pathbuf, [TRACKED],
+        "use the given file of symbol remapping rules to match the functions in the profile \
+        given to `-C profile-use` or `-Z profile-sample-use` to those being compiled, e.g. \
+        after their symbol hashes changed (new pass manager only)"),
+    profile_sample_use: Option<PathBuf> = (None, parse_opt_pathbuf, [TRACKED],
+        "use the given sample profile (e.g. collected with `perf` and converted for AutoFDO) \
+        for profile-guided optimization"),
     profiler_runtime: Option<String> = (Some(String::from("profiler_builtins")), parse_opt_string, [TRACKED],
         "name of the profiler runtime crate to automatically inject, or None to disable"),
     query_dep_graph: bool = (false, parse_bool, [UNTRACKED],
@@ -1224,6 +1373,15 @@ mod parse {
         "whether ELF relocations can be relaxed"),
     relro_level: Option<RelroLevel> = (None, parse_relro_level, [TRACKED],
         "choose which RELRO level to use"),
+    remark_dir: Option<PathBuf> = (None, parse_opt_pathbuf, [UNTRACKED],
+        "directory into which to write the optimization remarks selected by `-C remark` \
+        instead of printing them"),
+    remark_format: String = ("yaml".to_string(), parse_string, [UNTRACKED],
+        "serialization format of the files written to `-Z remark-dir`: `yaml` or \
+        `bitstream` (default: `yaml`)"),
+    remark_hotness_threshold: Option<u64> = (None, parse_opt_number, [UNTRACKED],
+        "only write remarks whose profile count is at least this value to `-Z remark-dir` \
+        (requires profile data)"),
     simulate_remapped_rust_src_base: Option<PathBuf> = (None, parse_opt_pathbuf, [TRACKED],
         "simulate the effect of remap-debuginfo = true at bootstrapping by remapping path \
         to rust's source base directory. only meant for testing purposes"),
@@ -1250,6 +1408,12 @@ mod parse {
         for example: `-Z self-profile-events=default,query-keys`
         all options: none, all, default, generic-activity, query-provider, query-cache-hit
                      query-blocked, incr-cache-load, query-keys, function-args, args, llvm"),
+    self_profile_llvm_min_duration: Option<u64> = (None, parse_opt_number, [UNTRACKED],
+        "when recording `llvm` events, only record LLVM passes on functions and loops that \
+        take at least this many microseconds, and add up the rest per pass"),
+    self_profile_llvm_sample_every: Option<u32> = (None, parse_opt_number, [UNTRACKED],
+        "when recording `llvm` events, only record every Nth LLVM pass executed on a function \
+        or loop, and add up the rest per pass"),
     share_generics: Option<bool> = (None, parse_opt_bool, [TRACKED],
         "make the current crate share its generic instantiations"),
     show_span: Option<String> = (None, parse_opt_string, [TRACKED],
@@ -1261,22 +1425,61 @@ mod parse {
         "exclude spans when debug-printing compiler state (default: no)"),
     src_hash_algorithm: Option<SourceFileHashAlgorithm> = (None, parse_src_file_hash, [TRACKED],
         "hash algorithm of source files in debug info (`md5`, `sha1`, or `sha256`)"),
+    stack_size_report: bool = (false, parse_bool, [UNTRACKED],
+        "write the stack frame size of every function, and whether it has dynamically sized \
+        allocas, to a JSON file per codegen unit (default: no)"),
     strip: Strip = (Strip::None, parse_strip, [UNTRACKED],
         "tell the linker which information to strip (`none` (default), `debuginfo` or `symbols`)"),
     split_dwarf_inlining: bool = (true, parse_bool, [UNTRACKED],
         "provide minimal debug info in the object/executable to facilitate online \
          symbolication/stack traces in the absence of .dwo/.dwp files when using Split DWARF"),
+    split_machine_functions: bool = (false, parse_bool, [TRACKED],
+        "move the blocks that the profile given to `-C profile-use` or `-Z profile-sample-use` \
+        marks as cold out of their functions into separate sections (ELF only) (default: no)"),
     symbol_mangling_version: Option<SymbolManglingVersion> = (None,
         parse_symbol_mangling_version, [TRACKED],
         "which mangling version to use for symbol names ('legacy' (default) or 'v0')"),
+    symbol_ordering_file: Option<PathBuf> = (None, parse_opt_pathbuf, [UNTRACKED],
+        "have the linker lay out functions in the order given by this file, one symbol per \
+        line (lld, ld64 and link.exe only)"),
     teach: bool = (false, parse_bool, [TRACKED],
         "show extended diagnostic help (default: no)"),
     terminal_width: Option<usize> = (None, parse_opt_number, [UNTRACKED],
         "set the current terminal width"),
     tune_cpu: Option<String> = (None, parse_opt_string, [TRACKED],
         "select processor to schedule for (`rustc --print target-cpus` for details)"),
+    thin_archives: bool = (false, parse_bool, [TRACKED],
+        "write rlibs as thin archives that refer to their object and metadata files instead \
+        of containing them; the files are kept next to the output (default: no)"),
     thinlto: Option<bool> = (None, parse_opt_bool, [TRACKED],
         "enable ThinLTO when possible"),
+    thinlto_compress_buffers: bool = (false, parse_bool, [UNTRACKED],
+        "keep the serialized bitcode of codegen units compressed in memory while they wait \
+        for ThinLTO (default: no)"),
+    thinlto_import_cold_multiplier: Option<f32> = (None, parse_opt_number, [TRACKED],
+        "multiplier applied to the ThinLTO import instruction limit for cold call sites \
+        (default: LLVM's `-import-cold-multiplier`)"),
+    thinlto_import_hot_multiplier: Option<f32> = (None, parse_opt_number, [TRACKED],
+        "multiplier applied to the ThinLTO import instruction limit for hot call sites \
+        (default: LLVM's `-import-hot-multiplier`)"),
+    thinlto_import_instr_limit: Option<u32> = (None, parse_opt_number, [TRACKED],
+        "maximum size in instructions of a function imported by ThinLTO \
+        (default: LLVM's `-import-instr-limit`)"),
+    thinlto_import_max_module_functions: Option<usize> = (None, parse_opt_number, [TRACKED],
+        "maximum number of functions ThinLTO imports into a single module (default: no limit)"),
+    thinlto_import_max_module_instrs: Option<usize> = (None, parse_opt_number, [TRACKED],
+        "maximum number of instructions ThinLTO imports into a single module \
+        (default: no limit)"),
+    thinlto_import_native_bitcode: bool = (false, parse_bool, [TRACKED],
+        "let ThinLTO import from the ThinLTO bitcode of native objects bundled into the rlibs \
+        being linked, e.g. C built with `clang -flto=thin` (default: no)"),
+    thinlto_propagate_global_attrs: bool = (false, parse_bool, [TRACKED],
+        "let the ThinLTO index mark statics with internal linkage read-only or write-only, so \
+        that the modules importing them can fold their loads or drop their stores \
+        (default: no)"),
+    thinlto_write_index_shards: bool = (false, parse_bool, [UNTRACKED],
+        "write a ThinLTO index shard (`.thinlto.bc`) and imports list (`.imports`) for each \
+        module, for use by distributed ThinLTO backends (default: no)"),
     thir_unsafeck: bool = (false, parse_bool, [TRACKED],
         "use the work-in-progress THIR unsafety checker. NOTE: this is unsound (default: no)"),
     /// We default to 1 here since we want to behave like
@@ -1289,6 +1492,10 @@ mod parse {
         "measure time of rustc processes (default: no)"),
     time_llvm_passes: bool = (false, parse_bool, [UNTRACKED],
         "measure time of each LLVM pass (default: no)"),
+    time_llvm_passes_json: bool = (false, parse_bool, [UNTRACKED],
+        "write the time spent in each LLVM pass and the instructions it added or removed to \
+        a JSON file per module and optimization stage, with the new pass manager only \
+        (default: no)"),
     time_passes: bool = (false, parse_bool, [UNTRACKED],
         "measure time of each rustc pass (default: no)"),
     tls_model: Option<TlsModel> = (None, parse_tls_model, [TRACKED],
@@ -1331,6 +1538,10 @@ mod parse {
         "verify LLVM IR (default: no)"),
     wasi_exec_model: Option<WasiExecModel> = (None, parse_wasi_exec_model, [TRACKED],
         "whether to build a wasi command or reactor"),
+    whole_program_visibility: bool = (false, parse_bool, [TRACKED],
+        "let LTO assume that no code outside of the crate graph being linked derives from its \
+        vtables, enabling whole-program devirtualization; only applies to executables \
+        (default: no)"),
 
     // This list is in alphabetical order.
     //
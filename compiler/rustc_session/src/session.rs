@@ -1,7 +1,9 @@
 use crate::cgu_reuse_tracker::CguReuseTracker;
 use crate::code_stats::CodeStats;
 pub use crate::code_stats::{DataTypeKind, FieldInfo, SizeKind, VariantInfo};
-use crate::config::{self, CrateType, OutputType, PrintRequest, SwitchWithOptPath};
+use crate::config::{
+    self, CrateType, DebugInfoCompression, OutputType, PrintRequest, SwitchWithOptPath,
+};
 use crate::filesearch;
 use crate::lint::{self, LintId};
 use crate::parse::ParseSess;
@@ -1066,6 +1068,13 @@ pub fn instrument_coverage(&self) -> bool {
             != config::InstrumentCoverage::Off
     }
 
+    /// Whether the program is instrumented for profile-guided optimization,
+    /// either with `-C profile-generate` or `-Z cs-profile-generate`.
+    pub fn instrument_pgo(&self) -> bool {
+        self.opts.cg.profile_generate.enabled()
+            || self.opts.debugging_opts.cs_profile_generate.enabled()
+    }
+
     pub fn instrument_coverage_except_unused_generics(&self) -> bool {
         self.opts.debugging_opts.instrument_coverage.unwrap_or(config::InstrumentCoverage::Off)
             == config::InstrumentCoverage::ExceptUnusedGenerics
@@ -1430,6 +1439,89 @@ fn validate_commandline_args_with_session_available(sess: &Session) {
         }
     }
 
+    if let Some(ref path) = sess.opts.debugging_opts.profile_sample_use {
+        if !path.exists() {
+            sess.err(&format!(
+                "File `{}` passed to `-Z profile-sample-use` does not exist.",
+                path.display()
+            ));
+        }
+    }
+
+    if let Some(ref path) = sess.opts.debugging_opts.profile_remapping_file {
+        if !path.exists() {
+            sess.err(&format!(
+                "File `{}` passed to `-Z profile-remapping-file` does not exist.",
+                path.display()
+            ));
+        }
+        if !sess.opts.debugging_opts.new_llvm_pass_manager.unwrap_or(false) {
+            sess.warn(
+                "`-Z profile-remapping-file` is ignored unless `-Z new-llvm-pass-manager` is \
+                enabled, which LLVM's legacy pass manager has no way of taking",
+            );
+        }
+    }
+
+    if sess.opts.debugging_opts.time_llvm_passes_json
+        && !sess.opts.debugging_opts.new_llvm_pass_manager.unwrap_or(false)
+    {
+        sess.warn(
+            "`-Z time-llvm-passes-json` is ignored unless `-Z new-llvm-pass-manager` is \
+            enabled, use `-Z time-llvm-passes` with the legacy pass manager",
+        );
+    }
+
+    if sess.opts.debugging_opts.split_machine_functions {
+        if sess.opts.cg.profile_use.is_none()
+            && sess.opts.debugging_opts.profile_sample_use.is_none()
+        {
+            sess.warn(
+                "`-Z split-machine-functions` has no effect without `-C profile-use` or \
+                `-Z profile-sample-use`",
+            );
+        } else if sess.target.is_like_osx || sess.target.is_like_windows || sess.target.is_like_wasm
+        {
+            sess.warn("`-Z split-machine-functions` only has an effect on ELF targets");
+        }
+    }
+
+    // LLVM only knows how to emit basic-block sections and their address map
+    // for ELF.
+    if sess.opts.debugging_opts.basic_block_sections.enabled()
+        && (sess.target.is_like_osx || sess.target.is_like_windows || sess.target.is_like_wasm)
+    {
+        sess.err("`-Z basic-block-sections` is only supported on ELF targets");
+    }
+
+    // Thin archives are understood by the GNU tools and LLD, but not by the Apple and Microsoft
+    // linkers.
+    if sess.opts.debugging_opts.thin_archives
+        && (sess.target.is_like_osx || sess.target.is_like_windows || sess.target.is_like_wasm)
+    {
+        sess.err("`-Z thin-archives` is only supported on ELF targets");
+    }
+
+    // Only ELF has compressed debug sections that linkers and debuggers
+    // understand.
+    if sess.opts.debugging_opts.debuginfo_compression != DebugInfoCompression::None
+        && (sess.target.is_like_osx || sess.target.is_like_windows || sess.target.is_like_wasm)
+    {
+        sess.err("`-Z debuginfo-compression` is only supported on ELF targets");
+    }
+
+    // Type units are deduplicated through COMDAT sections, which LLVM only
+    // emits them into for ELF.
+    if sess.opts.debugging_opts.debug_types_section
+        && (sess.target.is_like_osx || sess.target.is_like_windows || sess.target.is_like_wasm)
+    {
+        sess.err("`-Z debug-types-section` is only supported on ELF targets");
+    }
+
+    if sess.opts.debugging_opts.fat_lto_partitions == 0 {
+        sess.err("value for `-Z fat-lto-partitions` must be a positive non-zero integer");
+    }
+
     // Unwind tables cannot be disabled if the target requires them.
     if let Some(include_uwtables) = sess.opts.cg.force_unwind_tables {
         if sess.target.requires_uwtable && !include_uwtables {
@@ -1446,7 +1538,7 @@ fn validate_commandline_args_with_session_available(sess: &Session) {
     // does not crash and will probably generate a corrupted binary.
     // We should only display this error if we're actually going to run PGO.
     // If we're just supposed to print out some data, don't show the error (#61002).
-    if sess.opts.cg.profile_generate.enabled()
+    if sess.instrument_pgo()
         && sess.target.is_like_msvc
         && sess.panic_strategy() == PanicStrategy::Unwind
         && sess.opts.prints.iter().all(|&p| p == PrintRequest::NativeStaticLibs)
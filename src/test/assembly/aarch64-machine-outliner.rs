@@ -0,0 +1,46 @@
+// Checks that `-Z machine-outliner=always` makes LLVM outline the instruction
+// sequence shared by the functions below, and that the outliner stays off by
+// default.
+//
+// revisions: always never
+// assembly-output: emit-asm
+// compile-flags: --target aarch64-unknown-linux-gnu -C opt-level=2
+// [always] compile-flags: -Z machine-outliner=always
+// needs-llvm-components: aarch64
+
+#![feature(no_core, lang_items)]
+#![no_core]
+#![crate_type = "rlib"]
+
+#[lang = "sized"]
+trait Sized {}
+
+#[lang = "copy"]
+trait Copy {}
+
+impl Copy for u64 {}
+
+extern "C" {
+    fn sink(a: u64, b: u64, c: u64, d: u64, e: u64, f: u64) -> u64;
+}
+
+// always: OUTLINED_FUNCTION_
+// never-NOT: OUTLINED_FUNCTION_
+
+#[no_mangle]
+pub unsafe fn first(x: u64) -> u64 {
+    sink(x, 11, 22, 33, 44, 55);
+    sink(x, 66, 77, 88, 99, 111)
+}
+
+#[no_mangle]
+pub unsafe fn second(x: u64) -> u64 {
+    sink(x, 11, 22, 33, 44, 55);
+    sink(x, 66, 77, 88, 99, 111)
+}
+
+#[no_mangle]
+pub unsafe fn third(x: u64) -> u64 {
+    sink(x, 11, 22, 33, 44, 55);
+    sink(x, 66, 77, 88, 99, 111)
+}
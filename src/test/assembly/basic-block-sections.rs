@@ -0,0 +1,28 @@
+// Checks that `-Z basic-block-sections=all` gives each basic block a section
+// of its own, and that `-Z basic-block-sections=labels` keeps the blocks
+// together and only emits the basic-block address map.
+//
+// min-llvm-version: 12.0.0
+// only-x86_64
+// only-linux
+// revisions: all labels
+// assembly-output: emit-asm
+// compile-flags: -C opt-level=2
+// [all] compile-flags: -Z basic-block-sections=all
+// [labels] compile-flags: -Z basic-block-sections=labels
+
+#![crate_type = "lib"]
+
+extern "C" {
+    fn left(x: u32) -> u32;
+    fn right(x: u32) -> u32;
+}
+
+// CHECK-LABEL: branchy:
+#[no_mangle]
+pub unsafe fn branchy(x: u32, y: u32) -> u32 {
+    // all: .section .text.branchy,"ax",@progbits,unique,
+    // labels-NOT: unique,
+    // labels: .section {{\.(llvm_)?}}bb_addr_map
+    if x > y { left(x) + 1 } else { right(y) * 3 }
+}
@@ -0,0 +1,139 @@
+// Checks how the structs used by `rust_test_helpers.c` cross the FFI boundary
+// on x86_64 SysV, and that passing values that fit into registers doesn't go
+// through memory once optimized.
+//
+// only-x86_64
+// ignore-windows
+// compile-flags: -O
+
+#![crate_type = "lib"]
+#![allow(improper_ctypes)]
+
+#[repr(C)]
+pub struct TwoU64s {
+    one: u64,
+    two: u64,
+}
+
+#[repr(C)]
+pub struct TwoDoubles {
+    one: f64,
+    two: f64,
+}
+
+#[repr(C)]
+pub struct CharCharDouble {
+    a: u8,
+    b: u8,
+    c: f64,
+}
+
+#[repr(C)]
+pub struct Quad {
+    a: u64,
+    b: u64,
+    c: u64,
+    d: u64,
+}
+
+#[repr(C)]
+pub struct Floats {
+    a: f64,
+    b: u8,
+    c: f64,
+}
+
+#[repr(C, u8)]
+pub enum U8TaggedEnumOptionU64 {
+    None,
+    Some(u64),
+}
+
+extern "C" {
+    fn rust_dbg_extern_identity_TwoU64s(v: TwoU64s) -> TwoU64s;
+    fn rust_dbg_extern_identity_TwoDoubles(v: TwoDoubles) -> TwoDoubles;
+    fn rust_dbg_abi_1(q: Quad) -> Quad;
+    fn rust_dbg_abi_2(f: Floats) -> Floats;
+    fn rust_dbg_abi_3(a: CharCharDouble) -> CharCharDouble;
+    fn rust_dbg_new_some_u64(some: u64) -> U8TaggedEnumOptionU64;
+    fn rust_interesting_average(_: u64, ...) -> f64;
+    fn identity(a: u128) -> u128;
+    fn sub(a: i128, b: i128) -> i128;
+}
+
+// CHECK-LABEL: @pass_two_u64s
+// CHECK-NOT: alloca
+// CHECK-NOT: memcpy
+// CHECK: call { i64, i64 } @rust_dbg_extern_identity_TwoU64s({ i64, i64 }
+// CHECK-NOT: memcpy
+// CHECK: ret
+#[no_mangle]
+pub fn pass_two_u64s(v: TwoU64s) -> TwoU64s {
+    unsafe { rust_dbg_extern_identity_TwoU64s(v) }
+}
+
+// CHECK-LABEL: @pass_two_doubles
+// CHECK-NOT: alloca
+// CHECK-NOT: memcpy
+// CHECK: call { double, double } @rust_dbg_extern_identity_TwoDoubles({ double, double }
+// CHECK-NOT: memcpy
+// CHECK: ret
+#[no_mangle]
+pub fn pass_two_doubles(v: TwoDoubles) -> TwoDoubles {
+    unsafe { rust_dbg_extern_identity_TwoDoubles(v) }
+}
+
+// CHECK-LABEL: @pass_char_char_double
+// CHECK: call { i64, double } @rust_dbg_abi_3({ i64, double }
+#[no_mangle]
+pub fn pass_char_char_double(a: CharCharDouble) -> CharCharDouble {
+    unsafe { rust_dbg_abi_3(a) }
+}
+
+// Structs larger than 16 bytes are passed and returned in memory.
+
+// CHECK-LABEL: @pass_quad
+// CHECK: call void @rust_dbg_abi_1({{.*}}sret{{.*}}byval
+#[no_mangle]
+pub fn pass_quad(q: Quad) -> Quad {
+    unsafe { rust_dbg_abi_1(q) }
+}
+
+// CHECK-LABEL: @pass_floats
+// CHECK: call void @rust_dbg_abi_2({{.*}}sret{{.*}}byval
+#[no_mangle]
+pub fn pass_floats(f: Floats) -> Floats {
+    unsafe { rust_dbg_abi_2(f) }
+}
+
+// CHECK-LABEL: @new_some_u64
+// CHECK: call { i64, i64 } @rust_dbg_new_some_u64(i64
+#[no_mangle]
+pub fn new_some_u64(some: u64) -> U8TaggedEnumOptionU64 {
+    unsafe { rust_dbg_new_some_u64(some) }
+}
+
+// CHECK-LABEL: @interesting_average
+// CHECK: call double (i64, ...) @rust_interesting_average(i64 2, i64 {{.*}}, double
+#[no_mangle]
+pub fn interesting_average(x: i64, y: f64) -> f64 {
+    unsafe { rust_interesting_average(2, x, y, x, y) }
+}
+
+// CHECK-LABEL: @pass_u128
+// CHECK-NOT: alloca
+// CHECK: call i128 @identity(i128
+// CHECK: ret i128
+#[no_mangle]
+pub fn pass_u128(a: u128) -> u128 {
+    unsafe { identity(a) }
+}
+
+// CHECK-LABEL: @pass_i128_pair
+// CHECK-NOT: alloca
+// CHECK: call i128 @sub(i128 {{.*}}, i128
+// CHECK: ret i128
+#[no_mangle]
+pub fn pass_i128_pair(a: i128, b: i128) -> i128 {
+    unsafe { sub(a, b) }
+}
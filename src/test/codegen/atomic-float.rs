@@ -0,0 +1,40 @@
+// Floating-point atomic add and sub are lowered to `atomicrmw` instead of a
+// compare-exchange loop.
+//
+// compile-flags: -O
+#![crate_type = "lib"]
+#![feature(core_intrinsics)]
+
+use std::intrinsics::{atomic_xadd, atomic_xadd_relaxed, atomic_xsub, atomic_xsub_acq};
+
+// CHECK-LABEL: @fadd_f32
+#[no_mangle]
+pub unsafe fn fadd_f32(p: *mut f32, v: f32) -> f32 {
+    // CHECK-NOT: cmpxchg
+    // CHECK: atomicrmw fadd float* %p, float %v seq_cst
+    atomic_xadd(p, v)
+}
+
+// CHECK-LABEL: @fadd_f64_relaxed
+#[no_mangle]
+pub unsafe fn fadd_f64_relaxed(p: *mut f64, v: f64) -> f64 {
+    // CHECK-NOT: cmpxchg
+    // CHECK: atomicrmw fadd double* %p, double %v monotonic
+    atomic_xadd_relaxed(p, v)
+}
+
+// CHECK-LABEL: @fsub_f32
+#[no_mangle]
+pub unsafe fn fsub_f32(p: *mut f32, v: f32) -> f32 {
+    // CHECK-NOT: cmpxchg
+    // CHECK: atomicrmw fsub float* %p, float %v seq_cst
+    atomic_xsub(p, v)
+}
+
+// CHECK-LABEL: @fsub_f64_acquire
+#[no_mangle]
+pub unsafe fn fsub_f64_acquire(p: *mut f64, v: f64) -> f64 {
+    // CHECK-NOT: cmpxchg
+    // CHECK: atomicrmw fsub double* %p, double %v acquire
+    atomic_xsub_acq(p, v)
+}
@@ -0,0 +1,36 @@
+// only-x86_64-unknown-linux-gnu
+// revisions: DEFAULT DIRECT DIRECTLIB INDIRECT
+// [DEFAULT] compile-flags: -C relocation-model=pic --crate-type=bin
+// [DIRECT] compile-flags: -C relocation-model=pic -Z direct-access-external-data=yes
+// [DIRECT] compile-flags: --crate-type=bin
+// [DIRECTLIB] compile-flags: -C relocation-model=pic -Z direct-access-external-data=yes
+// [DIRECTLIB] compile-flags: --crate-type=dylib
+// [INDIRECT] compile-flags: -C relocation-model=static -Z direct-access-external-data=no
+// [INDIRECT] compile-flags: --crate-type=bin
+
+// Shared objects have to keep their exported statics interposable.
+// DIRECTLIB: @EXPORTED = global
+#[no_mangle]
+pub static mut EXPORTED: u32 = 0;
+
+extern "C" {
+    // DEFAULT: @VAR = external global
+    // DIRECT: @VAR = external dso_local global
+    // DIRECTLIB: @VAR = external global
+    // INDIRECT: @VAR = external global
+    static VAR: u32;
+
+    // Functions are left alone, they go through the PLT (or the GOT without one).
+    // DIRECT-NOT: declare dso_local i32 @getpid
+    fn getpid() -> i32;
+}
+
+pub fn main() {
+    unsafe {
+        EXPORTED = VAR + getpid() as u32;
+    }
+}
+
+// DIRECT: !"direct-access-external-data", i32 1}
+// DIRECTLIB: !"direct-access-external-data", i32 1}
+// INDIRECT: !"direct-access-external-data", i32 0}
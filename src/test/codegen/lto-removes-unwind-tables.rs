@@ -0,0 +1,27 @@
+// Checks that `-Z lto-remove-unwind` leaves no unwinding behind in a `panic=abort` LTO module,
+// including in the code that comes from the standard library.
+//
+// ignore-windows
+// compile-flags: -C lto -C panic=abort -O -Z lto-remove-unwind
+// no-prefer-dynamic
+
+// CHECK-NOT: invoke
+// CHECK-NOT: landingpad
+// CHECK-NOT: attributes #{{[0-9]+}} = { {{.*}}uwtable
+
+fn main() {
+    foo();
+}
+
+#[no_mangle]
+#[inline(never)]
+fn foo() {
+    let _a = Box::new(3);
+    bar();
+}
+
+#[inline(never)]
+#[no_mangle]
+fn bar() {
+    println!("hello!");
+}
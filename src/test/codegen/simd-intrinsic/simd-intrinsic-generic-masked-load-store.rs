@@ -0,0 +1,32 @@
+//
+
+// compile-flags: -C no-prepopulate-passes
+
+#![crate_type = "lib"]
+
+#![feature(repr_simd, platform_intrinsics)]
+#![allow(non_camel_case_types)]
+
+#[repr(simd)]
+#[derive(Copy, Clone, PartialEq, Debug)]
+pub struct Vec4<T>(pub T, pub T, pub T, pub T);
+
+extern "platform-intrinsic" {
+    fn simd_masked_load<T, P, M>(values: T, pointer: P, mask: M) -> T;
+    fn simd_masked_store<T, P, M>(values: T, pointer: P, mask: M);
+}
+
+// CHECK-LABEL: @load_f32x4
+#[no_mangle]
+pub unsafe fn load_f32x4(pointer: *const f32, mask: Vec4<i32>,
+                         values: Vec4<f32>) -> Vec4<f32> {
+    // CHECK: call <4 x float> @llvm.masked.load.v4f32.p0v4f32(<4 x float>* {{.*}}, i32 4, <4 x i1> {{.*}}, <4 x float> {{.*}})
+    simd_masked_load(values, pointer, mask)
+}
+
+// CHECK-LABEL: @store_f32x4
+#[no_mangle]
+pub unsafe fn store_f32x4(pointer: *mut f32, mask: Vec4<i32>, values: Vec4<f32>) {
+    // CHECK: call void @llvm.masked.store.v4f32.p0v4f32(<4 x float> {{.*}}, <4 x float>* {{.*}}, i32 4, <4 x i1> {{.*}})
+    simd_masked_store(values, pointer, mask)
+}
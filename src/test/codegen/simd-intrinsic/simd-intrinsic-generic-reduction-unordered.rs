@@ -0,0 +1,32 @@
+// min-llvm-version: 12.0
+// compile-flags: -C no-prepopulate-passes
+
+#![crate_type = "lib"]
+
+#![feature(repr_simd, platform_intrinsics)]
+#![allow(non_camel_case_types)]
+
+#[repr(simd)]
+#[derive(Copy, Clone, PartialEq, Debug)]
+pub struct f32x4(pub f32, pub f32, pub f32, pub f32);
+
+extern "platform-intrinsic" {
+    fn simd_reduce_add_unordered<T, U>(x: T) -> U;
+    fn simd_reduce_mul_unordered<T, U>(x: T) -> U;
+}
+
+// Unordered reductions may be reassociated, but must keep NaN and infinity semantics.
+
+// CHECK-LABEL: @sum_f32x4
+#[no_mangle]
+pub unsafe fn sum_f32x4(x: f32x4) -> f32 {
+    // CHECK: call reassoc float @llvm.vector.reduce.fadd.v4f32(float {{.*}}, <4 x float> {{.*}})
+    simd_reduce_add_unordered(x)
+}
+
+// CHECK-LABEL: @product_f32x4
+#[no_mangle]
+pub unsafe fn product_f32x4(x: f32x4) -> f32 {
+    // CHECK: call reassoc float @llvm.vector.reduce.fmul.v4f32(float {{.*}}, <4 x float> {{.*}})
+    simd_reduce_mul_unordered(x)
+}
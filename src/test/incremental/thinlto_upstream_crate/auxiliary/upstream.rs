@@ -0,0 +1,12 @@
+// no-prefer-dynamic
+
+#![crate_type = "rlib"]
+
+pub fn value() -> u32 {
+    1234
+}
+
+#[inline(never)]
+pub fn double(x: u32) -> u32 {
+    x * 2
+}
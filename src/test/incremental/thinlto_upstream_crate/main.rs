@@ -0,0 +1,23 @@
+// Checks that ThinLTO can run over local modules, modules of an upstream crate and modules
+// re-used from the incremental cache all at once, and that the modules keep their places.
+
+// revisions: rpass1 rpass2
+// aux-build: upstream.rs
+// compile-flags: -Z query-dep-graph -O -C lto=thin
+// no-prefer-dynamic
+
+#![feature(rustc_attrs)]
+#![crate_type = "bin"]
+#![rustc_expected_cgu_reuse(module = "main-foo", cfg = "rpass2", kind = "post-lto")]
+
+extern crate upstream;
+
+mod foo {
+    pub fn get() -> u32 {
+        upstream::double(upstream::value())
+    }
+}
+
+fn main() {
+    assert_eq!(foo::get(), 2468);
+}
@@ -0,0 +1,15 @@
+#![crate_type = "rlib"]
+
+pub fn answer() -> u32 {
+    42
+}
+
+#[cfg(big)]
+pub mod big {
+    pub static TABLE: [u64; 4096] = [7; 4096];
+
+    #[inline(never)]
+    pub fn lookup(i: usize) -> u64 {
+        TABLE[i % TABLE.len()]
+    }
+}
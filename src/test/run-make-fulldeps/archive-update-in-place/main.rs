@@ -0,0 +1,6 @@
+extern crate lib;
+
+fn main() {
+    assert_eq!(lib::answer(), 42);
+    assert_eq!(lib::big::lookup(5000), 7);
+}
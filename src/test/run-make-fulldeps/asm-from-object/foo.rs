@@ -0,0 +1,10 @@
+#[no_mangle]
+#[inline(never)]
+pub extern "C" fn helper(x: u32) -> u32 {
+    x.wrapping_mul(2_654_435_761)
+}
+
+#[no_mangle]
+pub extern "C" fn frobnicate(x: u32) -> u32 {
+    helper(x) ^ helper(x + 1)
+}
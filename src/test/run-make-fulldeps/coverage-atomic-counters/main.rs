@@ -0,0 +1,19 @@
+use std::thread;
+
+#[inline(never)]
+fn count_up(n: u32) -> u32 {
+    let mut total = 0;
+    for i in 0..n {
+        if i % 3 == 0 {
+            total += i;
+        }
+    }
+    total
+}
+
+fn main() {
+    let threads = (0..4).map(|_| thread::spawn(|| count_up(10_000))).collect::<Vec<_>>();
+    for thread in threads {
+        assert_eq!(thread.join().unwrap(), 16_668_333);
+    }
+}
@@ -0,0 +1,7 @@
+extern crate xyz_sys;
+
+fn main() {
+    unsafe {
+        println!("blub: {}", xyz_sys::c_always_inlined() + xyz_sys::c_never_inlined());
+    }
+}
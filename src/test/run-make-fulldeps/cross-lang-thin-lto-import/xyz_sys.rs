@@ -0,0 +1,7 @@
+#![crate_type = "rlib"]
+
+#[link(name = "xyz", kind = "static")]
+extern "C" {
+    pub fn c_always_inlined() -> u32;
+    pub fn c_never_inlined() -> u32;
+}
@@ -0,0 +1,36 @@
+pub struct Point {
+    pub x: i32,
+    pub y: i32,
+}
+
+pub enum Shape {
+    Circle(Point, u32),
+    Line(Point, Point),
+}
+
+mod a {
+    use super::{Point, Shape};
+
+    #[inline(never)]
+    pub fn circle() -> Shape {
+        Shape::Circle(Point { x: 1, y: 2 }, 3)
+    }
+}
+
+mod b {
+    use super::{Point, Shape};
+
+    #[inline(never)]
+    pub fn line() -> Shape {
+        Shape::Line(Point { x: 0, y: 0 }, Point { x: 4, y: 5 })
+    }
+}
+
+fn main() {
+    for shape in [a::circle(), b::line()].iter() {
+        match shape {
+            Shape::Circle(center, radius) => assert_eq!(center.x + center.y + *radius as i32, 6),
+            Shape::Line(from, to) => assert_eq!(to.x - from.x + to.y - from.y, 9),
+        }
+    }
+}
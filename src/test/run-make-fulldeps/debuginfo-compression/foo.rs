@@ -0,0 +1,10 @@
+#![crate_type = "lib"]
+
+pub struct Point {
+    pub x: f64,
+    pub y: f64,
+}
+
+pub fn length(p: &Point) -> f64 {
+    (p.x * p.x + p.y * p.y).sqrt()
+}
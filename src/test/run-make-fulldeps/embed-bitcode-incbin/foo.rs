@@ -0,0 +1,3 @@
+pub fn foo(x: u32) -> u32 {
+    x.wrapping_mul(7)
+}
@@ -0,0 +1,24 @@
+#![crate_type = "rlib"]
+
+// Nothing refers to this static, `#[used]` alone has to keep it.
+#[used]
+static USED_BY_LIB: [u8; 4] = *b"used";
+
+// Only called from the module-level assembly in `main.rs`.
+#[no_mangle]
+pub extern "C" fn called_from_asm() -> u32 {
+    42
+}
+
+// Unwinding out of this needs the personality function.
+#[inline(never)]
+pub fn checked_div(a: u32, b: u32) -> u32 {
+    if b == 0 {
+        panic!("division by zero");
+    }
+    a / b
+}
+
+pub fn unused() -> Vec<u32> {
+    (0..100).map(|i| checked_div(1000, i + 1)).collect()
+}
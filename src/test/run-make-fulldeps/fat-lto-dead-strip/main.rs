@@ -0,0 +1,15 @@
+#![feature(global_asm)]
+
+extern crate lib;
+
+global_asm!(".globl asm_trampoline", "asm_trampoline:", "jmp called_from_asm");
+
+extern "C" {
+    fn asm_trampoline() -> u32;
+}
+
+fn main() {
+    assert_eq!(unsafe { asm_trampoline() }, 42);
+    assert_eq!(lib::checked_div(100, 5), 20);
+    assert!(std::panic::catch_unwind(|| lib::checked_div(1, 0)).is_err());
+}
@@ -0,0 +1,43 @@
+#![cfg_attr(module_asm, feature(global_asm))]
+
+#[cfg(module_asm)]
+global_asm!(".globl module_asm_marker", "module_asm_marker:", "ret");
+
+// Spread the code over a few modules, and so codegen units, that call each other so that
+// the partitions refer to symbols in other partitions.
+mod a {
+    #[inline(never)]
+    pub fn fib(n: u64) -> u64 {
+        if n < 2 { n } else { crate::b::fib(n - 1) + crate::b::fib(n - 2) }
+    }
+}
+
+mod b {
+    #[inline(never)]
+    pub fn fib(n: u64) -> u64 {
+        if n < 2 { n } else { crate::a::fib(n - 1) + crate::a::fib(n - 2) }
+    }
+}
+
+mod c {
+    static TABLE: [u32; 8] = [1, 1, 2, 3, 5, 8, 13, 21];
+
+    #[inline(never)]
+    pub fn lookup(i: usize) -> u32 {
+        TABLE[i % TABLE.len()]
+    }
+}
+
+mod d {
+    #[inline(never)]
+    pub fn describe(n: u64) -> String {
+        format!("fib = {}", n)
+    }
+}
+
+fn main() {
+    let n = a::fib(20);
+    assert_eq!(n, 6765);
+    assert_eq!(c::lookup(7), 21);
+    assert_eq!(d::describe(n), "fib = 6765");
+}
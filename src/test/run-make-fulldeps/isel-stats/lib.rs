@@ -0,0 +1,7 @@
+#![crate_type = "lib"]
+
+// FastISel can't lower `i128` arguments, so it leaves this one to SelectionDAG.
+#[no_mangle]
+pub fn wide_mul(a: u128, b: u128) -> u128 {
+    a.wrapping_mul(b)
+}
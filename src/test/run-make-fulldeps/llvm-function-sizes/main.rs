@@ -0,0 +1,8 @@
+fn sum(xs: &[u32]) -> u32 {
+    xs.iter().map(|x| x * 3).filter(|x| x % 2 == 1).sum()
+}
+
+fn main() {
+    let xs: Vec<u32> = (0..100).collect();
+    assert_eq!(sum(&xs), 7500);
+}
@@ -0,0 +1,31 @@
+#![crate_type = "lib"]
+
+// Enough loops for the optimization pipeline to take well over a millisecond.
+macro_rules! kernels {
+    ($($name:ident),*) => {
+        $(
+            pub fn $name(xs: &mut [u32; 64], ys: &[u32; 64], k: u32) -> u32 {
+                let mut acc = 0u32;
+                for i in 0..64 {
+                    xs[i] = xs[i].wrapping_mul(k).wrapping_add(ys[i]);
+                    acc = acc.wrapping_add(xs[i] ^ ys[63 - i]);
+                }
+                for i in 0..64 {
+                    if xs[i] & 1 == 0 {
+                        acc = acc.rotate_left(xs[i] & 31);
+                    }
+                }
+                acc
+            }
+        )*
+    };
+}
+
+kernels!(k00, k01, k02, k03, k04, k05, k06, k07, k08, k09);
+kernels!(k10, k11, k12, k13, k14, k15, k16, k17, k18, k19);
+kernels!(k20, k21, k22, k23, k24, k25, k26, k27, k28, k29);
+kernels!(k30, k31, k32, k33, k34, k35, k36, k37, k38, k39);
+kernels!(k40, k41, k42, k43, k44, k45, k46, k47, k48, k49);
+kernels!(k50, k51, k52, k53, k54, k55, k56, k57, k58, k59);
+kernels!(k60, k61, k62, k63, k64, k65, k66, k67, k68, k69);
+kernels!(k70, k71, k72, k73, k74, k75, k76, k77, k78, k79);
@@ -0,0 +1,26 @@
+#[inline(never)]
+fn checksum(xs: &[u32]) -> u32 {
+    xs.iter().fold(0, |acc, &x| acc.rotate_left(3) ^ x)
+}
+
+#[inline(never)]
+fn squares(n: u32) -> Vec<u32> {
+    (0..n).map(|x| x * x).collect()
+}
+
+#[inline(never)]
+fn classify(x: u32) -> &'static str {
+    match x % 4 {
+        0 => "zero",
+        1 => "one",
+        2 => "two",
+        _ => "three",
+    }
+}
+
+fn main() {
+    let xs = squares(64);
+    assert_eq!(xs[63], 3969);
+    assert_eq!(checksum(&[1, 2]), 10);
+    assert_eq!(classify(xs[3]), "one");
+}
@@ -0,0 +1,21 @@
+#[inline(never)]
+fn step(x: u64) -> u64 {
+    if x % 3 == 0 { x / 3 } else { x * 2 + 1 }
+}
+
+mod a {
+    pub fn run(n: u64) -> u64 {
+        (0..n).map(super::step).sum()
+    }
+}
+
+mod b {
+    pub fn run(n: u64) -> u64 {
+        (0..n).filter(|x| x % 2 == 0).map(super::step).sum()
+    }
+}
+
+fn main() {
+    let n = std::env::args().count() as u64 * 1000;
+    println!("{}", a::run(n) + b::run(n));
+}
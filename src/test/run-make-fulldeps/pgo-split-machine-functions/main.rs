@@ -0,0 +1,22 @@
+#[inline(never)]
+fn report(x: u64) {
+    println!("unexpected value {}", x);
+    println!("this never happens while profiling");
+}
+
+#[inline(never)]
+fn process(x: u64) -> u64 {
+    if x == u64::MAX {
+        report(x);
+        return 0;
+    }
+    x.wrapping_mul(31) ^ (x >> 3)
+}
+
+fn main() {
+    let mut acc = 0;
+    for i in 0..100_000 {
+        acc ^= process(i);
+    }
+    println!("{}", acc);
+}
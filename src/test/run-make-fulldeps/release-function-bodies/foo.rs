@@ -0,0 +1,22 @@
+#[inline(never)]
+fn internal(x: u32) -> u32 {
+    x.rotate_left(3) ^ 0x5a5a
+}
+
+#[inline(never)]
+fn generic<T: Into<u64>>(x: T) -> u64 {
+    x.into().wrapping_mul(31)
+}
+
+#[inline(never)]
+pub fn exported(x: u32) -> u64 {
+    generic(internal(x)) + generic(x as u8)
+}
+
+static TABLE: [fn(u32) -> u32; 2] = [internal, |x| internal(x + 1)];
+
+fn main() {
+    let x = std::env::args().count() as u32;
+    assert_eq!(TABLE[x as usize % 2](x), internal(x + 1));
+    assert_eq!(exported(x), generic(internal(x)) + generic(x as u8));
+}
@@ -0,0 +1,14 @@
+#[inline(never)]
+fn add(a: u32, b: u32) -> u32 {
+    a.wrapping_add(b)
+}
+
+#[inline]
+fn twice(x: u32) -> u32 {
+    add(x, x)
+}
+
+fn main() {
+    let n = std::env::args().count() as u32;
+    std::process::exit(twice(n) as i32 - 2);
+}
@@ -0,0 +1,28 @@
+mod a {
+    pub fn f(x: u32) -> u32 {
+        x.wrapping_mul(3)
+    }
+}
+
+mod b {
+    pub fn f(x: u32) -> u32 {
+        x.rotate_left(5)
+    }
+}
+
+mod c {
+    pub fn f(x: u32) -> u32 {
+        x ^ 0xdead_beef
+    }
+}
+
+mod d {
+    pub fn f(x: u32) -> u32 {
+        x.wrapping_sub(17)
+    }
+}
+
+fn main() {
+    let x = std::env::args().count() as u32;
+    println!("{}", a::f(x) + b::f(x) + c::f(x) + d::f(x));
+}
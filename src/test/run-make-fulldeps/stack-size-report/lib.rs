@@ -0,0 +1,11 @@
+#![crate_type = "lib"]
+#![feature(bench_black_box)]
+
+#[no_mangle]
+#[inline(never)]
+pub fn big_frame(i: usize) -> u8 {
+    let mut buf = [0u8; 4096];
+    buf[i % 4096] = 1;
+    std::hint::black_box(&mut buf);
+    buf[(i + 1) % 4096]
+}
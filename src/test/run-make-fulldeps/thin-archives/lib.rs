@@ -0,0 +1,30 @@
+#![crate_type = "rlib"]
+
+#[cfg(bundled)]
+#[link(name = "native", kind = "static")]
+extern "C" {
+    pub fn native_answer() -> i32;
+}
+
+pub struct Counter {
+    count: u32,
+}
+
+impl Counter {
+    pub fn new() -> Counter {
+        Counter { count: 0 }
+    }
+
+    #[inline(never)]
+    pub fn bump(&mut self) -> u32 {
+        self.count += 1;
+        self.count
+    }
+}
+
+pub mod more {
+    #[inline(never)]
+    pub fn sum(xs: &[u32]) -> u32 {
+        xs.iter().sum()
+    }
+}
@@ -0,0 +1,10 @@
+extern crate lib;
+
+fn main() {
+    let mut counter = lib::Counter::new();
+    counter.bump();
+    assert_eq!(counter.bump(), 2);
+    assert_eq!(lib::more::sum(&[1, 2, 3]), 6);
+    #[cfg(bundled)]
+    assert_eq!(unsafe { lib::native_answer() }, 42);
+}
@@ -0,0 +1,3 @@
+int native_answer() {
+    return 42;
+}
@@ -0,0 +1,26 @@
+mod a {
+    // Small enough to be imported into `main`'s module.
+    pub fn scale(x: u32) -> u32 {
+        x * 3 + 1
+    }
+
+    #[inline(never)]
+    pub fn sum(xs: &[u32]) -> u32 {
+        xs.iter().map(|&x| scale(x)).sum()
+    }
+}
+
+mod b {
+    pub static TABLE: [u32; 4] = [1, 2, 3, 4];
+
+    #[inline(never)]
+    pub fn lookup(i: usize) -> u32 {
+        TABLE[i % TABLE.len()]
+    }
+}
+
+fn main() {
+    let xs: Vec<u32> = (0..100).collect();
+    assert_eq!(a::sum(&xs), 14950);
+    assert_eq!(a::scale(b::lookup(xs.len())), 4);
+}
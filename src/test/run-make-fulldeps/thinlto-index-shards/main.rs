@@ -0,0 +1,16 @@
+mod a {
+    #[inline(never)]
+    pub fn answer() -> u32 {
+        42
+    }
+}
+
+mod b {
+    pub fn check() {
+        assert_eq!(crate::a::answer(), 42);
+    }
+}
+
+fn main() {
+    b::check();
+}
@@ -0,0 +1,28 @@
+mod a {
+    #[inline(never)]
+    pub fn sum(xs: &[u32]) -> u32 {
+        xs.iter().map(|x| x * 3).filter(|x| x % 2 == 1).sum()
+    }
+
+    // Nothing calls this, so its body doesn't have to be read.
+    #[allow(dead_code)]
+    #[inline(never)]
+    pub fn unused(xs: &[u32]) -> u32 {
+        xs.iter().rev().fold(0, |acc, x| acc.rotate_left(5) ^ x)
+    }
+}
+
+mod b {
+    pub static TABLE: [u32; 4] = [1, 2, 3, 4];
+
+    #[inline(never)]
+    pub fn lookup(i: usize) -> u32 {
+        TABLE[i % TABLE.len()]
+    }
+}
+
+fn main() {
+    let xs: Vec<u32> = (0..100).collect();
+    assert_eq!(a::sum(&xs), 7500);
+    assert_eq!(b::lookup(xs.len()), 1);
+}
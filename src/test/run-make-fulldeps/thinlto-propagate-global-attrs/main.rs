@@ -0,0 +1,26 @@
+mod table {
+    // Only `lookup` names this, so it stays internal to its codegen unit.
+    static TABLE: [u32; 8] = [2, 3, 5, 7, 11, 13, 17, 19];
+
+    #[inline(never)]
+    pub fn lookup(i: usize) -> u32 {
+        TABLE[i % TABLE.len()]
+    }
+}
+
+mod reader {
+    // FOLDED-LABEL: define{{.*}}@answer
+    // FOLDED-NOT: load
+    // FOLDED: ret i32 7
+    // LOADED-LABEL: define{{.*}}@answer
+    // LOADED: load i32
+    #[no_mangle]
+    #[inline(never)]
+    pub fn answer() -> u32 {
+        crate::table::lookup(3)
+    }
+}
+
+fn main() {
+    assert_eq!(reader::answer(), 7);
+}
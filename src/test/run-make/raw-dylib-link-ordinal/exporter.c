@@ -0,0 +1,13 @@
+#include <stdio.h>
+
+int exported_variable = 0;
+
+void exported_function() {
+    printf("exported_function\n");
+    fflush(stdout);
+}
+
+void print_exported_variable() {
+    printf("exported_variable value: %d\n", exported_variable);
+    fflush(stdout);
+}
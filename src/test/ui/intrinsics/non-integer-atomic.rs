@@ -90,3 +90,23 @@ pub unsafe fn test_Quux_cxchg(p: &mut Quux, v: Quux) {
     intrinsics::atomic_cxchg(p, v, v);
     //~^ ERROR `atomic_cxchg` intrinsic: expected basic integer type, found `[u8; 100]`
 }
+
+pub unsafe fn test_f32_xchg(p: &mut f32, v: f32) {
+    intrinsics::atomic_xchg(p, v);
+    //~^ ERROR `atomic_xchg` intrinsic: expected basic integer type, found `f32`
+}
+
+pub unsafe fn test_f64_and(p: &mut f64, v: f64) {
+    intrinsics::atomic_and(p, v);
+    //~^ ERROR `atomic_and` intrinsic: expected basic integer type, found `f64`
+}
+
+pub unsafe fn test_f32_max(p: &mut f32, v: f32) {
+    intrinsics::atomic_max(p, v);
+    //~^ ERROR `atomic_max` intrinsic: expected basic integer type, found `f32`
+}
+
+pub unsafe fn test_f64_min(p: &mut f64, v: f64) {
+    intrinsics::atomic_min(p, v);
+    //~^ ERROR `atomic_min` intrinsic: expected basic integer type, found `f64`
+}
@@ -0,0 +1,24 @@
+// build-fail
+
+// The locality of the prefetch intrinsics is an immediate operand of
+// `llvm.prefetch`, so it has to be a constant between 0 and 3.
+
+#![feature(core_intrinsics)]
+#![crate_type = "rlib"]
+
+use std::intrinsics::{prefetch_read_data, prefetch_write_instruction};
+
+pub unsafe fn out_of_range(p: *const u8) {
+    prefetch_read_data(p, 4);
+    //~^ ERROR the locality of `prefetch_read_data` has to be a constant between 0 and 3
+}
+
+pub unsafe fn negative(p: *const u8) {
+    prefetch_write_instruction(p, -1);
+    //~^ ERROR the locality of `prefetch_write_instruction` has to be a constant between 0 and 3
+}
+
+pub unsafe fn not_constant(p: *const u8, locality: i32) {
+    prefetch_read_data(p, locality);
+    //~^ ERROR the locality of `prefetch_read_data` has to be a constant between 0 and 3
+}
@@ -0,0 +1,4 @@
+// check-pass
+// compile-flags: -Z time-llvm-passes-json -Z new-llvm-pass-manager=no
+
+fn main() {}
@@ -3,8 +3,8 @@
 
 #[link(name = "foo")]
 extern "C" {
-    #[link_ordinal(18446744073709551616)]
-    //~^ ERROR ordinal value in `link_ordinal` is too large: `18446744073709551616`
+    #[link_ordinal(65536)]
+    //~^ ERROR ordinal value in `link_ordinal` is too large: `65536`
     fn foo();
 }
 
@@ -0,0 +1,28 @@
+// only-x86_64-pc-windows-msvc
+// compile-flags: --crate-type lib --emit link
+#![allow(incomplete_features)]
+#![feature(raw_dylib)]
+
+mod a {
+    #[link(name = "foo", kind = "raw-dylib")]
+    extern "C" {
+        #[link_ordinal(1)]
+        pub fn f(x: i32);
+    }
+}
+
+mod b {
+    #[link(name = "foo", kind = "raw-dylib")]
+    extern "C" {
+        #[link_ordinal(2)]
+        pub fn f(x: i32);
+        //~^ ERROR multiple declarations of external item `f` from library `foo.dll` have different ordinals
+    }
+}
+
+pub fn lib_main() {
+    unsafe {
+        a::f(1);
+        b::f(2);
+    }
+}
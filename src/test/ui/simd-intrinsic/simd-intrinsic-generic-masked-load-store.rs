@@ -0,0 +1,63 @@
+// build-fail
+
+// Test that the simd_masked_load and simd_masked_store intrinsics produce
+// ok-ish error messages when misused.
+
+#![feature(repr_simd, platform_intrinsics)]
+#![allow(non_camel_case_types)]
+
+#[repr(simd)]
+#[derive(Copy, Clone)]
+pub struct f32x4(pub f32, pub f32, pub f32, pub f32);
+
+#[repr(simd)]
+#[derive(Copy, Clone)]
+pub struct u32x4(pub u32, pub u32, pub u32, pub u32);
+
+#[repr(simd)]
+#[derive(Copy, Clone)]
+pub struct i32x4(pub i32, pub i32, pub i32, pub i32);
+
+#[repr(simd)]
+#[derive(Copy, Clone)]
+pub struct i8x8(pub i8, pub i8, pub i8, pub i8,
+                 pub i8, pub i8, pub i8, pub i8);
+
+extern "platform-intrinsic" {
+    fn simd_masked_load<V, P, M>(values: V, pointer: P, mask: M) -> V;
+    fn simd_masked_store<V, P, M>(values: V, pointer: P, mask: M);
+}
+
+fn main() {
+    let m4 = i32x4(0, 0, 0, 0);
+    let m8 = i8x8(0, 0, 0, 0, 0, 0, 0, 0);
+    let u = u32x4(0, 0, 0, 0);
+    let mut z = f32x4(0.0, 0.0, 0.0, 0.0);
+    let mut arr = [0.0f32; 4];
+
+    unsafe {
+        let _: f32x4 = simd_masked_load(z, arr.as_ptr(), m4);
+        simd_masked_store(z, arr.as_mut_ptr(), m4);
+
+        simd_masked_load(z, arr.as_ptr(), 0i32);
+        //~^ ERROR expected SIMD third type, found non-SIMD `i32`
+
+        simd_masked_load(z, arr.as_ptr(), m8);
+        //~^ ERROR found `i8x8` with length 8
+
+        simd_masked_load(z, 0usize, m4);
+        //~^ ERROR expected second argument `usize` to be a pointer to the element type `f32`
+
+        simd_masked_load(z, &mut z as *mut f32x4, m4);
+        //~^ ERROR expected second argument `*mut f32x4` to be a pointer to the element type `f32`
+
+        simd_masked_store(z, arr.as_ptr(), m4);
+        //~^ ERROR expected second argument `*const f32` to be a pointer to the element type `f32`
+
+        simd_masked_load(z, arr.as_ptr(), u);
+        //~^ ERROR expected element type `u32` of third argument `u32x4` to be a signed integer type
+
+        simd_masked_store(z, arr.as_mut_ptr(), z);
+        //~^ ERROR expected element type `f32` of third argument `f32x4` to be a signed integer type
+    }
+}